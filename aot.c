@@ -0,0 +1,517 @@
+#include "compiler.h"
+#include "vm.h"
+#include "debug.h"
+#include <inttypes.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+// Ahead-of-time compiler: register bytecode -> C.
+//
+// Each module (the main script and everything it loads) is compiled to a
+// register chunk exactly as for --exec=register, and every chunk becomes one C
+// function whose registers are C locals; gcc keeps them in machine registers.
+// Variables live in C globals between modules, the way the symbol table
+// carries them from one module to the next in the interpreter. main() runs the
+// module functions in the order the interpreter would have run the modules.
+//
+// The generated file is self-contained: a small runtime (aot_runtime below)
+// reproduces the interpreter's value semantics and error messages, so a
+// compiled program prints exactly what `compiler source.zr` prints. Strings
+// only ever come from literals, so the runtime never copies or frees them.
+
+typedef struct {
+    FILE* modules;     // Module functions, emitted as the modules are compiled
+    int module_count;
+    char** globals;    // Variable names; the index is the C global's number
+    int global_count;
+    int global_capacity;
+} AotProgram;
+
+static AotProgram program = { NULL, 0, NULL, 0, 0 };
+
+// Runtime emitted at the top of every generated program. The ZR_TYPE_* and
+// ZR_OP_* constants it uses are emitted before it, from the compiler's enums.
+static const char* aot_runtime =
+    "#include <inttypes.h>\n"
+    "#include <stdarg.h>\n"
+    "#include <stdbool.h>\n"
+    "#include <stdint.h>\n"
+    "#include <stdio.h>\n"
+    "#include <string.h>\n"
+    "\n"
+    "typedef struct {\n"
+    "    int type;\n"
+    "    union { int32_t i32; int64_t i64; double f; bool b; const char* s; } as;\n"
+    "} ZrValue;\n"
+    "\n"
+    "#ifdef __GNUC__\n"
+    "#define ZR_INLINE static inline __attribute__((always_inline))\n"
+    "#define ZR_COLD static __attribute__((cold, noinline))\n"
+    "#else\n"
+    "#define ZR_INLINE static inline\n"
+    "#define ZR_COLD static\n"
+    "#endif\n"
+    "\n"
+    "#define ZR_VALUE(t, field, v) ((ZrValue){ (t), { .field = (v) } })\n"
+    "#define ZR_ERROR_VALUE ZR_VALUE(ZR_TYPE_ERROR, i64, 0)\n"
+    "\n"
+    "// Report a runtime error. stdout is flushed first so that both streams\n"
+    "// interleave as they do in the interpreter, which flushes after each print.\n"
+    "ZR_COLD ZrValue zr_fail(const char* format, ...) {\n"
+    "    va_list args;\n"
+    "    fflush(stdout);\n"
+    "    va_start(args, format);\n"
+    "    vfprintf(stderr, format, args);\n"
+    "    va_end(args);\n"
+    "    return ZR_ERROR_VALUE;\n"
+    "}\n"
+    "\n"
+    "ZR_INLINE bool zr_defined(ZrValue v, const char* name) {\n"
+    "    if (v.type != ZR_TYPE_VOID) return true;\n"
+    "    zr_fail(\"Error: Undefined variable '%s'\\n\", name);\n"
+    "    return false;\n"
+    "}\n"
+    "\n"
+    "ZR_INLINE bool zr_is_arithmetic(int op) { return op >= ZR_OP_ADD && op <= ZR_OP_DIV; }\n"
+    "ZR_INLINE bool zr_is_comparison(int op) { return op >= ZR_OP_GT && op <= ZR_OP_NOTEQ; }\n"
+    "\n"
+    "ZR_INLINE ZrValue zr_int32_binary(int op, const char* text, int32_t l, int32_t r) {\n"
+    "    int32_t result = 0;\n"
+    "    bool overflow = false;\n"
+    "    switch (op) {\n"
+    "        case ZR_OP_ADD: overflow = __builtin_add_overflow(l, r, &result); break;\n"
+    "        case ZR_OP_SUB: overflow = __builtin_sub_overflow(l, r, &result); break;\n"
+    "        case ZR_OP_MUL: overflow = __builtin_mul_overflow(l, r, &result); break;\n"
+    "        case ZR_OP_DIV:\n"
+    "            if (r == 0) return zr_fail(\"Error: Division by zero (integer)\\n\");\n"
+    "            if (l == INT32_MIN && r == -1) overflow = true; else result = l / r;\n"
+    "            break;\n"
+    "        case ZR_OP_GT:    return ZR_VALUE(ZR_TYPE_BOOL, b, l > r);\n"
+    "        case ZR_OP_LT:    return ZR_VALUE(ZR_TYPE_BOOL, b, l < r);\n"
+    "        case ZR_OP_EQ:    return ZR_VALUE(ZR_TYPE_BOOL, b, l == r);\n"
+    "        case ZR_OP_LTEQ:  return ZR_VALUE(ZR_TYPE_BOOL, b, l <= r);\n"
+    "        case ZR_OP_GTEQ:  return ZR_VALUE(ZR_TYPE_BOOL, b, l >= r);\n"
+    "        default:          return ZR_VALUE(ZR_TYPE_BOOL, b, l != r);\n"
+    "    }\n"
+    "    if (overflow) return zr_fail(\"Runtime Error: int32 overflow in %\" PRId32 \" %s %\" PRId32 \".\\n\", l, text, r);\n"
+    "    return ZR_VALUE(ZR_TYPE_INT32, i32, result);\n"
+    "}\n"
+    "\n"
+    "// int64 arithmetic wraps around, as it does in the interpreter\n"
+    "ZR_INLINE ZrValue zr_binary(int op, const char* text, ZrValue l, ZrValue r) {\n"
+    "    int lt = l.type, rt = r.type;\n"
+    "    if (lt == ZR_TYPE_INT32 && rt == ZR_TYPE_INT32 && (zr_is_arithmetic(op) || zr_is_comparison(op))) {\n"
+    "        return zr_int32_binary(op, text, l.as.i32, r.as.i32);\n"
+    "    }\n"
+    "    int64_t li = lt == ZR_TYPE_INT32 ? l.as.i32 : l.as.i64;\n"
+    "    int64_t ri = rt == ZR_TYPE_INT32 ? r.as.i32 : r.as.i64;\n"
+    "    if (lt == ZR_TYPE_INT32) lt = ZR_TYPE_INT64;\n"
+    "    if (rt == ZR_TYPE_INT32) rt = ZR_TYPE_INT64;\n"
+    "    bool ints = lt == ZR_TYPE_INT64 && rt == ZR_TYPE_INT64;\n"
+    "    bool numbers = (lt == ZR_TYPE_FLOAT && (rt == ZR_TYPE_INT64 || rt == ZR_TYPE_FLOAT)) ||\n"
+    "                   (rt == ZR_TYPE_FLOAT && (lt == ZR_TYPE_INT64 || lt == ZR_TYPE_FLOAT));\n"
+    "    double lf = lt == ZR_TYPE_FLOAT ? l.as.f : (double)li;\n"
+    "    double rf = rt == ZR_TYPE_FLOAT ? r.as.f : (double)ri;\n"
+    "\n"
+    "    if (zr_is_arithmetic(op)) {\n"
+    "        if (ints) {\n"
+    "            switch (op) {\n"
+    "                case ZR_OP_ADD: return ZR_VALUE(ZR_TYPE_INT64, i64, (int64_t)((uint64_t)li + (uint64_t)ri));\n"
+    "                case ZR_OP_SUB: return ZR_VALUE(ZR_TYPE_INT64, i64, (int64_t)((uint64_t)li - (uint64_t)ri));\n"
+    "                case ZR_OP_MUL: return ZR_VALUE(ZR_TYPE_INT64, i64, (int64_t)((uint64_t)li * (uint64_t)ri));\n"
+    "                default:\n"
+    "                    if (ri == 0) return zr_fail(\"Error: Division by zero (integer)\\n\");\n"
+    "                    return ZR_VALUE(ZR_TYPE_INT64, i64, li / ri);\n"
+    "            }\n"
+    "        }\n"
+    "        if (numbers) {\n"
+    "            switch (op) {\n"
+    "                case ZR_OP_ADD: return ZR_VALUE(ZR_TYPE_FLOAT, f, lf + rf);\n"
+    "                case ZR_OP_SUB: return ZR_VALUE(ZR_TYPE_FLOAT, f, lf - rf);\n"
+    "                case ZR_OP_MUL: return ZR_VALUE(ZR_TYPE_FLOAT, f, lf * rf);\n"
+    "                default:\n"
+    "                    if (rf == 0.0) return zr_fail(\"Error: Division by zero (float)\\n\");\n"
+    "                    return ZR_VALUE(ZR_TYPE_FLOAT, f, lf / rf);\n"
+    "            }\n"
+    "        }\n"
+    "        return zr_fail(\"Error: Type error: Operands for arithmetic operator '%s' must be numbers.\\n\", text);\n"
+    "    }\n"
+    "\n"
+    "    if (zr_is_comparison(op)) {\n"
+    "        if (ints) {\n"
+    "            switch (op) {\n"
+    "                case ZR_OP_GT:   return ZR_VALUE(ZR_TYPE_BOOL, b, li > ri);\n"
+    "                case ZR_OP_LT:   return ZR_VALUE(ZR_TYPE_BOOL, b, li < ri);\n"
+    "                case ZR_OP_EQ:   return ZR_VALUE(ZR_TYPE_BOOL, b, li == ri);\n"
+    "                case ZR_OP_LTEQ: return ZR_VALUE(ZR_TYPE_BOOL, b, li <= ri);\n"
+    "                case ZR_OP_GTEQ: return ZR_VALUE(ZR_TYPE_BOOL, b, li >= ri);\n"
+    "                default:         return ZR_VALUE(ZR_TYPE_BOOL, b, li != ri);\n"
+    "            }\n"
+    "        }\n"
+    "        if (numbers) {\n"
+    "            switch (op) {\n"
+    "                case ZR_OP_GT:   return ZR_VALUE(ZR_TYPE_BOOL, b, lf > rf);\n"
+    "                case ZR_OP_LT:   return ZR_VALUE(ZR_TYPE_BOOL, b, lf < rf);\n"
+    "                case ZR_OP_EQ:   return ZR_VALUE(ZR_TYPE_BOOL, b, lf == rf);\n"
+    "                case ZR_OP_LTEQ: return ZR_VALUE(ZR_TYPE_BOOL, b, lf <= rf);\n"
+    "                case ZR_OP_GTEQ: return ZR_VALUE(ZR_TYPE_BOOL, b, lf >= rf);\n"
+    "                default:         return ZR_VALUE(ZR_TYPE_BOOL, b, lf != rf);\n"
+    "            }\n"
+    "        }\n"
+    "        if (lt == ZR_TYPE_STRING && rt == ZR_TYPE_STRING && (op == ZR_OP_EQ || op == ZR_OP_NOTEQ)) {\n"
+    "            bool equal = strcmp(l.as.s, r.as.s) == 0;\n"
+    "            return ZR_VALUE(ZR_TYPE_BOOL, b, op == ZR_OP_EQ ? equal : !equal);\n"
+    "        }\n"
+    "        return zr_fail(\"Error: Type error: Operands for comparison operator '%s' are incompatible (%d, %d).\\n\", text, lt, rt);\n"
+    "    }\n"
+    "\n"
+    "    if (op == ZR_OP_AND || op == ZR_OP_OR) {\n"
+    "        if (l.type != ZR_TYPE_BOOL || r.type != ZR_TYPE_BOOL) {\n"
+    "            return zr_fail(\"Error: Type error: Operands for logical operator '%s' must be booleans.\\n\", text);\n"
+    "        }\n"
+    "        return ZR_VALUE(ZR_TYPE_BOOL, b, op == ZR_OP_AND ? (l.as.b && r.as.b) : (l.as.b || r.as.b));\n"
+    "    }\n"
+    "    return zr_fail(\"Error: Operator '%s' not defined for operand types %d and %d\\n\", text, l.type, r.type);\n"
+    "}\n"
+    "\n"
+    "// Convert a let initializer to the variable's declared type\n"
+    "ZR_COLD ZrValue zr_convert(const char* name, int declared, ZrValue v) {\n"
+    "    if (v.type == declared) return v;\n"
+    "    if (declared == ZR_TYPE_FLOAT && v.type == ZR_TYPE_INT64) return ZR_VALUE(ZR_TYPE_FLOAT, f, (double)v.as.i64);\n"
+    "    if (declared == ZR_TYPE_FLOAT && v.type == ZR_TYPE_INT32) return ZR_VALUE(ZR_TYPE_FLOAT, f, (double)v.as.i32);\n"
+    "    if (declared == ZR_TYPE_INT64 && v.type == ZR_TYPE_INT32) return ZR_VALUE(ZR_TYPE_INT64, i64, v.as.i32);\n"
+    "    if (declared == ZR_TYPE_INT32 && v.type == ZR_TYPE_INT64) {\n"
+    "        if (v.as.i64 >= INT32_MIN && v.as.i64 <= INT32_MAX) return ZR_VALUE(ZR_TYPE_INT32, i32, (int32_t)v.as.i64);\n"
+    "        return zr_fail(\"Runtime Error: Value %\" PRId64 \" for variable '%s' overflows declared type int32.\\n\", v.as.i64, name);\n"
+    "    }\n"
+    "    return zr_fail(\"Runtime Error: Cannot assign expression of type %s to variable '%s' of declared type %s.\\n\",\n"
+    "                   zr_type_names[v.type], name, zr_type_names[declared]);\n"
+    "}\n"
+    "\n"
+    "static void zr_print(ZrValue v) {\n"
+    "    switch (v.type) {\n"
+    "        case ZR_TYPE_FLOAT:  printf(\"%.2f\\n\", v.as.f); break;\n"
+    "        case ZR_TYPE_STRING: printf(\"%s\\n\", v.as.s); break;\n"
+    "        case ZR_TYPE_BOOL:   printf(\"%s\\n\", v.as.b ? \"true\" : \"false\"); break;\n"
+    "        case ZR_TYPE_INT32:  printf(\"%\" PRId32 \"\\n\", v.as.i32); break;\n"
+    "        case ZR_TYPE_INT64:  printf(\"%\" PRId64 \"\\n\", v.as.i64); break;\n"
+    "        default:             printf(\"(void)\\n\"); break;\n"
+    "    }\n"
+    "}\n";
+
+// Names of the constants the generated code uses for DataType and BinaryOp values
+static const char* type_macros[] = {
+    [TYPE_INT] = "ZR_TYPE_INT", [TYPE_FLOAT] = "ZR_TYPE_FLOAT", [TYPE_BOOL] = "ZR_TYPE_BOOL",
+    [TYPE_STRING] = "ZR_TYPE_STRING", [TYPE_VOID] = "ZR_TYPE_VOID", [TYPE_INT32] = "ZR_TYPE_INT32",
+    [TYPE_INT64] = "ZR_TYPE_INT64", [TYPE_ERROR] = "ZR_TYPE_ERROR",
+};
+
+static const char* op_macros[] = {
+    [BINOP_NONE] = "ZR_OP_NONE", [BINOP_ADD] = "ZR_OP_ADD", [BINOP_SUB] = "ZR_OP_SUB",
+    [BINOP_MUL] = "ZR_OP_MUL", [BINOP_DIV] = "ZR_OP_DIV", [BINOP_GT] = "ZR_OP_GT",
+    [BINOP_LT] = "ZR_OP_LT", [BINOP_EQ] = "ZR_OP_EQ", [BINOP_LTEQ] = "ZR_OP_LTEQ",
+    [BINOP_GTEQ] = "ZR_OP_GTEQ", [BINOP_NOTEQ] = "ZR_OP_NOTEQ", [BINOP_AND] = "ZR_OP_AND",
+    [BINOP_OR] = "ZR_OP_OR",
+};
+
+// Write 'text' as a C string literal
+static void emit_c_string(FILE* out, const char* text) {
+    fputc('"', out);
+    for (const unsigned char* p = (const unsigned char*)text; *p != '\0'; p++) {
+        switch (*p) {
+            case '"':  fputs("\\\"", out); break;
+            case '\\': fputs("\\\\", out); break;
+            case '\n': fputs("\\n", out); break;
+            case '\t': fputs("\\t", out); break;
+            case '?':  fputs("\\?", out); break; // No trigraphs
+            default:
+                if (*p < 0x20 || *p >= 0x7F) fprintf(out, "\\%03o", *p);
+                else fputc(*p, out);
+        }
+    }
+    fputc('"', out);
+}
+
+static void emit_constant(FILE* out, RuntimeValue constant) {
+    switch (constant.type) {
+        case TYPE_INT32:
+            fprintf(out, "ZR_VALUE(ZR_TYPE_INT32, i32, %" PRId32 ")", constant.val.int32_val);
+            break;
+        case TYPE_INT64:
+            if (constant.val.int64_val == INT64_MIN) fputs("ZR_VALUE(ZR_TYPE_INT64, i64, INT64_MIN)", out);
+            else fprintf(out, "ZR_VALUE(ZR_TYPE_INT64, i64, INT64_C(%" PRId64 "))", constant.val.int64_val);
+            break;
+        case TYPE_FLOAT:
+            // Hexadecimal floats are exact
+            if (isnan(constant.val.float_val)) fputs("ZR_VALUE(ZR_TYPE_FLOAT, f, __builtin_nan(\"\"))", out);
+            else if (isinf(constant.val.float_val)) fprintf(out, "ZR_VALUE(ZR_TYPE_FLOAT, f, %s__builtin_inf())", constant.val.float_val < 0 ? "-" : "");
+            else fprintf(out, "ZR_VALUE(ZR_TYPE_FLOAT, f, %a)", constant.val.float_val);
+            break;
+        case TYPE_BOOL:
+            fprintf(out, "ZR_VALUE(ZR_TYPE_BOOL, b, %s)", constant.val.bool_val ? "true" : "false");
+            break;
+        case TYPE_STRING:
+            fputs("ZR_VALUE(ZR_TYPE_STRING, s, ", out);
+            emit_c_string(out, constant.val.string_val);
+            fputc(')', out);
+            break;
+        default: // Operands of unreachable code
+            fputs("ZR_VALUE(ZR_TYPE_VOID, i64, 0)", out);
+            break;
+    }
+}
+
+static void emit_operand(FILE* out, const Chunk* chunk, int operand) {
+    if (RK_IS_CONSTANT(operand)) {
+        emit_constant(out, chunk->constants[RK_CONSTANT_INDEX(operand)]);
+    } else {
+        fprintf(out, "r%d", operand);
+    }
+}
+
+// Variable slots hold TYPE_VOID until assigned; temporaries are always written first
+static void emit_defined_check(FILE* out, const Chunk* chunk, int operand) {
+    if (RK_IS_CONSTANT(operand) || operand >= chunk->slot_count) return;
+    fprintf(out, "    if (!zr_defined(r%d, ", operand);
+    emit_c_string(out, chunk->slot_names[operand]);
+    fputs(")) goto done;\n", out);
+}
+
+static void emit_binary_call(FILE* out, const Chunk* chunk, BinaryOp op, int left, int right) {
+    fprintf(out, "zr_binary(%s, ", op_macros[op]);
+    emit_c_string(out, binary_op_text(op));
+    fputs(", ", out);
+    emit_operand(out, chunk, left);
+    fputs(", ", out);
+    emit_operand(out, chunk, right);
+    fputc(')', out);
+}
+
+// Store 'v' (already computed) into register a, converting for a typed let
+static void emit_store(FILE* out, const Chunk* chunk, const Instruction* instr) {
+    if (instr->type != TYPE_VOID) {
+        fprintf(out, "        v = zr_convert(");
+        emit_c_string(out, chunk->slot_names[instr->a]);
+        fprintf(out, ", %s, v);\n        if (v.type == ZR_TYPE_ERROR) goto done;\n", type_macros[instr->type]);
+    }
+    fprintf(out, "        r%d = v;\n    }\n", instr->a);
+}
+
+static void emit_instruction(FILE* out, const Chunk* chunk, int pc) {
+    const Instruction* instr = &chunk->code[pc];
+    switch (instr->op) {
+        case ROP_MOVE:
+            emit_defined_check(out, chunk, instr->b);
+            fputs("    {\n        ZrValue v = ", out);
+            emit_operand(out, chunk, instr->b);
+            fputs(";\n", out);
+            emit_store(out, chunk, instr);
+            break;
+        case ROP_BINARY:
+            emit_defined_check(out, chunk, instr->b);
+            emit_defined_check(out, chunk, instr->c);
+            fputs("    {\n        ZrValue v = ", out);
+            emit_binary_call(out, chunk, (BinaryOp)instr->binop, instr->b, instr->c);
+            fputs(";\n        if (v.type == ZR_TYPE_ERROR) goto done;\n", out);
+            emit_store(out, chunk, instr);
+            break;
+        case ROP_PRINT:
+            emit_defined_check(out, chunk, instr->a);
+            fputs("    zr_print(", out);
+            emit_operand(out, chunk, instr->a);
+            fputs(");\n", out);
+            break;
+        case ROP_JUMP:
+            fprintf(out, "    goto L%d;\n", instr->a);
+            break;
+        case ROP_JUMP_IF_FALSE:
+            emit_defined_check(out, chunk, instr->a);
+            fputs("    {\n        ZrValue v = ", out);
+            emit_operand(out, chunk, instr->a);
+            fputs(";\n        if (v.type != ZR_TYPE_BOOL) { zr_fail(\"%s\", ", out);
+            emit_c_string(out, CONDITION_ERROR_MESSAGE(instr->c));
+            fprintf(out, "); goto done; }\n        if (!v.as.b) goto L%d;\n    }\n", instr->b);
+            break;
+        case ROP_JUMP_UNLESS_CMP:
+            emit_defined_check(out, chunk, instr->a);
+            emit_defined_check(out, chunk, instr->b);
+            fputs("    {\n        ZrValue v = ", out);
+            emit_binary_call(out, chunk, (BinaryOp)instr->binop, instr->a, instr->b);
+            fprintf(out, ";\n        if (v.type == ZR_TYPE_ERROR) goto done;\n        if (!v.as.b) goto L%d;\n    }\n", instr->c);
+            break;
+        case ROP_FAIL:
+            fputs("    zr_fail(\"%s\", ", out);
+            emit_c_string(out, chunk->constants[instr->a].val.string_val);
+            fputs(");\n    goto done;\n", out);
+            break;
+        case ROP_HALT:
+            fputs("    goto done;\n", out);
+            break;
+        default:
+            error("AOT: unknown register opcode %d.", instr->op);
+    }
+}
+
+static int global_index(const char* name) {
+    for (int i = 0; i < program.global_count; i++) {
+        if (strcmp(program.globals[i], name) == 0) return i;
+    }
+    if (program.global_count == program.global_capacity) {
+        int new_capacity = program.global_capacity == 0 ? 32 : program.global_capacity * 2;
+        char** grown = safe_malloc(sizeof(char*) * new_capacity);
+        if (program.globals != NULL) {
+            memcpy(grown, program.globals, sizeof(char*) * program.global_count);
+            safe_free(program.globals);
+        }
+        program.globals = grown;
+        program.global_capacity = new_capacity;
+    }
+    program.globals[program.global_count] = strdup(name);
+    return program.global_count++;
+}
+
+// Compile one module's code block into the program being built. Modules must
+// be added in the order they would run.
+void aot_add_module(ASTNode* program_node) {
+    if (program.modules == NULL) {
+        program.modules = tmpfile();
+        if (program.modules == NULL) {
+            error("AOT: could not create a temporary file.");
+        }
+    }
+    FILE* out = program.modules;
+    Chunk* chunk = compile_register_chunk(program_node);
+    optimize_chunk(chunk, false);
+
+    bool* is_target = safe_malloc(sizeof(bool) * (chunk->count + 1));
+    memset(is_target, 0, sizeof(bool) * (chunk->count + 1));
+    for (int pc = 0; pc < chunk->count; pc++) {
+        const Instruction* instr = &chunk->code[pc];
+        if (instr->op == ROP_JUMP) is_target[instr->a] = true;
+        if (instr->op == ROP_JUMP_IF_FALSE) is_target[instr->b] = true;
+        if (instr->op == ROP_JUMP_UNLESS_CMP) is_target[instr->c] = true;
+    }
+
+    fprintf(out, "\nstatic void zr_module_%d(void) {\n", program.module_count);
+    for (int i = 0; i < chunk->slot_count; i++) {
+        fprintf(out, "    ZrValue r%d = zr_global_%d; // %s\n", i, global_index(chunk->slot_names[i]), chunk->slot_names[i]);
+    }
+    for (int i = chunk->slot_count; i < chunk->register_count; i++) {
+        fprintf(out, "    ZrValue r%d = ZR_VALUE(ZR_TYPE_VOID, i64, 0);\n", i);
+    }
+    for (int pc = 0; pc < chunk->count; pc++) {
+        if (is_target[pc]) fprintf(out, "L%d:\n", pc);
+        emit_instruction(out, chunk, pc);
+    }
+    fputs("done:\n", out);
+    for (int i = 0; i < chunk->slot_count; i++) {
+        fprintf(out, "    zr_global_%d = r%d;\n", global_index(chunk->slot_names[i]), i);
+    }
+    fputs("}\n", out);
+
+    LOG_DEBUG("AOT: module %d compiled from %d register instructions.", program.module_count, chunk->count);
+    program.module_count++;
+    safe_free(is_target);
+    free_chunk(chunk);
+}
+
+static bool write_program(FILE* out) {
+    fputs("// Generated by the ZR# compiler.\n\n", out);
+    for (int type = TYPE_INT; type <= TYPE_ERROR; type++) {
+        fprintf(out, "#define %s %d\n", type_macros[type], type);
+    }
+    for (int op = BINOP_NONE; op <= BINOP_OR; op++) {
+        fprintf(out, "#define %s %d\n", op_macros[op], op);
+    }
+    fputc('\n', out);
+    fputs("static const char* const zr_type_names[] = {", out);
+    for (int type = TYPE_INT; type <= TYPE_ERROR; type++) {
+        fputs(type == TYPE_INT ? " " : ", ", out);
+        emit_c_string(out, get_type_name((DataType)type));
+    }
+    fputs(" };\n\n", out);
+    fputs(aot_runtime, out);
+
+    fputc('\n', out);
+    for (int i = 0; i < program.global_count; i++) {
+        fprintf(out, "static ZrValue zr_global_%d = ZR_VALUE(ZR_TYPE_VOID, i64, 0); // %s\n", i, program.globals[i]);
+    }
+
+    if (program.modules != NULL) {
+        char buffer[8192];
+        size_t n;
+        rewind(program.modules);
+        while ((n = fread(buffer, 1, sizeof(buffer), program.modules)) > 0) {
+            fwrite(buffer, 1, n, out);
+        }
+    }
+
+    // A runtime error stops its module; like the interpreter, the next module still runs
+    fputs("\nint main(void) {\n", out);
+    for (int i = 0; i < program.module_count; i++) {
+        fprintf(out, "    zr_module_%d();\n", i);
+    }
+    fputs("    return 0;\n}\n", out);
+    return !ferror(out);
+}
+
+static int run_c_compiler(const char* c_path, const char* output_path) {
+    pid_t pid = fork();
+    if (pid < 0) {
+        fprintf(stderr, "Error: Could not start gcc.\n");
+        return 1;
+    }
+    if (pid == 0) {
+        execlp("gcc", "gcc", "-O2", "-o", output_path, c_path, (char*)NULL);
+        fprintf(stderr, "Error: Could not run gcc.\n");
+        _exit(127);
+    }
+    int status;
+    if (waitpid(pid, &status, 0) < 0 || !WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+        fprintf(stderr, "Error: C compilation of '%s' failed.\n", output_path);
+        return 1;
+    }
+    return 0;
+}
+
+// Write the program built by aot_add_module as C to 'c_path' (a temporary
+// file if NULL) and, if 'output_path' is given, compile it into an executable.
+// Returns the process exit status.
+int aot_finish(const char* output_path, const char* c_path) {
+    char temp_path[] = "/tmp/zrXXXXXX.c";
+    FILE* out;
+    if (c_path != NULL) {
+        out = fopen(c_path, "w");
+    } else {
+        int fd = mkstemps(temp_path, 2);
+        out = fd < 0 ? NULL : fdopen(fd, "w");
+        c_path = temp_path;
+    }
+    if (out == NULL) {
+        fprintf(stderr, "Error: Could not write C output '%s'.\n", c_path);
+        return 1;
+    }
+    bool written = write_program(out);
+    if (fclose(out) != 0 || !written) {
+        fprintf(stderr, "Error: Could not write C output '%s'.\n", c_path);
+        return 1;
+    }
+    LOG_DEBUG("AOT: wrote %d module(s) and %d global(s) to %s.", program.module_count, program.global_count, c_path);
+
+    int status = output_path != NULL ? run_c_compiler(c_path, output_path) : 0;
+    if (c_path == temp_path) {
+        remove(temp_path);
+    }
+
+    if (program.modules != NULL) fclose(program.modules);
+    for (int i = 0; i < program.global_count; i++) {
+        free(program.globals[i]);
+    }
+    safe_free(program.globals);
+    memset(&program, 0, sizeof(program));
+    return status;
+}
@@ -0,0 +1,404 @@
+#include "compiler.h"
+#include "debug.h"
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+// Benchmark harness for `make bench`. It generates synthetic workloads, runs
+// the compiler on each for its peak RSS (and the time to load a program of
+// many modules), then measures the lexer, parser and tree walker on them
+// in-process, linked against the compiler's objects. Results go to stdout as JSON; with --baseline, any
+// metric more than --tolerance percent worse than the baseline fails the run.
+//
+// Metrics ending in _per_sec are rates (higher is better), those ending in
+// _kb are memory (lower is better).
+//
+// Workloads stay inside the language's fixed limits: at most MAX_STATEMENTS
+// statements per block, 100 variables, MAX_LOADED_MODULES modules.
+
+#define SAMPLES 5                 // Measurements of each metric; the best one counts
+#define MIN_SAMPLE_SECONDS 0.05   // Repeat the work of one sample for at least this long
+#define MAX_METRICS 32
+
+typedef struct {
+    char name[64];
+    double value;
+} Metric;
+
+static Metric metrics[MAX_METRICS];
+static int metric_count = 0;
+
+static void add_metric(const char* workload, const char* name, double value) {
+    if (metric_count == MAX_METRICS) error("Too many metrics.");
+    snprintf(metrics[metric_count].name, sizeof(metrics[metric_count].name), "%s%s%s",
+             workload, workload[0] ? "." : "", name);
+    metrics[metric_count++].value = value;
+}
+
+static double now_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// --- Workload generators ---
+
+static FILE* create_file(const char* dir, const char* name) {
+    char path[MAX_MODULE_PATH_LEN];
+    snprintf(path, sizeof(path), "%s/%s", dir, name);
+    FILE* file = fopen(path, "w");
+    if (file == NULL) error("Could not create %s.", path);
+    return file;
+}
+
+// Arithmetic and conditionals over a rotating set of variables
+static void generate_statements(const char* dir, int count) {
+    FILE* out = create_file(dir, "statements.zr");
+    fprintf(out, "let v0 = 1;\n");
+    for (int i = 1; i < count; i++) {
+        int v = i % 50, prev = (i - 1) % 50;
+        if (i % 10 == 0) {
+            fprintf(out, "if (v%d > %d) { let v%d = v%d - %d; } else { let v%d = v%d + 1; }\n",
+                    prev, i, v, prev, i % 7, v, prev);
+        } else {
+            fprintf(out, "let v%d = (v%d * %d) + %d;\n", v, prev, i % 3 + 1, i % 11);
+        }
+    }
+    fclose(out);
+}
+
+// Parenthesized expressions nested 'depth' levels deep
+static void generate_deep_expressions(const char* dir, int count, int depth) {
+    FILE* out = create_file(dir, "deep_expressions.zr");
+    for (int i = 0; i < count; i++) {
+        fprintf(out, "let d%d = ", i % 50);
+        for (int j = 0; j < depth; j++) fprintf(out, "(%d + ", j % 10);
+        fprintf(out, "1");
+        for (int j = 0; j < depth; j++) fprintf(out, ")");
+        fprintf(out, ";\n");
+    }
+    fclose(out);
+}
+
+static void generate_print_heavy(const char* dir, int count) {
+    FILE* out = create_file(dir, "print_heavy.zr");
+    fprintf(out, "let p = 0;\n");
+    for (int i = 1; i < count; i++) {
+        if (i % 3 == 0) {
+            fprintf(out, "print \"line %d of the print-heavy workload\";\n", i);
+        } else if (i % 3 == 1) {
+            fprintf(out, "print p + %d;\n", i);
+        } else {
+            fprintf(out, "print %d.5;\n", i);
+        }
+    }
+    fclose(out);
+}
+
+// A main module loading 'count' modules of 'statements' statements each
+static void generate_wide_loadin(const char* dir, int count, int statements) {
+    FILE* main_module = create_file(dir, "wide_loadin.zr");
+    for (int m = 0; m < count; m++) {
+        fprintf(main_module, "loadin \"./module%d\";\n", m);
+        char name[64];
+        snprintf(name, sizeof(name), "module%d.zr", m);
+        FILE* out = create_file(dir, name);
+        for (int i = 0; i < statements; i++) {
+            fprintf(out, "let m%d_%d = %d + (%d * 2);\n", m % 10, i % 8, m, i);
+        }
+        fclose(out);
+    }
+    fprintf(main_module, "print m0_0;\n");
+    fclose(main_module);
+}
+
+// --- In-process measurements ---
+
+static char* read_file(const char* dir, const char* name) {
+    char path[MAX_MODULE_PATH_LEN];
+    snprintf(path, sizeof(path), "%s/%s", dir, name);
+    FILE* file = fopen(path, "r");
+    if (file == NULL) error("Could not open %s.", path);
+    fseek(file, 0, SEEK_END);
+    long size = ftell(file);
+    fseek(file, 0, SEEK_SET);
+    char* source = safe_malloc(size + 1);
+    if (fread(source, 1, size, file) != (size_t)size) error("Could not read %s.", path);
+    source[size] = '\0';
+    fclose(file);
+    return source;
+}
+
+static long count_nodes(const ASTNode* node) {
+    if (node == NULL) return 0;
+    long count = 1 + count_nodes(node->left) + count_nodes(node->right) + count_nodes(node->condition) +
+                 count_nodes(node->body) + count_nodes(node->else_body);
+    for (int i = 0; i < node->param_count; i++) count += count_nodes(node->params[i]);
+    for (int i = 0; i < node->statement_count; i++) count += count_nodes(node->statements[i]);
+    return count;
+}
+
+static ASTNode* parse_source(char* source) {
+    Lexer* lexer = init_lexer(source);
+    Parser* parser = init_parser(lexer);
+    ASTNode* program = parse_program(parser);
+    free_parser(parser);
+    free_lexer(lexer);
+    return program;
+}
+
+static long lex_source(char* source) {
+    Lexer* lexer = init_lexer(source);
+    long tokens = 0;
+    for (;;) {
+        Token token = get_next_token(lexer);
+        safe_free(token.text);
+        if (token.type == TOKEN_EOF) break;
+        tokens++;
+    }
+    free_lexer(lexer);
+    return tokens;
+}
+
+// One pass of a phase (lex, parse, or typecheck and interpret) over 'source':
+// returns its time, and the tokens, AST nodes or statements it handled.
+// Statements run on the tree walker.
+static double run_phase(Phase phase, char* source, const char* workload, int expected_statements, long* units) {
+    if (phase == PHASE_LEX) {
+        double start = now_seconds();
+        *units = lex_source(source);
+        return now_seconds() - start;
+    }
+
+    double start = now_seconds();
+    ASTNode* program = parse_source(source);
+    double elapsed = now_seconds() - start;
+    if (program->statement_count != expected_statements) {
+        error("%s: parsed %d statements, expected %d.", workload, program->statement_count, expected_statements);
+    }
+    if (phase == PHASE_PARSE) {
+        *units = count_nodes(program);
+        free_ast(program);
+        return elapsed;
+    }
+
+    start = now_seconds();
+    if (check_types(program) == TYPE_ERROR) error("%s: type checking failed.", workload);
+    interpret(program);
+    fflush(stdout);
+    elapsed = now_seconds() - start;
+    free_ast(program);
+    free_interpreter_memory();
+    free_type_checker_memory();
+    *units = expected_statements;
+    return elapsed;
+}
+
+// Best rate of SAMPLES samples, each repeating the phase for at least
+// MIN_SAMPLE_SECONDS: other load on the machine only ever slows a sample down
+static double best_rate(Phase phase, char* source, const char* workload, int expected_statements) {
+    double best = 0;
+    for (int sample = 0; sample < SAMPLES; sample++) {
+        double elapsed = 0, units = 0;
+        while (elapsed < MIN_SAMPLE_SECONDS) {
+            long count;
+            elapsed += run_phase(phase, source, workload, expected_statements, &count);
+            units += count;
+        }
+        if (units / elapsed > best) best = units / elapsed;
+    }
+    return best;
+}
+
+// Tokens, AST nodes and statements per second for one generated module,
+// with the program's output discarded
+static void measure_module(const char* dir, const char* workload, int expected_statements) {
+    char file_name[64];
+    snprintf(file_name, sizeof(file_name), "%s.zr", workload);
+    char* source = read_file(dir, file_name);
+
+    fflush(stdout);
+    int saved_stdout = dup(STDOUT_FILENO);
+    int null_fd = open("/dev/null", O_WRONLY);
+    dup2(null_fd, STDOUT_FILENO);
+    close(null_fd);
+    double tokens = best_rate(PHASE_LEX, source, workload, expected_statements);
+    double nodes = best_rate(PHASE_PARSE, source, workload, expected_statements);
+    double statements = best_rate(PHASE_INTERPRET, source, workload, expected_statements);
+    dup2(saved_stdout, STDOUT_FILENO);
+    close(saved_stdout);
+
+    add_metric(workload, "tokens_per_sec", tokens);
+    add_metric(workload, "nodes_per_sec", nodes);
+    add_metric(workload, "statements_per_sec", statements);
+    safe_free(source);
+}
+
+// --- The compiler as a whole ---
+
+// Best wall time of SAMPLES runs of the compiler on 'module', and its peak RSS
+static double run_compiler(const char* compiler, const char* dir, const char* module, long* peak_rss_kb) {
+    double best = -1;
+    *peak_rss_kb = 0;
+    for (int run = 0; run < SAMPLES; run++) {
+        double start = now_seconds();
+        pid_t pid = fork();
+        if (pid < 0) error("fork failed.");
+        if (pid == 0) {
+            int null_fd = open("/dev/null", O_WRONLY);
+            dup2(null_fd, STDOUT_FILENO);
+            dup2(null_fd, STDERR_FILENO);
+            if (chdir(dir) != 0) _exit(127);
+            execl(compiler, compiler, module, (char*)NULL);
+            _exit(127);
+        }
+        int status;
+        struct rusage usage;
+        if (wait4(pid, &status, 0, &usage) < 0) error("wait4 failed.");
+        double elapsed = now_seconds() - start;
+        if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+            error("%s failed on %s/%s (status %d).", compiler, dir, module, status);
+        }
+        if (best < 0 || elapsed < best) best = elapsed;
+        if (usage.ru_maxrss > *peak_rss_kb) *peak_rss_kb = usage.ru_maxrss;
+    }
+    return best;
+}
+
+// --- Results ---
+
+static void write_results(FILE* out) {
+    fprintf(out, "{\n  \"metrics\": {\n");
+    for (int i = 0; i < metric_count; i++) {
+        fprintf(out, "    \"%s\": %.1f%s\n", metrics[i].name, metrics[i].value, i + 1 < metric_count ? "," : "");
+    }
+    fprintf(out, "  }\n}\n");
+}
+
+static bool higher_is_better(const char* name) {
+    size_t length = strlen(name);
+    return length > 8 && strcmp(name + length - 8, "_per_sec") == 0;
+}
+
+// Compare against a file written by write_results. Returns the number of
+// metrics that regressed past the tolerance.
+static int check_baseline(const char* path, double tolerance) {
+    FILE* file = fopen(path, "r");
+    if (file == NULL) {
+        fprintf(stderr, "No baseline at %s; run `make bench-baseline` to record one.\n", path);
+        return 0;
+    }
+    int regressions = 0;
+    char line[256];
+    while (fgets(line, sizeof(line), file) != NULL) {
+        char name[64];
+        double baseline;
+        if (sscanf(line, " \"%63[^\"]\": %lf", name, &baseline) != 2) continue;
+        const Metric* metric = NULL;
+        for (int i = 0; i < metric_count; i++) {
+            if (strcmp(metrics[i].name, name) == 0) metric = &metrics[i];
+        }
+        if (metric == NULL || baseline <= 0) continue;
+        double change = (metric->value - baseline) / baseline * 100;
+        bool regressed = higher_is_better(name) ? change < -tolerance : change > tolerance;
+        if (regressed) {
+            fprintf(stderr, "REGRESSION %s: %.1f -> %.1f (%+.1f%%)\n", name, baseline, metric->value, change);
+            regressions++;
+        }
+    }
+    fclose(file);
+    return regressions;
+}
+
+static void print_usage(const char* program_name) {
+    fprintf(stderr, "Usage: %s [options]\n", program_name);
+    fprintf(stderr, "  --compiler=PATH     Compiler binary for whole-program runs (default ./compiler)\n");
+    fprintf(stderr, "  --baseline=FILE     Fail if a metric is worse than in FILE by more than the tolerance\n");
+    fprintf(stderr, "  --tolerance=PCT     Allowed regression in percent (default 25)\n");
+    fprintf(stderr, "  --output=FILE       Also write the JSON results to FILE\n");
+}
+
+int main(int argc, char* argv[]) {
+    set_debug_level(DEBUG_LEVEL_WARN);
+
+    const char* compiler = "./compiler";
+    const char* baseline_path = NULL;
+    const char* output_path = NULL;
+    double tolerance = 25;
+    for (int i = 1; i < argc; i++) {
+        if (strncmp(argv[i], "--compiler=", 11) == 0) {
+            compiler = argv[i] + 11;
+        } else if (strncmp(argv[i], "--baseline=", 11) == 0) {
+            baseline_path = argv[i] + 11;
+        } else if (strncmp(argv[i], "--tolerance=", 12) == 0) {
+            char* end;
+            tolerance = strtod(argv[i] + 12, &end);
+            if (*end != '\0' || tolerance < 0) {
+                fprintf(stderr, "Invalid tolerance: %s\n", argv[i] + 12);
+                return 1;
+            }
+        } else if (strncmp(argv[i], "--output=", 9) == 0) {
+            output_path = argv[i] + 9;
+        } else {
+            print_usage(argv[0]);
+            return 1;
+        }
+    }
+
+    char compiler_path[MAX_MODULE_PATH_LEN];
+    if (realpath(compiler, compiler_path) == NULL) error("Compiler not found: %s", compiler);
+    char dir[] = "/tmp/zr-bench-XXXXXX";
+    if (mkdtemp(dir) == NULL) error("Could not create a temporary directory.");
+
+    generate_statements(dir, MAX_STATEMENTS);
+    generate_deep_expressions(dir, 50, 500);
+    generate_print_heavy(dir, MAX_STATEMENTS);
+    generate_wide_loadin(dir, 100, 200);
+
+    // Whole-program runs first: Linux keeps a process's peak RSS across
+    // execve, so the children must be forked while this process is small
+    static const char* const modules[] = { "statements", "deep_expressions", "print_heavy", "wide_loadin" };
+    for (int i = 0; i < 4; i++) {
+        char file_name[64];
+        snprintf(file_name, sizeof(file_name), "%s.zr", modules[i]);
+        long peak_rss_kb;
+        double seconds = run_compiler(compiler_path, dir, file_name, &peak_rss_kb);
+        if (strcmp(modules[i], "wide_loadin") == 0) {
+            add_metric(modules[i], "modules_per_sec", 100 / seconds);
+            add_metric(modules[i], "statements_per_sec", (100 * 200 + 1) / seconds);
+        }
+        add_metric(modules[i], "peak_rss_kb", peak_rss_kb);
+    }
+
+    measure_module(dir, "statements", MAX_STATEMENTS);
+    measure_module(dir, "deep_expressions", 50);
+    measure_module(dir, "print_heavy", MAX_STATEMENTS);
+
+    char command[MAX_MODULE_PATH_LEN + 16];
+    snprintf(command, sizeof(command), "rm -rf %s", dir);
+    if (system(command) != 0) fprintf(stderr, "Could not remove %s\n", dir);
+
+    write_results(stdout);
+    if (output_path != NULL) {
+        FILE* out = fopen(output_path, "w");
+        if (out == NULL) error("Could not write %s.", output_path);
+        write_results(out);
+        fclose(out);
+    }
+    if (baseline_path != NULL) {
+        int regressions = check_baseline(baseline_path, tolerance);
+        if (regressions > 0) {
+            fprintf(stderr, "%d metric(s) regressed by more than %.0f%% against %s\n",
+                    regressions, tolerance, baseline_path);
+            return 1;
+        }
+        fprintf(stderr, "No regressions against %s (tolerance %.0f%%)\n", baseline_path, tolerance);
+    }
+    return 0;
+}
@@ -0,0 +1,575 @@
+#include "compiler.h"
+#include "vm.h"
+#include "debug.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h> // For PRId64, PRId32
+
+// AST -> stack bytecode compiler.
+//
+// Statements compile to straight-line code with forward jumps for if/else and
+// a backward jump closing each while loop.
+// Three statement shapes that dominate our scripts get superinstructions:
+//   let x = y <op> <literal>;      -> OP_LET_VAR_OP_CONST
+//   if/while (x <cmp> <literal>)    -> OP_JUMP_UNLESS_VAR_CMP_CONST
+//   print x;                       -> OP_PRINT_VAR
+// Each replaces three or four dispatches with one, and reads the variable in
+// place instead of copying it onto the operand stack.
+
+typedef struct {
+    Chunk* chunk;
+    int depth; // Current operand stack depth
+} BytecodeCompiler;
+
+static const char* binary_op_texts[] = {
+    [BINOP_NONE] = "=", // The parser only produces BINOP_NONE for '='
+    [BINOP_ADD] = "+",
+    [BINOP_SUB] = "-",
+    [BINOP_MUL] = "*",
+    [BINOP_DIV] = "/",
+    [BINOP_GT] = ">",
+    [BINOP_LT] = "<",
+    [BINOP_EQ] = "==",
+    [BINOP_LTEQ] = "<=",
+    [BINOP_GTEQ] = ">=",
+    [BINOP_NOTEQ] = "!=",
+    [BINOP_AND] = "&&",
+    [BINOP_OR] = "||",
+};
+
+// Source text of an operator, for error messages
+const char* binary_op_text(BinaryOp op) {
+    return binary_op_texts[op];
+}
+
+static void adjust_depth(BytecodeCompiler* bc, int delta) {
+    bc->depth += delta;
+    if (bc->depth > bc->chunk->max_stack) {
+        bc->chunk->max_stack = bc->depth;
+    }
+}
+
+// Append an instruction to a chunk and return its index
+int chunk_write(Chunk* chunk, int op, int binop, int type, int a, int b, int c) {
+    if (chunk->count == chunk->capacity) {
+        int new_capacity = chunk->capacity == 0 ? 64 : chunk->capacity * 2;
+        Instruction* grown = safe_malloc(sizeof(Instruction) * new_capacity);
+        ASTNode** grown_sites = safe_malloc(sizeof(ASTNode*) * new_capacity);
+        if (chunk->code != NULL) {
+            memcpy(grown, chunk->code, sizeof(Instruction) * chunk->count);
+            memcpy(grown_sites, chunk->sites, sizeof(ASTNode*) * chunk->count);
+            safe_free(chunk->code);
+            safe_free(chunk->sites);
+        }
+        chunk->code = grown;
+        chunk->sites = grown_sites;
+        chunk->capacity = new_capacity;
+    }
+    chunk->sites[chunk->count] = chunk->site;
+    Instruction* instr = &chunk->code[chunk->count];
+    instr->op = (uint8_t)op;
+    instr->binop = (uint8_t)binop;
+    instr->type = (uint8_t)type;
+    instr->a = a;
+    instr->b = b;
+    instr->c = c;
+    return chunk->count++;
+}
+
+static int emit(BytecodeCompiler* bc, OpCode op, int binop, int type, int a, int b, int c) {
+    return chunk_write(bc->chunk, op, binop, type, a, b, c);
+}
+
+// Add a constant; the chunk takes ownership of any string in it
+int chunk_add_constant(Chunk* chunk, RuntimeValue value) {
+    if (chunk->constant_count == chunk->constant_capacity) {
+        int new_capacity = chunk->constant_capacity == 0 ? 16 : chunk->constant_capacity * 2;
+        RuntimeValue* grown = safe_malloc(sizeof(RuntimeValue) * new_capacity);
+        if (chunk->constants != NULL) {
+            memcpy(grown, chunk->constants, sizeof(RuntimeValue) * chunk->constant_count);
+            safe_free(chunk->constants);
+        }
+        chunk->constants = grown;
+        chunk->constant_capacity = new_capacity;
+    }
+    chunk->constants[chunk->constant_count] = value;
+    return chunk->constant_count++;
+}
+
+// Frame slot of a variable, allocated on first use
+int chunk_resolve_slot(Chunk* chunk, const char* name) {
+    for (int i = 0; i < chunk->slot_count; i++) {
+        if (strcmp(chunk->slot_names[i], name) == 0) return i;
+    }
+    if (chunk->slot_count == chunk->slot_capacity) {
+        int new_capacity = chunk->slot_capacity == 0 ? 16 : chunk->slot_capacity * 2;
+        char** grown = safe_malloc(sizeof(char*) * new_capacity);
+        if (chunk->slot_names != NULL) {
+            memcpy(grown, chunk->slot_names, sizeof(char*) * chunk->slot_count);
+            safe_free(chunk->slot_names);
+        }
+        chunk->slot_names = grown;
+        chunk->slot_capacity = new_capacity;
+    }
+    chunk->slot_names[chunk->slot_count] = strdup(name);
+    return chunk->slot_count++;
+}
+
+static int add_constant(BytecodeCompiler* bc, RuntimeValue value) {
+    return chunk_add_constant(bc->chunk, value);
+}
+
+static int resolve_slot(BytecodeCompiler* bc, const char* name) {
+    return chunk_resolve_slot(bc->chunk, name);
+}
+
+// Emit a runtime failure with the message the AST interpreter would report
+static void emit_fail(BytecodeCompiler* bc, const char* message) {
+    emit(bc, OP_FAIL, 0, 0, add_constant(bc, create_string_runtime_value(message)), 0, 0);
+}
+
+// Constant for a literal node. Returns false (with the interpreter's error
+// message) for literals that fail to parse or aren't literals at all.
+bool literal_constant(const ASTNode* node, RuntimeValue* out, char* message, size_t message_size) {
+    message[0] = '\0';
+    if (node == NULL) return false;
+    switch (node->type) {
+        case NODE_NUMBER:
+            return parse_number_literal(node, out, message, message_size);
+        case NODE_STRING:
+            *out = create_string_runtime_value(node->value.string_val);
+            return true;
+        case NODE_BOOL:
+            *out = create_bool_runtime_value(node->value.bool_val);
+            return true;
+        default:
+            return false;
+    }
+}
+
+// Does 'node' have the form <identifier> <op> <literal>?
+static bool is_var_op_literal(ASTNode* node) {
+    if (node == NULL || node->type != NODE_BINARY || node->value.string_val == NULL) return false;
+    if (node->left == NULL || node->left->type != NODE_IDENT) return false;
+    if (node->right == NULL) return false;
+    if (node->right->type == NODE_NUMBER) {
+        RuntimeValue ignored;
+        char message[MAX_STRING_LEN];
+        return parse_number_literal(node->right, &ignored, message, sizeof(message));
+    }
+    return node->right->type == NODE_STRING || node->right->type == NODE_BOOL;
+}
+
+// The compiler doesn't recurse on the C stack, so that it handles any nesting
+// the parser accepts: like evaluate_node, it keeps a frame per node being
+// compiled, recording which child it is waiting for, on a stack in the heap.
+// Expressions leave their value on the operand stack, so a finished child
+// has nothing to hand back to its parent.
+typedef enum {
+    TASK_STATEMENT,
+    TASK_EXPRESSION
+} CompileTask;
+
+typedef struct {
+    CompileTask task;
+    ASTNode* node;
+    int state;  // 0 on entry; afterwards node-specific progress
+    int index;  // Next statement to compile, for blocks
+    int branch; // if/while: the conditional branch to patch
+    int jump;   // if: the jump over the else arm; while: the loop head
+    ASTNode* enclosing_site;
+} CompileFrame;
+
+typedef struct {
+    CompileFrame* frames;
+    int count;
+    int capacity;
+} CompileStack;
+
+static void push_compile_frame(CompileStack* stack, CompileTask task, ASTNode* node) {
+    if (stack->count == stack->capacity) {
+        int new_capacity = stack->capacity == 0 ? 64 : stack->capacity * 2;
+        CompileFrame* grown = safe_malloc(sizeof(CompileFrame) * new_capacity);
+        if (stack->frames != NULL) {
+            memcpy(grown, stack->frames, sizeof(CompileFrame) * stack->count);
+            safe_free(stack->frames);
+        }
+        stack->frames = grown;
+        stack->capacity = new_capacity;
+    }
+    CompileFrame* frame = &stack->frames[stack->count++];
+    frame->task = task;
+    frame->node = node;
+    frame->state = 0;
+    frame->index = 0;
+    frame->branch = -1;
+    frame->jump = -1;
+    frame->enclosing_site = NULL;
+}
+
+// Code for a literal or identifier, or a failure for a node that can't be
+// an operand; false for a binary node, whose operands come first
+static bool compile_leaf(BytecodeCompiler* bc, ASTNode* node) {
+    char message[MAX_STRING_LEN];
+    RuntimeValue constant;
+
+    if (node == NULL) {
+        emit_fail(bc, ""); // A missing operand is an error without a message
+        return true;
+    }
+    switch (node->type) {
+        case NODE_NUMBER:
+        case NODE_STRING:
+        case NODE_BOOL:
+            if (literal_constant(node, &constant, message, sizeof(message))) {
+                emit(bc, OP_CONST, 0, 0, add_constant(bc, constant), 0, 0);
+                adjust_depth(bc, 1);
+            } else {
+                emit_fail(bc, message);
+            }
+            return true;
+        case NODE_IDENT:
+            emit(bc, OP_LOAD, 0, 0, resolve_slot(bc, node->value.string_val), 0, 0);
+            adjust_depth(bc, 1);
+            return true;
+        case NODE_BINARY:
+            return false;
+        default:
+            snprintf(message, sizeof(message), "Error: Unknown AST node type %d in evaluate_node.\n", node->type);
+            emit_fail(bc, message);
+            return true;
+    }
+}
+
+// Push the code of an expression onto the work stack; leaves are compiled
+// at once. Returns whether a frame was pushed.
+static bool start_expression(BytecodeCompiler* bc, CompileStack* stack, ASTNode* node) {
+    if (compile_leaf(bc, node)) return false;
+    push_compile_frame(stack, TASK_EXPRESSION, node);
+    return true;
+}
+
+// A binary node: left operand, right operand, then the operator. Returns
+// true once the node is compiled.
+static bool step_expression(BytecodeCompiler* bc, CompileStack* stack, CompileFrame* frame) {
+    ASTNode* node = frame->node;
+    if (frame->state == 0) {
+        frame->state = 1;
+        if (start_expression(bc, stack, node->left)) return false;
+    }
+    if (frame->state == 1) {
+        frame->state = 2;
+        if (start_expression(bc, stack, node->right)) return false;
+    }
+    if (node->value.string_val == NULL) {
+        emit_fail(bc, "Error: Binary operator token has NULL text.\n");
+        return true;
+    }
+    emit(bc, OP_BINARY, node->op, 0, 0, 0, 0);
+    adjust_depth(bc, -1);
+    return true;
+}
+
+// Compile a let statement outright, or start its expression and return
+// false, for finish_let to store the value
+static bool compile_let(BytecodeCompiler* bc, CompileStack* stack, ASTNode* node) {
+    if (node->value.string_val == NULL || node->left == NULL) {
+        emit_fail(bc, "Error: Invalid let statement structure.\n");
+        return true;
+    }
+    if (is_var_op_literal(node->left)) {
+        RuntimeValue constant;
+        char message[MAX_STRING_LEN];
+        literal_constant(node->left->right, &constant, message, sizeof(message));
+        emit(bc, OP_LET_VAR_OP_CONST, node->left->op, node->explicit_type, resolve_slot(bc, node->value.string_val),
+             resolve_slot(bc, node->left->left->value.string_val), add_constant(bc, constant));
+        return true;
+    }
+    start_expression(bc, stack, node->left);
+    return false;
+}
+
+static void finish_let(BytecodeCompiler* bc, ASTNode* node) {
+    emit(bc, OP_LET, 0, node->explicit_type, resolve_slot(bc, node->value.string_val), 0, 0);
+    adjust_depth(bc, -1);
+}
+
+// Compile a print statement outright, or start its expression and return
+// false, for finish_print to print the value
+static bool compile_print(BytecodeCompiler* bc, CompileStack* stack, ASTNode* node) {
+    if (node->left == NULL) {
+        emit_fail(bc, "Error: Nothing to print\n");
+        return true;
+    }
+    if (node->left->type == NODE_IDENT) {
+        emit(bc, OP_PRINT_VAR, 0, 0, resolve_slot(bc, node->left->value.string_val), 0, 0);
+        return true;
+    }
+    start_expression(bc, stack, node->left);
+    return false;
+}
+
+static void finish_print(BytecodeCompiler* bc) {
+    emit(bc, OP_PRINT, 0, 0, 0, 0, 0);
+    adjust_depth(bc, -1);
+}
+
+// Emit a branch to a not-yet-known target, taken when 'condition' is false,
+// into frame->branch (for patch_branch). Returns false after starting the
+// condition: call again once it is compiled.
+static bool compile_branch_unless(BytecodeCompiler* bc, CompileStack* stack, CompileFrame* frame,
+                                  ASTNode* condition, bool loop) {
+    if (frame->branch == -1) {
+        if (is_var_op_literal(condition) && condition->op >= BINOP_GT && condition->op <= BINOP_NOTEQ) {
+            RuntimeValue constant;
+            char message[MAX_STRING_LEN];
+            literal_constant(condition->right, &constant, message, sizeof(message));
+            frame->branch = emit(bc, OP_JUMP_UNLESS_VAR_CMP_CONST, condition->op, 0,
+                                 resolve_slot(bc, condition->left->value.string_val),
+                                 add_constant(bc, constant), -1);
+            return true;
+        }
+        frame->branch = -2; // Condition started
+        start_expression(bc, stack, condition);
+        return false;
+    }
+    adjust_depth(bc, -1);
+    frame->branch = emit(bc, OP_JUMP_IF_FALSE, 0, 0, -1, loop ? 1 : 0, 0);
+    return true;
+}
+
+static void patch_branch(BytecodeCompiler* bc, int index, int target) {
+    Instruction* branch_instr = &bc->chunk->code[index];
+    if (branch_instr->op == OP_JUMP_UNLESS_VAR_CMP_CONST) {
+        branch_instr->c = target;
+    } else {
+        branch_instr->a = target;
+    }
+}
+
+static void start_statement(CompileStack* stack, ASTNode* node) {
+    if (node != NULL) push_compile_frame(stack, TASK_STATEMENT, node);
+}
+
+// Advance a statement by one step. A step ends whenever it starts a child,
+// since pushing a frame moves the stack; the statement is stepped again once
+// the child is compiled. Returns true once the statement is compiled.
+static bool step_statement(BytecodeCompiler* bc, CompileStack* stack, CompileFrame* frame) {
+    char message[MAX_STRING_LEN];
+    ASTNode* node = frame->node;
+
+    if (frame->state == 0) {
+        // Each instruction is attributed to the innermost statement it belongs to
+        frame->enclosing_site = bc->chunk->site;
+        if (node->type != NODE_BLOCK) bc->chunk->site = node;
+        frame->state = 1;
+    }
+
+    switch (node->type) {
+        case NODE_LET:
+            if (frame->state == 1) {
+                frame->state = 2;
+                if (!compile_let(bc, stack, node)) return false;
+            } else {
+                finish_let(bc, node);
+            }
+            break;
+        case NODE_PRINT:
+            if (frame->state == 1) {
+                frame->state = 2;
+                if (!compile_print(bc, stack, node)) return false;
+            } else {
+                finish_print(bc);
+            }
+            break;
+        case NODE_IF:
+            if (frame->state == 1) {
+                if (!compile_branch_unless(bc, stack, frame, node->condition, false)) return false;
+                frame->state = 2;
+                start_statement(stack, node->body);
+                return false;
+            }
+            if (frame->state == 2 && node->else_body != NULL) {
+                frame->jump = emit(bc, OP_JUMP, 0, 0, -1, 0, 0);
+                patch_branch(bc, frame->branch, bc->chunk->count);
+                frame->state = 3;
+                start_statement(stack, node->else_body);
+                return false;
+            }
+            if (frame->state == 2) {
+                patch_branch(bc, frame->branch, bc->chunk->count);
+            } else {
+                bc->chunk->code[frame->jump].a = bc->chunk->count;
+            }
+            break;
+        case NODE_WHILE:
+            if (frame->state == 1) {
+                if (frame->branch == -1) frame->jump = bc->chunk->count; // Loop head
+                if (!compile_branch_unless(bc, stack, frame, node->condition, true)) return false;
+                frame->state = 2;
+                start_statement(stack, node->body);
+                return false;
+            }
+            emit(bc, OP_JUMP, 0, 0, frame->jump, 0, 0);
+            patch_branch(bc, frame->branch, bc->chunk->count);
+            break;
+        case NODE_BLOCK:
+            if (node->statements == NULL && node->statement_count > 0) {
+                emit_fail(bc, "Internal Error: NODE_BLOCK has statements but statements array is NULL.\n");
+                break;
+            }
+            if (frame->index < node->statement_count) {
+                start_statement(stack, node->statements[frame->index++]);
+                return false;
+            }
+            break;
+        case NODE_LOADIN:
+            emit_fail(bc, "Internal Error: NODE_LOADIN encountered in evaluate_node. This should have been processed earlier.\n");
+            break;
+        case NODE_NUMBER:
+        case NODE_STRING:
+        case NODE_BOOL:
+        case NODE_IDENT:
+        case NODE_BINARY:
+            // Expression statement: evaluated for its errors, value discarded
+            if (frame->state == 1) {
+                frame->state = 2;
+                start_expression(bc, stack, node);
+                return false;
+            }
+            emit(bc, OP_POP, 0, 0, 0, 0, 0);
+            adjust_depth(bc, -1);
+            break;
+        default:
+            snprintf(message, sizeof(message), "Error: Unknown AST node type %d in evaluate_node.\n", node->type);
+            emit_fail(bc, message);
+            break;
+    }
+
+    bc->chunk->site = frame->enclosing_site;
+    return true;
+}
+
+static void compile_statement(BytecodeCompiler* bc, ASTNode* root) {
+    CompileStack stack = { NULL, 0, 0 };
+    start_statement(&stack, root);
+    while (stack.count > 0) {
+        CompileFrame* frame = &stack.frames[stack.count - 1];
+        bool finished = frame->task == TASK_STATEMENT ? step_statement(bc, &stack, frame)
+                                                      : step_expression(bc, &stack, frame);
+        if (finished) stack.count--;
+    }
+    safe_free(stack.frames);
+}
+
+// Compile a module's code block into a chunk
+Chunk* compile_chunk(ASTNode* block) {
+    Chunk* chunk = safe_malloc(sizeof(Chunk));
+    memset(chunk, 0, sizeof(Chunk));
+
+    BytecodeCompiler bc = { chunk, 0 };
+    compile_statement(&bc, block);
+    emit(&bc, OP_HALT, 0, 0, 0, 0, 0);
+
+    LOG_DEBUG("Compiled chunk: %d instructions, %d constants, %d slots, max stack %d",
+              chunk->count, chunk->constant_count, chunk->slot_count, chunk->max_stack);
+    return chunk;
+}
+
+void free_chunk(Chunk* chunk) {
+    if (chunk == NULL) return;
+    for (int i = 0; i < chunk->constant_count; i++) {
+        release_runtime_value(&chunk->constants[i]);
+    }
+    for (int i = 0; i < chunk->slot_count; i++) {
+        safe_free(chunk->slot_names[i]);
+    }
+    jit_free(chunk->native);
+    for (int i = 0; i < chunk->deopt_count; i++) {
+        safe_free(chunk->deopt_points[i].path);
+    }
+    safe_free(chunk->deopt_points);
+    safe_free(chunk->code);
+    safe_free(chunk->sites);
+    safe_free(chunk->constants);
+    safe_free(chunk->slot_names);
+    safe_free(chunk);
+}
+
+static const char* opcode_names[OP_COUNT] = {
+    [OP_CONST] = "CONST",
+    [OP_LOAD] = "LOAD",
+    [OP_LET] = "LET",
+    [OP_BINARY] = "BINARY",
+    [OP_POP] = "POP",
+    [OP_PRINT] = "PRINT",
+    [OP_JUMP] = "JUMP",
+    [OP_JUMP_IF_FALSE] = "JUMP_IF_FALSE",
+    [OP_FAIL] = "FAIL",
+    [OP_HALT] = "HALT",
+    [OP_LET_VAR_OP_CONST] = "LET_VAR_OP_CONST",
+    [OP_JUMP_UNLESS_VAR_CMP_CONST] = "JUMP_UNLESS_VAR_CMP_CONST",
+    [OP_PRINT_VAR] = "PRINT_VAR",
+};
+
+const char* opcode_name(uint8_t op) {
+    return op < OP_COUNT ? opcode_names[op] : "UNKNOWN";
+}
+
+void print_constant(const Chunk* chunk, int index, FILE* out) {
+    RuntimeValue constant = chunk->constants[index];
+    switch (constant.type) {
+        case TYPE_INT32:  fprintf(out, "%" PRId32, constant.val.int32_val); break;
+        case TYPE_INT64:  fprintf(out, "%" PRId64, constant.val.int64_val); break;
+        case TYPE_FLOAT:  fprintf(out, "%g", constant.val.float_val); break;
+        case TYPE_BOOL:   fprintf(out, "%s", constant.val.bool_val ? "true" : "false"); break;
+        case TYPE_STRING: fprintf(out, "\"%s\"", constant.val.string_val); break;
+        default:          fprintf(out, "<%s>", get_type_name(constant.type)); break;
+    }
+}
+
+// Print a human-readable listing of a chunk
+void disassemble_chunk(const Chunk* chunk, FILE* out) {
+    for (int i = 0; i < chunk->count; i++) {
+        const Instruction* instr = &chunk->code[i];
+        fprintf(out, "%04d  %-26s", i, opcode_names[instr->op]);
+        switch (instr->op) {
+            case OP_CONST:
+                print_constant(chunk, instr->a, out);
+                break;
+            case OP_LOAD:
+            case OP_PRINT_VAR:
+                fprintf(out, "%s", chunk->slot_names[instr->a]);
+                break;
+            case OP_LET:
+                fprintf(out, "%s", chunk->slot_names[instr->a]);
+                if (instr->type != TYPE_VOID) fprintf(out, " : %s", get_type_name((DataType)instr->type));
+                break;
+            case OP_BINARY:
+                fprintf(out, "%s", binary_op_text((BinaryOp)instr->binop));
+                break;
+            case OP_JUMP:
+            case OP_JUMP_IF_FALSE:
+                fprintf(out, "-> %04d", instr->a);
+                break;
+            case OP_FAIL:
+                fprintf(out, "\"%.*s\"", (int)strcspn(chunk->constants[instr->a].val.string_val, "\n"),
+                        chunk->constants[instr->a].val.string_val);
+                break;
+            case OP_LET_VAR_OP_CONST:
+                fprintf(out, "%s = %s %s ", chunk->slot_names[instr->a], chunk->slot_names[instr->b],
+                        binary_op_text((BinaryOp)instr->binop));
+                print_constant(chunk, instr->c, out);
+                break;
+            case OP_JUMP_UNLESS_VAR_CMP_CONST:
+                fprintf(out, "%s %s ", chunk->slot_names[instr->a], binary_op_text((BinaryOp)instr->binop));
+                print_constant(chunk, instr->b, out);
+                fprintf(out, " else -> %04d", instr->c);
+                break;
+            default:
+                break;
+        }
+        fprintf(out, "\n");
+    }
+}
@@ -7,6 +7,8 @@
 #include <ctype.h>
 #include <stdbool.h>
 #include <stdint.h>
+#include <setjmp.h>
+#include <sys/stat.h>
 
 // Maximum number of statements in a program
 #define MAX_STATEMENTS 1000
@@ -18,6 +20,9 @@
 #define MAX_STRING_LEN 1024
 // Maximum number of parameters
 #define MAX_PARAMS 16
+// Maximum nesting depth of expressions and blocks accepted by the parser.
+// Operator chains nest to the right, so each operator counts as one level.
+#define MAX_NESTING_DEPTH 10000
 
 // Token types
 typedef enum {
@@ -122,12 +127,72 @@ typedef enum {
     NODE_LOADIN   // New AST node type for loadin "filepath"
 } NodeType;
 
+// Binary operators, decoded from the operator token by the parser
+typedef enum {
+    BINOP_NONE,
+    BINOP_ADD,
+    BINOP_SUB,
+    BINOP_MUL,
+    BINOP_DIV,
+    BINOP_GT,
+    BINOP_LT,
+    BINOP_EQ,
+    BINOP_LTEQ,
+    BINOP_GTEQ,
+    BINOP_NOTEQ,
+    BINOP_AND,
+    BINOP_OR
+} BinaryOp;
+
+// Type-specialized variants a node is rewritten into after its first evaluation.
+// The INT32, INT64 and FLOAT families are laid out in BinaryOp order (ADD..NOTEQ).
+typedef enum {
+    QUICK_NONE,       // Not evaluated yet
+    QUICK_GENERIC,    // Operand types were unstable: always take the generic path
+    QUICK_INT32_ADD,
+    QUICK_INT32_SUB,
+    QUICK_INT32_MUL,
+    QUICK_INT32_DIV,
+    QUICK_INT32_GT,
+    QUICK_INT32_LT,
+    QUICK_INT32_EQ,
+    QUICK_INT32_LTEQ,
+    QUICK_INT32_GTEQ,
+    QUICK_INT32_NOTEQ,
+    QUICK_INT64_ADD,
+    QUICK_INT64_SUB,
+    QUICK_INT64_MUL,
+    QUICK_INT64_DIV,
+    QUICK_INT64_GT,
+    QUICK_INT64_LT,
+    QUICK_INT64_EQ,
+    QUICK_INT64_LTEQ,
+    QUICK_INT64_GTEQ,
+    QUICK_INT64_NOTEQ,
+    QUICK_FLOAT_ADD,
+    QUICK_FLOAT_SUB,
+    QUICK_FLOAT_MUL,
+    QUICK_FLOAT_DIV,
+    QUICK_FLOAT_GT,
+    QUICK_FLOAT_LT,
+    QUICK_FLOAT_EQ,
+    QUICK_FLOAT_LTEQ,
+    QUICK_FLOAT_GTEQ,
+    QUICK_FLOAT_NOTEQ,
+    QUICK_BOOL_AND,
+    QUICK_BOOL_OR,
+    QUICK_CONST       // NODE_NUMBER whose literal is already parsed into cached_value
+} QuickKind;
+
 // AST node structure
 typedef struct ASTNode {
     NodeType type;
     DataType data_type; // For inferred/evaluated type of the node itself
     DataType explicit_type; // For explicitly declared type in 'let' statements
     Value value;
+    BinaryOp op;        // Operator of a NODE_BINARY
+    QuickKind quick;    // Specialization chosen by the interpreter at first evaluation
+    Value cached_value; // Parsed literal for QUICK_CONST nodes
     struct ASTNode* left;
     struct ASTNode* right;
     struct ASTNode* condition;
@@ -137,6 +202,11 @@ typedef struct ASTNode {
     int param_count;
     struct ASTNode** statements;
     int statement_count;
+    int hotness;          // While loops: entries plus iterations so far (tiered execution)
+    struct Chunk* chunk;  // While loops: register bytecode, once promoted (tiered execution)
+    int deopts;           // While loops: times speculative code for the loop was abandoned
+    int line;             // Source position of the node's first token
+    int column;
 } ASTNode;
 
 // Function structure
@@ -167,6 +237,8 @@ typedef struct {
     int scope_level;
     Function functions[MAX_VARIABLES];
     int function_count;
+    int depth; // Current expression/block nesting depth
+    int error_count; // Syntax errors reported so far
 } Parser;
 
 // Function declarations
@@ -176,8 +248,142 @@ void free_lexer(Lexer* lexer); // Added declaration
 Parser* init_parser(Lexer* lexer);
 ASTNode* parse_program(Parser* parser); // Might need context
 void free_parser(Parser* parser); // Added declaration
-void interpret(ASTNode* node); // Will be refactored to interpret_statement
+bool interpret(ASTNode* node); // False if a runtime error stopped it
+
+// Execution engine used by interpret()
+typedef enum {
+    EXEC_TREE,       // Walk the AST directly
+    EXEC_STACK_VM,   // Compile each module to stack bytecode and run it on the stack VM
+    EXEC_REGISTER_VM, // Compile each module to register bytecode and run it on the register VM
+    EXEC_TIERED,      // Walk the AST, promoting hot while loops to the register VM (and its JIT)
+    EXEC_AOT,         // Don't run anything: add each module to the C program built by aot.c
+    EXEC_ELF          // Don't run anything: add each module to the executable built by elf.c
+} ExecMode;
+
+void set_exec_mode(ExecMode mode);
+void set_dump_bytecode(bool enabled); // Disassemble each compiled chunk to stderr
+
+// Register VM only: compile a chunk to native code once one of its loops has
+// run this many iterations (0 disables the JIT)
+#define JIT_DEFAULT_THRESHOLD 1000
+void set_jit_threshold(int threshold);
+
+// Tiered execution: a while loop moves to register bytecode when it is entered
+// after this many entries plus iterations
+#define TIER_DEFAULT_THRESHOLD 100
+void set_tier_threshold(int threshold);
+void set_osr(bool enabled); // Also promote a loop on a back-edge, mid-execution (default on)
+
+// Register bytecode optimization (regopt.c): -O0 to -O2, default 2
+void set_optimization_level(int level);
+extern bool time_passes;
+void set_time_passes(bool enabled); // Sum up the time spent in each pass...
+void report_pass_timings(FILE* out); // ...and print it (a no-op without set_time_passes)
+
+// Per-module phase timing (phases.c): --time-phases
+typedef enum {
+    PHASE_READ,      // Reading the source file
+    PHASE_LEX,       // Tokenizing, measured inside the parser
+    PHASE_PARSE,     // Building the AST, not counting the lexer
+    PHASE_RESOLVE,   // Resolving and registering loadin paths
+    PHASE_TYPECHECK,
+    PHASE_INTERPRET, // Running (or, with -o, compiling) the module
+    PHASE_COUNT
+} Phase;
+
+extern bool time_phases;
+void set_time_phases(bool enabled, const char* trace_path); // NULL: print a table instead of a trace
+const char* phase_name(Phase phase);
+double phase_clock(void);
+double phase_start(Phase phase); // Start time for phase_record, if timing is on
+void phase_record(Phase phase, const char* module, double start);
+void phase_enter_module(const char* module);
+void phase_leave_module(void);
+void note_lex_time(double seconds);
+void report_phase_timings(FILE* out);
+
+// Execution statistics (stats.c): --stats. The counters are compiled in
+// unless the build defines ZR_NO_STATS, and only count while stats_enabled
+// is set. Allocations are split by the phase they happen in.
+#define STATS_OTHER_PHASE PHASE_COUNT // Outside the phases above (startup, cleanup)
+
+typedef struct {
+    unsigned long evaluations[NODE_LOADIN + 1];                     // AST walker, per NodeType
+    unsigned long binary_ops[BINOP_OR + 1][TYPE_ERROR + 1][TYPE_ERROR + 1]; // Operator, left and right type
+    unsigned long lookups;        // Symbol table searches (reads and assignments)
+    unsigned long lookup_probes;  // Entries compared
+    unsigned long lookup_misses;
+    unsigned long allocations[PHASE_COUNT + 1]; // safe_malloc
+    unsigned long allocated_bytes[PHASE_COUNT + 1];
+    unsigned long frees[PHASE_COUNT + 1];       // safe_free
+    unsigned long freed_bytes[PHASE_COUNT + 1];
+} ExecutionStats;
+
+#ifndef ZR_NO_STATS
+extern bool stats_enabled;
+extern ExecutionStats stats;
+extern int stats_phase;
+void stats_count_free(void* ptr);
+#define STATS(update) do { if (stats_enabled) { update; } } while (0)
+#define STAT_PHASE(phase) STATS(stats_phase = (phase))
+#else
+#define stats_enabled false
+#define STATS(update) ((void)0)
+#define STAT_PHASE(phase) ((void)(phase))
+#endif
+
+#define STAT_EVALUATION(type) STATS(stats.evaluations[(type)]++)
+#define STAT_BINARY(op, left_type, right_type) STATS(stats.binary_ops[(op)][(left_type)][(right_type)]++)
+#define STAT_LOOKUP(probes, found) \
+    STATS(stats.lookups++; stats.lookup_probes += (probes); stats.lookup_misses += !(found))
+#define STAT_ALLOCATION(size) \
+    STATS(stats.allocations[stats_phase]++; stats.allocated_bytes[stats_phase] += (size))
+#define STAT_FREE(ptr) STATS(stats_count_free(ptr))
+
+void set_stats(bool enabled);
+void report_stats(FILE* out);
+
+// Sampling profiler (profile.c): --profile. A SIGPROF timer samples the
+// statement being run, by whichever engine runs it.
+typedef enum {
+    PROFILE_TREE,       // The AST walker: profile_statement
+    PROFILE_STACK_VM,   // The bytecode engines: profile_chunk and profile_pc (vm.h)
+    PROFILE_REGISTER_VM,
+    PROFILE_JIT,
+    PROFILE_ENGINE_COUNT
+} ProfileEngine;
+
+extern bool profiling;
+extern __thread const ASTNode* volatile profile_statement;
+void set_profile(bool enabled, const char* output_path); // NULL: folded stacks go to stderr
+void profile_enter_module(const char* module);
+void profile_leave_module(const ASTNode* code); // Attribute the module's samples to its statements
+void write_profile(void);
+
+// Script server (server.c): --serve, and the client side, --connect and
+// --server-stats. Each returns the process's exit status.
+// Until SIGINT or SIGTERM; 0 threads: one per CPU. With a prelude, requests
+// run in processes forked from the state it leaves instead (--zygote).
+int serve(const char* socket_path, int threads, const char* prelude_path);
+int run_on_server(const char* socket_path, const char* script_path); // The script's ZrStatus
+int print_server_stats(const char* socket_path);
+
+// Preludes (snapshot.c): --prelude runs a file before the program, and the
+// modules it loads count as loaded for the program. With a snapshot path
+// (--snapshot), the state the prelude leaves is saved there and, while no
+// source changes, later runs bind it from the file instead of running the
+// prelude. False if the prelude can't be read.
+bool load_prelude(const char* prelude_path, const char* snapshot_path, const char* main_script_dir);
+
+// Ahead-of-time compilation to C (aot.c)
+void aot_add_module(ASTNode* program_node);
+int aot_finish(const char* output_path, const char* c_path);
+
+// Ahead-of-time compilation straight to a static x86-64 Linux executable (elf.c)
+void elf_add_module(ASTNode* program_node);
+int elf_finish(const char* output_path);
 void free_ast(ASTNode* node);
+ASTNode* clone_ast(const ASTNode* node); // Fresh execution state (loop bytecode, hotness)
 
 // Module Loading Structures
 #define MAX_LOADED_MODULES 128
@@ -185,9 +391,39 @@ void free_ast(ASTNode* node);
 
 typedef struct {
     char paths[MAX_LOADED_MODULES][MAX_MODULE_PATH_LEN];
+    struct stat files[MAX_LOADED_MODULES]; // Each module's file, as it was when read (for snapshot.c)
     int count;
+    ASTNode* code[MAX_LOADED_MODULES + 1]; // Code blocks of the modules run so far
+    int code_count;
+    int preloaded; // The first paths: loaded by a prelude (zr_preload), so 'loadin' skips them
 } LoadedModulesRegistry;
 
+// Module loading (loader.c). The registry in use is the CLI's unless a
+// libzr context has selected its own. Like the interpreter's other
+// selections, it is per thread, so that contexts can run on several.
+void init_loaded_modules_registry(LoadedModulesRegistry* registry);
+void set_module_registry(LoadedModulesRegistry* registry); // NULL: the CLI's
+LoadedModulesRegistry* get_module_registry(void); // The one in use
+void free_module_registry(LoadedModulesRegistry* registry); // Frees the code it kept
+bool get_directory_part(const char* path, char* dir_buffer, size_t buffer_size);
+ASTNode* load_module_code(char* source_code, const char* source_filepath, const char* main_script_dir,
+                          bool* modules_completed); // False after a runtime error in a module
+bool process_source_code(char* source_code, const char* source_filepath, const char* main_script_dir); // False after a runtime error
+
+// Parsed modules shared between threads (a libzr pool's workers, the script
+// server's): once one has parsed a module, the others load it from a copy
+// of the tree until its file changes
+typedef struct ModuleCache ModuleCache;
+typedef struct {
+    int modules;
+    unsigned long hits;   // Loads from a cached tree
+    unsigned long parses; // Loads that parsed the file (first, or after a change)
+} ModuleCacheStats;
+ModuleCache* create_module_cache(void);
+void free_module_cache(ModuleCache* cache);
+void set_module_cache(ModuleCache* cache); // NULL: parse every module loaded
+ModuleCacheStats get_module_cache_stats(ModuleCache* cache);
+
 // Context for parsing, mainly to know the current file's path for relative loads
 typedef struct {
     char current_file_path[MAX_MODULE_PATH_LEN];
@@ -198,19 +434,51 @@ typedef struct {
 ASTNode* create_node(NodeType type);
 
 
-// Error handling
-void error(const char* format, ...);
+// Error handling. error() prints and exits, or, while a libzr call has set
+// a recovery point, longjmps to it. Errors in the program being run are
+// written to DIAGNOSTICS: stderr, or the buffer of the libzr call.
+extern __thread FILE* diagnostic_output;
+#define DIAGNOSTICS (diagnostic_output != NULL ? diagnostic_output : stderr)
+
+// Where 'print' writes: stdout, or the stream a libzr context was given
+extern __thread FILE* program_output;
+#define PROGRAM_OUTPUT (program_output != NULL ? program_output : stdout)
+void error(const char* format, ...) __attribute__((format(printf, 1, 2)));
+void set_error_recovery(jmp_buf* recovery); // NULL: exit again
 void warning(const char* format, ...);
 
 // Type checking
 DataType check_types(ASTNode* node);
 bool is_compatible_type(DataType left, DataType right);
+void free_type_checker_memory(void);
+bool lookup_static_type(const char* name, DataType* type); // False if the variable isn't bound
+void declare_static_type(const char* name, DataType type);
+int static_type_count(void);
+const char* static_type_at(int index, DataType* type); // The name; 0 <= index < static_type_count()
+
+// The variables and their static types live in a symbol table (interpreter.c)
+// and a type environment (typecheck.c). The CLI uses one of each; every libzr
+// context has its own and selects them while it runs.
+typedef struct SymbolTable SymbolTable;
+typedef struct TypeEnv TypeEnv;
+SymbolTable* create_symbol_table(void);
+void free_symbol_table(SymbolTable* table);
+void set_symbol_table(SymbolTable* table); // NULL: the CLI's
+void clear_symbol_table(SymbolTable* table); // Unbind every variable
+TypeEnv* create_type_env(void);
+void free_type_env(TypeEnv* env);
+void set_type_env(TypeEnv* env); // NULL: the CLI's
+void clear_type_env(TypeEnv* env);
+const char* get_type_name(DataType type);
+QuickKind select_binary_quick_kind(BinaryOp op, DataType left_type, DataType right_type);
 
 // Memory management
 void* safe_malloc(size_t size);
+char* safe_strdup(const char* text); // strdup through safe_malloc (NULL stays NULL)
 void safe_free(void* ptr);
 
 // Interpreter memory cleanup
 void free_interpreter_memory(void);
+void free_eval_stack(void); // The calling thread's (free_interpreter_memory does the CLI's)
 
 #endif // COMPILER_H
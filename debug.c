@@ -1,20 +1,58 @@
 #include "debug.h"
 #include <stdarg.h>
+#include <stdlib.h>
 #include <time.h>
 #include <string.h>
+#include <strings.h>
 #include <stdint.h>
-#ifdef __APPLE__
+#include <unistd.h>
 #include <pthread.h>
-#endif
 
-static DebugLevel current_level = DEBUG_LEVEL_ERROR;
+// Log records are formatted into one buffer by the caller and written with a
+// single write, either straight to stderr or, with set_debug_async, into a
+// ring of fixed-size slots that a background thread drains. Callers block
+// when the ring is full rather than dropping records. 'running' changes
+// only under the ring's lock; debug_log reads it atomically first so that
+// synchronous logging takes no lock.
+//
+// The LOG_* macros in debug.h test the level before calling in here, so a
+// disabled record costs a compare and its arguments are never evaluated.
+
+#define LOG_RECORD_SIZE 1024
+#define LOG_RING_SLOTS 256 // A power of two
+
+DebugLevel active_debug_level = DEBUG_LEVEL_ERROR;
+
+typedef struct {
+    int length;
+    char text[LOG_RECORD_SIZE];
+} LogRecord;
+
+static struct {
+    bool running;  // Records go to the ring
+    bool stopping; // The writer exits once the ring is empty
+    pthread_t writer;
+    pthread_mutex_t lock;
+    pthread_cond_t not_empty;
+    pthread_cond_t not_full;
+    pthread_cond_t drained;
+    unsigned long head; // Next slot to write to stderr
+    unsigned long tail; // Next slot to fill
+    bool writing;       // The writer holds a record outside the lock
+    LogRecord slots[LOG_RING_SLOTS];
+} ring = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .not_empty = PTHREAD_COND_INITIALIZER,
+    .not_full = PTHREAD_COND_INITIALIZER,
+    .drained = PTHREAD_COND_INITIALIZER,
+};
 
 void set_debug_level(DebugLevel level) {
-    current_level = level;
+    active_debug_level = level;
 }
 
 DebugLevel get_debug_level(void) {
-    return current_level;
+    return active_debug_level;
 }
 
 static const char* debug_level_name(DebugLevel level) {
@@ -28,35 +66,150 @@ static const char* debug_level_name(DebugLevel level) {
     }
 }
 
-void debug_log(DebugLevel level, const char* file, int line, const char* func, const char* fmt, ...) {
-    if (level > current_level) return;
+bool parse_debug_level(const char* name, DebugLevel* level) {
+    for (int candidate = DEBUG_LEVEL_ERROR; candidate <= DEBUG_LEVEL_TRACE; candidate++) {
+        if (strcasecmp(name, debug_level_name((DebugLevel)candidate)) == 0) {
+            *level = (DebugLevel)candidate;
+            return true;
+        }
+    }
+    return false;
+}
+
+static void write_record(const char* text, int length) {
+    while (length > 0) {
+        ssize_t written = write(STDERR_FILENO, text, length);
+        if (written <= 0) return;
+        text += written;
+        length -= written;
+    }
+}
 
-    // Timestamp
+static void* drain_ring(void* unused) {
+    (void)unused;
+    pthread_mutex_lock(&ring.lock);
+    for (;;) {
+        while (ring.head == ring.tail) {
+            ring.writing = false;
+            pthread_cond_broadcast(&ring.drained);
+            if (ring.stopping) {
+                pthread_mutex_unlock(&ring.lock);
+                return NULL;
+            }
+            pthread_cond_wait(&ring.not_empty, &ring.lock);
+        }
+        ring.writing = true;
+        LogRecord* record = &ring.slots[ring.head & (LOG_RING_SLOTS - 1)];
+        pthread_mutex_unlock(&ring.lock);
+        write_record(record->text, record->length);
+        pthread_mutex_lock(&ring.lock);
+        ring.head++; // Only now may the slot be reused
+        pthread_cond_signal(&ring.not_full);
+    }
+}
+
+void flush_debug_log(void) {
+    pthread_mutex_lock(&ring.lock);
+    while (ring.head != ring.tail || ring.writing) {
+        pthread_cond_wait(&ring.drained, &ring.lock);
+    }
+    pthread_mutex_unlock(&ring.lock);
+}
+
+static void stop_debug_async(void) {
+    set_debug_async(false);
+}
+
+void set_debug_async(bool enabled) {
+    pthread_mutex_lock(&ring.lock);
+    bool running = ring.running;
+    if (!enabled && running) {
+        // The writer drains what is queued, then exits; later records are
+        // written directly, after these
+        __atomic_store_n(&ring.running, false, __ATOMIC_RELEASE);
+        ring.stopping = true;
+        pthread_cond_signal(&ring.not_empty);
+    }
+    pthread_mutex_unlock(&ring.lock);
+    if (enabled == running) return;
+    if (!enabled) {
+        pthread_join(ring.writer, NULL);
+        return;
+    }
+
+    ring.stopping = false;
+    if (pthread_create(&ring.writer, NULL, drain_ring, NULL) != 0) {
+        fprintf(stderr, "Warning: Could not start the log writer thread; logging synchronously\n");
+        return;
+    }
+    static bool registered = false;
+    if (!registered) {
+        atexit(stop_debug_async);
+        registered = true;
+    }
+    pthread_mutex_lock(&ring.lock);
+    __atomic_store_n(&ring.running, true, __ATOMIC_RELEASE);
+    pthread_mutex_unlock(&ring.lock);
+}
+
+// "YYYY-MM-DD HH:MM:SS", reformatted only when the second changes
+static const char* timestamp(void) {
+    static __thread time_t cached_second = (time_t)-1;
+    static __thread char cached[20];
     time_t now = time(NULL);
-    struct tm tm_now;
-    localtime_r(&now, &tm_now);
-    char timebuf[20];
-    strftime(timebuf, sizeof(timebuf), "%Y-%m-%d %H:%M:%S", &tm_now);
+    if (now != cached_second) {
+        struct tm tm_now;
+        localtime_r(&now, &tm_now);
+        strftime(cached, sizeof(cached), "%Y-%m-%d %H:%M:%S", &tm_now);
+        cached_second = now;
+    }
+    return cached;
+}
+
+void debug_log(DebugLevel level, const char* file, int line, const char* func, const char* fmt, ...) {
+    if (level > active_debug_level) return;
+
+    char text[LOG_RECORD_SIZE];
+    int length = snprintf(text, sizeof(text), "[%s] [%s]", timestamp(), debug_level_name(level));
 
     // Thread id (optional, only on POSIX)
     #ifdef __APPLE__
     uint64_t tid;
     pthread_threadid_np(NULL, &tid);
+    length += snprintf(text + length, sizeof(text) - length, " [TID:%llu]", (unsigned long long)tid);
     #endif
 
-    // Print log header
-    fprintf(stderr, "[%s] [%s]", timebuf, debug_level_name(level));
-    #ifdef __APPLE__
-    fprintf(stderr, " [TID:%llu]", (unsigned long long)tid);
-    #endif
-    fprintf(stderr, " [%s:%d:%s] ", file, line, func);
-
-    // Print log message
-    va_list args;
-    va_start(args, fmt);
-    vfprintf(stderr, fmt, args);
-    va_end(args);
+    length += snprintf(text + length, sizeof(text) - length, " [%s:%d:%s] ", file, line, func);
+    if (length < (int)sizeof(text)) {
+        va_list args;
+        va_start(args, fmt);
+        length += vsnprintf(text + length, sizeof(text) - length, fmt, args);
+        va_end(args);
+    }
+    if (length > (int)sizeof(text) - 2) {
+        length = sizeof(text) - 2;
+        memcpy(text + length - 3, "...", 3); // Truncated
+    }
+    text[length++] = '\n';
+    text[length] = '\0';
 
-    fprintf(stderr, "\n");
-    fflush(stderr);
-}
\ No newline at end of file
+    if (!__atomic_load_n(&ring.running, __ATOMIC_ACQUIRE)) {
+        write_record(text, length);
+        return;
+    }
+    pthread_mutex_lock(&ring.lock);
+    if (!ring.running) { // Stopped since
+        pthread_mutex_unlock(&ring.lock);
+        write_record(text, length);
+        return;
+    }
+    while (ring.tail - ring.head == LOG_RING_SLOTS) {
+        pthread_cond_wait(&ring.not_full, &ring.lock);
+    }
+    LogRecord* record = &ring.slots[ring.tail & (LOG_RING_SLOTS - 1)];
+    memcpy(record->text, text, length);
+    record->length = length;
+    ring.tail++;
+    pthread_cond_signal(&ring.not_empty);
+    pthread_mutex_unlock(&ring.lock);
+}
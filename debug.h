@@ -12,16 +12,41 @@ typedef enum {
     DEBUG_LEVEL_TRACE
 } DebugLevel;
 
+// Most verbose level compiled in, as a number (0 = ERROR .. 4 = TRACE). Calls
+// above it compile to nothing, e.g. -DZR_LOG_MAX_LEVEL=1 keeps errors and
+// warnings only.
+#ifndef ZR_LOG_MAX_LEVEL
+#define ZR_LOG_MAX_LEVEL 4
+#endif
+
+#define DEBUG_DEFAULT_LEVEL DEBUG_LEVEL_WARN
+
 void set_debug_level(DebugLevel level);
 DebugLevel get_debug_level(void);
+bool parse_debug_level(const char* name, DebugLevel* level); // "error" .. "trace"
+void set_debug_async(bool enabled); // Queue records for a background writer thread (false: drain and join it)
+void flush_debug_log(void);         // Wait until queued records are written
+
+extern DebugLevel active_debug_level;
+
+void debug_log(DebugLevel level, const char* file, int line, const char* func, const char* fmt, ...)
+    __attribute__((format(printf, 5, 6)));
 
-void debug_log(DebugLevel level, const char* file, int line, const char* func, const char* fmt, ...);
+// Log at 'level' if it is enabled. The arguments are only evaluated (and the
+// message only formatted) when it is; levels above ZR_LOG_MAX_LEVEL are
+// constant-false and optimized away, while still type-checking the format.
+#define LOG_AT(level, fmt, ...)                                                     \
+    do {                                                                            \
+        if ((level) <= ZR_LOG_MAX_LEVEL && (level) <= active_debug_level) {         \
+            debug_log((level), __FILE__, __LINE__, __func__, fmt, ##__VA_ARGS__);   \
+        }                                                                           \
+    } while (0)
 
 // Convenience macros for contextual logging
-#define LOG_ERROR(fmt, ...) debug_log(DEBUG_LEVEL_ERROR, __FILE__, __LINE__, __func__, fmt, ##__VA_ARGS__)
-#define LOG_WARN(fmt, ...)  debug_log(DEBUG_LEVEL_WARN,  __FILE__, __LINE__, __func__, fmt, ##__VA_ARGS__)
-#define LOG_INFO(fmt, ...)  debug_log(DEBUG_LEVEL_INFO,  __FILE__, __LINE__, __func__, fmt, ##__VA_ARGS__)
-#define LOG_DEBUG(fmt, ...) debug_log(DEBUG_LEVEL_DEBUG, __FILE__, __LINE__, __func__, fmt, ##__VA_ARGS__)
-#define LOG_TRACE(fmt, ...) debug_log(DEBUG_LEVEL_TRACE, __FILE__, __LINE__, __func__, fmt, ##__VA_ARGS__)
+#define LOG_ERROR(fmt, ...) LOG_AT(DEBUG_LEVEL_ERROR, fmt, ##__VA_ARGS__)
+#define LOG_WARN(fmt, ...)  LOG_AT(DEBUG_LEVEL_WARN,  fmt, ##__VA_ARGS__)
+#define LOG_INFO(fmt, ...)  LOG_AT(DEBUG_LEVEL_INFO,  fmt, ##__VA_ARGS__)
+#define LOG_DEBUG(fmt, ...) LOG_AT(DEBUG_LEVEL_DEBUG, fmt, ##__VA_ARGS__)
+#define LOG_TRACE(fmt, ...) LOG_AT(DEBUG_LEVEL_TRACE, fmt, ##__VA_ARGS__)
 
-#endif // DEBUG_H
\ No newline at end of file
+#endif // DEBUG_H
@@ -0,0 +1,1468 @@
+#include "compiler.h"
+#include "vm.h"
+#include "x86_64.h"
+#include "debug.h"
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+// Native back end: register bytecode -> static x86-64 Linux ELF executable,
+// with no C compiler, assembler or linker involved.
+//
+// Modules are compiled to register chunks as for --exec=register, and their
+// instructions are lowered to machine code operating on tagged values laid out
+// like RuntimeValue ({type, value}, 16 bytes). Variables are global values
+// shared by all modules; each module's temporaries get their own. Every value
+// is addressed as [rbx + disp], rbx holding the data segment's base address.
+//
+// int64 arithmetic and comparisons are inlined behind type tag guards.
+// Everything else goes through a small runtime that is itself emitted as
+// machine code into the executable (see emit_runtime): buffered output on
+// write(2), print formatting (including printf's correctly rounded "%.2f"),
+// the generic binary operator with the interpreter's promotion rules and error
+// messages, and typed let conversions. A runtime error stops the module, and
+// the next one runs, as in the interpreter.
+//
+// Layout:
+//   text segment  ELF header, program headers, code (R+X)
+//   bss segment   runtime buffers at DATA_VADDR (RW, zero-filled)
+//   data segment  constants, strings and values at DATA_VADDR + BSS_SIZE (RW)
+
+#define TEXT_VADDR   0x400000
+#define DATA_VADDR   0x10000000
+#define HEADER_SIZE  (64 + 3 * 56) // ELF header plus three program headers
+#define PAGE_SIZE    0x1000
+
+// bss layout (offsets from rbx)
+#define BSS_OUT_LEN  0     // Bytes pending in the output buffer
+#define BSS_OP_TEXT  8     // Operator text of the current generic binary operation
+#define BSS_SCRATCH  16    // One value
+#define BSS_DIGITS   32    // 32 bytes: digits being formatted, right to left
+#define BSS_TEXT     64    // 512 bytes: a formatted number
+#define BSS_LIMBS    576   // 40 base-1e9 limbs for printing large floats
+#define BSS_OUT      1024  // Output buffer
+#define OUT_CAPACITY (64 * 1024 - BSS_OUT)
+#define BSS_SIZE     (64 * 1024)
+
+#define VALUE_SIZE   16    // Tagged value: 32-bit type, padding, 64-bit payload
+#define VALUE_TYPE   0
+#define VALUE_DATA   8
+
+#define SYS_WRITE      1
+#define SYS_EXIT_GROUP 231
+
+typedef struct {
+    size_t at;  // rel32 field to patch
+    int label;
+} LabelUse;
+
+typedef struct {
+    char* text;
+    int32_t disp;
+} InternedString;
+
+typedef struct {
+    CodeBuffer code;
+    CodeBuffer data; // Initialized data, at rbx + BSS_SIZE
+    size_t* labels;  // Code offset of each label; SIZE_MAX until bound
+    int label_count;
+    int label_capacity;
+    LabelUse* uses;
+    int use_count;
+    int use_capacity;
+    InternedString* strings;
+    int string_count;
+    int string_capacity;
+    char** global_names;
+    int32_t* global_disps;
+    int global_count;
+    int global_capacity;
+    int module_count;
+    size_t entry;       // Code offset of the program entry point
+    int32_t type_names; // Table of type name pointers, indexed by DataType
+
+    // Runtime routines
+    int rt_write, rt_flush, rt_out, rt_err, rt_strlen, rt_out_cstr, rt_err_cstr, rt_err_int;
+    int rt_append_u64, rt_append_int64, rt_append_pad9, rt_format_float;
+    int rt_print, rt_binary, rt_convert;
+} ElfCompiler;
+
+static ElfCompiler elf;
+static bool elf_started = false;
+
+// --- Labels -----------------------------------------------------------------
+
+static int new_label(void) {
+    if (elf.label_count == elf.label_capacity) {
+        int new_capacity = elf.label_capacity == 0 ? 256 : elf.label_capacity * 2;
+        size_t* grown = safe_malloc(sizeof(size_t) * new_capacity);
+        if (elf.labels != NULL) {
+            memcpy(grown, elf.labels, sizeof(size_t) * elf.label_count);
+            safe_free(elf.labels);
+        }
+        elf.labels = grown;
+        elf.label_capacity = new_capacity;
+    }
+    elf.labels[elf.label_count] = SIZE_MAX;
+    return elf.label_count++;
+}
+
+static void bind_label(int label) {
+    elf.labels[label] = elf.code.count;
+}
+
+static void use_label(size_t at, int label) {
+    if (elf.use_count == elf.use_capacity) {
+        int new_capacity = elf.use_capacity == 0 ? 1024 : elf.use_capacity * 2;
+        LabelUse* grown = safe_malloc(sizeof(LabelUse) * new_capacity);
+        if (elf.uses != NULL) {
+            memcpy(grown, elf.uses, sizeof(LabelUse) * elf.use_count);
+            safe_free(elf.uses);
+        }
+        elf.uses = grown;
+        elf.use_capacity = new_capacity;
+    }
+    elf.uses[elf.use_count].at = at;
+    elf.uses[elf.use_count].label = label;
+    elf.use_count++;
+}
+
+static void jump(int label) {
+    use_label(x86_jmp(&elf.code), label);
+}
+
+static void branch(X86Condition cc, int label) {
+    use_label(x86_jcc(&elf.code, cc), label);
+}
+
+static void call(int label) {
+    use_label(x86_call(&elf.code), label);
+}
+
+// --- Data -------------------------------------------------------------------
+
+static int32_t add_data(const void* bytes, size_t size) {
+    while (elf.data.count % 8 != 0) code_byte(&elf.data, 0);
+    int32_t disp = (int32_t)(BSS_SIZE + elf.data.count);
+    for (size_t i = 0; i < size; i++) code_byte(&elf.data, ((const uint8_t*)bytes)[i]);
+    return disp;
+}
+
+// Address of a NUL-terminated copy of 'text' in the data segment (shared)
+static int32_t intern_string(const char* text) {
+    for (int i = 0; i < elf.string_count; i++) {
+        if (strcmp(elf.strings[i].text, text) == 0) return elf.strings[i].disp;
+    }
+    if (elf.string_count == elf.string_capacity) {
+        int new_capacity = elf.string_capacity == 0 ? 64 : elf.string_capacity * 2;
+        InternedString* grown = safe_malloc(sizeof(InternedString) * new_capacity);
+        if (elf.strings != NULL) {
+            memcpy(grown, elf.strings, sizeof(InternedString) * elf.string_count);
+            safe_free(elf.strings);
+        }
+        elf.strings = grown;
+        elf.string_capacity = new_capacity;
+    }
+    elf.strings[elf.string_count].text = strdup(text); // Chunk constants are freed per module
+    elf.strings[elf.string_count].disp = add_data(text, strlen(text) + 1);
+    return elf.strings[elf.string_count++].disp;
+}
+
+static uint64_t data_address(int32_t disp) {
+    return (uint64_t)DATA_VADDR + (uint64_t)disp;
+}
+
+static int32_t add_value(RuntimeValue value) {
+    uint8_t bytes[VALUE_SIZE];
+    uint64_t payload = 0;
+    memset(bytes, 0, sizeof(bytes));
+    switch (value.type) {
+        case TYPE_INT32:  payload = (uint64_t)(int64_t)value.val.int32_val; break;
+        case TYPE_BOOL:   payload = value.val.bool_val ? 1 : 0; break;
+        case TYPE_STRING: payload = data_address(intern_string(value.val.string_val)); break;
+        case TYPE_INT64:
+        case TYPE_FLOAT:  memcpy(&payload, &value.val, sizeof(payload)); break;
+        default:          break;
+    }
+    uint32_t type = (uint32_t)value.type;
+    memcpy(bytes + VALUE_TYPE, &type, sizeof(type));
+    memcpy(bytes + VALUE_DATA, &payload, sizeof(payload));
+    return add_data(bytes, sizeof(bytes));
+}
+
+static int32_t global_disp(const char* name) {
+    for (int i = 0; i < elf.global_count; i++) {
+        if (strcmp(elf.global_names[i], name) == 0) return elf.global_disps[i];
+    }
+    if (elf.global_count == elf.global_capacity) {
+        int new_capacity = elf.global_capacity == 0 ? 32 : elf.global_capacity * 2;
+        char** names = safe_malloc(sizeof(char*) * new_capacity);
+        int32_t* disps = safe_malloc(sizeof(int32_t) * new_capacity);
+        if (elf.global_names != NULL) {
+            memcpy(names, elf.global_names, sizeof(char*) * elf.global_count);
+            memcpy(disps, elf.global_disps, sizeof(int32_t) * elf.global_count);
+            safe_free(elf.global_names);
+            safe_free(elf.global_disps);
+        }
+        elf.global_names = names;
+        elf.global_disps = disps;
+        elf.global_capacity = new_capacity;
+    }
+    elf.global_names[elf.global_count] = strdup(name);
+    elf.global_disps[elf.global_count] = add_value(create_void_runtime_value()); // Undefined until assigned
+    return elf.global_disps[elf.global_count++];
+}
+
+// --- Runtime ----------------------------------------------------------------
+//
+// Runtime routines take their arguments in registers as documented on each
+// one, and may clobber rax, rcx, rdx, rsi, rdi, r8-r11 and xmm0-xmm2. rbx
+// always holds DATA_VADDR. rt_binary and rt_convert also use r12-r15, which
+// generated code never relies on.
+
+#define C (&elf.code)
+
+static void emit_load_string(X86Register reg, const char* text) {
+    x86_lea(C, reg, X86_RBX, intern_string(text));
+}
+
+// Report a fixed piece of an error message on stderr
+static void emit_error_text(const char* text) {
+    emit_load_string(X86_RSI, text);
+    call(elf.rt_err_cstr);
+}
+
+static void emit_error_int(X86Register reg) {
+    if (reg != X86_RAX) x86_mov_reg(C, X86_RAX, reg);
+    call(elf.rt_err_int);
+}
+
+// Name of the DataType in 'reg' (not rsi/rax) on stderr
+static void emit_error_type_name(X86Register reg) {
+    x86_mov_reg(C, X86_RAX, reg);
+    x86_shift_imm(C, X86_SHL, X86_RAX, 3);
+    x86_lea(C, X86_RSI, X86_RBX, elf.type_names);
+    x86_alu(C, X86_ADD, X86_RSI, X86_RAX);
+    x86_load64(C, X86_RSI, X86_RSI, 0);
+    call(elf.rt_err_cstr);
+}
+
+static void emit_return_status(int status) {
+    x86_mov_imm32(C, X86_RAX, (uint32_t)status);
+    x86_ret(C);
+}
+
+// rt_write: write(edi, rsi, rdx), retrying short writes
+static void emit_rt_write(void) {
+    int loop = new_label(), done = new_label();
+    bind_label(elf.rt_write);
+    bind_label(loop);
+    x86_alu_imm32(C, X86_CMP, X86_RDX, 0);
+    branch(X86_CC_LE, done);
+    x86_mov_imm32(C, X86_RAX, SYS_WRITE);
+    x86_syscall(C);
+    x86_alu_imm32(C, X86_CMP, X86_RAX, 0);
+    branch(X86_CC_LE, done);
+    x86_alu(C, X86_ADD, X86_RSI, X86_RAX);
+    x86_alu(C, X86_SUB, X86_RDX, X86_RAX);
+    jump(loop);
+    bind_label(done);
+    x86_ret(C);
+}
+
+// rt_flush: write out the output buffer
+static void emit_rt_flush(void) {
+    bind_label(elf.rt_flush);
+    x86_load64(C, X86_RDX, X86_RBX, BSS_OUT_LEN);
+    x86_mov_imm32(C, X86_RDI, 1);
+    x86_lea(C, X86_RSI, X86_RBX, BSS_OUT);
+    call(elf.rt_write);
+    x86_mov_imm32(C, X86_RAX, 0);
+    x86_store64(C, X86_RBX, BSS_OUT_LEN, X86_RAX);
+    x86_ret(C);
+}
+
+// rt_out: append rdx bytes at rsi to the output buffer
+static void emit_rt_out(void) {
+    int copy = new_label();
+    bind_label(elf.rt_out);
+    x86_load64(C, X86_RAX, X86_RBX, BSS_OUT_LEN);
+    x86_alu(C, X86_ADD, X86_RAX, X86_RDX);
+    x86_alu_imm32(C, X86_CMP, X86_RAX, OUT_CAPACITY);
+    branch(X86_CC_BE, copy);
+    x86_push(C, X86_RSI);
+    x86_push(C, X86_RDX);
+    call(elf.rt_flush);
+    x86_pop(C, X86_RDX);
+    x86_pop(C, X86_RSI);
+    x86_alu_imm32(C, X86_CMP, X86_RDX, OUT_CAPACITY);
+    branch(X86_CC_BE, copy);
+    x86_mov_imm32(C, X86_RDI, 1); // Too big to buffer
+    jump(elf.rt_write);
+    bind_label(copy);
+    x86_load64(C, X86_RDI, X86_RBX, BSS_OUT_LEN);
+    x86_lea(C, X86_RAX, X86_RBX, BSS_OUT);
+    x86_alu(C, X86_ADD, X86_RDI, X86_RAX);
+    x86_mov_reg(C, X86_RCX, X86_RDX);
+    x86_rep_movsb(C);
+    x86_load64(C, X86_RAX, X86_RBX, BSS_OUT_LEN);
+    x86_alu(C, X86_ADD, X86_RAX, X86_RDX);
+    x86_store64(C, X86_RBX, BSS_OUT_LEN, X86_RAX);
+    x86_ret(C);
+}
+
+// rt_err: write rdx bytes at rsi to stderr, after flushing stdout so that the
+// streams interleave as in the interpreter
+static void emit_rt_err(void) {
+    bind_label(elf.rt_err);
+    x86_push(C, X86_RSI);
+    x86_push(C, X86_RDX);
+    call(elf.rt_flush);
+    x86_pop(C, X86_RDX);
+    x86_pop(C, X86_RSI);
+    x86_mov_imm32(C, X86_RDI, 2);
+    jump(elf.rt_write);
+}
+
+// rt_strlen: rdx = length of the string at rsi; rt_out_cstr/rt_err_cstr print it
+static void emit_rt_strings(void) {
+    int loop = new_label(), done = new_label();
+    bind_label(elf.rt_strlen);
+    x86_mov_reg(C, X86_RDX, X86_RSI);
+    bind_label(loop);
+    x86_cmp8_mem_imm(C, X86_RDX, 0, 0);
+    branch(X86_CC_E, done);
+    x86_alu_imm32(C, X86_ADD, X86_RDX, 1);
+    jump(loop);
+    bind_label(done);
+    x86_alu(C, X86_SUB, X86_RDX, X86_RSI);
+    x86_ret(C);
+
+    bind_label(elf.rt_out_cstr);
+    call(elf.rt_strlen);
+    jump(elf.rt_out);
+
+    bind_label(elf.rt_err_cstr);
+    call(elf.rt_strlen);
+    jump(elf.rt_err);
+}
+
+// Number formatting. Each routine appends to the buffer at rdi and advances it.
+//   rt_append_u64:   unsigned rax in decimal
+//   rt_append_int64: signed rax in decimal
+//   rt_append_pad9:  rax < 1e9 as exactly nine digits
+//   rt_err_int:      signed rax on stderr
+static void emit_rt_numbers(void) {
+    int loop = new_label(), positive = new_label(), pad_loop = new_label();
+
+    bind_label(elf.rt_append_u64);
+    x86_lea(C, X86_RSI, X86_RBX, BSS_DIGITS + 32);
+    x86_mov_imm32(C, X86_R8, 10);
+    bind_label(loop);
+    x86_mov_imm32(C, X86_RDX, 0);
+    x86_div(C, X86_R8);
+    x86_alu_imm32(C, X86_ADD, X86_RDX, '0');
+    x86_alu_imm32(C, X86_SUB, X86_RSI, 1);
+    x86_store8(C, X86_RSI, 0, X86_RDX);
+    x86_alu_imm32(C, X86_CMP, X86_RAX, 0);
+    branch(X86_CC_NE, loop);
+    x86_lea(C, X86_RCX, X86_RBX, BSS_DIGITS + 32);
+    x86_alu(C, X86_SUB, X86_RCX, X86_RSI);
+    x86_rep_movsb(C);
+    x86_ret(C);
+
+    bind_label(elf.rt_append_int64);
+    x86_alu_imm32(C, X86_CMP, X86_RAX, 0);
+    branch(X86_CC_GE, positive);
+    x86_store8_imm(C, X86_RDI, 0, '-');
+    x86_alu_imm32(C, X86_ADD, X86_RDI, 1);
+    x86_neg(C, X86_RAX); // INT64_MIN stays 2^63 read as unsigned
+    bind_label(positive);
+    jump(elf.rt_append_u64);
+
+    bind_label(elf.rt_append_pad9);
+    x86_mov_imm32(C, X86_R8, 10);
+    x86_mov_imm32(C, X86_RCX, 9);
+    x86_lea(C, X86_RSI, X86_RDI, 9);
+    bind_label(pad_loop);
+    x86_mov_imm32(C, X86_RDX, 0);
+    x86_div(C, X86_R8);
+    x86_alu_imm32(C, X86_ADD, X86_RDX, '0');
+    x86_alu_imm32(C, X86_SUB, X86_RSI, 1);
+    x86_store8(C, X86_RSI, 0, X86_RDX);
+    x86_alu_imm32(C, X86_SUB, X86_RCX, 1);
+    branch(X86_CC_NE, pad_loop);
+    x86_alu_imm32(C, X86_ADD, X86_RDI, 9);
+    x86_ret(C);
+
+    bind_label(elf.rt_err_int);
+    x86_lea(C, X86_RDI, X86_RBX, BSS_TEXT);
+    call(elf.rt_append_int64);
+    x86_lea(C, X86_RSI, X86_RBX, BSS_TEXT);
+    x86_mov_reg(C, X86_RDX, X86_RDI);
+    x86_alu(C, X86_SUB, X86_RDX, X86_RSI);
+    jump(elf.rt_err);
+}
+
+static void emit_append_chars(const char* text) {
+    for (int i = 0; text[i] != '\0'; i++) {
+        x86_store8_imm(C, X86_RDI, i, (uint8_t)text[i]);
+    }
+    x86_alu_imm32(C, X86_ADD, X86_RDI, (int32_t)strlen(text));
+}
+
+// rt_format_float: append xmm0 as printf's "%.2f" would (exactly rounded,
+// ties to even). The double is m * 2^e; with e < 0 the value times 100 is
+// rounded with integer arithmetic, otherwise it is an integer that is
+// converted through base-1e9 limbs.
+static void emit_rt_format_float(void) {
+    int positive = new_label(), finite = new_label(), infinite = new_label(), subnormal = new_label();
+    int decomposed = new_label(), rounded = new_label(), round_up = new_label();
+    int big = new_label(), doubling = new_label(), limb = new_label(), no_carry = new_label();
+    int next_bit = new_label(), trim = new_label(), top = new_label(), rest = new_label(), fraction = new_label();
+
+    bind_label(elf.rt_format_float);
+    x86_movq_from_xmm(C, X86_RAX, X86_XMM0);
+    x86_alu_imm32(C, X86_CMP, X86_RAX, 0);
+    branch(X86_CC_GE, positive);
+    emit_append_chars("-");
+    bind_label(positive);
+    x86_mov_reg(C, X86_RDX, X86_RAX);
+    x86_shift_imm(C, X86_SHR, X86_RDX, 52);
+    x86_alu_imm32(C, X86_AND, X86_RDX, 0x7FF);
+    x86_mov_imm64(C, X86_R8, (UINT64_C(1) << 52) - 1);
+    x86_alu(C, X86_AND, X86_R8, X86_RAX);
+    x86_alu_imm32(C, X86_CMP, X86_RDX, 0x7FF);
+    branch(X86_CC_NE, finite);
+    x86_alu_imm32(C, X86_CMP, X86_R8, 0);
+    branch(X86_CC_E, infinite);
+    emit_append_chars("nan");
+    x86_ret(C);
+    bind_label(infinite);
+    emit_append_chars("inf");
+    x86_ret(C);
+
+    bind_label(finite); // r8 = m, rdx = e
+    x86_alu_imm32(C, X86_CMP, X86_RDX, 0);
+    branch(X86_CC_E, subnormal);
+    x86_mov_imm64(C, X86_RAX, UINT64_C(1) << 52);
+    x86_alu(C, X86_OR, X86_R8, X86_RAX);
+    x86_alu_imm32(C, X86_SUB, X86_RDX, 1075);
+    jump(decomposed);
+    bind_label(subnormal);
+    x86_mov_imm64(C, X86_RDX, (uint64_t)(int64_t)-1074);
+    bind_label(decomposed);
+    x86_alu_imm32(C, X86_CMP, X86_RDX, 0);
+    branch(X86_CC_GE, big);
+
+    // e < 0: q = round(m * 100 / 2^-e)
+    x86_mov_reg(C, X86_RCX, X86_RDX);
+    x86_neg(C, X86_RCX);
+    x86_mov_imm32(C, X86_RAX, 100);
+    x86_imul(C, X86_R8, X86_RAX); // m < 2^53, so m * 100 < 2^60
+    x86_mov_imm32(C, X86_RAX, 0);
+    x86_alu_imm32(C, X86_CMP, X86_RCX, 64);
+    branch(X86_CC_AE, rounded); // Below 0.005 and never a tie: rounds to zero
+    x86_mov_reg(C, X86_RAX, X86_R8);
+    x86_shift_cl(C, X86_SHR, X86_RAX);
+    x86_mov_imm32(C, X86_R9, 1); // r9 = remainder
+    x86_shift_cl(C, X86_SHL, X86_R9);
+    x86_alu_imm32(C, X86_SUB, X86_R9, 1);
+    x86_alu(C, X86_AND, X86_R9, X86_R8);
+    x86_mov_imm32(C, X86_R10, 1); // r10 = half
+    x86_alu_imm32(C, X86_SUB, X86_RCX, 1);
+    x86_shift_cl(C, X86_SHL, X86_R10);
+    x86_alu(C, X86_CMP, X86_R9, X86_R10);
+    branch(X86_CC_B, rounded);
+    branch(X86_CC_A, round_up);
+    x86_mov_reg(C, X86_R11, X86_RAX);
+    x86_alu_imm32(C, X86_AND, X86_R11, 1);
+    branch(X86_CC_E, rounded);
+    bind_label(round_up);
+    x86_alu_imm32(C, X86_ADD, X86_RAX, 1);
+    bind_label(rounded);
+    x86_mov_imm32(C, X86_R8, 100);
+    x86_mov_imm32(C, X86_RDX, 0);
+    x86_div(C, X86_R8);
+    x86_push(C, X86_RDX);
+    call(elf.rt_append_u64);
+    x86_pop(C, X86_RAX);
+    emit_append_chars(".");
+    x86_mov_imm32(C, X86_R8, 10);
+    x86_mov_imm32(C, X86_RDX, 0);
+    x86_div(C, X86_R8);
+    x86_alu_imm32(C, X86_ADD, X86_RAX, '0');
+    x86_store8(C, X86_RDI, 0, X86_RAX);
+    x86_alu_imm32(C, X86_ADD, X86_RDX, '0');
+    x86_store8(C, X86_RDI, 1, X86_RDX);
+    x86_alu_imm32(C, X86_ADD, X86_RDI, 2);
+    x86_ret(C);
+
+    // e >= 0: m * 2^e in base-1e9 limbs (r9 = limb count, r10 = 1e9, r11 = e)
+    bind_label(big);
+    x86_mov_reg(C, X86_R11, X86_RDX);
+    x86_mov_imm32(C, X86_R10, 1000000000);
+    x86_mov_reg(C, X86_RAX, X86_R8);
+    x86_mov_imm32(C, X86_RDX, 0);
+    x86_div(C, X86_R10);
+    x86_store64(C, X86_RBX, BSS_LIMBS, X86_RDX);
+    x86_store64(C, X86_RBX, BSS_LIMBS + 8, X86_RAX);
+    x86_mov_imm32(C, X86_R9, 2);
+    bind_label(doubling);
+    x86_alu_imm32(C, X86_CMP, X86_R11, 0);
+    branch(X86_CC_E, trim);
+    x86_lea(C, X86_RSI, X86_RBX, BSS_LIMBS);
+    x86_mov_reg(C, X86_RCX, X86_R9);
+    x86_mov_imm32(C, X86_R8, 0); // Carry
+    bind_label(limb);
+    x86_load64(C, X86_RAX, X86_RSI, 0);
+    x86_alu(C, X86_ADD, X86_RAX, X86_RAX);
+    x86_alu(C, X86_ADD, X86_RAX, X86_R8);
+    x86_mov_imm32(C, X86_R8, 0);
+    x86_alu(C, X86_CMP, X86_RAX, X86_R10);
+    branch(X86_CC_B, no_carry);
+    x86_alu(C, X86_SUB, X86_RAX, X86_R10);
+    x86_mov_imm32(C, X86_R8, 1);
+    bind_label(no_carry);
+    x86_store64(C, X86_RSI, 0, X86_RAX);
+    x86_alu_imm32(C, X86_ADD, X86_RSI, 8);
+    x86_alu_imm32(C, X86_SUB, X86_RCX, 1);
+    branch(X86_CC_NE, limb);
+    x86_alu_imm32(C, X86_CMP, X86_R8, 0);
+    branch(X86_CC_E, next_bit);
+    x86_store64(C, X86_RSI, 0, X86_R8);
+    x86_alu_imm32(C, X86_ADD, X86_R9, 1);
+    bind_label(next_bit);
+    x86_alu_imm32(C, X86_SUB, X86_R11, 1);
+    jump(doubling);
+
+    bind_label(trim); // Drop leading zero limbs
+    x86_alu_imm32(C, X86_CMP, X86_R9, 1);
+    branch(X86_CC_BE, top);
+    x86_mov_reg(C, X86_RAX, X86_R9);
+    x86_shift_imm(C, X86_SHL, X86_RAX, 3);
+    x86_lea(C, X86_RSI, X86_RBX, BSS_LIMBS - 8);
+    x86_alu(C, X86_ADD, X86_RSI, X86_RAX);
+    x86_load64(C, X86_RAX, X86_RSI, 0);
+    x86_alu_imm32(C, X86_CMP, X86_RAX, 0);
+    branch(X86_CC_NE, top);
+    x86_alu_imm32(C, X86_SUB, X86_R9, 1);
+    jump(trim);
+    bind_label(top);
+    x86_mov_reg(C, X86_R11, X86_R9);
+    x86_alu_imm32(C, X86_SUB, X86_R11, 1);
+    x86_mov_reg(C, X86_RAX, X86_R11);
+    x86_shift_imm(C, X86_SHL, X86_RAX, 3);
+    x86_lea(C, X86_RSI, X86_RBX, BSS_LIMBS);
+    x86_alu(C, X86_ADD, X86_RSI, X86_RAX);
+    x86_load64(C, X86_RAX, X86_RSI, 0);
+    call(elf.rt_append_u64);
+    bind_label(rest);
+    x86_alu_imm32(C, X86_CMP, X86_R11, 0);
+    branch(X86_CC_E, fraction);
+    x86_alu_imm32(C, X86_SUB, X86_R11, 1);
+    x86_mov_reg(C, X86_RAX, X86_R11);
+    x86_shift_imm(C, X86_SHL, X86_RAX, 3);
+    x86_lea(C, X86_RSI, X86_RBX, BSS_LIMBS);
+    x86_alu(C, X86_ADD, X86_RSI, X86_RAX);
+    x86_load64(C, X86_RAX, X86_RSI, 0);
+    call(elf.rt_append_pad9);
+    jump(rest);
+    bind_label(fraction);
+    emit_append_chars(".00");
+    x86_ret(C);
+}
+
+// rt_print: print the value at rdi and a newline
+static void emit_rt_print(void) {
+    int int64 = new_label(), not_int32 = new_label(), not_bool = new_label(), is_false = new_label();
+    int not_string = new_label(), not_float = new_label(), line = new_label();
+
+    bind_label(elf.rt_print);
+    x86_load32(C, X86_RCX, X86_RDI, VALUE_TYPE);
+    x86_load64(C, X86_RAX, X86_RDI, VALUE_DATA);
+    x86_lea(C, X86_RDI, X86_RBX, BSS_TEXT);
+    x86_cmp32_imm(C, X86_RCX, TYPE_INT64);
+    branch(X86_CC_E, int64);
+    x86_cmp32_imm(C, X86_RCX, TYPE_INT32);
+    branch(X86_CC_NE, not_int32);
+    x86_movsxd(C, X86_RAX, X86_RAX);
+    bind_label(int64);
+    call(elf.rt_append_int64);
+    jump(line);
+
+    bind_label(not_int32);
+    x86_cmp32_imm(C, X86_RCX, TYPE_BOOL);
+    branch(X86_CC_NE, not_bool);
+    x86_test8(C, X86_RAX, X86_RAX);
+    branch(X86_CC_E, is_false);
+    emit_load_string(X86_RSI, "true\n");
+    x86_mov_imm32(C, X86_RDX, 5);
+    jump(elf.rt_out);
+    bind_label(is_false);
+    emit_load_string(X86_RSI, "false\n");
+    x86_mov_imm32(C, X86_RDX, 6);
+    jump(elf.rt_out);
+
+    bind_label(not_bool);
+    x86_cmp32_imm(C, X86_RCX, TYPE_STRING);
+    branch(X86_CC_NE, not_string);
+    x86_mov_reg(C, X86_RSI, X86_RAX);
+    call(elf.rt_out_cstr);
+    emit_load_string(X86_RSI, "\n");
+    x86_mov_imm32(C, X86_RDX, 1);
+    jump(elf.rt_out);
+
+    bind_label(not_string);
+    x86_cmp32_imm(C, X86_RCX, TYPE_FLOAT);
+    branch(X86_CC_NE, not_float);
+    x86_movq_to_xmm(C, X86_XMM0, X86_RAX);
+    call(elf.rt_format_float);
+    jump(line);
+
+    bind_label(not_float);
+    emit_load_string(X86_RSI, "(void)\n");
+    x86_mov_imm32(C, X86_RDX, 7);
+    jump(elf.rt_out);
+
+    bind_label(line);
+    emit_append_chars("\n");
+    x86_lea(C, X86_RSI, X86_RBX, BSS_TEXT);
+    x86_mov_reg(C, X86_RDX, X86_RDI);
+    x86_alu(C, X86_SUB, X86_RDX, X86_RSI);
+    jump(elf.rt_out);
+}
+
+static X86Condition comparison_condition(BinaryOp op) {
+    switch (op) {
+        case BINOP_GT:   return X86_CC_G;
+        case BINOP_LT:   return X86_CC_L;
+        case BINOP_EQ:   return X86_CC_E;
+        case BINOP_LTEQ: return X86_CC_LE;
+        case BINOP_GTEQ: return X86_CC_GE;
+        default:         return X86_CC_NE;
+    }
+}
+
+static X86Condition negate_condition(X86Condition cc) {
+    return (X86Condition)(cc ^ 1);
+}
+
+// Store the 0/1 in al as a bool result at [r14]
+static void emit_store_bool_result(void) {
+    x86_movzx8(C, X86_RAX, X86_RAX);
+    x86_store64(C, X86_R14, VALUE_DATA, X86_RAX);
+    x86_store32_imm(C, X86_R14, VALUE_TYPE, TYPE_BOOL);
+}
+
+// Integer operators first..last on rax and rcx, selected by the operator in
+// r15 (the last one is taken without a test). Arithmetic leaves its result in
+// rax and jumps to 'store'; comparisons store a bool and jump to 'done'.
+static void emit_int_operations(BinaryOp first, BinaryOp last, int divide_by_zero, int store, int done) {
+    for (int op = (int)first; op <= (int)last; op++) {
+        int next = new_label();
+        if (op != (int)last) {
+            x86_cmp32_imm(C, X86_R15, (uint32_t)op);
+            branch(X86_CC_NE, next);
+        }
+        switch (op) {
+            case BINOP_ADD: x86_alu(C, X86_ADD, X86_RAX, X86_RCX); jump(store); break;
+            case BINOP_SUB: x86_alu(C, X86_SUB, X86_RAX, X86_RCX); jump(store); break;
+            case BINOP_MUL: x86_imul(C, X86_RAX, X86_RCX); jump(store); break;
+            case BINOP_DIV: {
+                int divide = new_label();
+                x86_alu_imm32(C, X86_CMP, X86_RCX, 0);
+                branch(X86_CC_E, divide_by_zero);
+                x86_alu_imm32(C, X86_CMP, X86_RCX, -1);
+                branch(X86_CC_NE, divide);
+                x86_neg(C, X86_RAX); // idiv would trap on INT64_MIN / -1; negation wraps
+                jump(store);
+                bind_label(divide);
+                x86_cqo(C);
+                x86_idiv(C, X86_RCX);
+                jump(store);
+                break;
+            }
+            default:
+                x86_alu(C, X86_CMP, X86_RAX, X86_RCX);
+                x86_setcc(C, comparison_condition((BinaryOp)op), X86_RAX);
+                emit_store_bool_result();
+                jump(done);
+                break;
+        }
+        bind_label(next);
+    }
+}
+
+// Report an error made of 'before', the operator's text and 'after'
+static void emit_operator_error(const char* before, const char* after) {
+    emit_error_text(before);
+    x86_load64(C, X86_RSI, X86_RBX, BSS_OP_TEXT);
+    call(elf.rt_err_cstr);
+    emit_error_text(after);
+}
+
+// rt_binary: [rdx] = [rdi] op [rsi], with op in ecx and the operator's text in
+// r8. Returns eax = 0, or 1 after reporting an error (the destination is then
+// untouched, and it may alias an operand). Mirrors evaluate_binary_values().
+static void emit_rt_binary(void) {
+    int widen = new_label(), int32_store = new_label(), int64_store = new_label();
+    int int_divide_by_zero = new_label(), float_divide_by_zero = new_label();
+    int success = new_label(), failed = new_label(), classified = new_label();
+    int not_arithmetic = new_label(), arithmetic_floats = new_label(), arithmetic_error = new_label();
+    int not_comparison = new_label(), comparison_floats = new_label(), comparison_other = new_label();
+    int not_logical = new_label(), logical_error = new_label(), incompatible = new_label();
+
+    bind_label(elf.rt_binary);
+    x86_mov_reg(C, X86_R12, X86_RDI);
+    x86_mov_reg(C, X86_R13, X86_RSI);
+    x86_mov_reg(C, X86_R14, X86_RDX);
+    x86_mov_reg(C, X86_R15, X86_RCX);
+    x86_store64(C, X86_RBX, BSS_OP_TEXT, X86_R8);
+    x86_load32(C, X86_R9, X86_R12, VALUE_TYPE);
+    x86_load32(C, X86_R10, X86_R13, VALUE_TYPE);
+
+    // int32 with int32 stays int32: compute in 64 bits, then range check
+    x86_cmp32_imm(C, X86_R9, TYPE_INT32);
+    branch(X86_CC_NE, widen);
+    x86_cmp32_imm(C, X86_R10, TYPE_INT32);
+    branch(X86_CC_NE, widen);
+    x86_cmp32_imm(C, X86_R15, BINOP_ADD);
+    branch(X86_CC_B, widen);
+    x86_cmp32_imm(C, X86_R15, BINOP_NOTEQ);
+    branch(X86_CC_A, widen);
+    x86_load32_sx(C, X86_RAX, X86_R12, VALUE_DATA);
+    x86_load32_sx(C, X86_RCX, X86_R13, VALUE_DATA);
+    emit_int_operations(BINOP_ADD, BINOP_NOTEQ, int_divide_by_zero, int32_store, success);
+
+    bind_label(int32_store);
+    {
+        int overflow = new_label();
+        x86_movsxd(C, X86_RDX, X86_RAX);
+        x86_alu(C, X86_CMP, X86_RDX, X86_RAX);
+        branch(X86_CC_NE, overflow);
+        x86_store64(C, X86_R14, VALUE_DATA, X86_RAX);
+        x86_store32_imm(C, X86_R14, VALUE_TYPE, TYPE_INT32);
+        jump(success);
+        bind_label(overflow);
+        emit_error_text("Runtime Error: int32 overflow in ");
+        x86_load32_sx(C, X86_RAX, X86_R12, VALUE_DATA);
+        emit_error_int(X86_RAX);
+        emit_operator_error(" ", " ");
+        x86_load32_sx(C, X86_RAX, X86_R13, VALUE_DATA);
+        emit_error_int(X86_RAX);
+        emit_error_text(".\n");
+        jump(failed);
+    }
+
+    bind_label(int64_store);
+    x86_store64(C, X86_R14, VALUE_DATA, X86_RAX);
+    x86_store32_imm(C, X86_R14, VALUE_TYPE, TYPE_INT64);
+    jump(success);
+
+    // Widen int32 to int64: r9/r10 = widened types, rax/rcx = integer payloads
+    bind_label(widen);
+    for (int side = 0; side < 2; side++) {
+        X86Register type = side == 0 ? X86_R9 : X86_R10;
+        X86Register payload = side == 0 ? X86_RAX : X86_RCX;
+        int wide = new_label();
+        x86_load64(C, payload, side == 0 ? X86_R12 : X86_R13, VALUE_DATA);
+        x86_cmp32_imm(C, type, TYPE_INT32);
+        branch(X86_CC_NE, wide);
+        x86_movsxd(C, payload, payload);
+        x86_mov_imm32(C, type, TYPE_INT64);
+        bind_label(wide);
+    }
+
+    // r11 = 0: both int64; 1: numbers, at least one float (in xmm0/xmm1); 2: anything else
+    {
+        int not_ints = new_label();
+        x86_mov_imm32(C, X86_R11, 0);
+        x86_cmp32_imm(C, X86_R9, TYPE_INT64);
+        branch(X86_CC_NE, not_ints);
+        x86_cmp32_imm(C, X86_R10, TYPE_INT64);
+        branch(X86_CC_E, classified);
+        bind_label(not_ints);
+        x86_mov_imm32(C, X86_R11, 2);
+        for (int side = 0; side < 2; side++) {
+            X86Register type = side == 0 ? X86_R9 : X86_R10;
+            int number = new_label();
+            x86_cmp32_imm(C, type, TYPE_INT64);
+            branch(X86_CC_E, number);
+            x86_cmp32_imm(C, type, TYPE_FLOAT);
+            branch(X86_CC_NE, classified);
+            bind_label(number);
+        }
+        x86_mov_imm32(C, X86_R11, 1);
+        for (int side = 0; side < 2; side++) {
+            X86Register type = side == 0 ? X86_R9 : X86_R10;
+            X86Register payload = side == 0 ? X86_RAX : X86_RCX;
+            X86XmmRegister xmm = side == 0 ? X86_XMM0 : X86_XMM1;
+            int is_float = new_label(), converted = new_label();
+            x86_cmp32_imm(C, type, TYPE_FLOAT);
+            branch(X86_CC_E, is_float);
+            x86_cvtsi2sd(C, xmm, payload);
+            jump(converted);
+            bind_label(is_float);
+            x86_movq_to_xmm(C, xmm, payload);
+            bind_label(converted);
+        }
+    }
+    bind_label(classified);
+
+    // Arithmetic
+    x86_cmp32_imm(C, X86_R15, BINOP_ADD);
+    branch(X86_CC_B, not_arithmetic);
+    x86_cmp32_imm(C, X86_R15, BINOP_DIV);
+    branch(X86_CC_A, not_arithmetic);
+    x86_cmp32_imm(C, X86_R11, 1);
+    branch(X86_CC_E, arithmetic_floats);
+    branch(X86_CC_A, arithmetic_error);
+    emit_int_operations(BINOP_ADD, BINOP_DIV, int_divide_by_zero, int64_store, success);
+    bind_label(arithmetic_floats);
+    for (int op = BINOP_ADD; op <= BINOP_DIV; op++) {
+        static const X86SseOp sse_ops[] = {
+            [BINOP_ADD] = X86_ADDSD, [BINOP_SUB] = X86_SUBSD, [BINOP_MUL] = X86_MULSD, [BINOP_DIV] = X86_DIVSD,
+        };
+        int next = new_label();
+        if (op != BINOP_DIV) {
+            x86_cmp32_imm(C, X86_R15, (uint32_t)op);
+            branch(X86_CC_NE, next);
+        } else {
+            int nonzero = new_label();
+            x86_xorpd(C, X86_XMM2, X86_XMM2);
+            x86_ucomisd(C, X86_XMM1, X86_XMM2);
+            branch(X86_CC_P, nonzero); // NaN is not zero
+            branch(X86_CC_E, float_divide_by_zero);
+            bind_label(nonzero);
+        }
+        x86_sse_arith(C, sse_ops[op], X86_XMM0, X86_XMM1);
+        x86_movsd_store(C, X86_R14, VALUE_DATA, X86_XMM0);
+        x86_store32_imm(C, X86_R14, VALUE_TYPE, TYPE_FLOAT);
+        jump(success);
+        bind_label(next);
+    }
+    bind_label(arithmetic_error);
+    emit_operator_error("Error: Type error: Operands for arithmetic operator '", "' must be numbers.\n");
+    jump(failed);
+
+    // Comparisons
+    bind_label(not_arithmetic);
+    x86_cmp32_imm(C, X86_R15, BINOP_NOTEQ);
+    branch(X86_CC_A, not_comparison);
+    x86_cmp32_imm(C, X86_R11, 1);
+    branch(X86_CC_E, comparison_floats);
+    branch(X86_CC_A, comparison_other);
+    emit_int_operations(BINOP_GT, BINOP_NOTEQ, int_divide_by_zero, int64_store, success);
+    bind_label(comparison_floats);
+    for (int op = BINOP_GT; op <= BINOP_NOTEQ; op++) {
+        int next = new_label();
+        if (op != BINOP_NOTEQ) {
+            x86_cmp32_imm(C, X86_R15, (uint32_t)op);
+            branch(X86_CC_NE, next);
+        }
+        // Unordered operands compare false, except for !=
+        switch (op) {
+            case BINOP_GT:   x86_ucomisd(C, X86_XMM0, X86_XMM1); x86_setcc(C, X86_CC_A, X86_RAX); break;
+            case BINOP_GTEQ: x86_ucomisd(C, X86_XMM0, X86_XMM1); x86_setcc(C, X86_CC_AE, X86_RAX); break;
+            case BINOP_LT:   x86_ucomisd(C, X86_XMM1, X86_XMM0); x86_setcc(C, X86_CC_A, X86_RAX); break;
+            case BINOP_LTEQ: x86_ucomisd(C, X86_XMM1, X86_XMM0); x86_setcc(C, X86_CC_AE, X86_RAX); break;
+            case BINOP_EQ:
+                x86_ucomisd(C, X86_XMM0, X86_XMM1);
+                x86_setcc(C, X86_CC_E, X86_RAX);
+                x86_setcc(C, X86_CC_NP, X86_RCX);
+                x86_alu(C, X86_AND, X86_RAX, X86_RCX);
+                break;
+            default:
+                x86_ucomisd(C, X86_XMM0, X86_XMM1);
+                x86_setcc(C, X86_CC_NE, X86_RAX);
+                x86_setcc(C, X86_CC_P, X86_RCX);
+                x86_alu(C, X86_OR, X86_RAX, X86_RCX);
+                break;
+        }
+        emit_store_bool_result();
+        jump(success);
+        bind_label(next);
+    }
+    bind_label(comparison_other); // Only strings remain, and only for == and !=
+    {
+        int equality = new_label(), loop = new_label(), differ = new_label(), same = new_label();
+        x86_cmp32_imm(C, X86_R9, TYPE_STRING);
+        branch(X86_CC_NE, incompatible);
+        x86_cmp32_imm(C, X86_R10, TYPE_STRING);
+        branch(X86_CC_NE, incompatible);
+        x86_cmp32_imm(C, X86_R15, BINOP_EQ);
+        branch(X86_CC_E, equality);
+        x86_cmp32_imm(C, X86_R15, BINOP_NOTEQ);
+        branch(X86_CC_NE, incompatible);
+        bind_label(equality);
+        x86_load64(C, X86_RSI, X86_R12, VALUE_DATA);
+        x86_load64(C, X86_RDI, X86_R13, VALUE_DATA);
+        bind_label(loop);
+        x86_load8_zx(C, X86_RAX, X86_RSI, 0);
+        x86_load8_zx(C, X86_RCX, X86_RDI, 0);
+        x86_alu(C, X86_CMP, X86_RAX, X86_RCX);
+        branch(X86_CC_NE, differ);
+        x86_alu_imm32(C, X86_CMP, X86_RAX, 0);
+        branch(X86_CC_E, same);
+        x86_alu_imm32(C, X86_ADD, X86_RSI, 1);
+        x86_alu_imm32(C, X86_ADD, X86_RDI, 1);
+        jump(loop);
+        bind_label(same);
+        x86_cmp32_imm(C, X86_R15, BINOP_EQ);
+        x86_setcc(C, X86_CC_E, X86_RAX);
+        emit_store_bool_result();
+        jump(success);
+        bind_label(differ);
+        x86_cmp32_imm(C, X86_R15, BINOP_NOTEQ);
+        x86_setcc(C, X86_CC_E, X86_RAX);
+        emit_store_bool_result();
+        jump(success);
+    }
+    bind_label(incompatible);
+    emit_operator_error("Error: Type error: Operands for comparison operator '", "' are incompatible (");
+    emit_error_int(X86_R9);
+    emit_error_text(", ");
+    emit_error_int(X86_R10);
+    emit_error_text(").\n");
+    jump(failed);
+
+    // Logical operators, on the operands' own types
+    bind_label(not_comparison);
+    x86_cmp32_imm(C, X86_R15, BINOP_OR);
+    branch(X86_CC_A, not_logical);
+    x86_cmp32_mem_imm(C, X86_R12, VALUE_TYPE, TYPE_BOOL);
+    branch(X86_CC_NE, logical_error);
+    x86_cmp32_mem_imm(C, X86_R13, VALUE_TYPE, TYPE_BOOL);
+    branch(X86_CC_NE, logical_error);
+    x86_load8_zx(C, X86_RAX, X86_R12, VALUE_DATA);
+    x86_load8_zx(C, X86_RCX, X86_R13, VALUE_DATA);
+    {
+        int is_or = new_label();
+        x86_cmp32_imm(C, X86_R15, BINOP_OR);
+        branch(X86_CC_E, is_or);
+        x86_alu(C, X86_AND, X86_RAX, X86_RCX);
+        emit_store_bool_result();
+        jump(success);
+        bind_label(is_or);
+        x86_alu(C, X86_OR, X86_RAX, X86_RCX);
+        emit_store_bool_result();
+        jump(success);
+    }
+    bind_label(logical_error);
+    emit_operator_error("Error: Type error: Operands for logical operator '", "' must be booleans.\n");
+    jump(failed);
+
+    bind_label(not_logical);
+    emit_operator_error("Error: Operator '", "' not defined for operand types ");
+    x86_load32(C, X86_RAX, X86_R12, VALUE_TYPE);
+    emit_error_int(X86_RAX);
+    emit_error_text(" and ");
+    x86_load32(C, X86_RAX, X86_R13, VALUE_TYPE);
+    emit_error_int(X86_RAX);
+    emit_error_text("\n");
+    jump(failed);
+
+    bind_label(int_divide_by_zero);
+    emit_error_text("Error: Division by zero (integer)\n");
+    jump(failed);
+    bind_label(float_divide_by_zero);
+    emit_error_text("Error: Division by zero (float)\n");
+
+    bind_label(failed);
+    emit_return_status(1);
+    bind_label(success);
+    emit_return_status(0);
+}
+
+// rt_convert: convert the value at rdi in place to the declared type in esi,
+// for the variable named by rdx. Returns eax = 0, or 1 after reporting an
+// error. Mirrors convert_let_value().
+static void emit_rt_convert(void) {
+    int done = new_label(), not_float = new_label(), int64_source = new_label(), to_float = new_label();
+    int not_int64 = new_label(), mismatch = new_label(), overflow = new_label(), failed = new_label();
+
+    bind_label(elf.rt_convert);
+    x86_mov_reg(C, X86_R12, X86_RDI);
+    x86_mov_reg(C, X86_R13, X86_RSI);
+    x86_mov_reg(C, X86_R14, X86_RDX);
+    x86_load32(C, X86_R15, X86_R12, VALUE_TYPE);
+    x86_alu(C, X86_CMP, X86_R15, X86_R13);
+    branch(X86_CC_E, done);
+
+    // int32/int64 -> float
+    x86_cmp32_imm(C, X86_R13, TYPE_FLOAT);
+    branch(X86_CC_NE, not_float);
+    x86_load64(C, X86_RAX, X86_R12, VALUE_DATA);
+    x86_cmp32_imm(C, X86_R15, TYPE_INT64);
+    branch(X86_CC_E, to_float);
+    x86_cmp32_imm(C, X86_R15, TYPE_INT32);
+    branch(X86_CC_NE, mismatch);
+    x86_movsxd(C, X86_RAX, X86_RAX);
+    bind_label(to_float);
+    x86_cvtsi2sd(C, X86_XMM0, X86_RAX);
+    x86_movsd_store(C, X86_R12, VALUE_DATA, X86_XMM0);
+    x86_store32_imm(C, X86_R12, VALUE_TYPE, TYPE_FLOAT);
+    jump(done);
+
+    // int32 -> int64
+    bind_label(not_float);
+    x86_cmp32_imm(C, X86_R13, TYPE_INT64);
+    branch(X86_CC_NE, not_int64);
+    x86_cmp32_imm(C, X86_R15, TYPE_INT32);
+    branch(X86_CC_NE, mismatch);
+    x86_load32_sx(C, X86_RAX, X86_R12, VALUE_DATA);
+    x86_store64(C, X86_R12, VALUE_DATA, X86_RAX);
+    x86_store32_imm(C, X86_R12, VALUE_TYPE, TYPE_INT64);
+    jump(done);
+
+    // int64 -> int32, if it fits
+    bind_label(not_int64);
+    x86_cmp32_imm(C, X86_R13, TYPE_INT32);
+    branch(X86_CC_NE, mismatch);
+    x86_cmp32_imm(C, X86_R15, TYPE_INT64);
+    branch(X86_CC_NE, mismatch);
+    bind_label(int64_source);
+    x86_load64(C, X86_RAX, X86_R12, VALUE_DATA);
+    x86_movsxd(C, X86_RCX, X86_RAX);
+    x86_alu(C, X86_CMP, X86_RCX, X86_RAX);
+    branch(X86_CC_NE, overflow);
+    x86_store32_imm(C, X86_R12, VALUE_TYPE, TYPE_INT32);
+    jump(done);
+
+    bind_label(overflow);
+    emit_error_text("Runtime Error: Value ");
+    x86_load64(C, X86_RAX, X86_R12, VALUE_DATA);
+    emit_error_int(X86_RAX);
+    emit_error_text(" for variable '");
+    x86_mov_reg(C, X86_RSI, X86_R14);
+    call(elf.rt_err_cstr);
+    emit_error_text("' overflows declared type int32.\n");
+    jump(failed);
+
+    bind_label(mismatch);
+    emit_error_text("Runtime Error: Cannot assign expression of type ");
+    emit_error_type_name(X86_R15);
+    emit_error_text(" to variable '");
+    x86_mov_reg(C, X86_RSI, X86_R14);
+    call(elf.rt_err_cstr);
+    emit_error_text("' of declared type ");
+    emit_error_type_name(X86_R13);
+    emit_error_text(".\n");
+
+    bind_label(failed);
+    emit_return_status(1);
+    bind_label(done);
+    emit_return_status(0);
+}
+
+static void emit_runtime(void) {
+    int* routines[] = {
+        &elf.rt_write, &elf.rt_flush, &elf.rt_out, &elf.rt_err, &elf.rt_strlen, &elf.rt_out_cstr,
+        &elf.rt_err_cstr, &elf.rt_err_int, &elf.rt_append_u64, &elf.rt_append_int64, &elf.rt_append_pad9,
+        &elf.rt_format_float, &elf.rt_print, &elf.rt_binary, &elf.rt_convert,
+    };
+    for (size_t i = 0; i < sizeof(routines) / sizeof(routines[0]); i++) {
+        *routines[i] = new_label();
+    }
+    emit_rt_write();
+    emit_rt_flush();
+    emit_rt_out();
+    emit_rt_err();
+    emit_rt_strings();
+    emit_rt_numbers();
+    emit_rt_format_float();
+    emit_rt_print();
+    emit_rt_binary();
+    emit_rt_convert();
+}
+
+#undef C
+
+// --- Program code -----------------------------------------------------------
+
+typedef struct {
+    const Chunk* chunk;
+    int32_t* registers; // Value displacement of each register
+    int32_t* constants; // Value displacement of each constant
+    int* pc_labels;
+    int done;
+} ModuleCode;
+
+static int32_t operand_disp(const ModuleCode* module, int operand) {
+    if (RK_IS_CONSTANT(operand)) return module->constants[RK_CONSTANT_INDEX(operand)];
+    return module->registers[operand];
+}
+
+static const RuntimeValue* constant_operand(const ModuleCode* module, int operand) {
+    return RK_IS_CONSTANT(operand) ? &module->chunk->constants[RK_CONSTANT_INDEX(operand)] : NULL;
+}
+
+// Variable slots hold TYPE_VOID until assigned; temporaries are always written first
+static void emit_defined_check(const ModuleCode* module, int operand) {
+    if (RK_IS_CONSTANT(operand) || operand >= module->chunk->slot_count) return;
+    char message[512];
+    int defined = new_label();
+    snprintf(message, sizeof(message), "Error: Undefined variable '%s'\n", module->chunk->slot_names[operand]);
+    x86_cmp32_mem_imm(&elf.code, X86_RBX, module->registers[operand] + VALUE_TYPE, TYPE_VOID);
+    branch(X86_CC_NE, defined);
+    x86_lea(&elf.code, X86_RSI, X86_RBX, intern_string(message));
+    call(elf.rt_err_cstr);
+    jump(module->done);
+    bind_label(defined);
+}
+
+static void emit_copy_value(int32_t dst, int32_t src) {
+    x86_load64(&elf.code, X86_RAX, X86_RBX, src);
+    x86_store64(&elf.code, X86_RBX, dst, X86_RAX);
+    x86_load64(&elf.code, X86_RAX, X86_RBX, src + 8);
+    x86_store64(&elf.code, X86_RBX, dst + 8, X86_RAX);
+}
+
+// Convert the value in the scratch slot to the declared type of slot a and store it there
+static void emit_convert_store(const ModuleCode* module, const Instruction* instr) {
+    x86_lea(&elf.code, X86_RDI, X86_RBX, BSS_SCRATCH);
+    x86_mov_imm32(&elf.code, X86_RSI, instr->type);
+    x86_lea(&elf.code, X86_RDX, X86_RBX, intern_string(module->chunk->slot_names[instr->a]));
+    call(elf.rt_convert);
+    x86_alu_imm32(&elf.code, X86_CMP, X86_RAX, 0);
+    branch(X86_CC_NE, module->done);
+    emit_copy_value(module->registers[instr->a], BSS_SCRATCH);
+}
+
+// Generic binary operation into the value at 'dest'; on error the module stops
+static void emit_binary_call(const ModuleCode* module, BinaryOp op, int left, int right, int32_t dest) {
+    x86_lea(&elf.code, X86_RDI, X86_RBX, operand_disp(module, left));
+    x86_lea(&elf.code, X86_RSI, X86_RBX, operand_disp(module, right));
+    x86_lea(&elf.code, X86_RDX, X86_RBX, dest);
+    x86_mov_imm32(&elf.code, X86_RCX, op);
+    x86_lea(&elf.code, X86_R8, X86_RBX, intern_string(binary_op_text(op)));
+    call(elf.rt_binary);
+    x86_alu_imm32(&elf.code, X86_CMP, X86_RAX, 0);
+    branch(X86_CC_NE, module->done);
+}
+
+static bool is_int64_fast_op(BinaryOp op) {
+    return (op >= BINOP_ADD && op <= BINOP_DIV) || (op >= BINOP_GT && op <= BINOP_NOTEQ);
+}
+
+static bool is_comparison(BinaryOp op) {
+    return op >= BINOP_GT && op <= BINOP_NOTEQ;
+}
+
+// The int64 fast path applies unless a constant operand is known not to be int64
+static bool int64_operands_possible(const ModuleCode* module, int left, int right) {
+    const RuntimeValue* l = constant_operand(module, left);
+    const RuntimeValue* r = constant_operand(module, right);
+    return (l == NULL || l->type == TYPE_INT64) && (r == NULL || r->type == TYPE_INT64);
+}
+
+// Guard both operands to be int64 and load them into rax and rcx
+static void emit_int64_operands(const ModuleCode* module, int left, int right, int slow) {
+    for (int side = 0; side < 2; side++) {
+        int operand = side == 0 ? left : right;
+        X86Register reg = side == 0 ? X86_RAX : X86_RCX;
+        const RuntimeValue* constant = constant_operand(module, operand);
+        if (constant != NULL) {
+            x86_mov_imm64(&elf.code, reg, (uint64_t)constant->val.int64_val);
+        } else {
+            x86_cmp32_mem_imm(&elf.code, X86_RBX, module->registers[operand] + VALUE_TYPE, TYPE_INT64);
+            branch(X86_CC_NE, slow);
+            x86_load64(&elf.code, reg, X86_RBX, module->registers[operand] + VALUE_DATA);
+        }
+    }
+}
+
+static void emit_binary(const ModuleCode* module, const Instruction* instr) {
+    BinaryOp op = (BinaryOp)instr->binop;
+    DataType result_type = is_comparison(op) ? TYPE_BOOL : TYPE_INT64;
+    int32_t dest = module->registers[instr->a];
+
+    emit_defined_check(module, instr->b);
+    emit_defined_check(module, instr->c);
+
+    int slow = new_label(), next = new_label();
+    bool fast = is_int64_fast_op(op) && int64_operands_possible(module, instr->b, instr->c) &&
+                (instr->type == TYPE_VOID || instr->type == result_type);
+    if (fast) {
+        emit_int64_operands(module, instr->b, instr->c, slow);
+        switch (op) {
+            case BINOP_ADD: x86_alu(&elf.code, X86_ADD, X86_RAX, X86_RCX); break;
+            case BINOP_SUB: x86_alu(&elf.code, X86_SUB, X86_RAX, X86_RCX); break;
+            case BINOP_MUL: x86_imul(&elf.code, X86_RAX, X86_RCX); break;
+            case BINOP_DIV:
+                // Zero and -1 divisors (errors, INT64_MIN / -1) take the slow path
+                x86_lea(&elf.code, X86_RDX, X86_RCX, 1);
+                x86_alu_imm32(&elf.code, X86_CMP, X86_RDX, 1);
+                branch(X86_CC_BE, slow);
+                x86_cqo(&elf.code);
+                x86_idiv(&elf.code, X86_RCX);
+                break;
+            default:
+                x86_alu(&elf.code, X86_CMP, X86_RAX, X86_RCX);
+                x86_setcc(&elf.code, comparison_condition(op), X86_RAX);
+                x86_movzx8(&elf.code, X86_RAX, X86_RAX);
+                break;
+        }
+        x86_store64(&elf.code, X86_RBX, dest + VALUE_DATA, X86_RAX);
+        x86_store32_imm(&elf.code, X86_RBX, dest + VALUE_TYPE, result_type);
+        jump(next);
+    }
+
+    bind_label(slow);
+    if (instr->type == TYPE_VOID) {
+        emit_binary_call(module, op, instr->b, instr->c, dest);
+    } else {
+        emit_binary_call(module, op, instr->b, instr->c, BSS_SCRATCH);
+        emit_convert_store(module, instr);
+    }
+    bind_label(next);
+}
+
+static void emit_move(const ModuleCode* module, const Instruction* instr) {
+    const RuntimeValue* constant = constant_operand(module, instr->b);
+    emit_defined_check(module, instr->b);
+    if (instr->type == TYPE_VOID || (constant != NULL && constant->type == (DataType)instr->type)) {
+        emit_copy_value(module->registers[instr->a], operand_disp(module, instr->b));
+    } else {
+        emit_copy_value(BSS_SCRATCH, operand_disp(module, instr->b));
+        emit_convert_store(module, instr);
+    }
+}
+
+static void emit_jump_unless_cmp(const ModuleCode* module, const Instruction* instr) {
+    BinaryOp op = (BinaryOp)instr->binop;
+    int target = module->pc_labels[instr->c];
+
+    emit_defined_check(module, instr->a);
+    emit_defined_check(module, instr->b);
+
+    int slow = new_label(), next = new_label();
+    if (is_comparison(op) && int64_operands_possible(module, instr->a, instr->b)) {
+        emit_int64_operands(module, instr->a, instr->b, slow);
+        x86_alu(&elf.code, X86_CMP, X86_RAX, X86_RCX);
+        branch(negate_condition(comparison_condition(op)), target);
+        jump(next);
+    }
+
+    bind_label(slow);
+    emit_binary_call(module, op, instr->a, instr->b, BSS_SCRATCH);
+    x86_cmp8_mem_imm(&elf.code, X86_RBX, BSS_SCRATCH + VALUE_DATA, 0);
+    branch(X86_CC_E, target);
+    bind_label(next);
+}
+
+static void emit_jump_if_false(const ModuleCode* module, const Instruction* instr) {
+    int32_t condition = operand_disp(module, instr->a);
+    int is_bool = new_label();
+
+    emit_defined_check(module, instr->a);
+    x86_cmp32_mem_imm(&elf.code, X86_RBX, condition + VALUE_TYPE, TYPE_BOOL);
+    branch(X86_CC_E, is_bool);
+    x86_lea(&elf.code, X86_RSI, X86_RBX, intern_string(CONDITION_ERROR_MESSAGE(instr->c)));
+    call(elf.rt_err_cstr);
+    jump(module->done);
+    bind_label(is_bool);
+    x86_cmp8_mem_imm(&elf.code, X86_RBX, condition + VALUE_DATA, 0);
+    branch(X86_CC_E, module->pc_labels[instr->b]);
+}
+
+static void emit_instruction(const ModuleCode* module, int pc) {
+    const Instruction* instr = &module->chunk->code[pc];
+    switch (instr->op) {
+        case ROP_MOVE:
+            emit_move(module, instr);
+            break;
+        case ROP_BINARY:
+            emit_binary(module, instr);
+            break;
+        case ROP_PRINT:
+            emit_defined_check(module, instr->a);
+            x86_lea(&elf.code, X86_RDI, X86_RBX, operand_disp(module, instr->a));
+            call(elf.rt_print);
+            break;
+        case ROP_JUMP:
+            jump(module->pc_labels[instr->a]);
+            break;
+        case ROP_JUMP_IF_FALSE:
+            emit_jump_if_false(module, instr);
+            break;
+        case ROP_JUMP_UNLESS_CMP:
+            emit_jump_unless_cmp(module, instr);
+            break;
+        case ROP_FAIL:
+            x86_lea(&elf.code, X86_RSI, X86_RBX, intern_string(module->chunk->constants[instr->a].val.string_val));
+            call(elf.rt_err_cstr);
+            jump(module->done);
+            break;
+        case ROP_HALT:
+            jump(module->done);
+            break;
+        default:
+            error("ELF: unknown register opcode %d.", instr->op);
+    }
+}
+
+static void elf_start(void) {
+    memset(&elf, 0, sizeof(elf));
+    code_init(&elf.code);
+    code_init(&elf.data);
+
+    uint64_t type_names[TYPE_ERROR + 1];
+    for (int type = TYPE_INT; type <= TYPE_ERROR; type++) {
+        type_names[type] = data_address(intern_string(get_type_name((DataType)type)));
+    }
+    elf.type_names = add_data(type_names, sizeof(type_names));
+
+    emit_runtime();
+
+    // Program entry: the modules follow in order, then elf_finish adds the exit
+    elf.entry = elf.code.count;
+    x86_mov_imm32(&elf.code, X86_RBX, DATA_VADDR);
+    elf_started = true;
+}
+
+// Compile one module's code block into the executable being built. Modules
+// must be added in the order they would run.
+void elf_add_module(ASTNode* program_node) {
+    if (!elf_started) elf_start();
+    Chunk* chunk = compile_register_chunk(program_node);
+    optimize_chunk(chunk, false);
+
+    ModuleCode module;
+    module.chunk = chunk;
+    module.registers = safe_malloc(sizeof(int32_t) * (chunk->register_count + 1));
+    module.constants = safe_malloc(sizeof(int32_t) * (chunk->constant_count + 1));
+    module.pc_labels = safe_malloc(sizeof(int) * (chunk->count + 1));
+    for (int i = 0; i < chunk->slot_count; i++) {
+        module.registers[i] = global_disp(chunk->slot_names[i]);
+    }
+    for (int i = chunk->slot_count; i < chunk->register_count; i++) {
+        module.registers[i] = add_value(create_void_runtime_value());
+    }
+    for (int i = 0; i < chunk->constant_count; i++) {
+        module.constants[i] = add_value(chunk->constants[i]);
+    }
+    for (int pc = 0; pc < chunk->count; pc++) {
+        module.pc_labels[pc] = new_label();
+    }
+    module.done = new_label();
+    module.pc_labels[chunk->count] = module.done;
+
+    for (int pc = 0; pc < chunk->count; pc++) {
+        bind_label(module.pc_labels[pc]);
+        emit_instruction(&module, pc);
+    }
+    bind_label(module.done); // A runtime error ends up here too; the next module still runs
+
+    LOG_DEBUG("ELF: module %d compiled from %d register instructions.", elf.module_count, chunk->count);
+    elf.module_count++;
+    safe_free(module.registers);
+    safe_free(module.constants);
+    safe_free(module.pc_labels);
+    free_chunk(chunk);
+}
+
+// --- Executable file --------------------------------------------------------
+
+static void code_u16(CodeBuffer* code, uint16_t value) {
+    code_byte(code, (uint8_t)value);
+    code_byte(code, (uint8_t)(value >> 8));
+}
+
+static void write_program_header(CodeBuffer* out, uint32_t flags, uint64_t offset, uint64_t vaddr,
+                                 uint64_t file_size, uint64_t memory_size) {
+    code_u32(out, 1); // PT_LOAD
+    code_u32(out, flags);
+    code_u64(out, offset);
+    code_u64(out, vaddr);
+    code_u64(out, vaddr);
+    code_u64(out, file_size);
+    code_u64(out, memory_size);
+    code_u64(out, PAGE_SIZE);
+}
+
+// Build the headers for the current code and data
+static void write_headers(CodeBuffer* out, uint64_t data_offset) {
+    static const uint8_t ident[16] = { 0x7F, 'E', 'L', 'F', 2, 1, 1, 0 }; // 64-bit, little endian, SysV
+    for (int i = 0; i < 16; i++) code_byte(out, ident[i]);
+    code_u16(out, 2);  // ET_EXEC
+    code_u16(out, 62); // EM_X86_64
+    code_u32(out, 1);  // EV_CURRENT
+    code_u64(out, TEXT_VADDR + HEADER_SIZE + elf.entry);
+    code_u64(out, 64); // Program headers follow the ELF header
+    code_u64(out, 0);  // No section headers
+    code_u32(out, 0);
+    code_u16(out, 64);
+    code_u16(out, 56);
+    code_u16(out, 3);
+    code_u16(out, 64);
+    code_u16(out, 0);
+    code_u16(out, 0);
+
+    write_program_header(out, 5 /* R+X */, 0, TEXT_VADDR, HEADER_SIZE + elf.code.count, HEADER_SIZE + elf.code.count);
+    write_program_header(out, 6 /* R+W */, 0, DATA_VADDR, 0, BSS_SIZE);
+    write_program_header(out, 6 /* R+W */, data_offset, DATA_VADDR + BSS_SIZE, elf.data.count, elf.data.count);
+}
+
+static void elf_reset(void) {
+    code_free(&elf.code);
+    code_free(&elf.data);
+    for (int i = 0; i < elf.string_count; i++) {
+        free(elf.strings[i].text);
+    }
+    for (int i = 0; i < elf.global_count; i++) {
+        free(elf.global_names[i]);
+    }
+    safe_free(elf.labels);
+    safe_free(elf.uses);
+    safe_free(elf.strings);
+    safe_free(elf.global_names);
+    safe_free(elf.global_disps);
+    memset(&elf, 0, sizeof(elf));
+    elf_started = false;
+}
+
+// Finish the program built by elf_add_module and write it to 'output_path'
+// as a static executable. Returns the process exit status.
+int elf_finish(const char* output_path) {
+    if (!elf_started) elf_start();
+
+    call(elf.rt_flush);
+    x86_mov_imm32(&elf.code, X86_RDI, 0);
+    x86_mov_imm32(&elf.code, X86_RAX, SYS_EXIT_GROUP);
+    x86_syscall(&elf.code);
+
+    for (int i = 0; i < elf.use_count; i++) {
+        x86_patch_jump(&elf.code, elf.uses[i].at, elf.labels[elf.uses[i].label]);
+    }
+
+    uint64_t data_offset = (HEADER_SIZE + elf.code.count + PAGE_SIZE - 1) / PAGE_SIZE * PAGE_SIZE;
+    CodeBuffer headers;
+    code_init(&headers);
+    write_headers(&headers, data_offset);
+
+    FILE* out = fopen(output_path, "wb");
+    bool written = out != NULL;
+    if (written) {
+        written = fwrite(headers.bytes, 1, headers.count, out) == headers.count &&
+                  fwrite(elf.code.bytes, 1, elf.code.count, out) == elf.code.count;
+        for (uint64_t at = HEADER_SIZE + elf.code.count; written && at < data_offset; at++) {
+            written = fputc(0, out) != EOF;
+        }
+        written = written && fwrite(elf.data.bytes, 1, elf.data.count, out) == elf.data.count;
+        written = fclose(out) == 0 && written;
+    }
+    code_free(&headers);
+    if (!written || chmod(output_path, 0755) != 0) {
+        fprintf(stderr, "Error: Could not write executable '%s'.\n", output_path);
+        elf_reset();
+        return 1;
+    }
+    LOG_DEBUG("ELF: wrote %zu bytes of code and %zu bytes of data for %d module(s) to %s.",
+              elf.code.count, elf.data.count, elf.module_count, output_path);
+    elf_reset();
+    return 0;
+}
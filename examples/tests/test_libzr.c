@@ -0,0 +1,100 @@
+// Embedding API checks (make test-libzr): statuses of zr_load, zr_run and
+// zr_preload, including failures in the modules a program loads.
+#include "zr.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+static int failures = 0;
+
+static void expect_status(const char* what, ZrStatus actual, ZrStatus expected) {
+    if (actual != expected) {
+        fprintf(stderr, "FAIL: %s: status %d, expected %d\n", what, (int)actual, (int)expected);
+        failures++;
+    }
+}
+
+static void write_file(const char* directory, const char* name, const char* source) {
+    char path[512];
+    snprintf(path, sizeof(path), "%s/%s", directory, name);
+    FILE* file = fopen(path, "w");
+    if (file == NULL) {
+        perror(path);
+        exit(1);
+    }
+    fputs(source, file);
+    fclose(file);
+}
+
+int main(void) {
+    char directory[] = "/tmp/zr_libzr_test_XXXXXX";
+    if (mkdtemp(directory) == NULL) {
+        perror("mkdtemp");
+        return 1;
+    }
+    write_file(directory, "good.zr", "let base = 40;\n");
+    write_file(directory, "failing.zr", "let z = 1 / 0;\n");
+    char name[512];
+    snprintf(name, sizeof(name), "%s/main.zr", directory);
+
+    // A program and the module it loads both run
+    ZrContext* zr = zr_create();
+    int64_t answer = 0;
+    expect_status("load with a module", zr_load(zr, name, "loadin \"good\"\nlet answer = base + 2;\n"), ZR_OK);
+    expect_status("run", zr_run(zr), ZR_OK);
+    expect_status("get", zr_get_int(zr, "answer", &answer), ZR_OK);
+    if (answer != 42) {
+        fprintf(stderr, "FAIL: answer is %lld, expected 42\n", (long long)answer);
+        failures++;
+    }
+
+    // A runtime error in a loaded module fails the load
+    zr_reset(zr);
+    expect_status("load with a failing module", zr_load(zr, name, "loadin \"failing\"\nlet after = 1;\n"), ZR_ERROR_RUNTIME);
+    if (strstr(zr_error(zr), "Division by zero") == NULL) {
+        fprintf(stderr, "FAIL: no division error reported, got \"%s\"\n", zr_error(zr));
+        failures++;
+    }
+    expect_status("run after a failed load", zr_run(zr), ZR_ERROR_NO_PROGRAM);
+
+    // ...and so does a prelude, which then marks nothing preloaded
+    zr_reset(zr);
+    expect_status("failing prelude", zr_preload(zr, name, "loadin \"failing\"\n"), ZR_ERROR_RUNTIME);
+    zr_reset(zr);
+    expect_status("prelude", zr_preload(zr, name, "loadin \"good\"\n"), ZR_OK);
+    expect_status("load after a prelude", zr_load(zr, name, "loadin \"good\"\nlet answer = base + 1;\n"), ZR_OK);
+    expect_status("run after a prelude", zr_run(zr), ZR_OK);
+    zr_destroy(zr);
+
+    // Setting one variable past the table's size fails without touching
+    // the caller's string, and existing variables can still be set
+    zr = zr_create();
+    char* value = strdup("owned by the caller");
+    for (int i = 0; i <= 100; i++) {
+        char variable[32];
+        snprintf(variable, sizeof(variable), "s%d", i);
+        expect_status(variable, zr_set_string(zr, variable, value), i < 100 ? ZR_OK : ZR_ERROR_FULL);
+    }
+    expect_status("set an existing variable in a full table", zr_set_string(zr, "s0", value), ZR_OK);
+    if (strcmp(value, "owned by the caller") != 0) {
+        fprintf(stderr, "FAIL: the caller's string changed\n");
+        failures++;
+    }
+    free(value);
+    const char* copy = NULL;
+    expect_status("get from a full table", zr_get_string(zr, "s99", &copy), ZR_OK);
+    if (copy == NULL || strcmp(copy, "owned by the caller") != 0) {
+        fprintf(stderr, "FAIL: s99 lost its value\n");
+        failures++;
+    }
+    zr_destroy(zr);
+
+    char path[512];
+    snprintf(path, sizeof(path), "%s/good.zr", directory);
+    unlink(path);
+    snprintf(path, sizeof(path), "%s/failing.zr", directory);
+    unlink(path);
+    rmdir(directory);
+    return failures == 0 ? 0 : 1;
+}
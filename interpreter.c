@@ -1,4 +1,5 @@
 #include "compiler.h"
+#include "vm.h"
 #include "debug.h" // Added for LOG_DEBUG
 #include <stdio.h>
 #include <stdlib.h>
@@ -6,13 +7,7 @@
 #include <inttypes.h> // For PRId64, PRId32
 #include <errno.h>    // For ERANGE with strtoll
 
-// Value (union) and DataType (enum) are from compiler.h
-
-// Local struct to hold runtime values (DataType + Value union)
-typedef struct {
-    DataType type;
-    Value val; // Value here is the union from compiler.h
-} RuntimeValue;
+// Value (union) and DataType (enum) are from compiler.h; RuntimeValue is from vm.h
 
 #define MAX_SYMBOLS 100
 
@@ -22,11 +17,19 @@ typedef struct {
     Value val;     // Store Value union separately
 } Symbol;
 
-static Symbol symbol_table[MAX_SYMBOLS];
-static int symbol_count = 0;
+struct SymbolTable {
+    Symbol entries[MAX_SYMBOLS];
+    int count;
+};
+
+// The CLI's variables, or those of the libzr context this thread is running
+static SymbolTable default_symbol_table;
+static __thread SymbolTable* symbol_table = &default_symbol_table;
+
+__thread FILE* program_output = NULL;
 
 // Helper function to create an error value
-static RuntimeValue create_error_runtime_value() {
+RuntimeValue create_error_runtime_value(void) {
     RuntimeValue rt_val;
     rt_val.type = TYPE_ERROR;
     rt_val.val.int_val = 0; // Default error payload
@@ -34,39 +37,39 @@ static RuntimeValue create_error_runtime_value() {
 }
 
 // Helper functions for value operations
-static RuntimeValue create_int64_runtime_value(int64_t num) {
+RuntimeValue create_int64_runtime_value(int64_t num) {
     RuntimeValue rt_val;
     rt_val.type = TYPE_INT64;
     rt_val.val.int64_val = num;
     return rt_val;
 }
 
-static RuntimeValue create_int32_runtime_value(int32_t num) {
+RuntimeValue create_int32_runtime_value(int32_t num) {
     RuntimeValue rt_val;
     rt_val.type = TYPE_INT32;
     rt_val.val.int32_val = num;
     return rt_val;
 }
 
-static RuntimeValue create_number_runtime_value(double num) { // This creates TYPE_FLOAT
+RuntimeValue create_number_runtime_value(double num) { // This creates TYPE_FLOAT
     RuntimeValue rt_val;
     rt_val.type = TYPE_FLOAT;
     rt_val.val.float_val = num;
     return rt_val;
 }
 
-static RuntimeValue create_string_runtime_value(const char* str) {
+RuntimeValue create_string_runtime_value(const char* str) {
     RuntimeValue rt_val;
     rt_val.type = TYPE_STRING;
-    rt_val.val.string_val = strdup(str);
+    rt_val.val.string_val = safe_strdup(str);
     if (str != NULL && rt_val.val.string_val == NULL) {
-        fprintf(stderr, "Error: Memory allocation failed in create_string_runtime_value.\n");
+        fprintf(DIAGNOSTICS, "Error: Memory allocation failed in create_string_runtime_value.\n");
         return create_error_runtime_value();
     }
     return rt_val;
 }
 
-static RuntimeValue create_bool_runtime_value(bool b) {
+RuntimeValue create_bool_runtime_value(bool b) {
     RuntimeValue rt_val;
     rt_val.type = TYPE_BOOL;
     rt_val.val.bool_val = b;
@@ -74,7 +77,7 @@ static RuntimeValue create_bool_runtime_value(bool b) {
 }
 
 // Helper function to get string representation of a data type
-static const char* get_type_name(DataType type) {
+const char* get_type_name(DataType type) {
     switch (type) {
         case TYPE_INT: return "int_legacy"; // Should ideally not be produced by parser anymore
         case TYPE_INT32: return "int32";
@@ -90,62 +93,86 @@ static const char* get_type_name(DataType type) {
 
 // Get a symbol from the symbol table (returns a pointer to the Symbol struct)
 static Symbol* get_symbol(const char* name) {
-    for (int i = 0; i < symbol_count; i++) {
-        if (strcmp(symbol_table[i].name, name) == 0) {
-            return &symbol_table[i];
+    for (int i = 0; i < symbol_table->count; i++) {
+        if (strcmp(symbol_table->entries[i].name, name) == 0) {
+            STAT_LOOKUP(i + 1, true);
+            return &symbol_table->entries[i];
         }
     }
+    STAT_LOOKUP(symbol_table->count, false);
     return NULL;
 }
 
-// Set a symbol in the symbol table
-static void set_symbol(const char* name, RuntimeValue rt_new_value) {
+// Look up a variable's current value. The value (and any string in it) stays
+// owned by the symbol table. Returns false if the variable is undefined.
+bool lookup_symbol_value(const char* name, RuntimeValue* out) {
+    Symbol* sym = get_symbol(name);
+    if (sym == NULL) return false;
+    out->type = sym->type;
+    out->val = sym->val;
+    return true;
+}
+
+// The variables in the order they were bound, for snapshot.c. Like
+// lookup_symbol_value, the value stays owned by the symbol table.
+int symbol_count(void) {
+    return symbol_table->count;
+}
+
+bool symbol_table_full(void) {
+    return symbol_table->count >= MAX_SYMBOLS;
+}
+
+const char* symbol_at(int index, RuntimeValue* out) {
+    out->type = symbol_table->entries[index].type;
+    out->val = symbol_table->entries[index].val;
+    return symbol_table->entries[index].name;
+}
+
+// Set a symbol in the symbol table (string values are copied)
+void set_symbol(const char* name, RuntimeValue rt_new_value) {
     // Update existing symbol if found
-    for (int i = 0; i < symbol_count; i++) {
-        if (strcmp(symbol_table[i].name, name) == 0) {
+    for (int i = 0; i < symbol_table->count; i++) {
+        if (strcmp(symbol_table->entries[i].name, name) == 0) {
+            STAT_LOOKUP(i + 1, true);
             // Free old string value if needed
-            if (symbol_table[i].type == TYPE_STRING && symbol_table[i].val.string_val != NULL) {
-                safe_free(symbol_table[i].val.string_val);
+            if (symbol_table->entries[i].type == TYPE_STRING && symbol_table->entries[i].val.string_val != NULL) {
+                safe_free(symbol_table->entries[i].val.string_val);
             }
-            symbol_table[i].type = rt_new_value.type;
+            symbol_table->entries[i].type = rt_new_value.type;
             // Deep copy string values to avoid double-free or dangling pointers
             if (rt_new_value.type == TYPE_STRING && rt_new_value.val.string_val != NULL) {
-                symbol_table[i].val.string_val = strdup(rt_new_value.val.string_val);
-                if (symbol_table[i].val.string_val == NULL) {
-                    fprintf(stderr, "Error: Memory allocation failed for symbol value.\n");
+                symbol_table->entries[i].val.string_val = safe_strdup(rt_new_value.val.string_val);
+                if (symbol_table->entries[i].val.string_val == NULL) {
+                    fprintf(DIAGNOSTICS, "Error: Memory allocation failed for symbol value.\n");
                 }
             } else {
-                symbol_table[i].val = rt_new_value.val;
+                symbol_table->entries[i].val = rt_new_value.val;
             }
             return;
         }
     }
 
     // Add new symbol if not found
-    if (symbol_count < MAX_SYMBOLS) {
-        symbol_table[symbol_count].name = strdup(name);
-        if (symbol_table[symbol_count].name == NULL && name != NULL) {
-            fprintf(stderr, "Error: Memory allocation failed for symbol name.\n");
-            if (rt_new_value.type == TYPE_STRING && rt_new_value.val.string_val != NULL) {
-                safe_free(rt_new_value.val.string_val);
-            }
+    STAT_LOOKUP(symbol_table->count, false);
+    if (symbol_table->count < MAX_SYMBOLS) {
+        symbol_table->entries[symbol_table->count].name = safe_strdup(name);
+        if (symbol_table->entries[symbol_table->count].name == NULL && name != NULL) {
+            fprintf(DIAGNOSTICS, "Error: Memory allocation failed for symbol name.\n");
             return;
         }
-        symbol_table[symbol_count].type = rt_new_value.type;
+        symbol_table->entries[symbol_table->count].type = rt_new_value.type;
         if (rt_new_value.type == TYPE_STRING && rt_new_value.val.string_val != NULL) {
-            symbol_table[symbol_count].val.string_val = strdup(rt_new_value.val.string_val);
-            if (symbol_table[symbol_count].val.string_val == NULL) {
-                fprintf(stderr, "Error: Memory allocation failed for symbol value.\n");
+            symbol_table->entries[symbol_table->count].val.string_val = safe_strdup(rt_new_value.val.string_val);
+            if (symbol_table->entries[symbol_table->count].val.string_val == NULL) {
+                fprintf(DIAGNOSTICS, "Error: Memory allocation failed for symbol value.\n");
             }
         } else {
-            symbol_table[symbol_count].val = rt_new_value.val;
+            symbol_table->entries[symbol_table->count].val = rt_new_value.val;
         }
-        symbol_count++;
+        symbol_table->count++;
     } else {
-        fprintf(stderr, "Error: Symbol table overflow.\n");
-        if (rt_new_value.type == TYPE_STRING && rt_new_value.val.string_val != NULL) {
-            safe_free(rt_new_value.val.string_val);
-        }
+        fprintf(DIAGNOSTICS, "Error: Symbol table overflow.\n"); // The caller still owns the value
     }
 }
 
@@ -153,58 +180,216 @@ static void set_symbol(const char* name, RuntimeValue rt_new_value) {
 static void print_runtime_value(RuntimeValue rt_value) {
     switch (rt_value.type) {
         case TYPE_FLOAT:
-            printf("%.2f", rt_value.val.float_val);
+            fprintf(PROGRAM_OUTPUT, "%.2f", rt_value.val.float_val);
             break;
         case TYPE_STRING:
-            printf("%s", rt_value.val.string_val);
+            fprintf(PROGRAM_OUTPUT, "%s", rt_value.val.string_val);
             break;
         case TYPE_BOOL:
-            printf("%s", rt_value.val.bool_val ? "true" : "false");
+            fprintf(PROGRAM_OUTPUT, "%s", rt_value.val.bool_val ? "true" : "false");
             break;
         case TYPE_INT:
-            printf("%d", rt_value.val.int_val); // Kept for existing TYPE_INT, though might become dead code
+            fprintf(PROGRAM_OUTPUT, "%d", rt_value.val.int_val); // Kept for existing TYPE_INT, though might become dead code
             break;
         case TYPE_INT32:
-            printf("%" PRId32, rt_value.val.int32_val);
+            fprintf(PROGRAM_OUTPUT, "%" PRId32, rt_value.val.int32_val);
             break;
         case TYPE_INT64:
-            printf("%" PRId64, rt_value.val.int64_val);
+            fprintf(PROGRAM_OUTPUT, "%" PRId64, rt_value.val.int64_val);
             break;
         case TYPE_VOID:
-            printf("(void)");
+            fprintf(PROGRAM_OUTPUT, "(void)");
             break;
         case TYPE_ERROR:
-            fprintf(stderr, "ErrorValue");
+            fprintf(DIAGNOSTICS, "ErrorValue");
             break;
         default:
-            fprintf(stderr, "Unknown data type: %d\n", rt_value.type);
+            fprintf(DIAGNOSTICS, "Unknown data type: %d\n", rt_value.type);
     }
 }
 
-// Forward declaration
-static RuntimeValue evaluate_node(ASTNode* node);
+static bool is_arithmetic_op(BinaryOp op) {
+    return op >= BINOP_ADD && op <= BINOP_DIV;
+}
 
-// Evaluate a binary operation
-static RuntimeValue evaluate_binary_op(ASTNode* node) {
-    RuntimeValue left_rt = evaluate_node(node->left);
-    RuntimeValue right_rt = evaluate_node(node->right);
+static bool is_comparison_op(BinaryOp op) {
+    return op >= BINOP_GT && op <= BINOP_NOTEQ;
+}
 
-    // Check for errors from operands
-    if (left_rt.type == TYPE_ERROR) return left_rt;
-    if (right_rt.type == TYPE_ERROR) return right_rt;
+// Choose the specialized variant for a binary node from the operand types seen
+// at its first evaluation. Combinations without a fast path stay generic.
+QuickKind select_binary_quick_kind(BinaryOp op, DataType left_type, DataType right_type) {
+    if (left_type == TYPE_INT32 && right_type == TYPE_INT32 && (is_arithmetic_op(op) || is_comparison_op(op))) {
+        return (QuickKind)(QUICK_INT32_ADD + (op - BINOP_ADD));
+    }
+    if (left_type == TYPE_INT64 && right_type == TYPE_INT64 && (is_arithmetic_op(op) || is_comparison_op(op))) {
+        return (QuickKind)(QUICK_INT64_ADD + (op - BINOP_ADD));
+    }
+    if (left_type == TYPE_FLOAT && right_type == TYPE_FLOAT && (is_arithmetic_op(op) || is_comparison_op(op))) {
+        return (QuickKind)(QUICK_FLOAT_ADD + (op - BINOP_ADD));
+    }
+    if (left_type == TYPE_BOOL && right_type == TYPE_BOOL) {
+        if (op == BINOP_AND) return QUICK_BOOL_AND;
+        if (op == BINOP_OR) return QUICK_BOOL_OR;
+    }
+    return QUICK_GENERIC;
+}
+
+// int32 arithmetic and comparison without widening to int64. Overflow is a
+// runtime error, just like storing an out-of-range value into an int32 variable.
+static RuntimeValue evaluate_int32_binary(BinaryOp op, int32_t l_val, int32_t r_val, const char* op_text) {
+    int32_t result_val = 0;
+    bool overflow = false;
+    switch (op) {
+        case BINOP_ADD: overflow = __builtin_add_overflow(l_val, r_val, &result_val); break;
+        case BINOP_SUB: overflow = __builtin_sub_overflow(l_val, r_val, &result_val); break;
+        case BINOP_MUL: overflow = __builtin_mul_overflow(l_val, r_val, &result_val); break;
+        case BINOP_DIV:
+            if (r_val == 0) {
+                fprintf(DIAGNOSTICS, "Error: Division by zero (integer)\n");
+                return create_error_runtime_value();
+            }
+            if (l_val == INT32_MIN && r_val == -1) {
+                overflow = true;
+            } else {
+                result_val = l_val / r_val;
+            }
+            break;
+        case BINOP_GT:    return create_bool_runtime_value(l_val > r_val);
+        case BINOP_LT:    return create_bool_runtime_value(l_val < r_val);
+        case BINOP_EQ:    return create_bool_runtime_value(l_val == r_val);
+        case BINOP_LTEQ:  return create_bool_runtime_value(l_val <= r_val);
+        case BINOP_GTEQ:  return create_bool_runtime_value(l_val >= r_val);
+        case BINOP_NOTEQ: return create_bool_runtime_value(l_val != r_val);
+        default: /* Should not happen */ return create_error_runtime_value();
+    }
+    if (overflow) {
+        fprintf(DIAGNOSTICS, "Runtime Error: int32 overflow in %" PRId32 " %s %" PRId32 ".\n", l_val, op_text, r_val);
+        return create_error_runtime_value();
+    }
+    return create_int32_runtime_value(result_val);
+}
+
+// Fast path for a quickened binary node. Returns false when the operand types
+// no longer match the specialization (the guard failed).
+static bool evaluate_quickened_binary(ASTNode* node, RuntimeValue left_rt, RuntimeValue right_rt, RuntimeValue* result) {
+    QuickKind quick = node->quick;
+
+    if (quick >= QUICK_INT32_ADD && quick <= QUICK_INT32_NOTEQ) {
+        if (left_rt.type != TYPE_INT32 || right_rt.type != TYPE_INT32) return false;
+        *result = evaluate_int32_binary((BinaryOp)(BINOP_ADD + (quick - QUICK_INT32_ADD)),
+                                        left_rt.val.int32_val, right_rt.val.int32_val, node->value.string_val);
+        return true;
+    }
+
+    if (quick >= QUICK_INT64_ADD && quick <= QUICK_INT64_NOTEQ) {
+        if (left_rt.type != TYPE_INT64 || right_rt.type != TYPE_INT64) return false;
+        int64_t l_val = left_rt.val.int64_val;
+        int64_t r_val = right_rt.val.int64_val;
+        switch (quick) {
+            case QUICK_INT64_ADD: *result = create_int64_runtime_value(l_val + r_val); break;
+            case QUICK_INT64_SUB: *result = create_int64_runtime_value(l_val - r_val); break;
+            case QUICK_INT64_MUL: *result = create_int64_runtime_value(l_val * r_val); break;
+            case QUICK_INT64_DIV:
+                if (r_val == 0) {
+                    fprintf(DIAGNOSTICS, "Error: Division by zero (integer)\n");
+                    *result = create_error_runtime_value();
+                } else {
+                    *result = create_int64_runtime_value(l_val / r_val);
+                }
+                break;
+            case QUICK_INT64_GT:    *result = create_bool_runtime_value(l_val > r_val); break;
+            case QUICK_INT64_LT:    *result = create_bool_runtime_value(l_val < r_val); break;
+            case QUICK_INT64_EQ:    *result = create_bool_runtime_value(l_val == r_val); break;
+            case QUICK_INT64_LTEQ:  *result = create_bool_runtime_value(l_val <= r_val); break;
+            case QUICK_INT64_GTEQ:  *result = create_bool_runtime_value(l_val >= r_val); break;
+            case QUICK_INT64_NOTEQ: *result = create_bool_runtime_value(l_val != r_val); break;
+            default: return false;
+        }
+        return true;
+    }
+
+    if (quick >= QUICK_FLOAT_ADD && quick <= QUICK_FLOAT_NOTEQ) {
+        if (left_rt.type != TYPE_FLOAT || right_rt.type != TYPE_FLOAT) return false;
+        double l_val = left_rt.val.float_val;
+        double r_val = right_rt.val.float_val;
+        switch (quick) {
+            case QUICK_FLOAT_ADD: *result = create_number_runtime_value(l_val + r_val); break;
+            case QUICK_FLOAT_SUB: *result = create_number_runtime_value(l_val - r_val); break;
+            case QUICK_FLOAT_MUL: *result = create_number_runtime_value(l_val * r_val); break;
+            case QUICK_FLOAT_DIV:
+                if (r_val == 0.0) {
+                    fprintf(DIAGNOSTICS, "Error: Division by zero (float)\n");
+                    *result = create_error_runtime_value();
+                } else {
+                    *result = create_number_runtime_value(l_val / r_val);
+                }
+                break;
+            case QUICK_FLOAT_GT:    *result = create_bool_runtime_value(l_val > r_val); break;
+            case QUICK_FLOAT_LT:    *result = create_bool_runtime_value(l_val < r_val); break;
+            case QUICK_FLOAT_EQ:    *result = create_bool_runtime_value(l_val == r_val); break;
+            case QUICK_FLOAT_LTEQ:  *result = create_bool_runtime_value(l_val <= r_val); break;
+            case QUICK_FLOAT_GTEQ:  *result = create_bool_runtime_value(l_val >= r_val); break;
+            case QUICK_FLOAT_NOTEQ: *result = create_bool_runtime_value(l_val != r_val); break;
+            default: return false;
+        }
+        return true;
+    }
+
+    if (quick == QUICK_BOOL_AND || quick == QUICK_BOOL_OR) {
+        if (left_rt.type != TYPE_BOOL || right_rt.type != TYPE_BOOL) return false;
+        bool logical_res = (quick == QUICK_BOOL_AND)
+            ? (left_rt.val.bool_val && right_rt.val.bool_val)
+            : (left_rt.val.bool_val || right_rt.val.bool_val);
+        *result = create_bool_runtime_value(logical_res);
+        return true;
+    }
+
+    return false;
+}
+
+// Evaluate a binary operation on its already evaluated operands
+static RuntimeValue evaluate_binary_op(ASTNode* node, RuntimeValue left_rt, RuntimeValue right_rt) {
+    STAT_BINARY(node->op, left_rt.type, right_rt.type);
+    // Quickening: the first evaluation specializes the node on the operand types it
+    // sees; later evaluations only re-check those types. A failed guard demotes the
+    // node to the generic path for good, so unstable sites don't thrash.
+    if (node->quick != QUICK_GENERIC) {
+        if (node->quick == QUICK_NONE) {
+            node->quick = select_binary_quick_kind(node->op, left_rt.type, right_rt.type);
+        }
+        RuntimeValue quick_result;
+        if (node->quick != QUICK_GENERIC && evaluate_quickened_binary(node, left_rt, right_rt, &quick_result)) {
+            return quick_result;
+        }
+        if (node->quick != QUICK_GENERIC) {
+            LOG_TRACE("Quickened binary node '%s' saw (%s, %s); falling back to generic path.",
+                      node->value.string_val, get_type_name(left_rt.type), get_type_name(right_rt.type));
+            node->quick = QUICK_GENERIC;
+        }
+    }
 
     // Using node->value.string_val for operator (Req 3)
-    const char* op = node->value.string_val;
-    if (op == NULL) {
-        fprintf(stderr, "Error: Binary operator token has NULL text.\n");
+    if (node->value.string_val == NULL) {
+        fprintf(DIAGNOSTICS, "Error: Binary operator token has NULL text.\n");
         return create_error_runtime_value();
     }
+    return evaluate_binary_values(node->op, node->value.string_val, left_rt, right_rt);
+}
 
+// Generic (unspecialized) binary operation on two evaluated operands.
+// 'op' is the operator's source text, used in error messages.
+RuntimeValue evaluate_binary_values(BinaryOp binop, const char* op, RuntimeValue left_rt, RuntimeValue right_rt) {
     // Type promotion and operation logic
     DataType left_type = left_rt.type;
     DataType right_type = right_rt.type;
 
-    // Promote INT32 to INT64 for simplicity in binary operations for now
+    // int32 with int32 stays in 32 bits
+    if (left_type == TYPE_INT32 && right_type == TYPE_INT32 && (is_arithmetic_op(binop) || is_comparison_op(binop))) {
+        return evaluate_int32_binary(binop, left_rt.val.int32_val, right_rt.val.int32_val, op);
+    }
+
+    // Mixed int32/int64 operands are widened to INT64
     if (left_type == TYPE_INT32) {
         left_rt.val.int64_val = (int64_t)left_rt.val.int32_val;
         left_type = TYPE_INT64;
@@ -226,149 +411,111 @@ static RuntimeValue evaluate_binary_op(ASTNode* node) {
 
 
     // Arithmetic Operators (+, -, *, /)
-    if (strcmp(op, "+") == 0 || strcmp(op, "-") == 0 || strcmp(op, "*") == 0 || strcmp(op, "/") == 0) {
+    if (is_arithmetic_op(binop)) {
         if (left_type == TYPE_INT64 && right_type == TYPE_INT64) {
             int64_t result_val;
-            if (strcmp(op, "+") == 0) result_val = left_rt.val.int64_val + right_rt.val.int64_val;
-            else if (strcmp(op, "-") == 0) result_val = left_rt.val.int64_val - right_rt.val.int64_val;
-            else if (strcmp(op, "*") == 0) result_val = left_rt.val.int64_val * right_rt.val.int64_val;
-            else if (strcmp(op, "/") == 0) {
-                if (right_rt.val.int64_val == 0) {
-                    fprintf(stderr, "Error: Division by zero (integer)\n");
-                    return create_error_runtime_value();
-                }
-                result_val = left_rt.val.int64_val / right_rt.val.int64_val; // Integer division
-            } else { /* Should not happen */ return create_error_runtime_value(); }
+            switch (binop) {
+                case BINOP_ADD: result_val = left_rt.val.int64_val + right_rt.val.int64_val; break;
+                case BINOP_SUB: result_val = left_rt.val.int64_val - right_rt.val.int64_val; break;
+                case BINOP_MUL: result_val = left_rt.val.int64_val * right_rt.val.int64_val; break;
+                case BINOP_DIV:
+                    if (right_rt.val.int64_val == 0) {
+                        fprintf(DIAGNOSTICS, "Error: Division by zero (integer)\n");
+                        return create_error_runtime_value();
+                    }
+                    result_val = left_rt.val.int64_val / right_rt.val.int64_val; // Integer division
+                    break;
+                default: /* Should not happen */ return create_error_runtime_value();
+            }
             return create_int64_runtime_value(result_val);
         } else if ((left_type == TYPE_FLOAT && (right_type == TYPE_INT64 || right_type == TYPE_FLOAT)) ||
                    (right_type == TYPE_FLOAT && (left_type == TYPE_INT64 || left_type == TYPE_FLOAT))) {
             double l_val = (left_type == TYPE_FLOAT) ? left_rt.val.float_val : (double)left_rt.val.int64_val;
             double r_val = (right_type == TYPE_FLOAT) ? right_rt.val.float_val : (double)right_rt.val.int64_val;
             double result_val;
-            if (strcmp(op, "+") == 0) result_val = l_val + r_val;
-            else if (strcmp(op, "-") == 0) result_val = l_val - r_val;
-            else if (strcmp(op, "*") == 0) result_val = l_val * r_val;
-            else if (strcmp(op, "/") == 0) {
-                if (r_val == 0.0) {
-                    fprintf(stderr, "Error: Division by zero (float)\n");
-                    return create_error_runtime_value();
-                }
-                result_val = l_val / r_val;
-            } else { /* Should not happen */ return create_error_runtime_value(); }
+            switch (binop) {
+                case BINOP_ADD: result_val = l_val + r_val; break;
+                case BINOP_SUB: result_val = l_val - r_val; break;
+                case BINOP_MUL: result_val = l_val * r_val; break;
+                case BINOP_DIV:
+                    if (r_val == 0.0) {
+                        fprintf(DIAGNOSTICS, "Error: Division by zero (float)\n");
+                        return create_error_runtime_value();
+                    }
+                    result_val = l_val / r_val;
+                    break;
+                default: /* Should not happen */ return create_error_runtime_value();
+            }
             return create_number_runtime_value(result_val); // create_number_runtime_value creates TYPE_FLOAT
         } else {
-            fprintf(stderr, "Error: Type error: Operands for arithmetic operator '%s' must be numbers.\n", op);
+            fprintf(DIAGNOSTICS, "Error: Type error: Operands for arithmetic operator '%s' must be numbers.\n", op);
             return create_error_runtime_value();
         }
     }
     // Comparison Operators (>, <, ==, <=, >=, !=)
-    else if (strcmp(op, ">") == 0 || strcmp(op, "<") == 0 || strcmp(op, "==") == 0 ||
-             strcmp(op, "<=") == 0 || strcmp(op, ">=") == 0 || strcmp(op, "!=") == 0) {
+    else if (is_comparison_op(binop)) {
         bool cmp_res;
         if (left_type == TYPE_INT64 && right_type == TYPE_INT64) {
-            if (strcmp(op, ">") == 0) cmp_res = left_rt.val.int64_val > right_rt.val.int64_val;
-            else if (strcmp(op, "<") == 0) cmp_res = left_rt.val.int64_val < right_rt.val.int64_val;
-            else if (strcmp(op, "==") == 0) cmp_res = left_rt.val.int64_val == right_rt.val.int64_val;
-            else if (strcmp(op, "<=") == 0) cmp_res = left_rt.val.int64_val <= right_rt.val.int64_val;
-            else if (strcmp(op, ">=") == 0) cmp_res = left_rt.val.int64_val >= right_rt.val.int64_val;
-            else if (strcmp(op, "!=") == 0) cmp_res = left_rt.val.int64_val != right_rt.val.int64_val;
-            else { /* Should not happen */ return create_error_runtime_value(); }
+            int64_t l_val = left_rt.val.int64_val;
+            int64_t r_val = right_rt.val.int64_val;
+            switch (binop) {
+                case BINOP_GT:    cmp_res = l_val > r_val; break;
+                case BINOP_LT:    cmp_res = l_val < r_val; break;
+                case BINOP_EQ:    cmp_res = l_val == r_val; break;
+                case BINOP_LTEQ:  cmp_res = l_val <= r_val; break;
+                case BINOP_GTEQ:  cmp_res = l_val >= r_val; break;
+                case BINOP_NOTEQ: cmp_res = l_val != r_val; break;
+                default: /* Should not happen */ return create_error_runtime_value();
+            }
         } else if ((left_type == TYPE_FLOAT && (right_type == TYPE_INT64 || right_type == TYPE_FLOAT)) ||
                    (right_type == TYPE_FLOAT && (left_type == TYPE_INT64 || left_type == TYPE_FLOAT))) {
             double l_val = (left_type == TYPE_FLOAT) ? left_rt.val.float_val : (double)left_rt.val.int64_val;
             double r_val = (right_type == TYPE_FLOAT) ? right_rt.val.float_val : (double)right_rt.val.int64_val;
-            if (strcmp(op, ">") == 0) cmp_res = l_val > r_val;
-            else if (strcmp(op, "<") == 0) cmp_res = l_val < r_val;
-            else if (strcmp(op, "==") == 0) cmp_res = l_val == r_val; // Note: float equality can be tricky
-            else if (strcmp(op, "<=") == 0) cmp_res = l_val <= r_val;
-            else if (strcmp(op, ">=") == 0) cmp_res = l_val >= r_val;
-            else if (strcmp(op, "!=") == 0) cmp_res = l_val != r_val;
-            else { /* Should not happen */ return create_error_runtime_value(); }
+            switch (binop) {
+                case BINOP_GT:    cmp_res = l_val > r_val; break;
+                case BINOP_LT:    cmp_res = l_val < r_val; break;
+                case BINOP_EQ:    cmp_res = l_val == r_val; break; // Note: float equality can be tricky
+                case BINOP_LTEQ:  cmp_res = l_val <= r_val; break;
+                case BINOP_GTEQ:  cmp_res = l_val >= r_val; break;
+                case BINOP_NOTEQ: cmp_res = l_val != r_val; break;
+                default: /* Should not happen */ return create_error_runtime_value();
+            }
         }
         // Add string comparison for "==" and "!="
-        else if (left_type == TYPE_STRING && right_type == TYPE_STRING && (strcmp(op, "==") == 0 || strcmp(op, "!=") == 0)) {
-            if (strcmp(op, "==") == 0) cmp_res = strcmp(left_rt.val.string_val, right_rt.val.string_val) == 0;
+        else if (left_type == TYPE_STRING && right_type == TYPE_STRING && (binop == BINOP_EQ || binop == BINOP_NOTEQ)) {
+            if (binop == BINOP_EQ) cmp_res = strcmp(left_rt.val.string_val, right_rt.val.string_val) == 0;
             else cmp_res = strcmp(left_rt.val.string_val, right_rt.val.string_val) != 0;
         }
         else {
-            fprintf(stderr, "Error: Type error: Operands for comparison operator '%s' are incompatible (%d, %d).\n", op, left_type, right_type);
+            fprintf(DIAGNOSTICS, "Error: Type error: Operands for comparison operator '%s' are incompatible (%d, %d).\n", op, left_type, right_type);
             return create_error_runtime_value();
         }
         return create_bool_runtime_value(cmp_res);
     }
     // Logical Operators (&&, ||) - Require TYPE_BOOL for both operands
-    else if (strcmp(op, "&&") == 0 || strcmp(op, "||") == 0) {
+    else if (binop == BINOP_AND || binop == BINOP_OR) {
         if (left_rt.type != TYPE_BOOL || right_rt.type != TYPE_BOOL) {
-            fprintf(stderr, "Error: Type error: Operands for logical operator '%s' must be booleans.\n", op);
+            fprintf(DIAGNOSTICS, "Error: Type error: Operands for logical operator '%s' must be booleans.\n", op);
             return create_error_runtime_value();
         }
         bool logical_res;
-        if (strcmp(op, "&&") == 0) logical_res = left_rt.val.bool_val && right_rt.val.bool_val;
-        else if (strcmp(op, "||") == 0) logical_res = left_rt.val.bool_val || right_rt.val.bool_val;
-        else { /* Should not happen */ return create_error_runtime_value(); }
+        if (binop == BINOP_AND) logical_res = left_rt.val.bool_val && right_rt.val.bool_val;
+        else logical_res = left_rt.val.bool_val || right_rt.val.bool_val;
         return create_bool_runtime_value(logical_res);
     }
     
-    fprintf(stderr, "Error: Operator '%s' not defined for operand types %d and %d\n", op, left_rt.type, right_rt.type);
+    fprintf(DIAGNOSTICS, "Error: Operator '%s' not defined for operand types %d and %d\n", op, left_rt.type, right_rt.type);
     return create_error_runtime_value();
 }
 
-// Evaluate an if statement
-static RuntimeValue evaluate_if(ASTNode* node) {
-    RuntimeValue condition_rt_val = evaluate_node(node->condition);
-    
-    if (condition_rt_val.type == TYPE_ERROR) return condition_rt_val;
-
-    if (condition_rt_val.type != TYPE_BOOL) {
-        fprintf(stderr, "Error: If statement condition must be a boolean.\n");
-        return create_error_runtime_value();
-    }
-
-    if (condition_rt_val.val.bool_val) {
-        if (node->body != NULL) { // body is node->body
-             if (node->body->type == NODE_BLOCK) {
-                RuntimeValue last_rt_val = create_error_runtime_value();
-                for (int i = 0; i < node->body->statement_count; i++) {
-                    last_rt_val = evaluate_node(node->body->statements[i]);
-                    if (last_rt_val.type == TYPE_ERROR) return last_rt_val;
-                }
-                return last_rt_val;
-            } else {
-                 return evaluate_node(node->body);
-            }
-        }
-    } else if (node->else_body != NULL) {
-        if (node->else_body->type == NODE_BLOCK) {
-            RuntimeValue last_rt_val = create_error_runtime_value();
-            for (int i = 0; i < node->else_body->statement_count; i++) {
-                last_rt_val = evaluate_node(node->else_body->statements[i]);
-                if (last_rt_val.type == TYPE_ERROR) return last_rt_val;
-            }
-            return last_rt_val;
-        } else {
-            return evaluate_node(node->else_body);
-        }
-    }
-    // If condition is false and no else block, or empty block
-    return create_error_runtime_value(); // Or a specific void/undefined RuntimeValue
-}
-
-// Evaluate a let statement
-static RuntimeValue evaluate_let(ASTNode* node) {
-    if (node == NULL || node->value.string_val == NULL || node->left == NULL) {
-        fprintf(stderr, "Error: Invalid let statement structure.\n");
-        return create_error_runtime_value();
-    }
-    
-    RuntimeValue expr_val = evaluate_node(node->left);
-    if (expr_val.type == TYPE_ERROR) {
-        return expr_val; // Propagate error
-    }
-
+// Convert the value of a let initializer to the variable's declared type
+// (TYPE_VOID: none). On failure the error is reported, expr_val is released
+// and an error value is returned.
+RuntimeValue convert_let_value(const char* name, DataType explicit_type, RuntimeValue expr_val) {
     RuntimeValue final_val = expr_val; // Start with expr_val, potentially convert
 
-    if (node->explicit_type != TYPE_VOID) {
-        DataType declared_type = node->explicit_type;
+    if (explicit_type != TYPE_VOID) {
+        DataType declared_type = explicit_type;
         DataType actual_type = expr_val.type;
 
         if (declared_type == actual_type) {
@@ -408,8 +555,8 @@ static RuntimeValue evaluate_let(ASTNode* node) {
                         final_val.type = TYPE_INT32;
                         final_val.val.int32_val = (int32_t)expr_val.val.int64_val;
                     } else {
-                        fprintf(stderr, "Runtime Error: Value %" PRId64 " for variable '%s' overflows declared type int32.\n",
-                                expr_val.val.int64_val, node->value.string_val);
+                        fprintf(DIAGNOSTICS, "Runtime Error: Value %" PRId64 " for variable '%s' overflows declared type int32.\n",
+                                expr_val.val.int64_val, name);
                         // expr_val is not a string here, so no need to free its string_val
                         return create_error_runtime_value();
                     }
@@ -418,8 +565,8 @@ static RuntimeValue evaluate_let(ASTNode* node) {
                         final_val.type = TYPE_INT32;
                         final_val.val.int32_val = (int32_t)expr_val.val.int_val;
                     } else {
-                        fprintf(stderr, "Runtime Error: Value %d for variable '%s' overflows declared type int32.\n",
-                                expr_val.val.int_val, node->value.string_val);
+                        fprintf(DIAGNOSTICS, "Runtime Error: Value %d for variable '%s' overflows declared type int32.\n",
+                                expr_val.val.int_val, name);
                         return create_error_runtime_value();
                     }
                 }
@@ -443,166 +590,608 @@ static RuntimeValue evaluate_let(ASTNode* node) {
     }
     // If no explicit type, or if types matched, or if conversion was successful,
     // final_val holds the value to be set.
-
-    set_symbol(node->value.string_val, final_val);
-    // Note: set_symbol takes ownership of final_val.string_val if it's a string.
-    // If expr_val was a string and final_val is different (e.g. after a hypothetical conversion from string),
-    // and final_val is NOT a string, then expr_val.val.string_val might need freeing here.
-    // However, current conversions are numeric. If expr_val was a string and declared_type is numeric,
-    // it would hit type_error, and expr_val.val.string_val should be freed there.
-
-    return final_val; // Return the value that was actually stored (could be converted)
+    return final_val;
 
 type_error:
-    fprintf(stderr, "Runtime Error: Cannot assign expression of type %s to variable '%s' of declared type %s.\n",
-            get_type_name(expr_val.type), node->value.string_val, get_type_name(node->explicit_type));
+    fprintf(DIAGNOSTICS, "Runtime Error: Cannot assign expression of type %s to variable '%s' of declared type %s.\n",
+            get_type_name(expr_val.type), name, get_type_name(explicit_type));
     if (expr_val.type == TYPE_STRING && expr_val.val.string_val != NULL) {
         safe_free(expr_val.val.string_val); // Free the string from the expression if it's not being used
     }
     return create_error_runtime_value();
 }
 
-// Main evaluation function
-static RuntimeValue evaluate_node(ASTNode* node) {
-    if (node == NULL) return create_error_runtime_value();
-    
+// Evaluate a let statement, given the value of its initializer expression
+static RuntimeValue evaluate_let(ASTNode* node, RuntimeValue expr_val) {
+    RuntimeValue final_val = convert_let_value(node->value.string_val, node->explicit_type, expr_val);
+    if (final_val.type == TYPE_ERROR) return final_val;
+
+    set_symbol(node->value.string_val, final_val);
+    // Note: set_symbol copies string values, so final_val still owns its string.
+    return final_val; // Return the value that was actually stored (could be converted)
+}
+
+// Parse a NODE_NUMBER literal into a runtime value. On failure, 'message' gets
+// the error the interpreter reports for it and false is returned.
+bool parse_number_literal(const ASTNode* node, RuntimeValue* out, char* message, size_t message_size) {
+    if (node->data_type == TYPE_INT64 || node->data_type == TYPE_INT) { // Treat old TYPE_INT as INT64
+        char *endptr;
+        errno = 0;
+        long long int_val = strtoll(node->value.string_val, &endptr, 10);
+        if (node->value.string_val == endptr || *endptr != '\0') {
+            snprintf(message, message_size, "Error: Invalid integer literal '%s'\n", node->value.string_val);
+            return false;
+        }
+        if (errno == ERANGE) {
+            snprintf(message, message_size, "Error: Integer literal '%s' out of range for int64.\n", node->value.string_val);
+            return false;
+        }
+        *out = create_int64_runtime_value(int_val);
+        return true;
+    } else if (node->data_type == TYPE_FLOAT) {
+        *out = create_number_runtime_value(atof(node->value.string_val));
+        return true;
+    } else if (node->data_type == TYPE_INT32) { // Explicitly handle INT32 if parser produces it
+        char *endptr;
+        errno = 0;
+        long int_val = strtol(node->value.string_val, &endptr, 10);
+        if (node->value.string_val == endptr || *endptr != '\0') {
+            snprintf(message, message_size, "Error: Invalid int32 literal '%s'\n", node->value.string_val);
+            return false;
+        }
+        if (errno == ERANGE || int_val > INT32_MAX || int_val < INT32_MIN) {
+            snprintf(message, message_size, "Error: Integer literal '%s' out of range for int32.\n", node->value.string_val);
+            return false;
+        }
+        *out = create_int32_runtime_value((int32_t)int_val);
+        return true;
+    }
+    snprintf(message, message_size, "Error: Unknown data type for NODE_NUMBER: %d\n", node->data_type);
+    return false;
+}
+
+static RuntimeValue evaluate_number_literal(ASTNode* node) {
+    RuntimeValue literal_val;
+    char message[MAX_STRING_LEN];
+    if (!parse_number_literal(node, &literal_val, message, sizeof(message))) {
+        fputs(message, DIAGNOSTICS);
+        return create_error_runtime_value();
+    }
+    return literal_val;
+}
+
+// Copy a value, giving the copy its own string storage
+RuntimeValue copy_runtime_value(RuntimeValue rt_value) {
+    if (rt_value.type == TYPE_STRING && rt_value.val.string_val != NULL) {
+        return create_string_runtime_value(rt_value.val.string_val);
+    }
+    return rt_value;
+}
+
+// Release the heap storage owned by a temporary value
+void release_runtime_value(RuntimeValue* rt_value) {
+    if (rt_value->type == TYPE_STRING && rt_value->val.string_val != NULL) {
+        safe_free(rt_value->val.string_val);
+        rt_value->val.string_val = NULL;
+    }
+}
+
+RuntimeValue create_void_runtime_value(void) {
+    RuntimeValue rt_val;
+    rt_val.type = TYPE_VOID;
+    rt_val.val.int64_val = 0;
+    return rt_val;
+}
+
+// Evaluate a leaf node (literal or variable reference)
+static RuntimeValue evaluate_leaf(ASTNode* node) {
     switch (node->type) {
-        case NODE_NUMBER:
-            if (node->data_type == TYPE_INT64 || node->data_type == TYPE_INT) { // Treat old TYPE_INT as INT64
-                char *endptr;
-                long long int_val = strtoll(node->value.string_val, &endptr, 10);
-                if (node->value.string_val == endptr || *endptr != '\0') {
-                    fprintf(stderr, "Error: Invalid integer literal '%s'\n", node->value.string_val);
-                    return create_error_runtime_value();
-                }
-                if (errno == ERANGE) {
-                    fprintf(stderr, "Error: Integer literal '%s' out of range for int64.\n", node->value.string_val);
-                    return create_error_runtime_value();
-                }
-                return create_int64_runtime_value(int_val);
-            } else if (node->data_type == TYPE_FLOAT) {
-                // Assuming create_number_runtime_value handles TYPE_FLOAT correctly by parsing string to double
-                return create_number_runtime_value(atof(node->value.string_val));
-            } else if (node->data_type == TYPE_INT32) { // Explicitly handle INT32 if parser produces it
-                 char *endptr;
-                // For now, parse as long long and cast, or use strtol if strict 32-bit range is needed
-                long int_val = strtol(node->value.string_val, &endptr, 10);
-                if (node->value.string_val == endptr || *endptr != '\0') {
-                    fprintf(stderr, "Error: Invalid int32 literal '%s'\n", node->value.string_val);
-                    return create_error_runtime_value();
-                }
-                if (errno == ERANGE || int_val > INT32_MAX || int_val < INT32_MIN) {
-                    fprintf(stderr, "Error: Integer literal '%s' out of range for int32.\n", node->value.string_val);
-                    return create_error_runtime_value();
-                }
-                return create_int32_runtime_value((int32_t)int_val);
-            } else {
-                fprintf(stderr, "Error: Unknown data type for NODE_NUMBER: %d\n", node->data_type);
-                return create_error_runtime_value();
+        case NODE_NUMBER: {
+            // Literals are parsed once; afterwards the node is a cached constant.
+            if (node->quick == QUICK_CONST) {
+                RuntimeValue const_val;
+                const_val.type = node->data_type;
+                const_val.val = node->cached_value;
+                return const_val;
+            }
+            RuntimeValue literal_val = evaluate_number_literal(node);
+            if (literal_val.type != TYPE_ERROR) {
+                node->cached_value = literal_val.val;
+                node->data_type = literal_val.type;
+                node->quick = QUICK_CONST;
             }
-        case NODE_STRING: // Added case
-            // The string value is already strdup'd by the parser
-            // create_string_runtime_value will strdup it again. This is important as
-            // the RuntimeValue might be freed (e.g. after print)
+            return literal_val;
+        }
+        case NODE_STRING:
+            // The RuntimeValue gets its own copy, since it may be freed (e.g. after print)
             return create_string_runtime_value(node->value.string_val);
-        case NODE_BOOL:   // Added case
+        case NODE_BOOL:
             return create_bool_runtime_value(node->value.bool_val);
-            
         case NODE_IDENT: {
             Symbol* sym = get_symbol(node->value.string_val);
             if (sym == NULL) {
-                fprintf(stderr, "Error: Undefined variable '%s'\n", node->value.string_val);
+                fprintf(DIAGNOSTICS, "Error: Undefined variable '%s'\n", node->value.string_val);
                 return create_error_runtime_value();
             }
             // Return a copy of the stored RuntimeValue essentially
             RuntimeValue id_val;
             id_val.type = sym->type;
-            id_val.val = sym->val; 
+            id_val.val = sym->val;
             // If it's a string, strdup it for the new RuntimeValue to own,
             // as symbol table's string might be freed/changed.
             if (id_val.type == TYPE_STRING && id_val.val.string_val != NULL) {
-                 id_val.val.string_val = strdup(id_val.val.string_val);
+                 id_val.val.string_val = safe_strdup(id_val.val.string_val);
                  if (id_val.val.string_val == NULL) return create_error_runtime_value(); // strdup failed
             }
             return id_val;
         }
-            
-        case NODE_BINARY:
-            return evaluate_binary_op(node);
-            
-        case NODE_IF:
-            return evaluate_if(node);
-            
-        case NODE_LET:
-            return evaluate_let(node);
-            
-        case NODE_PRINT: {
+        default:
+            fprintf(DIAGNOSTICS, "Error: Unknown AST node type %d in evaluate_node.\n", node->type);
+            return create_error_runtime_value();
+    }
+}
+
+// Evaluate a print statement, given the value to print
+RuntimeValue evaluate_print(RuntimeValue rt_val_to_print) {
+    print_runtime_value(rt_val_to_print);
+    fputc('\n', PROGRAM_OUTPUT);
+    fflush(PROGRAM_OUTPUT);
+    release_runtime_value(&rt_val_to_print);
+    // Print probably shouldn't return the value, but a status or void type
+    return create_void_runtime_value();
+}
+
+// Explicit evaluation stack.
+//
+// evaluate_node never recurses on the C stack: each node being evaluated has a
+// frame recording how far it got (which child it is waiting for), and finished
+// children leave their values on a separate value stack. Both stacks live on the
+// heap and are reused across calls, so C stack use stays constant no matter how
+// deeply the program nests.
+typedef struct {
+    ASTNode* node;
+    int state; // 0 on entry; afterwards node-specific progress
+    int index; // Next statement to run, for blocks
+} EvalFrame;
+
+typedef struct {
+    EvalFrame* frames;
+    int frame_count;
+    int frame_capacity;
+    RuntimeValue* values;
+    int value_count;
+    int value_capacity;
+} EvalStack;
+
+static __thread EvalStack eval_stack = { NULL, 0, 0, NULL, 0, 0 }; // Each thread's own
+
+static void push_eval_frame(ASTNode* node) {
+    if (eval_stack.frame_count == eval_stack.frame_capacity) {
+        int new_capacity = eval_stack.frame_capacity == 0 ? 64 : eval_stack.frame_capacity * 2;
+        EvalFrame* grown = safe_malloc(sizeof(EvalFrame) * new_capacity);
+        if (eval_stack.frames != NULL) {
+            memcpy(grown, eval_stack.frames, sizeof(EvalFrame) * eval_stack.frame_count);
+            safe_free(eval_stack.frames);
+        }
+        eval_stack.frames = grown;
+        eval_stack.frame_capacity = new_capacity;
+    }
+    if (node != NULL) STAT_EVALUATION(node->type);
+    EvalFrame* frame = &eval_stack.frames[eval_stack.frame_count++];
+    frame->node = node;
+    frame->state = 0;
+    frame->index = 0;
+}
+
+static void push_eval_value(RuntimeValue rt_val) {
+    if (eval_stack.value_count == eval_stack.value_capacity) {
+        int new_capacity = eval_stack.value_capacity == 0 ? 64 : eval_stack.value_capacity * 2;
+        RuntimeValue* grown = safe_malloc(sizeof(RuntimeValue) * new_capacity);
+        if (eval_stack.values != NULL) {
+            memcpy(grown, eval_stack.values, sizeof(RuntimeValue) * eval_stack.value_count);
+            safe_free(eval_stack.values);
+        }
+        eval_stack.values = grown;
+        eval_stack.value_capacity = new_capacity;
+    }
+    eval_stack.values[eval_stack.value_count++] = rt_val;
+}
+
+static RuntimeValue pop_eval_value(void) {
+    return eval_stack.values[--eval_stack.value_count];
+}
+
+static ExecMode exec_mode = EXEC_TREE;
+static bool dump_bytecode = false;
+static int tier_threshold = TIER_DEFAULT_THRESHOLD;
+static bool osr_enabled = true;
+
+void set_tier_threshold(int threshold) {
+    tier_threshold = threshold;
+}
+
+void set_osr(bool enabled) {
+    osr_enabled = enabled;
+}
+
+// Tiered execution: run a hot while loop as register bytecode, compiling it on
+// first use. The chunk stays on the node, so later entries skip the walker
+// entirely, and its back-edge counters keep accumulating for the JIT.
+//
+// This is also the on-stack replacement path: a loop that is already running
+// in the walker is handed over at its head, between iterations. The walker's
+// only live state there is the variables, which live in the symbol table;
+// run_register_chunk loads them into the chunk's registers (load_frame) and
+// writes the assigned ones back when the loop exits or fails, so the walker
+// carries on after the loop as if it had run it itself.
+//
+// The chunk speculates on the operand types the walker has seen (see
+// compile_loop_chunk). When a guard fails, the loop deoptimizes: the chunk is
+// thrown away, the walker runs the rest of the current iteration starting with
+// the statement that failed, and '*deoptimized' tells the caller to carry on
+// with the loop itself. Meanwhile the walker's quickening demotes the node
+// that failed, so the next promotion speculates less; a loop that keeps
+// deoptimizing is compiled without speculation.
+static RuntimeValue evaluate_node(ASTNode* root);
+
+#define MAX_LOOP_DEOPTS 3
+
+static RuntimeValue run_promoted_loop(ASTNode* loop, bool* deoptimized) {
+    *deoptimized = false;
+    if (loop->chunk == NULL) {
+        loop->chunk = compile_loop_chunk(loop, loop->deopts < MAX_LOOP_DEOPTS);
+        optimize_chunk(loop->chunk, true);
+        LOG_DEBUG("Tiering: while loop promoted to register bytecode after %d entries and iterations.", loop->hotness);
+        if (dump_bytecode) {
+            disassemble_register_chunk(loop->chunk, stderr);
+        }
+    }
+
+    RuntimeValue result = run_register_chunk(loop->chunk);
+    if (loop->chunk->deopt == NULL) return result;
+
+    // Copy the resume path out of the chunk before discarding it
+    int depth = loop->chunk->deopt->depth;
+    ASTNode** path = NULL;
+    if (depth > 0) {
+        path = safe_malloc(sizeof(ASTNode*) * depth);
+        memcpy(path, loop->chunk->deopt->path, sizeof(ASTNode*) * depth);
+    }
+    free_chunk(loop->chunk);
+    loop->chunk = NULL;
+    loop->hotness = 0;
+    loop->deopts++;
+    *deoptimized = true;
+    LOG_DEBUG("Tiering: speculation failed; while loop deoptimized (%d so far).", loop->deopts);
+
+    // Finish the current iteration in the walker: the failed statement, then
+    // whatever follows it in each enclosing block. An enclosing while is run
+    // from its condition again; an enclosing if is done once its branch is.
+    for (int i = 0; i < depth && result.type != TYPE_ERROR; i++) {
+        ASTNode* child = path[i];
+        ASTNode* parent = i + 1 < depth ? path[i + 1] : NULL;
+        RuntimeValue value = create_void_runtime_value();
+        if (i == 0) {
+            value = evaluate_node(child);
+        }
+        if (parent != NULL && value.type != TYPE_ERROR) {
+            if (parent->type == NODE_BLOCK) {
+                int next = 0;
+                while (parent->statements[next] != child) next++;
+                for (next++; next < parent->statement_count && value.type != TYPE_ERROR; next++) {
+                    release_runtime_value(&value);
+                    value = evaluate_node(parent->statements[next]);
+                }
+            } else if (parent->type == NODE_WHILE) {
+                release_runtime_value(&value);
+                value = evaluate_node(parent);
+            }
+        }
+        if (value.type == TYPE_ERROR) result = value;
+        release_runtime_value(&value);
+    }
+    safe_free(path);
+    return result;
+}
+
+// Dispatch for the evaluation loop.
+//
+// With GCC/Clang the loop is direct-threaded: every handler ends by jumping
+// straight to the handler for the next frame through its own copy of the
+// indirect jump (labels-as-values), so the branch predictor learns each
+// handler's successors separately. Other compilers, or builds with
+// -DZR_NO_COMPUTED_GOTO, use a plain switch in a loop instead.
+#if defined(__GNUC__) && !defined(ZR_NO_COMPUTED_GOTO)
+#define ZR_COMPUTED_GOTO 1
+#endif
+
+#ifdef ZR_COMPUTED_GOTO
+#define EVAL_HANDLER(kind) handler_##kind
+#define EVAL_DISPATCH()                                                   \
+    do {                                                                  \
+        if (eval_stack.frame_count == base_frames) goto finished;         \
+        frame = &eval_stack.frames[eval_stack.frame_count - 1];           \
+        node = frame->node;                                               \
+        if (node == NULL) goto null_node;                                 \
+        goto *dispatch_table[node->type];                                 \
+    } while (0)
+#else
+#define EVAL_HANDLER(kind) case kind
+#define EVAL_DISPATCH() goto dispatch
+#endif
+
+// Start evaluating a child of the current frame. Frame pointers are invalidated
+// by push_eval_frame, so callers record their progress before using this.
+#define EVAL_CHILD(child)                                                 \
+    do {                                                                  \
+        push_eval_frame(child);                                           \
+        EVAL_DISPATCH();                                                  \
+    } while (0)
+
+// Finish the current frame with 'value' and move on to whoever is waiting for it
+#define EVAL_COMPLETE(value)                                              \
+    do {                                                                  \
+        result = (value);                                                 \
+        eval_stack.frame_count--;                                         \
+        if (result.type == TYPE_ERROR) goto failed;                       \
+        push_eval_value(result);                                          \
+        EVAL_DISPATCH();                                                  \
+    } while (0)
+
+// Main evaluation function
+static RuntimeValue evaluate_node(ASTNode* root) {
+    if (root == NULL) return create_error_runtime_value();
+
+#ifdef ZR_COMPUTED_GOTO
+    static void* dispatch_table[] = {
+        [NODE_NUMBER] = &&handler_NODE_NUMBER,
+        [NODE_STRING] = &&handler_NODE_STRING,
+        [NODE_BOOL] = &&handler_NODE_BOOL,
+        [NODE_IDENT] = &&handler_NODE_IDENT,
+        [NODE_BINARY] = &&handler_NODE_BINARY,
+        [NODE_UNARY] = &&handler_unknown,
+        [NODE_LET] = &&handler_NODE_LET,
+        [NODE_IF] = &&handler_NODE_IF,
+        [NODE_WHILE] = &&handler_NODE_WHILE,
+        [NODE_BLOCK] = &&handler_NODE_BLOCK,
+        [NODE_PRINT] = &&handler_NODE_PRINT,
+        [NODE_FUNC] = &&handler_unknown,
+        [NODE_CALL] = &&handler_unknown,
+        [NODE_RETURN] = &&handler_unknown,
+        [NODE_LOADIN] = &&handler_NODE_LOADIN,
+    };
+#endif
+
+    int base_frames = eval_stack.frame_count;
+    int base_values = eval_stack.value_count;
+    EvalFrame* frame;
+    ASTNode* node;
+    RuntimeValue result;
+
+    push_eval_frame(root);
+
+#ifdef ZR_COMPUTED_GOTO
+    EVAL_DISPATCH();
+#else
+dispatch:
+    if (eval_stack.frame_count == base_frames) goto finished;
+    frame = &eval_stack.frames[eval_stack.frame_count - 1];
+    node = frame->node;
+    if (node == NULL) goto null_node;
+    switch (node->type) {
+#endif
+
+    EVAL_HANDLER(NODE_NUMBER):
+    EVAL_HANDLER(NODE_STRING):
+    EVAL_HANDLER(NODE_BOOL):
+    EVAL_HANDLER(NODE_IDENT):
+        EVAL_COMPLETE(evaluate_leaf(node));
+
+    EVAL_HANDLER(NODE_BINARY):
+        if (frame->state == 0) {
+            frame->state = 1;
+            EVAL_CHILD(node->left);
+        }
+        if (frame->state == 1) {
+            frame->state = 2;
+            EVAL_CHILD(node->right);
+        } else {
+            RuntimeValue right_rt = pop_eval_value();
+            RuntimeValue left_rt = pop_eval_value();
+            RuntimeValue binary_rt = evaluate_binary_op(node, left_rt, right_rt);
+            release_runtime_value(&left_rt);
+            release_runtime_value(&right_rt);
+            EVAL_COMPLETE(binary_rt);
+        }
+
+    EVAL_HANDLER(NODE_LET):
+        if (frame->state == 0) {
+            if (node->value.string_val == NULL || node->left == NULL) {
+                fprintf(DIAGNOSTICS, "Error: Invalid let statement structure.\n");
+                EVAL_COMPLETE(create_error_runtime_value());
+            }
+            frame->state = 1;
+            EVAL_CHILD(node->left);
+        }
+        EVAL_COMPLETE(evaluate_let(node, pop_eval_value()));
+
+    EVAL_HANDLER(NODE_PRINT):
+        if (frame->state == 0) {
             if (node->left == NULL) {
-                fprintf(stderr, "Error: Nothing to print\n");
-                return create_error_runtime_value();
+                fprintf(DIAGNOSTICS, "Error: Nothing to print\n");
+                EVAL_COMPLETE(create_error_runtime_value());
             }
-            RuntimeValue rt_val_to_print = evaluate_node(node->left);
-            if (rt_val_to_print.type == TYPE_ERROR) return rt_val_to_print;
-
-            print_runtime_value(rt_val_to_print);
-            printf("\n");
-            fflush(stdout);
-            // If the printed value was a string that was strdup'd (e.g. from IDENT), free it.
-            if (rt_val_to_print.type == TYPE_STRING && rt_val_to_print.val.string_val != NULL) {
-                 safe_free(rt_val_to_print.val.string_val); // Use safe_free
+            frame->state = 1;
+            EVAL_CHILD(node->left);
+        }
+        EVAL_COMPLETE(evaluate_print(pop_eval_value()));
+
+    EVAL_HANDLER(NODE_IF):
+        if (frame->state == 0) {
+            frame->state = 1;
+            EVAL_CHILD(node->condition);
+        }
+        if (frame->state == 1) {
+            RuntimeValue condition_rt_val = pop_eval_value();
+            if (condition_rt_val.type != TYPE_BOOL) {
+                fprintf(DIAGNOSTICS, "Error: If statement condition must be a boolean.\n");
+                release_runtime_value(&condition_rt_val);
+                EVAL_COMPLETE(create_error_runtime_value());
             }
-            // Print probably shouldn't return the value, but a status or void type
-            RuntimeValue print_status; print_status.type = TYPE_VOID; return print_status; 
-        }
-        case NODE_BLOCK: { // Changed from NODE_PROGRAM
-            RuntimeValue last_rt_val_in_block = create_error_runtime_value();
-            bool first_stmt_in_block = true;
-            // Ensure node->statements is not NULL before accessing, though parser should initialize it.
-            if (node->statements == NULL && node->statement_count > 0) {
-                 fprintf(stderr, "Internal Error: NODE_BLOCK has statements but statements array is NULL.\n");
-                 return create_error_runtime_value();
+            ASTNode* branch = condition_rt_val.val.bool_val ? node->body : node->else_body;
+            if (branch == NULL) {
+                // Condition false and no else block
+                EVAL_COMPLETE(create_void_runtime_value());
             }
-            for (int i = 0; i < node->statement_count; i++) {
-                if (node->statements[i] != NULL) {
-                    // Free previous statement's string result if it was one and not the one we are about to return
-                    // This logic is complex and might be better handled by ensuring each operation cleans up its own temporary results.
-                    // For now, this specific cleanup is commented out as it might lead to double frees if not perfectly managed.
-                    /*
-                    if (!first_stmt_in_block && last_rt_val_in_block.type == TYPE_STRING && last_rt_val_in_block.val.string_val != NULL) {
-                        // This logic is tricky: only free if it's an intermediate string result
-                        // For now, assume strings are handled/freed by who creates them (e.g. print)
-                    }
-                    */
-                    last_rt_val_in_block = evaluate_node(node->statements[i]);
-                    if (last_rt_val_in_block.type == TYPE_ERROR) return last_rt_val_in_block;
-                }
-                first_stmt_in_block = false;
+            frame->state = 2;
+            EVAL_CHILD(branch);
+        }
+        EVAL_COMPLETE(pop_eval_value()); // Value of the branch taken
+
+    EVAL_HANDLER(NODE_WHILE):
+        if (exec_mode == EXEC_TIERED && frame->state == 0 &&
+            (node->chunk != NULL || ++node->hotness >= tier_threshold)) {
+            // Hot loop: the register VM takes over at the loop head
+            bool deoptimized;
+            result = run_promoted_loop(node, &deoptimized);
+            if (!deoptimized || result.type == TYPE_ERROR) EVAL_COMPLETE(result);
+            // The walker has finished the iteration the VM gave up on; go on from the condition
+            frame = &eval_stack.frames[eval_stack.frame_count - 1];
+        }
+        if (frame->state == 2) {
+            // Body finished: drop its value and test the condition again
+            RuntimeValue body_rt_val = pop_eval_value();
+            release_runtime_value(&body_rt_val);
+            frame->state = 0;
+            if (exec_mode == EXEC_TIERED && ++node->hotness >= tier_threshold && osr_enabled) {
+                // On-stack replacement: finish this run of the loop in the register VM
+                LOG_DEBUG("Tiering: on-stack replacement of a running while loop.");
+                bool deoptimized;
+                result = run_promoted_loop(node, &deoptimized);
+                if (!deoptimized || result.type == TYPE_ERROR) EVAL_COMPLETE(result);
+                frame = &eval_stack.frames[eval_stack.frame_count - 1];
+            }
+        }
+        if (frame->state == 0) {
+            frame->state = 1;
+            profile_statement = node; // Back from the body
+            EVAL_CHILD(node->condition);
+        }
+        {
+            RuntimeValue condition_rt_val = pop_eval_value();
+            if (condition_rt_val.type != TYPE_BOOL) {
+                fprintf(DIAGNOSTICS, "Error: While loop condition must be a boolean.\n");
+                release_runtime_value(&condition_rt_val);
+                EVAL_COMPLETE(create_error_runtime_value());
+            }
+            if (!condition_rt_val.val.bool_val) {
+                EVAL_COMPLETE(create_void_runtime_value());
             }
-            if (first_stmt_in_block && node->statement_count == 0) { // Empty block
-                 RuntimeValue empty_block_val; empty_block_val.type = TYPE_VOID; return empty_block_val;
+            if (node->body == NULL) {
+                frame->state = 0;
+                EVAL_DISPATCH();
             }
-            // If the block was not empty but all statements were NULL (should not happen with current parser)
-            // or if last_rt_val_in_block was not updated (e.g. only NULL statements), it will return the initialized create_error_runtime_value().
-            // This might be okay, or might need a specific TYPE_VOID if all statements were valid but non-returning.
-            return last_rt_val_in_block;
+            frame->state = 2;
+            EVAL_CHILD(node->body);
         }
 
-        case NODE_LOADIN: // NODE_LOADIN should be handled by process_source_code, not evaluated directly.
-            fprintf(stderr, "Internal Error: NODE_LOADIN encountered in evaluate_node. This should have been processed earlier.\n");
-            return create_error_runtime_value();
-            
-        default: // This is the single default case now
-            fprintf(stderr, "Error: Unknown AST node type %d in evaluate_node.\n", node->type);
-            return create_error_runtime_value();
+    EVAL_HANDLER(NODE_BLOCK):
+        if (node->statements == NULL && node->statement_count > 0) {
+             fprintf(DIAGNOSTICS, "Internal Error: NODE_BLOCK has statements but statements array is NULL.\n");
+             EVAL_COMPLETE(create_error_runtime_value());
+        }
+        if (frame->state == 0) {
+            // Running result of the block: the value of its last statement
+            push_eval_value(create_void_runtime_value());
+            frame->state = 1;
+        } else {
+            RuntimeValue stmt_val = pop_eval_value();
+            release_runtime_value(&eval_stack.values[eval_stack.value_count - 1]);
+            eval_stack.values[eval_stack.value_count - 1] = stmt_val;
+        }
+        while (frame->index < node->statement_count && node->statements[frame->index] == NULL) {
+            frame->index++;
+        }
+        if (frame->index < node->statement_count) {
+            profile_statement = node->statements[frame->index];
+            EVAL_CHILD(node->statements[frame->index++]);
+        }
+        EVAL_COMPLETE(pop_eval_value());
+
+    EVAL_HANDLER(NODE_LOADIN): // NODE_LOADIN should be handled by process_source_code, not evaluated directly.
+        fprintf(DIAGNOSTICS, "Internal Error: NODE_LOADIN encountered in evaluate_node. This should have been processed earlier.\n");
+        EVAL_COMPLETE(create_error_runtime_value());
+
+#ifdef ZR_COMPUTED_GOTO
+    handler_unknown:
+#else
+    default:
+#endif
+        fprintf(DIAGNOSTICS, "Error: Unknown AST node type %d in evaluate_node.\n", node->type);
+        EVAL_COMPLETE(create_error_runtime_value());
+
+#ifndef ZR_COMPUTED_GOTO
+    }
+#endif
+
+null_node:
+    EVAL_COMPLETE(create_error_runtime_value());
+
+failed:
+    // Errors abort the whole evaluation: drop everything this call pushed.
+    while (eval_stack.value_count > base_values) {
+        RuntimeValue pending = pop_eval_value();
+        release_runtime_value(&pending);
+    }
+    eval_stack.frame_count = base_frames;
+    return result;
+
+finished:
+    return pop_eval_value();
+}
+
+#undef EVAL_HANDLER
+#undef EVAL_DISPATCH
+#undef EVAL_CHILD
+#undef EVAL_COMPLETE
+
+void set_exec_mode(ExecMode mode) {
+    exec_mode = mode;
+}
+
+void set_dump_bytecode(bool enabled) {
+    dump_bytecode = enabled;
+}
+
+// Compile a module's code block to stack bytecode and run it
+static RuntimeValue execute_on_stack_vm(ASTNode* program_node) {
+    Chunk* chunk = compile_chunk(program_node);
+    if (dump_bytecode) {
+        disassemble_chunk(chunk, stderr);
+    }
+    RuntimeValue result = run_chunk(chunk);
+    free_chunk(chunk);
+    return result;
+}
+
+// Compile a module's code block to register bytecode and run it
+static RuntimeValue execute_on_register_vm(ASTNode* program_node) {
+    Chunk* chunk = compile_register_chunk(program_node);
+    optimize_chunk(chunk, true);
+    if (dump_bytecode) {
+        disassemble_register_chunk(chunk, stderr);
     }
+    RuntimeValue result = run_register_chunk(chunk);
+    free_chunk(chunk);
+    return result;
 }
 
 // Public interface
-void interpret(ASTNode* program_node) {
+bool interpret(ASTNode* program_node) {
     // program_node is typically a NODE_BLOCK containing statements for the current module/file.
     if (program_node == NULL) {
         LOG_DEBUG("interpret called with NULL program_node.");
-        return;
+        return true;
     }
     if (program_node->type != NODE_BLOCK && program_node->statement_count == 0 && program_node->type != NODE_PRINT /* and other single valid statements */) {
         // Allow interpret to be called with single statements if needed, though current plan has it called with a block.
@@ -610,7 +1199,28 @@ void interpret(ASTNode* program_node) {
         LOG_DEBUG("Interpreting a non-block node or empty block directly. Node type: %d", program_node->type);
     }
 
-    RuntimeValue final_result = evaluate_node(program_node);
+    RuntimeValue final_result;
+    switch (exec_mode) {
+        case EXEC_STACK_VM:
+            final_result = execute_on_stack_vm(program_node);
+            break;
+        case EXEC_REGISTER_VM:
+            final_result = execute_on_register_vm(program_node);
+            break;
+        case EXEC_AOT:
+            aot_add_module(program_node);
+            final_result = create_void_runtime_value();
+            break;
+        case EXEC_ELF:
+            elf_add_module(program_node);
+            final_result = create_void_runtime_value();
+            break;
+        case EXEC_TREE:
+        case EXEC_TIERED:
+        default:
+            final_result = evaluate_node(program_node);
+            break;
+    }
 
     // Clean up any dynamically allocated memory in the result, if needed
     switch (final_result.type) {
@@ -630,24 +1240,57 @@ void interpret(ASTNode* program_node) {
             // No dynamic memory to free for these types
             break;
     }
+    return final_result.type != TYPE_ERROR;
 }
 
-// Function to free all memory allocated by the interpreter (symbol table)
-void free_interpreter_memory() {
-    for (int i = 0; i < symbol_count; i++) {
+// Free the variables of a symbol table, leaving it empty
+void clear_symbol_table(SymbolTable* table) {
+    for (int i = 0; i < table->count; i++) {
         // Free symbol name
-        if (symbol_table[i].name) {
-            safe_free(symbol_table[i].name);
-            symbol_table[i].name = NULL;
+        if (table->entries[i].name) {
+            safe_free(table->entries[i].name);
+            table->entries[i].name = NULL;
         }
         // Free value if it's a string
-        if (symbol_table[i].type == TYPE_STRING && symbol_table[i].val.string_val) {
-            safe_free(symbol_table[i].val.string_val);
-            symbol_table[i].val.string_val = NULL;
+        if (table->entries[i].type == TYPE_STRING && table->entries[i].val.string_val) {
+            safe_free(table->entries[i].val.string_val);
+            table->entries[i].val.string_val = NULL;
         }
         // Optionally, clear the rest of the symbol struct for safety
-        symbol_table[i].type = TYPE_VOID;
-        memset(&symbol_table[i].val, 0, sizeof(symbol_table[i].val));
+        table->entries[i].type = TYPE_VOID;
+        memset(&table->entries[i].val, 0, sizeof(table->entries[i].val));
     }
-    symbol_count = 0;
+    table->count = 0;
+}
+
+SymbolTable* create_symbol_table(void) {
+    SymbolTable* table = safe_malloc(sizeof(SymbolTable));
+    table->count = 0;
+    return table;
+}
+
+void free_symbol_table(SymbolTable* table) {
+    if (table == NULL) return;
+    clear_symbol_table(table);
+    if (symbol_table == table) symbol_table = &default_symbol_table;
+    safe_free(table);
+}
+
+void set_symbol_table(SymbolTable* table) {
+    symbol_table = table != NULL ? table : &default_symbol_table;
+}
+
+// Function to free all memory allocated by the interpreter (symbol table)
+void free_interpreter_memory() {
+    clear_symbol_table(symbol_table);
+    free_eval_stack();
+}
+
+void free_eval_stack(void) {
+    safe_free(eval_stack.frames);
+    safe_free(eval_stack.values);
+    eval_stack.frames = NULL;
+    eval_stack.values = NULL;
+    eval_stack.frame_count = eval_stack.frame_capacity = 0;
+    eval_stack.value_count = eval_stack.value_capacity = 0;
 }
\ No newline at end of file
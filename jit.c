@@ -0,0 +1,556 @@
+#include "compiler.h"
+#include "vm.h"
+#include "x86_64.h"
+#include "debug.h"
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Baseline template JIT: register bytecode -> x86-64.
+//
+// Each instruction becomes a fixed template operating directly on the
+// register VM's register file, so native code can be entered (and left) at
+// any instruction without translating state. Templates inline int64 and float
+// arithmetic and comparisons, guarded on the operands' type tags; constant
+// operands are folded into immediates and need no guard. Anything else
+// (strings, int32, declared-type conversions, print, runtime errors) takes
+// the instruction's slow path, which calls execute_register_instruction()
+// and then continues in native code at whatever pc that returns.
+//
+// Register use in generated code:
+//   rbx  register file (RuntimeValue*)
+//   r12  dirty flags (bool*)
+//   r13  the JitFrame, passed to the slow path
+//   rax, rcx, rdx, xmm0-xmm2  scratch
+
+#if defined(__x86_64__) && !defined(_WIN32) && !defined(ZR_NO_JIT)
+#define ZR_JIT_SUPPORTED 1
+#include <sys/mman.h>
+#endif
+
+struct NativeCode {
+    uint8_t* memory;       // Executable pages holding the code
+    size_t size;
+    size_t* entry_offsets; // Native offset of each bytecode instruction
+};
+
+typedef struct {
+    Chunk* chunk;
+    RuntimeValue* registers;
+    bool* dirty;
+} JitFrame;
+
+#ifdef ZR_JIT_SUPPORTED
+
+typedef int (*NativeEntry)(JitFrame* frame, const uint8_t* start);
+
+#define EXIT_FAILED   (-1) // Jump target: leave native code reporting an error
+#define EXIT_RETURN   (-2) // Jump target: leave native code with eax as the resume pc
+#define MAX_SLOW_JUMPS 16
+
+typedef struct {
+    size_t at;  // rel32 field to patch
+    int target; // Bytecode pc, or one of the EXIT_* targets
+} JumpFixup;
+
+typedef struct {
+    const Chunk* chunk;
+    CodeBuffer code;
+    size_t* offsets;
+    JumpFixup* fixups;
+    int fixup_count;
+    int fixup_capacity;
+    size_t slow_jumps[MAX_SLOW_JUMPS]; // Guards of the current instruction that fail over to its slow path
+    int slow_jump_count;
+} JitCompiler;
+
+static int jit_slow_path(JitFrame* frame, int pc) {
+    return execute_register_instruction(frame->chunk, frame->registers, frame->dirty, pc);
+}
+
+static int32_t tag_disp(int reg) {
+    return (int32_t)(reg * sizeof(RuntimeValue) + offsetof(RuntimeValue, type));
+}
+
+static int32_t value_disp(int reg) {
+    return (int32_t)(reg * sizeof(RuntimeValue) + offsetof(RuntimeValue, val));
+}
+
+static void add_fixup(JitCompiler* jc, size_t at, int target) {
+    if (jc->fixup_count == jc->fixup_capacity) {
+        int new_capacity = jc->fixup_capacity == 0 ? 64 : jc->fixup_capacity * 2;
+        JumpFixup* grown = safe_malloc(sizeof(JumpFixup) * new_capacity);
+        if (jc->fixups != NULL) {
+            memcpy(grown, jc->fixups, sizeof(JumpFixup) * jc->fixup_count);
+            safe_free(jc->fixups);
+        }
+        jc->fixups = grown;
+        jc->fixup_capacity = new_capacity;
+    }
+    jc->fixups[jc->fixup_count].at = at;
+    jc->fixups[jc->fixup_count].target = target;
+    jc->fixup_count++;
+}
+
+static void jump_to(JitCompiler* jc, int target) {
+    add_fixup(jc, x86_jmp(&jc->code), target);
+}
+
+static void branch_to(JitCompiler* jc, X86Condition cc, int target) {
+    add_fixup(jc, x86_jcc(&jc->code, cc), target);
+}
+
+// Guard: continue on the fast path only if 'cc' does not hold
+static void slow_if(JitCompiler* jc, X86Condition cc) {
+    if (jc->slow_jump_count == MAX_SLOW_JUMPS) {
+        error("JIT: too many guards in one instruction.");
+    }
+    jc->slow_jumps[jc->slow_jump_count++] = x86_jcc(&jc->code, cc);
+}
+
+static void slow_always(JitCompiler* jc) {
+    if (jc->slow_jump_count == MAX_SLOW_JUMPS) {
+        error("JIT: too many guards in one instruction.");
+    }
+    jc->slow_jumps[jc->slow_jump_count++] = x86_jmp(&jc->code);
+}
+
+static void guard_tag(JitCompiler* jc, int reg, DataType expected) {
+    x86_cmp32_mem_imm(&jc->code, X86_RBX, tag_disp(reg), (uint32_t)expected);
+    slow_if(jc, X86_CC_NE);
+}
+
+// The destination's old value is overwritten in place, so it must not own a string
+static void guard_destination(JitCompiler* jc, int reg) {
+    x86_cmp32_mem_imm(&jc->code, X86_RBX, tag_disp(reg), (uint32_t)TYPE_STRING);
+    slow_if(jc, X86_CC_E);
+}
+
+static DataType operand_static_type(const Chunk* chunk, int operand) {
+    return RK_IS_CONSTANT(operand) ? chunk->constants[RK_CONSTANT_INDEX(operand)].type : TYPE_VOID;
+}
+
+static void load_int_operand(JitCompiler* jc, X86Register dst, int operand) {
+    if (RK_IS_CONSTANT(operand)) {
+        x86_mov_imm64(&jc->code, dst, (uint64_t)jc->chunk->constants[RK_CONSTANT_INDEX(operand)].val.int64_val);
+    } else {
+        guard_tag(jc, operand, TYPE_INT64);
+        x86_load64(&jc->code, dst, X86_RBX, value_disp(operand));
+    }
+}
+
+static void load_float_operand(JitCompiler* jc, X86XmmRegister dst, int operand) {
+    if (RK_IS_CONSTANT(operand)) {
+        uint64_t bits;
+        double value = jc->chunk->constants[RK_CONSTANT_INDEX(operand)].val.float_val;
+        memcpy(&bits, &value, sizeof(bits));
+        x86_mov_imm64(&jc->code, X86_RAX, bits);
+        x86_movq_to_xmm(&jc->code, dst, X86_RAX);
+    } else {
+        guard_tag(jc, operand, TYPE_FLOAT);
+        x86_movsd_load(&jc->code, dst, X86_RBX, value_disp(operand));
+    }
+}
+
+static bool is_arithmetic(BinaryOp op) {
+    return op == BINOP_ADD || op == BINOP_SUB || op == BINOP_MUL || op == BINOP_DIV;
+}
+
+static bool is_comparison(BinaryOp op) {
+    return op >= BINOP_GT && op <= BINOP_NOTEQ;
+}
+
+// Multiply or divide rax by a constant d >= 2 without imul/idiv where that is
+// cheaper (see regopt.c): shifts for powers of two, a multiply by the magic
+// number for other divisors. Same results as C's truncating division.
+static bool emit_int_by_constant(JitCompiler* jc, BinaryOp op, int64_t d) {
+    if ((d & (d - 1)) == 0) {
+        int shift = __builtin_ctzll((uint64_t)d);
+        if (op == BINOP_MUL) {
+            if (shift > 62) return false;
+            x86_shift_imm(&jc->code, X86_SHL, X86_RAX, (uint8_t)shift);
+            return true;
+        }
+        // Bias negative dividends by d - 1 so the shift rounds toward zero
+        x86_mov_reg(&jc->code, X86_RCX, X86_RAX);
+        x86_shift_imm(&jc->code, X86_SAR, X86_RCX, 63);
+        x86_shift_imm(&jc->code, X86_SHR, X86_RCX, (uint8_t)(64 - shift));
+        x86_alu(&jc->code, X86_ADD, X86_RAX, X86_RCX);
+        x86_shift_imm(&jc->code, X86_SAR, X86_RAX, (uint8_t)shift);
+        return true;
+    }
+    if (op != BINOP_DIV) return false;
+
+    int64_t magic;
+    int shift;
+    division_magic(d, &magic, &shift);
+    x86_mov_reg(&jc->code, X86_RCX, X86_RAX);
+    x86_mov_imm64(&jc->code, X86_RAX, (uint64_t)magic);
+    x86_imul_wide(&jc->code, X86_RCX);
+    if (magic < 0) x86_alu(&jc->code, X86_ADD, X86_RDX, X86_RCX);
+    if (shift > 0) x86_shift_imm(&jc->code, X86_SAR, X86_RDX, (uint8_t)shift);
+    x86_mov_reg(&jc->code, X86_RAX, X86_RDX);
+    x86_shift_imm(&jc->code, X86_SHR, X86_RAX, 63);
+    x86_alu(&jc->code, X86_ADD, X86_RAX, X86_RDX);
+    return true;
+}
+
+// Operation on int64 operands: arithmetic leaves its result in rax, a
+// comparison leaves 0/1 in rax.
+static void emit_int_operation(JitCompiler* jc, BinaryOp op, int left, int right) {
+    load_int_operand(jc, X86_RAX, left);
+    if ((op == BINOP_MUL || op == BINOP_DIV) && RK_IS_CONSTANT(right) &&
+        jc->chunk->constants[RK_CONSTANT_INDEX(right)].val.int64_val >= 2 &&
+        emit_int_by_constant(jc, op, jc->chunk->constants[RK_CONSTANT_INDEX(right)].val.int64_val)) {
+        return;
+    }
+    load_int_operand(jc, X86_RCX, right);
+    switch (op) {
+        case BINOP_ADD: x86_alu(&jc->code, X86_ADD, X86_RAX, X86_RCX); return;
+        case BINOP_SUB: x86_alu(&jc->code, X86_SUB, X86_RAX, X86_RCX); return;
+        case BINOP_MUL: x86_imul(&jc->code, X86_RAX, X86_RCX); return;
+        case BINOP_DIV:
+            // Division by zero is reported by the slow path; INT64_MIN / -1 is left to it too
+            x86_alu_imm32(&jc->code, X86_CMP, X86_RCX, 0);
+            slow_if(jc, X86_CC_E);
+            x86_alu_imm32(&jc->code, X86_CMP, X86_RCX, -1);
+            slow_if(jc, X86_CC_E);
+            x86_cqo(&jc->code);
+            x86_idiv(&jc->code, X86_RCX);
+            return;
+        default:
+            break;
+    }
+
+    X86Condition cc;
+    switch (op) {
+        case BINOP_GT:   cc = X86_CC_G; break;
+        case BINOP_LT:   cc = X86_CC_L; break;
+        case BINOP_EQ:   cc = X86_CC_E; break;
+        case BINOP_LTEQ: cc = X86_CC_LE; break;
+        case BINOP_GTEQ: cc = X86_CC_GE; break;
+        default:         cc = X86_CC_NE; break;
+    }
+    x86_alu(&jc->code, X86_CMP, X86_RAX, X86_RCX);
+    x86_setcc(&jc->code, cc, X86_RAX);
+    x86_movzx8(&jc->code, X86_RAX, X86_RAX);
+}
+
+// Operation on float operands: arithmetic leaves its result in xmm0, a
+// comparison leaves 0/1 in rax (false when either side is NaN, as in C).
+static void emit_float_operation(JitCompiler* jc, BinaryOp op, int left, int right) {
+    load_float_operand(jc, X86_XMM0, left);
+    load_float_operand(jc, X86_XMM1, right);
+    switch (op) {
+        case BINOP_ADD: x86_sse_arith(&jc->code, X86_ADDSD, X86_XMM0, X86_XMM1); return;
+        case BINOP_SUB: x86_sse_arith(&jc->code, X86_SUBSD, X86_XMM0, X86_XMM1); return;
+        case BINOP_MUL: x86_sse_arith(&jc->code, X86_MULSD, X86_XMM0, X86_XMM1); return;
+        case BINOP_DIV:
+            x86_xorpd(&jc->code, X86_XMM2, X86_XMM2);
+            x86_ucomisd(&jc->code, X86_XMM1, X86_XMM2);
+            slow_if(jc, X86_CC_E); // Zero (or NaN): let the slow path decide
+            x86_sse_arith(&jc->code, X86_DIVSD, X86_XMM0, X86_XMM1);
+            return;
+        default:
+            break;
+    }
+
+    switch (op) {
+        case BINOP_GT:   x86_ucomisd(&jc->code, X86_XMM0, X86_XMM1); x86_setcc(&jc->code, X86_CC_A, X86_RAX); break;
+        case BINOP_GTEQ: x86_ucomisd(&jc->code, X86_XMM0, X86_XMM1); x86_setcc(&jc->code, X86_CC_AE, X86_RAX); break;
+        case BINOP_LT:   x86_ucomisd(&jc->code, X86_XMM1, X86_XMM0); x86_setcc(&jc->code, X86_CC_A, X86_RAX); break;
+        case BINOP_LTEQ: x86_ucomisd(&jc->code, X86_XMM1, X86_XMM0); x86_setcc(&jc->code, X86_CC_AE, X86_RAX); break;
+        case BINOP_EQ:
+            x86_ucomisd(&jc->code, X86_XMM0, X86_XMM1);
+            x86_setcc(&jc->code, X86_CC_E, X86_RAX);
+            x86_setcc(&jc->code, X86_CC_NP, X86_RCX);
+            x86_movzx8(&jc->code, X86_RCX, X86_RCX);
+            x86_movzx8(&jc->code, X86_RAX, X86_RAX);
+            x86_alu(&jc->code, X86_AND, X86_RAX, X86_RCX);
+            return;
+        default: // BINOP_NOTEQ
+            x86_ucomisd(&jc->code, X86_XMM0, X86_XMM1);
+            x86_setcc(&jc->code, X86_CC_NE, X86_RAX);
+            x86_setcc(&jc->code, X86_CC_P, X86_RCX);
+            x86_movzx8(&jc->code, X86_RCX, X86_RCX);
+            x86_movzx8(&jc->code, X86_RAX, X86_RAX);
+            x86_alu(&jc->code, X86_OR, X86_RAX, X86_RCX);
+            return;
+    }
+    x86_movzx8(&jc->code, X86_RAX, X86_RAX);
+}
+
+static void store_result(JitCompiler* jc, int dest, DataType type, bool in_xmm) {
+    if (in_xmm) {
+        x86_movsd_store(&jc->code, X86_RBX, value_disp(dest), X86_XMM0);
+    } else {
+        x86_store64(&jc->code, X86_RBX, value_disp(dest), X86_RAX);
+    }
+    x86_store32_imm(&jc->code, X86_RBX, tag_disp(dest), (uint32_t)type);
+    x86_store8_imm(&jc->code, X86_R12, dest, 1);
+}
+
+// Fast path of a binary operation for one operand family, ending in a jump
+// to the next instruction (or to the branch target)
+static void emit_binary_family(JitCompiler* jc, const Instruction* instr, int pc, DataType family) {
+    BinaryOp op = (BinaryOp)instr->binop;
+    bool compare = is_comparison(op);
+
+    if (instr->op == ROP_BINARY) {
+        DataType result_type = compare ? TYPE_BOOL : family;
+        if (instr->type != TYPE_VOID && instr->type != result_type) {
+            slow_always(jc); // Needs a conversion
+            return;
+        }
+        if (family == TYPE_INT64) emit_int_operation(jc, op, instr->b, instr->c);
+        else emit_float_operation(jc, op, instr->b, instr->c);
+        store_result(jc, instr->a, result_type, family == TYPE_FLOAT && !compare);
+        jump_to(jc, pc + 1);
+    } else { // ROP_JUMP_UNLESS_CMP
+        if (family == TYPE_INT64) emit_int_operation(jc, op, instr->a, instr->b);
+        else emit_float_operation(jc, op, instr->a, instr->b);
+        x86_test8(&jc->code, X86_RAX, X86_RAX);
+        branch_to(jc, X86_CC_E, instr->c);
+        jump_to(jc, pc + 1);
+    }
+}
+
+static void emit_binary(JitCompiler* jc, const Instruction* instr, int pc) {
+    BinaryOp op = (BinaryOp)instr->binop;
+    int left = instr->op == ROP_BINARY ? instr->b : instr->a;
+    int right = instr->op == ROP_BINARY ? instr->c : instr->b;
+    if (!is_arithmetic(op) && !is_comparison(op)) return; // Logical operators: slow path only
+
+    if (instr->op == ROP_BINARY) {
+        guard_destination(jc, instr->a);
+    }
+
+    DataType left_type = operand_static_type(jc->chunk, left);
+    DataType right_type = operand_static_type(jc->chunk, right);
+    DataType known = left_type != TYPE_VOID ? left_type : right_type;
+
+    if (known == TYPE_VOID) {
+        // Two registers: pick the family from the left operand's tag at runtime
+        x86_load32(&jc->code, X86_RDX, X86_RBX, tag_disp(left));
+        x86_cmp32_imm(&jc->code, X86_RDX, TYPE_FLOAT);
+        size_t to_float = x86_jcc(&jc->code, X86_CC_E);
+        emit_binary_family(jc, instr, pc, TYPE_INT64);
+        x86_patch_jump(&jc->code, to_float, jc->code.count);
+        emit_binary_family(jc, instr, pc, TYPE_FLOAT);
+        return;
+    }
+
+    bool both_match = (left_type == TYPE_VOID || left_type == known) && (right_type == TYPE_VOID || right_type == known);
+    if (both_match && (known == TYPE_INT64 || known == TYPE_FLOAT)) {
+        emit_binary_family(jc, instr, pc, known);
+    }
+    // Any other constant types: slow path only
+}
+
+static void emit_move(JitCompiler* jc, const Instruction* instr, int pc) {
+    DataType declared = (DataType)instr->type;
+
+    if (RK_IS_CONSTANT(instr->b)) {
+        RuntimeValue constant = jc->chunk->constants[RK_CONSTANT_INDEX(instr->b)];
+        if (constant.type == TYPE_STRING || (declared != TYPE_VOID && declared != constant.type)) return;
+        guard_destination(jc, instr->a);
+        uint64_t bits = 0;
+        if (constant.type == TYPE_BOOL) bits = constant.val.bool_val ? 1 : 0;
+        else if (constant.type == TYPE_INT32) bits = (uint32_t)constant.val.int32_val;
+        else memcpy(&bits, &constant.val, sizeof(bits));
+        x86_mov_imm64(&jc->code, X86_RAX, bits);
+        store_result(jc, instr->a, constant.type, false);
+        jump_to(jc, pc + 1);
+        return;
+    }
+
+    if (declared == TYPE_STRING) return;
+    guard_destination(jc, instr->a);
+    x86_load32(&jc->code, X86_RDX, X86_RBX, tag_disp(instr->b));
+    if (declared != TYPE_VOID) {
+        x86_cmp32_imm(&jc->code, X86_RDX, declared);
+        slow_if(jc, X86_CC_NE);
+    } else {
+        // Undefined variables and strings need the runtime
+        x86_cmp32_imm(&jc->code, X86_RDX, TYPE_VOID);
+        slow_if(jc, X86_CC_E);
+        x86_cmp32_imm(&jc->code, X86_RDX, TYPE_STRING);
+        slow_if(jc, X86_CC_E);
+    }
+    x86_load64(&jc->code, X86_RAX, X86_RBX, value_disp(instr->b));
+    x86_store64(&jc->code, X86_RBX, value_disp(instr->a), X86_RAX);
+    x86_store32(&jc->code, X86_RBX, tag_disp(instr->a), X86_RDX);
+    x86_store8_imm(&jc->code, X86_R12, instr->a, 1);
+    jump_to(jc, pc + 1);
+}
+
+static void emit_jump_if_false(JitCompiler* jc, const Instruction* instr, int pc) {
+    if (RK_IS_CONSTANT(instr->a)) {
+        RuntimeValue constant = jc->chunk->constants[RK_CONSTANT_INDEX(instr->a)];
+        if (constant.type != TYPE_BOOL) return;
+        jump_to(jc, constant.val.bool_val ? pc + 1 : instr->b);
+        return;
+    }
+    guard_tag(jc, instr->a, TYPE_BOOL);
+    x86_cmp8_mem_imm(&jc->code, X86_RBX, value_disp(instr->a), 0);
+    branch_to(jc, X86_CC_E, instr->b);
+    jump_to(jc, pc + 1);
+}
+
+// Slow path of the instruction at 'pc': run it in the interpreter, then go
+// where it says (the failure exit if it reported an error)
+static void emit_slow_path(JitCompiler* jc, const Instruction* instr, int pc) {
+    for (int i = 0; i < jc->slow_jump_count; i++) {
+        x86_patch_jump(&jc->code, jc->slow_jumps[i], jc->code.count);
+    }
+    jc->slow_jump_count = 0;
+
+    x86_mov_reg(&jc->code, X86_RDI, X86_R13);
+    x86_mov_imm32(&jc->code, X86_RSI, (uint32_t)pc);
+    x86_mov_imm64(&jc->code, X86_RAX, (uint64_t)(uintptr_t)&jit_slow_path);
+    x86_call_reg(&jc->code, X86_RAX);
+    x86_cmp32_imm(&jc->code, X86_RAX, (uint32_t)-1);
+    branch_to(jc, X86_CC_E, EXIT_FAILED);
+
+    int target = -1;
+    if (instr->op == ROP_JUMP_IF_FALSE) target = instr->b;
+    if (instr->op == ROP_JUMP_UNLESS_CMP) target = instr->c;
+    if (target >= 0) {
+        x86_cmp32_imm(&jc->code, X86_RAX, (uint32_t)target);
+        branch_to(jc, X86_CC_E, target);
+    }
+    jump_to(jc, pc + 1);
+}
+
+static void emit_instruction(JitCompiler* jc, int pc) {
+    // Speculative instructions compile like their generic forms: native code
+    // has guards of its own, and its slow path never deoptimizes
+    Instruction generic = jc->chunk->code[pc];
+    generic.op = generic_register_opcode(generic.op);
+    const Instruction* instr = &generic;
+    switch (instr->op) {
+        case ROP_JUMP:
+            jump_to(jc, instr->a);
+            return;
+        case ROP_HALT:
+            x86_mov_imm32(&jc->code, X86_RAX, (uint32_t)pc);
+            jump_to(jc, EXIT_RETURN);
+            return;
+        case ROP_MOVE:
+        case ROP_INVARIANT: // A move from the PRECOMPUTE register; the slow path handles TYPE_VOID
+            emit_move(jc, instr, pc);
+            break;
+        case ROP_BINARY:
+        case ROP_JUMP_UNLESS_CMP:
+            emit_binary(jc, instr, pc);
+            break;
+        case ROP_JUMP_IF_FALSE:
+            emit_jump_if_false(jc, instr, pc);
+            break;
+        default:
+            break; // Print, fail: runtime only
+    }
+    emit_slow_path(jc, instr, pc);
+}
+
+NativeCode* jit_compile(const Chunk* chunk) {
+    JitCompiler jc;
+    memset(&jc, 0, sizeof(jc));
+    jc.chunk = chunk;
+    code_init(&jc.code);
+    jc.offsets = safe_malloc(sizeof(size_t) * (chunk->count + 1));
+
+    // Prologue: int native(JitFrame* frame /* rdi */, const uint8_t* start /* rsi */).
+    // Three pushes keep the stack 16-byte aligned for slow path calls.
+    x86_push(&jc.code, X86_RBX);
+    x86_push(&jc.code, X86_R12);
+    x86_push(&jc.code, X86_R13);
+    x86_mov_reg(&jc.code, X86_R13, X86_RDI);
+    x86_load64(&jc.code, X86_RBX, X86_R13, (int32_t)offsetof(JitFrame, registers));
+    x86_load64(&jc.code, X86_R12, X86_R13, (int32_t)offsetof(JitFrame, dirty));
+    x86_jmp_reg(&jc.code, X86_RSI);
+
+    for (int pc = 0; pc < chunk->count; pc++) {
+        jc.offsets[pc] = jc.code.count;
+        if (profiling) {
+            // Publish the pc for --profile, as the VM does on each dispatch
+            x86_mov_imm64(&jc.code, X86_RAX, (uint64_t)(uintptr_t)&profile_pc);
+            x86_store32_imm(&jc.code, X86_RAX, 0, (uint32_t)pc);
+        }
+        emit_instruction(&jc, pc);
+    }
+
+    size_t failed_exit = jc.code.count;
+    x86_mov_imm32(&jc.code, X86_RAX, (uint32_t)-1);
+    size_t return_exit = jc.code.count;
+    x86_pop(&jc.code, X86_R13);
+    x86_pop(&jc.code, X86_R12);
+    x86_pop(&jc.code, X86_RBX);
+    x86_ret(&jc.code);
+
+    for (int i = 0; i < jc.fixup_count; i++) {
+        int target = jc.fixups[i].target;
+        size_t destination = target == EXIT_FAILED ? failed_exit
+                           : target == EXIT_RETURN ? return_exit
+                           : jc.offsets[target];
+        x86_patch_jump(&jc.code, jc.fixups[i].at, destination);
+    }
+    safe_free(jc.fixups);
+
+    void* memory = mmap(NULL, jc.code.count, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (memory == MAP_FAILED) {
+        LOG_DEBUG("JIT: mmap of %zu bytes failed.", jc.code.count);
+        code_free(&jc.code);
+        safe_free(jc.offsets);
+        return NULL;
+    }
+    memcpy(memory, jc.code.bytes, jc.code.count);
+    if (mprotect(memory, jc.code.count, PROT_READ | PROT_EXEC) != 0) {
+        LOG_DEBUG("JIT: could not make code executable.");
+        munmap(memory, jc.code.count);
+        code_free(&jc.code);
+        safe_free(jc.offsets);
+        return NULL;
+    }
+
+    NativeCode* native = safe_malloc(sizeof(NativeCode));
+    native->memory = memory;
+    native->size = jc.code.count;
+    native->entry_offsets = jc.offsets;
+    code_free(&jc.code);
+
+    LOG_DEBUG("JIT: compiled %d instructions into %zu bytes of native code.", chunk->count, native->size);
+    return native;
+}
+
+int jit_execute(NativeCode* native, Chunk* chunk, RuntimeValue* registers, bool* dirty, int pc) {
+    JitFrame frame = { chunk, registers, dirty };
+    NativeEntry entry = (NativeEntry)(void*)native->memory;
+    return entry(&frame, native->memory + native->entry_offsets[pc]);
+}
+
+void jit_free(NativeCode* native) {
+    if (native == NULL) return;
+    munmap(native->memory, native->size);
+    safe_free(native->entry_offsets);
+    safe_free(native);
+}
+
+#else // !ZR_JIT_SUPPORTED
+
+NativeCode* jit_compile(const Chunk* chunk) {
+    (void)chunk;
+    return NULL; // The register VM keeps interpreting
+}
+
+int jit_execute(NativeCode* native, Chunk* chunk, RuntimeValue* registers, bool* dirty, int pc) {
+    (void)native;
+    return execute_register_instruction(chunk, registers, dirty, pc);
+}
+
+void jit_free(NativeCode* native) {
+    (void)native;
+}
+
+#endif
@@ -367,12 +367,23 @@ void* safe_malloc(size_t size) {
         perror("malloc");
         exit(EXIT_FAILURE);
     }
+    STAT_ALLOCATION(size);
     return ptr;
 }
 
+// Copy a string with safe_malloc, so --stats sees the allocation
+char* safe_strdup(const char* text) {
+    if (text == NULL) return NULL;
+    size_t size = strlen(text) + 1;
+    char* copy = safe_malloc(size);
+    memcpy(copy, text, size);
+    return copy;
+}
+
 // Implementation of safe_free
 void safe_free(void* ptr) {
     if (ptr != NULL) {
+        STAT_FREE(ptr);
         free(ptr);
     }
 }
@@ -0,0 +1,238 @@
+#include "zr.h"
+#include "compiler.h"
+#include "vm.h"
+#include <setjmp.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// The embedding API (zr.h). The interpreter keeps its state behind pointers
+// that default to the CLI's instances: the symbol table (interpreter.c), the
+// type environment (typecheck.c) and the module registry (loader.c). A
+// context owns one of each and selects them for the duration of a call, with
+// diagnostics going to a memory stream and error() unwinding to the call
+// instead of exiting. The selections are per thread, so contexts can run
+// on several threads at once (see pool.c).
+
+struct ZrContext {
+    SymbolTable* symbols;
+    TypeEnv* types;
+    LoadedModulesRegistry modules;
+    ASTNode* program; // Last source loaded; NULL until a load succeeds
+    FILE* output;     // For 'print'; NULL: stdout
+    char* messages;   // Diagnostics of the last zr_load or zr_run
+    size_t messages_size;
+};
+
+static void select_context(ZrContext* context) {
+    set_symbol_table(context != NULL ? context->symbols : NULL);
+    set_type_env(context != NULL ? context->types : NULL);
+    set_module_registry(context != NULL ? &context->modules : NULL);
+    program_output = context != NULL ? context->output : NULL;
+}
+
+// Start a call that can fail: the context's state is selected and messages
+// are collected, until end_call
+static void begin_call(ZrContext* context, jmp_buf* recovery) {
+    free(context->messages);
+    context->messages = NULL;
+    context->messages_size = 0;
+    diagnostic_output = open_memstream(&context->messages, &context->messages_size);
+    select_context(context);
+    set_error_recovery(recovery);
+}
+
+static ZrStatus end_call(ZrStatus status) {
+    fflush(PROGRAM_OUTPUT); // Before whatever the caller prints next
+    if (diagnostic_output != NULL) fclose(diagnostic_output);
+    diagnostic_output = NULL;
+    set_error_recovery(NULL);
+    select_context(NULL);
+    return status;
+}
+
+ZrContext* zr_create(void) {
+    ZrContext* context = safe_malloc(sizeof(ZrContext));
+    context->symbols = create_symbol_table();
+    context->types = create_type_env();
+    init_loaded_modules_registry(&context->modules);
+    context->program = NULL;
+    context->output = NULL;
+    context->messages = NULL;
+    context->messages_size = 0;
+    return context;
+}
+
+void zr_destroy(ZrContext* context) {
+    if (context == NULL) return;
+    free_ast(context->program);
+    free_module_registry(&context->modules);
+    free_symbol_table(context->symbols);
+    free_type_env(context->types);
+    free(context->messages);
+    safe_free(context);
+}
+
+void zr_reset(ZrContext* context) {
+    free_ast(context->program);
+    context->program = NULL;
+    free_module_registry(&context->modules);
+    clear_symbol_table(context->symbols);
+    clear_type_env(context->types);
+    free(context->messages);
+    context->messages = NULL;
+    context->messages_size = 0;
+}
+
+void zr_set_output(ZrContext* context, FILE* output) {
+    context->output = output;
+}
+
+ZrStatus zr_load(ZrContext* context, const char* name, const char* source) {
+    jmp_buf recovery;
+    char* volatile copy = NULL; // The lexer works on its own copy
+    begin_call(context, &recovery);
+    if (setjmp(recovery) != 0) {
+        safe_free(copy);
+        return end_call(ZR_ERROR_COMPILE);
+    }
+
+    char directory[MAX_MODULE_PATH_LEN];
+    if (!get_directory_part(name, directory, sizeof(directory))) {
+        error("Could not determine the directory of '%s'.", name);
+    }
+    copy = safe_strdup(source);
+    bool modules_completed;
+    ASTNode* code = load_module_code(copy, name, directory, &modules_completed);
+    safe_free(copy);
+    if (code == NULL) return end_call(ZR_ERROR_COMPILE);
+    if (!modules_completed) {
+        free_ast(code);
+        return end_call(ZR_ERROR_RUNTIME);
+    }
+
+    free_ast(context->program);
+    context->program = code;
+    return end_call(ZR_OK);
+}
+
+ZrStatus zr_preload(ZrContext* context, const char* name, const char* source) {
+    ZrStatus status = zr_load(context, name, source);
+    if (status == ZR_OK) status = zr_run(context);
+    if (status != ZR_OK) return status;
+    context->modules.preloaded = context->modules.count;
+    free_ast(context->program); // Its statements have run; its modules' code stays
+    context->program = NULL;
+    return ZR_OK;
+}
+
+ZrStatus zr_run(ZrContext* context) {
+    jmp_buf recovery;
+    begin_call(context, &recovery);
+    if (setjmp(recovery) != 0) {
+        return end_call(ZR_ERROR_RUNTIME);
+    }
+    if (context->program == NULL) {
+        fprintf(DIAGNOSTICS, "Error: No program loaded.\n");
+        return end_call(ZR_ERROR_NO_PROGRAM);
+    }
+    bool completed = interpret(context->program);
+    return end_call(completed ? ZR_OK : ZR_ERROR_RUNTIME);
+}
+
+const char* zr_error(const ZrContext* context) {
+    return context->messages != NULL ? context->messages : "";
+}
+
+// Bind a variable from the embedding program, keeping a type the program
+// gave it: the type checker has compiled the program against it. A new
+// name must fit in the symbol table before anything is declared.
+static ZrStatus set_variable(ZrContext* context, const char* name, RuntimeValue value) {
+    select_context(context);
+    ZrStatus status = ZR_OK;
+    DataType declared;
+    RuntimeValue bound;
+    if (!lookup_symbol_value(name, &bound) && symbol_table_full()) {
+        status = ZR_ERROR_FULL;
+    } else if (!lookup_static_type(name, &declared)) {
+        declare_static_type(name, value.type);
+    } else if (declared == TYPE_INT32 && value.type == TYPE_INT64) {
+        if (value.val.int64_val < INT32_MIN || value.val.int64_val > INT32_MAX) {
+            status = ZR_ERROR_TYPE;
+        } else {
+            value = create_int32_runtime_value((int32_t)value.val.int64_val);
+        }
+    } else if (declared != TYPE_VOID && declared != value.type) {
+        status = ZR_ERROR_TYPE;
+    }
+    if (status == ZR_OK) set_symbol(name, value);
+    select_context(NULL);
+    return status;
+}
+
+ZrStatus zr_set_int(ZrContext* context, const char* name, int64_t value) {
+    return set_variable(context, name, create_int64_runtime_value(value));
+}
+
+ZrStatus zr_set_float(ZrContext* context, const char* name, double value) {
+    return set_variable(context, name, create_number_runtime_value(value));
+}
+
+ZrStatus zr_set_bool(ZrContext* context, const char* name, bool value) {
+    return set_variable(context, name, create_bool_runtime_value(value));
+}
+
+ZrStatus zr_set_string(ZrContext* context, const char* name, const char* value) {
+    RuntimeValue string;
+    string.type = TYPE_STRING;
+    string.val.string_val = (char*)value; // set_symbol copies it
+    return set_variable(context, name, string);
+}
+
+static ZrStatus get_variable(ZrContext* context, const char* name, RuntimeValue* value) {
+    select_context(context);
+    bool found = lookup_symbol_value(name, value);
+    select_context(NULL);
+    return found ? ZR_OK : ZR_ERROR_UNDEFINED;
+}
+
+ZrStatus zr_get_int(ZrContext* context, const char* name, int64_t* value) {
+    RuntimeValue variable;
+    ZrStatus status = get_variable(context, name, &variable);
+    if (status != ZR_OK) return status;
+    if (variable.type == TYPE_INT64) {
+        *value = variable.val.int64_val;
+    } else if (variable.type == TYPE_INT32) {
+        *value = variable.val.int32_val;
+    } else {
+        return ZR_ERROR_TYPE;
+    }
+    return ZR_OK;
+}
+
+ZrStatus zr_get_float(ZrContext* context, const char* name, double* value) {
+    RuntimeValue variable;
+    ZrStatus status = get_variable(context, name, &variable);
+    if (status != ZR_OK) return status;
+    if (variable.type != TYPE_FLOAT) return ZR_ERROR_TYPE;
+    *value = variable.val.float_val;
+    return ZR_OK;
+}
+
+ZrStatus zr_get_bool(ZrContext* context, const char* name, bool* value) {
+    RuntimeValue variable;
+    ZrStatus status = get_variable(context, name, &variable);
+    if (status != ZR_OK) return status;
+    if (variable.type != TYPE_BOOL) return ZR_ERROR_TYPE;
+    *value = variable.val.bool_val;
+    return ZR_OK;
+}
+
+ZrStatus zr_get_string(ZrContext* context, const char* name, const char** value) {
+    RuntimeValue variable;
+    ZrStatus status = get_variable(context, name, &variable);
+    if (status != ZR_OK) return status;
+    if (variable.type != TYPE_STRING) return ZR_ERROR_TYPE;
+    *value = variable.val.string_val;
+    return ZR_OK;
+}
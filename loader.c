@@ -0,0 +1,601 @@
+#include "compiler.h"
+#include <stdarg.h> // For va_list, va_start, va_end
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h> // For strcmp, strcpy, strcat
+#include <limits.h> // For PATH_MAX (maybe) or use a defined MAX_MODULE_PATH_LEN
+#include <setjmp.h>
+#include <unistd.h> // For getcwd (maybe, for resolving main_script_dir if path is relative)
+#include <sys/stat.h> // For checking file existence
+#include <errno.h>    // For errno
+#include <pthread.h>
+
+#include "debug.h"
+
+// Module loading: reading a source file, parsing it, resolving and running
+// the modules it names with 'loadin', and type checking what is left. The
+// CLI (main.c) runs each file once loaded; libzr.c keeps the code of the file
+// it loads to run it on request.
+
+// Registry of loaded modules: the CLI's, or that of the libzr context this
+// thread is running. The rest of the loader's state is per thread as well.
+static LoadedModulesRegistry default_registry;
+static __thread LoadedModulesRegistry* loaded_modules_registry = &default_registry;
+
+__thread FILE* diagnostic_output = NULL;
+
+// Set by a libzr call in progress: error() unwinds to it instead of exiting
+static __thread jmp_buf* error_recovery = NULL;
+
+// What the module loads in progress have allocated, innermost first, for
+// error() to free before it unwinds them
+typedef struct LoadFrame {
+    Lexer* lexer;
+    Parser* parser;
+    ASTNode* program; // Statements as parsed
+    ASTNode* code;    // Statements moved out of 'program'
+    char* module_path;   // Module being read, and its source
+    char* module_source;
+    FILE* module_file;
+    struct LoadFrame* outer;
+} LoadFrame;
+
+static __thread LoadFrame* loading = NULL;
+static __thread int failed_modules = 0; // Stopped by a runtime error
+
+static void release_loads(void) {
+    for (LoadFrame* frame = loading; frame != NULL; frame = frame->outer) {
+        if (frame->module_file != NULL) fclose(frame->module_file);
+        safe_free(frame->module_source);
+        safe_free(frame->module_path);
+        free_ast(frame->code);
+        free_ast(frame->program);
+        if (frame->parser != NULL) free_parser(frame->parser);
+        if (frame->lexer != NULL) free_lexer(frame->lexer);
+    }
+    loading = NULL;
+}
+
+// Initialize the loaded modules registry
+void init_loaded_modules_registry(LoadedModulesRegistry* registry) {
+    registry->count = 0;
+    registry->code_count = 0;
+    registry->preloaded = 0;
+    for (int i = 0; i < MAX_LOADED_MODULES; ++i) {
+        registry->paths[i][0] = '\0';
+    }
+}
+
+void free_module_registry(LoadedModulesRegistry* registry) {
+    for (int i = 0; i < registry->code_count; i++) {
+        free_ast(registry->code[i]);
+    }
+    init_loaded_modules_registry(registry);
+}
+
+void set_module_registry(LoadedModulesRegistry* registry) {
+    loaded_modules_registry = registry != NULL ? registry : &default_registry;
+}
+
+LoadedModulesRegistry* get_module_registry(void) {
+    return loaded_modules_registry;
+}
+
+void set_error_recovery(jmp_buf* recovery) {
+    error_recovery = recovery;
+}
+
+// Helper function to check if a file exists
+static bool file_exists(const char* path) {
+    struct stat buffer;
+    return (stat(path, &buffer) == 0 && S_ISREG(buffer.st_mode));
+}
+
+// Helper function to extract directory part from a path
+// Puts the directory part into dir_buffer.
+// Returns true on success, false if path is too long or no directory part.
+bool get_directory_part(const char* path, char* dir_buffer, size_t buffer_size) {
+    const char* last_slash = strrchr(path, '/');
+    if (last_slash == NULL) { // No slash, so no directory part (or it's just a filename in current dir)
+        // Consider it as current directory "."
+        if (buffer_size > 1) {
+            strcpy(dir_buffer, ".");
+            return true;
+        }
+        return false; // Buffer too small
+    }
+    size_t dir_len = last_slash - path;
+    if (dir_len + 1 > buffer_size) {
+        return false; // Buffer too small
+    }
+    if (dir_len == 0) { // Path starts with '/', e.g., "/file.zr"
+         if (buffer_size > 1) {
+            strcpy(dir_buffer, "/"); // Root directory
+            return true;
+        }
+        return false;
+    }
+    strncpy(dir_buffer, path, dir_len);
+    dir_buffer[dir_len] = '\0';
+    return true;
+}
+
+// Helper function to build a path safely
+// Concatenates base and component into out_buffer.
+// Ensures not to overflow out_buffer.
+static bool build_path(const char* base, const char* component, char* out_buffer, size_t buffer_size) {
+    if (base == NULL || component == NULL || out_buffer == NULL) return false;
+
+    // If component is already an absolute path, just use it (simplified)
+    if (component[0] == '/') {
+        if (strlen(component) + 1 > buffer_size) return false;
+        strcpy(out_buffer, component);
+        return true;
+    }
+
+    size_t base_len = strlen(base);
+    size_t component_len = strlen(component);
+
+    // Check for overflow: base_len + (optional '/') + component_len + null_terminator
+    if (base_len + (base_len > 0 && base[base_len - 1] != '/' ? 1 : 0) + component_len + 1 > buffer_size) {
+        return false;
+    }
+
+    strcpy(out_buffer, base);
+    if (base_len > 0 && out_buffer[base_len - 1] != '/' && component[0] != '\0') {
+        strcat(out_buffer, "/");
+    }
+    strcat(out_buffer, component);
+    return true;
+}
+
+
+// Resolve module path:
+// 1. Appends ".zr" if not present.
+// 2. Tries path relative to current_file_dir.
+// 3. Tries path relative to main_script_dir/files/
+// Returns an allocated string with a canonicalized absolute path if found, otherwise NULL.
+// Caller must free the returned string.
+static char* resolve_module_path(const char* requested_path_in, const char* current_file_dir, const char* main_script_dir) {
+    char module_name_or_rel_path[MAX_MODULE_PATH_LEN];
+    strncpy(module_name_or_rel_path, requested_path_in, MAX_MODULE_PATH_LEN - 1);
+    module_name_or_rel_path[MAX_MODULE_PATH_LEN - 1] = '\0';
+
+    char requested_file[MAX_MODULE_PATH_LEN];
+    if (strlen(module_name_or_rel_path) + 4 > MAX_MODULE_PATH_LEN) {
+         error("Error: Module path '%s' is too long to append .zr.", module_name_or_rel_path);
+         return NULL;
+    }
+    snprintf(requested_file, MAX_MODULE_PATH_LEN, "%s.zr", module_name_or_rel_path);
+
+    char candidate_path_buffer[MAX_MODULE_PATH_LEN]; // Buffer for path construction
+    char* real_path_result = NULL; // For realpath result
+    char* final_resolved_path = NULL; // To store the strdup'd version of real_path_result
+
+    // Function to try resolving a candidate
+    char* try_resolve(const char* candidate) {
+        if (file_exists(candidate)) {
+            char* rp = realpath(candidate, NULL);
+            if (rp) {
+                LOG_DEBUG("realpath for '%s' -> '%s'", candidate, rp);
+                return rp; // Caller will strdup and free rp
+            } else {
+                // realpath can fail if path components don't exist, or perms, etc.
+                // Since file_exists passed, this might be unusual, but good to log.
+                LOG_WARN("realpath failed for existing file '%s': %s", candidate, strerror(errno));
+                // Fallback to strdup(candidate) if realpath fails but file exists,
+                // though this means we lose canonicalization benefits.
+                // For stricter canonicalization, one might return NULL here.
+                // For now, let's be a bit lenient if realpath fails on an existing file.
+                return strdup(candidate);
+            }
+        }
+        return NULL;
+    }
+
+    // 1. Try relative to current_file_dir
+    if (current_file_dir) {
+        if (build_path(current_file_dir, requested_file, candidate_path_buffer, MAX_MODULE_PATH_LEN)) {
+            LOG_DEBUG("Resolve try 1 (relative to %s): %s", current_file_dir, candidate_path_buffer);
+            real_path_result = try_resolve(candidate_path_buffer);
+            if (real_path_result) goto found;
+        }
+    }
+
+    // 2. Try relative to main_script_dir/files/
+    if (main_script_dir) {
+        char files_dir_base[MAX_MODULE_PATH_LEN];
+        if (build_path(main_script_dir, "files", files_dir_base, MAX_MODULE_PATH_LEN)) {
+            if (build_path(files_dir_base, requested_file, candidate_path_buffer, MAX_MODULE_PATH_LEN)) {
+                LOG_DEBUG("Resolve try 2 (main_script_dir/files): %s", candidate_path_buffer);
+                real_path_result = try_resolve(candidate_path_buffer);
+                if (real_path_result) goto found;
+            }
+        }
+    }
+
+    // 3. If requested_path_in itself was an absolute path
+    if (requested_path_in[0] == '/') {
+        // requested_file here is already absolute + .zr
+        LOG_DEBUG("Resolve try 3 (absolute path given): %s", requested_file);
+        real_path_result = try_resolve(requested_file);
+        if (real_path_result) goto found;
+    }
+
+found:
+    if (real_path_result) {
+        final_resolved_path = strdup(real_path_result);
+        if (!final_resolved_path) {
+            error("Memory allocation failed for final resolved path.");
+            // real_path_result must be freed if strdup fails and we are about to exit or return NULL
+            free(real_path_result);
+            return NULL; // Or exit via error()
+        }
+        free(real_path_result); // Free the string allocated by realpath OR the strdup from try_resolve's fallback
+        return final_resolved_path;
+    }
+
+    LOG_DEBUG("Module '%s' (as '%s') not found with current_file_dir='%s', main_script_dir='%s'",
+            requested_path_in, requested_file, current_file_dir ? current_file_dir : "NULL", main_script_dir ? main_script_dir : "NULL");
+    return NULL;
+}
+
+// Check if a module is already loaded or currently loading. If not, register it.
+// Returns true if module can be loaded, false if it's a duplicate (error).
+// Uses the global loaded_modules_registry->
+static bool check_and_register_module(const char* canonical_path) {
+    if (canonical_path == NULL) return false; // Should not happen
+
+    for (int i = 0; i < loaded_modules_registry->count; ++i) {
+        if (strcmp(loaded_modules_registry->paths[i], canonical_path) == 0) {
+            if (i < loaded_modules_registry->preloaded) return false; // Already run, by the prelude
+            // Module already loaded or in the process of loading (as per Scenario 2 strict check)
+            error("Error: Module '%s' is already loaded or causes a circular dependency.", canonical_path);
+            return false;
+        }
+    }
+
+    if (loaded_modules_registry->count >= MAX_LOADED_MODULES) {
+        error("Error: Maximum number of loaded modules (%d) exceeded.", MAX_LOADED_MODULES);
+        return false;
+    }
+
+    strncpy(loaded_modules_registry->paths[loaded_modules_registry->count], canonical_path, MAX_MODULE_PATH_LEN -1);
+    loaded_modules_registry->paths[loaded_modules_registry->count][MAX_MODULE_PATH_LEN -1] = '\0';
+    loaded_modules_registry->count++;
+
+    return true;
+}
+
+
+// Function to report errors and exit (or, inside a libzr call, fail the call)
+void error(const char* format, ...) {
+    va_list args;
+    va_start(args, format);
+    fprintf(DIAGNOSTICS, "Error: "); // Prefix with "Error: "
+    vfprintf(DIAGNOSTICS, format, args);
+    fprintf(DIAGNOSTICS, "\n"); // Add a newline for better formatting
+    va_end(args);
+    if (error_recovery != NULL) {
+        // Nodes of a statement the parser was in the middle of are not freed
+        release_loads();
+        longjmp(*error_recovery, 1);
+    }
+    exit(1);
+}
+
+// Modules parsed once for a libzr pool (pool.c) or the script server
+// (server.c) and shared by their threads. The trees stay as parsed; a thread
+// loading a module runs a copy, since execution rewrites nodes (quickening,
+// loop bytecode). An entry is used only while its file is unchanged.
+typedef struct {
+    char* path; // Canonical
+    dev_t device; // The file parsed, and its version
+    ino_t inode;
+    off_t size;
+    struct timespec modified;
+    ASTNode* program;
+} CachedModule;
+
+struct ModuleCache {
+    pthread_rwlock_t lock; // Shared while a tree is copied
+    CachedModule* modules;
+    int count;
+    int capacity;
+    unsigned long hits;    // Atomic: counted under the shared lock
+    unsigned long parses;
+};
+
+static __thread ModuleCache* module_cache = NULL;
+
+ModuleCache* create_module_cache(void) {
+    ModuleCache* cache = safe_malloc(sizeof(ModuleCache));
+    pthread_rwlock_init(&cache->lock, NULL);
+    cache->modules = NULL;
+    cache->count = 0;
+    cache->capacity = 0;
+    cache->hits = 0;
+    cache->parses = 0;
+    return cache;
+}
+
+void free_module_cache(ModuleCache* cache) {
+    if (cache == NULL) return;
+    for (int i = 0; i < cache->count; i++) {
+        safe_free(cache->modules[i].path);
+        free_ast(cache->modules[i].program);
+    }
+    safe_free(cache->modules);
+    pthread_rwlock_destroy(&cache->lock);
+    safe_free(cache);
+}
+
+void set_module_cache(ModuleCache* cache) {
+    module_cache = cache;
+}
+
+ModuleCacheStats get_module_cache_stats(ModuleCache* cache) {
+    pthread_rwlock_rdlock(&cache->lock);
+    ModuleCacheStats stats = { cache->count, __atomic_load_n(&cache->hits, __ATOMIC_RELAXED), cache->parses };
+    pthread_rwlock_unlock(&cache->lock);
+    return stats;
+}
+
+static bool same_version(const CachedModule* module, const struct stat* file) {
+    return module->device == file->st_dev && module->inode == file->st_ino &&
+           module->size == file->st_size &&
+           module->modified.tv_sec == file->st_mtim.tv_sec &&
+           module->modified.tv_nsec == file->st_mtim.tv_nsec;
+}
+
+// A copy of the module at 'path' for this load, or NULL if it isn't cached
+// or its file has changed since. 'file' receives the version copied.
+static ASTNode* copy_cached_module(const char* path, struct stat* file) {
+    if (stat(path, file) != 0) return NULL;
+    ASTNode* copy = NULL;
+    pthread_rwlock_rdlock(&module_cache->lock);
+    for (int i = 0; i < module_cache->count; i++) {
+        if (strcmp(module_cache->modules[i].path, path) == 0) {
+            if (same_version(&module_cache->modules[i], file)) {
+                copy = clone_ast(module_cache->modules[i].program);
+                __atomic_fetch_add(&module_cache->hits, 1, __ATOMIC_RELAXED);
+            }
+            break;
+        }
+    }
+    pthread_rwlock_unlock(&module_cache->lock);
+    return copy;
+}
+
+// Keep the tree parsed from 'file', replacing an older version
+static void cache_module(const char* path, const struct stat* file, const ASTNode* program) {
+    ASTNode* copy = clone_ast(program);
+    pthread_rwlock_wrlock(&module_cache->lock);
+    module_cache->parses++;
+    CachedModule* module = NULL;
+    for (int i = 0; i < module_cache->count && module == NULL; i++) {
+        if (strcmp(module_cache->modules[i].path, path) == 0) module = &module_cache->modules[i];
+    }
+    if (module != NULL) {
+        free_ast(module->program);
+    } else {
+        if (module_cache->count == module_cache->capacity) {
+            int new_capacity = module_cache->capacity == 0 ? 16 : module_cache->capacity * 2;
+            CachedModule* grown = safe_malloc(sizeof(CachedModule) * new_capacity);
+            if (module_cache->modules != NULL) {
+                memcpy(grown, module_cache->modules, sizeof(CachedModule) * module_cache->count);
+                safe_free(module_cache->modules);
+            }
+            module_cache->modules = grown;
+            module_cache->capacity = new_capacity;
+        }
+        module = &module_cache->modules[module_cache->count++];
+        module->path = safe_strdup(path);
+    }
+    module->device = file->st_dev;
+    module->inode = file->st_ino;
+    module->size = file->st_size;
+    module->modified = file->st_mtim;
+    module->program = copy;
+    pthread_rwlock_unlock(&module_cache->lock);
+}
+
+// Lexes and parses a source file into its top-level block, owned by 'frame'
+static ASTNode* parse_module(LoadFrame* frame, char* source_code, const char* source_filepath) {
+    double phase_began = phase_start(PHASE_PARSE);
+    Lexer* lexer = frame->lexer = init_lexer(source_code);
+    Parser* parser = frame->parser = init_parser(lexer);
+    ASTNode* program_ast = frame->program = parse_program(parser); // This is a NODE_BLOCK
+    phase_record(PHASE_PARSE, source_filepath, phase_began);
+
+    if (program_ast == NULL || program_ast->type != NODE_BLOCK) {
+        error("Error: Failed to parse program: %s. Expected top-level NODE_BLOCK.", source_filepath);
+    }
+    // The CLI runs whatever parsed; an embedding caller gets the failure
+    if (parser->error_count > 0 && error_recovery != NULL) {
+        error("%d parse error(s) in %s.", parser->error_count, source_filepath);
+    }
+
+    // The tree doesn't point into the lexer's tokens
+    free_parser(parser);
+    free_lexer(lexer);
+    frame->parser = NULL;
+    frame->lexer = NULL;
+    return program_ast;
+}
+
+// Reads the module at 'path', through the frame so that error() can free it.
+// 'file' receives the version read, for the module cache and snapshots.
+static char* read_module(LoadFrame* frame, const char* path, struct stat* file) {
+    double phase_began = phase_start(PHASE_READ);
+    FILE* module_file = frame->module_file = fopen(path, "r");
+    if (!module_file) {
+        error("Error: Could not open module file '%s'.", path);
+    }
+    if (fstat(fileno(module_file), file) != 0) {
+        error("Error: Could not stat module file '%s'.", path);
+    }
+
+    fseek(module_file, 0, SEEK_END);
+    long module_size_long = ftell(module_file);
+    fseek(module_file, 0, SEEK_SET);
+
+    if (module_size_long < 0) { // Error check for ftell
+        error("Error: Could not determine size of module file '%s'.", path);
+    }
+    size_t module_size = (size_t)module_size_long; // Cast to size_t
+
+    char* module_source = frame->module_source = safe_malloc(module_size + 1);
+    if (fread(module_source, 1, module_size, module_file) != module_size) {
+         error("Error reading module file '%s'", path);
+    }
+    module_source[module_size] = '\0';
+    fclose(module_file);
+    frame->module_file = NULL;
+    phase_record(PHASE_READ, path, phase_began);
+    return module_source;
+}
+
+static void process_module(char* source_code, const struct stat* source_file, ASTNode* parsed,
+                           const char* source_filepath, const char* main_script_dir);
+
+// Processes the loadin directives of a parsed file (running the modules they
+// name), and type checks its other statements. Returns them as a block for
+// the caller to run; the caller owns it. The frame's program is freed.
+static ASTNode* collect_module_code(LoadFrame* frame, const char* source_filepath, const char* main_script_dir) {
+    ASTNode* program_ast = frame->program;
+
+    // Create a temporary block for non-loadin statements of the current file
+    ASTNode* current_file_code_block = frame->code = create_node(NODE_BLOCK);
+    current_file_code_block->statements = safe_malloc(sizeof(ASTNode*) * program_ast->statement_count); // Max possible needed
+    current_file_code_block->statement_count = 0;
+
+
+    // First pass: handle NODE_LOADIN directives and collect other statements
+    for (int i = 0; i < program_ast->statement_count; ++i) {
+        ASTNode* stmt = program_ast->statements[i];
+        if (stmt == NULL) continue;
+
+        if (stmt->type == NODE_LOADIN) {
+            if (stmt->value.string_val == NULL) {
+                error("Internal Error: NODE_LOADIN found with NULL path in %s.", source_filepath);
+                continue;
+            }
+            LOG_DEBUG("Found loadin directive for: %s in %s", stmt->value.string_val, source_filepath);
+
+            char current_dir_buffer[MAX_MODULE_PATH_LEN];
+            if (!get_directory_part(source_filepath, current_dir_buffer, MAX_MODULE_PATH_LEN)) {
+                error("Error: Could not determine directory for current file %s to resolve loadin.", source_filepath);
+                continue; // Or propagate error
+            }
+
+            double phase_began = phase_start(PHASE_RESOLVE);
+            char* resolved_module_path = frame->module_path = resolve_module_path(stmt->value.string_val, current_dir_buffer, main_script_dir);
+            if (resolved_module_path == NULL) {
+                error("Error: Failed to resolve module '%s' requested in %s.", stmt->value.string_val, source_filepath);
+            }
+
+            bool first_load = check_and_register_module(resolved_module_path);
+            phase_record(PHASE_RESOLVE, source_filepath, phase_began);
+            if (first_load) {
+                LOG_INFO("Loading module: %s", resolved_module_path);
+                struct stat* module_file = &loaded_modules_registry->files[loaded_modules_registry->count - 1];
+                ASTNode* parsed = module_cache != NULL ? copy_cached_module(resolved_module_path, module_file) : NULL;
+                if (parsed != NULL) {
+                    process_module(NULL, NULL, parsed, resolved_module_path, main_script_dir);
+                } else {
+                    char* module_source = read_module(frame, resolved_module_path, module_file);
+                    process_module(module_source, module_file, NULL, resolved_module_path, main_script_dir); // Recursive call
+                    safe_free(module_source);
+                    frame->module_source = NULL;
+                }
+            }
+            safe_free(resolved_module_path); // Free after use
+            frame->module_path = NULL;
+            // The NODE_LOADIN ast node itself (stmt) will be freed when program_ast is freed.
+        } else {
+            // Add non-NODE_LOADIN statements to the current_file_code_block
+            // We are "moving" the statement pointer.
+            current_file_code_block->statements[current_file_code_block->statement_count++] = stmt;
+            program_ast->statements[i] = NULL; // Nullify in original AST to prevent double free
+        }
+    }
+
+    // Statically check the collected statements against everything bound so far
+    // (including variables from the modules loaded above) before running any of them.
+    double phase_began = phase_start(PHASE_TYPECHECK);
+    if (check_types(current_file_code_block) == TYPE_ERROR) {
+        error("Type checking failed for %s.", source_filepath);
+    }
+    phase_record(PHASE_TYPECHECK, source_filepath, phase_began);
+
+    // Statements were moved out, so this frees the block and its NODE_LOADINs
+    free_ast(program_ast);
+    frame->program = NULL;
+    frame->code = NULL;
+    return current_file_code_block;
+}
+
+// Lexes and parses a source file, processes its loadin directives (running
+// the modules they name), and type checks its other statements. Returns them
+// as a block for the caller to run; the caller owns it. *modules_completed
+// is set to false if a runtime error stopped one of the modules.
+ASTNode* load_module_code(char* source_code, const char* source_filepath, const char* main_script_dir,
+                          bool* modules_completed) {
+    LoadFrame frame = { NULL, NULL, NULL, NULL, NULL, NULL, NULL, loading };
+    int failed_before = failed_modules;
+    loading = &frame;
+    parse_module(&frame, source_code, source_filepath);
+    ASTNode* code = collect_module_code(&frame, source_filepath, main_script_dir);
+    loading = frame.outer;
+    *modules_completed = failed_modules == failed_before;
+    return code;
+}
+
+// Loads and runs a module from its source (read from 'source_file', if it
+// may be cached) or, when it is cached, from a copy of its parsed tree
+// ('parsed', which this takes over)
+static void process_module(char* source_code, const struct stat* source_file, ASTNode* parsed,
+                           const char* source_filepath, const char* main_script_dir) {
+    LOG_DEBUG("Processing source file: %s", source_filepath);
+    phase_enter_module(source_filepath);
+    profile_enter_module(source_filepath);
+
+    LoadFrame frame = { NULL, NULL, parsed, NULL, NULL, NULL, NULL, loading };
+    loading = &frame;
+    if (parsed == NULL) {
+        parse_module(&frame, source_code, source_filepath);
+        if (module_cache != NULL && source_file != NULL) cache_module(source_filepath, source_file, frame.program);
+    }
+    ASTNode* current_file_code_block = collect_module_code(&frame, source_filepath, main_script_dir);
+    loading = frame.outer;
+
+    // After all loadins are processed, interpret the collected statements for the current file
+    if (current_file_code_block->statement_count > 0) {
+        LOG_DEBUG("Interpreting collected code for: %s", source_filepath);
+        // Kept for free_module_registry (and, with -o, for aot.c and elf.c)
+        loaded_modules_registry->code[loaded_modules_registry->code_count++] = current_file_code_block;
+        double phase_began = phase_start(PHASE_INTERPRET);
+        if (!interpret(current_file_code_block)) failed_modules++;
+        phase_record(PHASE_INTERPRET, source_filepath, phase_began);
+        profile_leave_module(current_file_code_block);
+    } else {
+        profile_leave_module(NULL);
+        free_ast(current_file_code_block); // Free if empty (no statements moved)
+    }
+
+    phase_leave_module();
+    LOG_DEBUG("Finished processing source file: %s", source_filepath);
+}
+
+// Processes a single source file: lexes, parses, handles loadin directives, and interprets other statements.
+// Returns false if a runtime error stopped the file or one of the modules it loaded.
+bool process_source_code(char* source_code, const char* source_filepath, const char* main_script_dir) {
+    if (source_code == NULL || source_filepath == NULL) {
+        error("Internal Error: process_source_code called with NULL source or filepath.");
+        return false;
+    }
+    int failed_before = failed_modules;
+    process_module(source_code, NULL, NULL, source_filepath, main_script_dir);
+    return failed_modules == failed_before;
+}
@@ -11,353 +11,219 @@
 #include "debug.h" 
 #include "compiler.h" // For LoadedModulesRegistry, MAX_MODULE_PATH_LEN
 
-// Global registry for loaded modules
-static LoadedModulesRegistry loaded_modules_registry;
 
-// Initialize the loaded modules registry
-void init_loaded_modules_registry() {
-    loaded_modules_registry.count = 0;
-    for (int i = 0; i < MAX_LOADED_MODULES; ++i) {
-        loaded_modules_registry.paths[i][0] = '\0';
-    }
-}
-
-// Helper function to check if a file exists
-static bool file_exists(const char* path) {
-    struct stat buffer;
-    return (stat(path, &buffer) == 0 && S_ISREG(buffer.st_mode));
-}
-
-// Helper function to extract directory part from a path
-// Puts the directory part into dir_buffer.
-// Returns true on success, false if path is too long or no directory part.
-static bool get_directory_part(const char* path, char* dir_buffer, size_t buffer_size) {
-    const char* last_slash = strrchr(path, '/');
-    if (last_slash == NULL) { // No slash, so no directory part (or it's just a filename in current dir)
-        // Consider it as current directory "."
-        if (buffer_size > 1) {
-            strcpy(dir_buffer, ".");
-            return true;
-        }
-        return false; // Buffer too small
-    }
-    size_t dir_len = last_slash - path;
-    if (dir_len + 1 > buffer_size) {
-        return false; // Buffer too small
-    }
-    if (dir_len == 0) { // Path starts with '/', e.g., "/file.zr"
-         if (buffer_size > 1) {
-            strcpy(dir_buffer, "/"); // Root directory
-            return true;
-        }
-        return false;
-    }
-    strncpy(dir_buffer, path, dir_len);
-    dir_buffer[dir_len] = '\0';
-    return true;
+static void print_usage(const char* program_name) {
+    fprintf(stderr, "Usage: %s [options] <source_file>\n", program_name);
+    fprintf(stderr, "       %s [options] --serve=SOCKET\n", program_name);
+    fprintf(stderr, "       %s --server-stats=SOCKET\n", program_name);
+    fprintf(stderr, "Options:\n");
+    fprintf(stderr, "  -o OUTPUT           Compile to a native executable instead of running\n");
+    fprintf(stderr, "  --backend=BACKEND   Back end for -o: c (via C and gcc -O2, default) or elf (direct x86-64 ELF)\n");
+    fprintf(stderr, "  --emit-c=FILE       Write the program as C to FILE instead of running\n");
+    fprintf(stderr, "  --exec=ENGINE       Execution engine: tree (AST walker, default), stack or register (bytecode VMs),\n");
+    fprintf(stderr, "                      or tiered (AST walker, promoting hot loops to the register VM and the JIT)\n");
+    fprintf(stderr, "  --dump-bytecode     Print the compiled bytecode of each module to stderr\n");
+    fprintf(stderr, "  --jit               Register VM with native compilation of hot loops\n");
+    fprintf(stderr, "  --jit-threshold=N   Loop iterations before a chunk is compiled (default %d)\n", JIT_DEFAULT_THRESHOLD);
+    fprintf(stderr, "  --tier-threshold=N  Loop entries plus iterations before a loop leaves the AST walker (default %d)\n", TIER_DEFAULT_THRESHOLD);
+    fprintf(stderr, "  --no-osr            Tiered execution: promote loops only when they are entered, not mid-loop\n");
+    fprintf(stderr, "  -O0, -O1, -O2       Register bytecode optimization level (default -O2; -O0 disables it)\n");
+    fprintf(stderr, "  --time-passes       Report the time spent in each optimization pass at exit\n");
+    fprintf(stderr, "  --time-phases[=FILE]\n");
+    fprintf(stderr, "                      Report read/lex/parse/resolve/typecheck/interpret time per module at exit,\n");
+    fprintf(stderr, "                      or write it to FILE as Chrome trace-event JSON\n");
+    fprintf(stderr, "  --profile[=FILE]    Sample the running statement every millisecond; at exit, print folded stacks\n");
+    fprintf(stderr, "                      (module;loops;line count, for flame graph tools) to stderr or FILE\n");
+    fprintf(stderr, "  --stats             Report node evaluations, binary operations by operand types, symbol lookups\n");
+    fprintf(stderr, "                      and allocations per phase at exit\n");
+    fprintf(stderr, "  --log-level=LEVEL   Log error, warn, info, debug or trace messages to stderr (default warn,\n");
+    fprintf(stderr, "                      or $ZR_LOG_LEVEL); levels above the build's ZR_LOG_MAX_LEVEL are compiled out\n");
+    fprintf(stderr, "  --log-async         Write log messages from a background thread (or set $ZR_LOG_ASYNC=1)\n");
+    fprintf(stderr, "  --prelude=FILE      Run FILE (and the modules it loads) before the source file\n");
+    fprintf(stderr, "  --snapshot=FILE     With --prelude: save the state the prelude leaves to FILE, and start from it\n");
+    fprintf(stderr, "                      instead of running the prelude until the prelude or one of its modules changes\n");
+    fprintf(stderr, "  --serve=SOCKET      Run scripts sent to the Unix socket SOCKET, keeping parsed modules between them\n");
+    fprintf(stderr, "  --serve-threads=N   Scripts the server runs at once (default: one per CPU)\n");
+    fprintf(stderr, "  --zygote=PRELUDE    Serve: run PRELUDE (and the modules it loads) once, then run each script\n");
+    fprintf(stderr, "                      in a process forked from that state\n");
+    fprintf(stderr, "  --connect=SOCKET    Run the source file on the server at SOCKET; exit with its status\n");
+    fprintf(stderr, "  --server-stats=SOCKET\n");
+    fprintf(stderr, "                      Print the request counters and wall times of the server at SOCKET\n");
 }
 
-// Helper function to build a path safely
-// Concatenates base and component into out_buffer.
-// Ensures not to overflow out_buffer.
-static bool build_path(const char* base, const char* component, char* out_buffer, size_t buffer_size) {
-    if (base == NULL || component == NULL || out_buffer == NULL) return false;
-
-    // If component is already an absolute path, just use it (simplified)
-    if (component[0] == '/') {
-        if (strlen(component) + 1 > buffer_size) return false;
-        strcpy(out_buffer, component);
-        return true;
-    }
-
-    size_t base_len = strlen(base);
-    size_t component_len = strlen(component);
-
-    // Check for overflow: base_len + (optional '/') + component_len + null_terminator
-    if (base_len + (base_len > 0 && base[base_len - 1] != '/' ? 1 : 0) + component_len + 1 > buffer_size) {
-        return false;
-    }
-
-    strcpy(out_buffer, base);
-    if (base_len > 0 && out_buffer[base_len - 1] != '/' && component[0] != '\0') {
-        strcat(out_buffer, "/");
-    }
-    strcat(out_buffer, component);
-    return true;
-}
-
-
-// Resolve module path:
-// 1. Appends ".zr" if not present.
-// 2. Tries path relative to current_file_dir.
-// 3. Tries path relative to main_script_dir/files/
-// Returns an allocated string with a canonicalized absolute path if found, otherwise NULL.
-// Caller must free the returned string.
-static char* resolve_module_path(const char* requested_path_in, const char* current_file_dir, const char* main_script_dir) {
-    char module_name_or_rel_path[MAX_MODULE_PATH_LEN];
-    strncpy(module_name_or_rel_path, requested_path_in, MAX_MODULE_PATH_LEN - 1);
-    module_name_or_rel_path[MAX_MODULE_PATH_LEN - 1] = '\0';
-
-    char requested_file[MAX_MODULE_PATH_LEN];
-    if (strlen(module_name_or_rel_path) + 4 > MAX_MODULE_PATH_LEN) {
-         error("Error: Module path '%s' is too long to append .zr.", module_name_or_rel_path);
-         return NULL;
+int main(int argc, char* argv[]) {
+    // Log level: ZR_LOG_LEVEL, overridden by --log-level
+    DebugLevel log_level = DEBUG_DEFAULT_LEVEL;
+    const char* env_level = getenv("ZR_LOG_LEVEL");
+    if (env_level != NULL && *env_level != '\0' && !parse_debug_level(env_level, &log_level)) {
+        fprintf(stderr, "Warning: Ignoring unknown ZR_LOG_LEVEL '%s'\n", env_level);
     }
-    snprintf(requested_file, MAX_MODULE_PATH_LEN, "%s.zr", module_name_or_rel_path);
-
-    char candidate_path_buffer[MAX_MODULE_PATH_LEN]; // Buffer for path construction
-    char* real_path_result = NULL; // For realpath result
-    char* final_resolved_path = NULL; // To store the strdup'd version of real_path_result
-
-    // Function to try resolving a candidate
-    char* try_resolve(const char* candidate) {
-        if (file_exists(candidate)) {
-            char* rp = realpath(candidate, NULL);
-            if (rp) {
-                LOG_DEBUG("realpath for '%s' -> '%s'", candidate, rp);
-                return rp; // Caller will strdup and free rp
-            } else {
-                // realpath can fail if path components don't exist, or perms, etc.
-                // Since file_exists passed, this might be unusual, but good to log.
-                LOG_WARN("realpath failed for existing file '%s': %s", candidate, strerror(errno));
-                // Fallback to strdup(candidate) if realpath fails but file exists,
-                // though this means we lose canonicalization benefits.
-                // For stricter canonicalization, one might return NULL here.
-                // For now, let's be a bit lenient if realpath fails on an existing file.
-                return strdup(candidate);
+    const char* env_async = getenv("ZR_LOG_ASYNC");
+    bool log_async = env_async != NULL && *env_async != '\0' && strcmp(env_async, "0") != 0;
+
+    char* initial_filepath_arg = NULL;
+    const char* output_path = NULL; // -o: compile ahead of time
+    const char* c_output_path = NULL; // --emit-c
+    bool elf_backend = false; // --backend=elf
+    bool tiered = false; // --exec=tiered or --tier-threshold
+    bool jit_threshold_given = false;
+    const char* serve_path = NULL; // --serve
+    int serve_threads = 0;
+    const char* zygote_prelude = NULL; // --zygote
+    const char* connect_path = NULL; // --connect
+    const char* server_stats_path = NULL; // --server-stats
+    const char* prelude_path = NULL; // --prelude
+    const char* snapshot_path = NULL; // --snapshot
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-o") == 0 && i + 1 < argc) {
+            output_path = argv[++i];
+        } else if (strncmp(argv[i], "--emit-c=", 9) == 0 && argv[i][9] != '\0') {
+            c_output_path = argv[i] + 9;
+        } else if (strcmp(argv[i], "--backend=c") == 0) {
+            elf_backend = false;
+        } else if (strcmp(argv[i], "--backend=elf") == 0) {
+            elf_backend = true;
+        } else if (strcmp(argv[i], "--exec=tree") == 0) {
+            set_exec_mode(EXEC_TREE);
+            tiered = false;
+        } else if (strcmp(argv[i], "--exec=stack") == 0) {
+            set_exec_mode(EXEC_STACK_VM);
+            tiered = false;
+        } else if (strcmp(argv[i], "--exec=register") == 0) {
+            set_exec_mode(EXEC_REGISTER_VM);
+            tiered = false;
+        } else if (strcmp(argv[i], "--exec=tiered") == 0) {
+            tiered = true;
+        } else if (strncmp(argv[i], "--tier-threshold=", 17) == 0) {
+            char* end;
+            long threshold = strtol(argv[i] + 17, &end, 10);
+            if (*end != '\0' || threshold < 1 || threshold > INT_MAX) {
+                fprintf(stderr, "Invalid tier threshold: %s\n", argv[i] + 17);
+                return 1;
             }
-        }
-        return NULL;
-    }
-
-    // 1. Try relative to current_file_dir
-    if (current_file_dir) {
-        if (build_path(current_file_dir, requested_file, candidate_path_buffer, MAX_MODULE_PATH_LEN)) {
-            LOG_DEBUG("Resolve try 1 (relative to %s): %s", current_file_dir, candidate_path_buffer);
-            real_path_result = try_resolve(candidate_path_buffer);
-            if (real_path_result) goto found;
-        }
-    }
-
-    // 2. Try relative to main_script_dir/files/
-    if (main_script_dir) {
-        char files_dir_base[MAX_MODULE_PATH_LEN];
-        if (build_path(main_script_dir, "files", files_dir_base, MAX_MODULE_PATH_LEN)) {
-            if (build_path(files_dir_base, requested_file, candidate_path_buffer, MAX_MODULE_PATH_LEN)) {
-                LOG_DEBUG("Resolve try 2 (main_script_dir/files): %s", candidate_path_buffer);
-                real_path_result = try_resolve(candidate_path_buffer);
-                if (real_path_result) goto found;
+            set_tier_threshold((int)threshold);
+            tiered = true;
+        } else if (strcmp(argv[i], "--no-osr") == 0) {
+            set_osr(false);
+        } else if (strcmp(argv[i], "--dump-bytecode") == 0) {
+            set_dump_bytecode(true);
+        } else if (strcmp(argv[i], "-O0") == 0 || strcmp(argv[i], "-O1") == 0 || strcmp(argv[i], "-O2") == 0) {
+            set_optimization_level(argv[i][2] - '0');
+        } else if (strcmp(argv[i], "--time-passes") == 0) {
+            set_time_passes(true);
+        } else if (strcmp(argv[i], "--time-phases") == 0) {
+            set_time_phases(true, NULL);
+        } else if (strncmp(argv[i], "--time-phases=", 14) == 0 && argv[i][14] != '\0') {
+            set_time_phases(true, argv[i] + 14);
+        } else if (strcmp(argv[i], "--profile") == 0) {
+            set_profile(true, NULL);
+        } else if (strncmp(argv[i], "--profile=", 10) == 0 && argv[i][10] != '\0') {
+            set_profile(true, argv[i] + 10);
+        } else if (strcmp(argv[i], "--stats") == 0) {
+            set_stats(true);
+        } else if (strncmp(argv[i], "--log-level=", 12) == 0) {
+            if (!parse_debug_level(argv[i] + 12, &log_level)) {
+                fprintf(stderr, "Invalid log level: %s\n", argv[i] + 12);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--log-async") == 0) {
+            log_async = true;
+        } else if (strncmp(argv[i], "--serve=", 8) == 0 && argv[i][8] != '\0') {
+            serve_path = argv[i] + 8;
+        } else if (strncmp(argv[i], "--serve-threads=", 16) == 0) {
+            char* end;
+            long threads = strtol(argv[i] + 16, &end, 10);
+            if (*end != '\0' || threads < 1 || threads > 1024) {
+                fprintf(stderr, "Invalid thread count: %s\n", argv[i] + 16);
+                return 1;
+            }
+            serve_threads = (int)threads;
+        } else if (strncmp(argv[i], "--zygote=", 9) == 0 && argv[i][9] != '\0') {
+            zygote_prelude = argv[i] + 9;
+        } else if (strncmp(argv[i], "--prelude=", 10) == 0 && argv[i][10] != '\0') {
+            prelude_path = argv[i] + 10;
+        } else if (strncmp(argv[i], "--snapshot=", 11) == 0 && argv[i][11] != '\0') {
+            snapshot_path = argv[i] + 11;
+        } else if (strncmp(argv[i], "--connect=", 10) == 0 && argv[i][10] != '\0') {
+            connect_path = argv[i] + 10;
+        } else if (strncmp(argv[i], "--server-stats=", 15) == 0 && argv[i][15] != '\0') {
+            server_stats_path = argv[i] + 15;
+        } else if (strcmp(argv[i], "--jit") == 0) {
+            set_exec_mode(EXEC_REGISTER_VM);
+            set_jit_threshold(JIT_DEFAULT_THRESHOLD);
+        } else if (strncmp(argv[i], "--jit-threshold=", 16) == 0) {
+            char* end;
+            long threshold = strtol(argv[i] + 16, &end, 10);
+            if (*end != '\0' || threshold < 1 || threshold > INT_MAX) {
+                fprintf(stderr, "Invalid JIT threshold: %s\n", argv[i] + 16);
+                return 1;
             }
+            set_exec_mode(EXEC_REGISTER_VM);
+            set_jit_threshold((int)threshold);
+            jit_threshold_given = true;
+        } else if (argv[i][0] == '-' && argv[i][1] == '-') {
+            fprintf(stderr, "Unknown option: %s\n", argv[i]);
+            print_usage(argv[0]);
+            return 1;
+        } else if (initial_filepath_arg == NULL) {
+            initial_filepath_arg = argv[i];
+        } else {
+            print_usage(argv[0]);
+            return 1;
         }
     }
-
-    // 3. If requested_path_in itself was an absolute path
-    if (requested_path_in[0] == '/') {
-        // requested_file here is already absolute + .zr
-        LOG_DEBUG("Resolve try 3 (absolute path given): %s", requested_file);
-        real_path_result = try_resolve(requested_file);
-        if (real_path_result) goto found;
+    // The server and its stats take no source file
+    bool needs_file = serve_path == NULL && server_stats_path == NULL;
+    if ((initial_filepath_arg != NULL) != needs_file) {
+        print_usage(argv[0]);
+        return 1;
     }
-
-found:
-    if (real_path_result) {
-        final_resolved_path = strdup(real_path_result);
-        if (!final_resolved_path) {
-            error("Memory allocation failed for final resolved path.");
-            // real_path_result must be freed if strdup fails and we are about to exit or return NULL
-            free(real_path_result);
-            return NULL; // Or exit via error()
-        }
-        free(real_path_result); // Free the string allocated by realpath OR the strdup from try_resolve's fallback
-        return final_resolved_path;
+    set_debug_level(log_level);
+    set_debug_async(log_async);
+    if (tiered) {
+        // Hot loops go from the AST walker to the register VM, and the JIT takes the hottest on to native code
+        set_exec_mode(EXEC_TIERED);
+        if (!jit_threshold_given) set_jit_threshold(JIT_DEFAULT_THRESHOLD);
     }
-
-    LOG_DEBUG("Module '%s' (as '%s') not found with current_file_dir='%s', main_script_dir='%s'",
-            requested_path_in, requested_file, current_file_dir ? current_file_dir : "NULL", main_script_dir ? main_script_dir : "NULL");
-    return NULL;
-}
-
-// Check if a module is already loaded or currently loading. If not, register it.
-// Returns true if module can be loaded, false if it's a duplicate (error).
-// Uses the global loaded_modules_registry.
-static bool check_and_register_module(const char* canonical_path) {
-    if (canonical_path == NULL) return false; // Should not happen
-
-    for (int i = 0; i < loaded_modules_registry.count; ++i) {
-        if (strcmp(loaded_modules_registry.paths[i], canonical_path) == 0) {
-            // Module already loaded or in the process of loading (as per Scenario 2 strict check)
-            error("Error: Module '%s' is already loaded or causes a circular dependency.", canonical_path);
-            return false;
-        }
+    if (elf_backend && (output_path == NULL || c_output_path != NULL)) {
+        fprintf(stderr, "--backend=elf needs -o and can't be combined with --emit-c\n");
+        return 1;
     }
-
-    if (loaded_modules_registry.count >= MAX_LOADED_MODULES) {
-        error("Error: Maximum number of loaded modules (%d) exceeded.", MAX_LOADED_MODULES);
-        return false;
+    if (output_path != NULL || c_output_path != NULL) {
+        set_exec_mode(elf_backend ? EXEC_ELF : EXEC_AOT);
     }
-
-    strncpy(loaded_modules_registry.paths[loaded_modules_registry.count], canonical_path, MAX_MODULE_PATH_LEN -1);
-    loaded_modules_registry.paths[loaded_modules_registry.count][MAX_MODULE_PATH_LEN -1] = '\0';
-    loaded_modules_registry.count++;
-
-    return true;
-}
-
-
-// Function to report errors and exit
-void error(const char* format, ...) {
-    va_list args;
-    va_start(args, format);
-    fprintf(stderr, "Error: "); // Prefix with "Error: "
-    vfprintf(stderr, format, args);
-    fprintf(stderr, "\n"); // Add a newline for better formatting
-    va_end(args);
-    // Note: exit(1) should only be called from the top-level main or if recovery is impossible.
-    // In recursive loadin, we might want to propagate errors differently.
-    // For now, keeping exit(1) as it's a fatal error handler.
-    exit(1);
-}
-
-// Forward declaration for recursive processing
-static void process_source_code(char* source_code, const char* source_filepath, const char* main_script_dir);
-
-
-// Processes a single source file: lexes, parses, handles loadin directives, and interprets other statements.
-static void process_source_code(char* source_code, const char* source_filepath, const char* main_script_dir) {
-    if (source_code == NULL || source_filepath == NULL) {
-        error("Internal Error: process_source_code called with NULL source or filepath.");
-        return;
+    if (zygote_prelude != NULL && serve_path == NULL) {
+        fprintf(stderr, "--zygote needs --serve\n");
+        return 1;
     }
-    LOG_DEBUG("Processing source file: %s", source_filepath);
-
-    Lexer* lexer = init_lexer(source_code);
-    Parser* parser = init_parser(lexer);
-    ASTNode* program_ast = parse_program(parser); // This is a NODE_BLOCK
-
-    if (program_ast == NULL || program_ast->type != NODE_BLOCK) {
-        error("Error: Failed to parse program: %s. Expected top-level NODE_BLOCK.", source_filepath);
-        // Cleanup for this level of processing
-        if (parser) free_parser(parser);
-        if (lexer) free_lexer(lexer);
-        // program_ast might be NULL or an invalid node, free_ast should handle NULL.
-        if (program_ast) free_ast(program_ast);
-        return; // Or propagate error
+    if (snapshot_path != NULL && prelude_path == NULL) {
+        fprintf(stderr, "--snapshot needs --prelude\n");
+        return 1;
     }
-
-    // Create a temporary block for non-loadin statements of the current file
-    ASTNode* current_file_code_block = create_node(NODE_BLOCK);
-    current_file_code_block->statements = safe_malloc(sizeof(ASTNode*) * program_ast->statement_count); // Max possible needed
-    current_file_code_block->statement_count = 0;
-
-
-    // First pass: handle NODE_LOADIN directives and collect other statements
-    for (int i = 0; i < program_ast->statement_count; ++i) {
-        ASTNode* stmt = program_ast->statements[i];
-        if (stmt == NULL) continue;
-
-        if (stmt->type == NODE_LOADIN) {
-            if (stmt->value.string_val == NULL) {
-                error("Internal Error: NODE_LOADIN found with NULL path in %s.", source_filepath);
-                continue;
-            }
-            LOG_DEBUG("Found loadin directive for: %s in %s", stmt->value.string_val, source_filepath);
-
-            char current_dir_buffer[MAX_MODULE_PATH_LEN];
-            if (!get_directory_part(source_filepath, current_dir_buffer, MAX_MODULE_PATH_LEN)) {
-                error("Error: Could not determine directory for current file %s to resolve loadin.", source_filepath);
-                continue; // Or propagate error
-            }
-
-            char* resolved_module_path = resolve_module_path(stmt->value.string_val, current_dir_buffer, main_script_dir);
-            if (resolved_module_path == NULL) {
-                error("Error: Failed to resolve module '%s' requested in %s.", stmt->value.string_val, source_filepath);
-                // Continue to allow other statements to be processed or error out? For now, error out.
-                // Freeing collected statements and program_ast before exit
-                free_ast(current_file_code_block);
-                // program_ast statements are moved or will be freed with program_ast.
-                // Need to be careful here: stmt is part of program_ast.
-                // If error() exits, memory will be leaked.
-                // This error path needs careful thought for resource cleanup in recursive calls.
-                // For now, relying on error() to exit.
-                 error("Exiting due to module resolution failure."); // This will call exit(1)
-            }
-
-            if (check_and_register_module(resolved_module_path)) {
-                LOG_INFO("Loading module: %s", resolved_module_path);
-                FILE* module_file = fopen(resolved_module_path, "r");
-                if (!module_file) {
-                    error("Error: Could not open module file '%s'.", resolved_module_path);
-                    safe_free(resolved_module_path); // Free path if file open fails
-                    // Similar error path cleanup concerns as above.
-                    error("Exiting due to file open failure.");
-                }
-
-                fseek(module_file, 0, SEEK_END);
-                long module_size_long = ftell(module_file);
-                fseek(module_file, 0, SEEK_SET);
-
-                if (module_size_long < 0) { // Error check for ftell
-                    error("Error: Could not determine size of module file '%s'.", resolved_module_path);
-                }
-                size_t module_size = (size_t)module_size_long; // Cast to size_t
-
-                char* module_source = safe_malloc(module_size + 1);
-                if (fread(module_source, 1, module_size, module_file) != module_size) {
-                     error("Error reading module file '%s'", resolved_module_path);
-                }
-                module_source[module_size] = '\0';
-                fclose(module_file);
-
-                process_source_code(module_source, resolved_module_path, main_script_dir); // Recursive call
-
-                safe_free(module_source);
-            }
-            safe_free(resolved_module_path); // Free after use
-            // The NODE_LOADIN ast node itself (stmt) will be freed when program_ast is freed.
-        } else {
-            // Add non-NODE_LOADIN statements to the current_file_code_block
-            // We are "moving" the statement pointer.
-            current_file_code_block->statements[current_file_code_block->statement_count++] = stmt;
-            program_ast->statements[i] = NULL; // Nullify in original AST to prevent double free
-        }
+    if (prelude_path != NULL && (serve_path != NULL || connect_path != NULL || server_stats_path != NULL)) {
+        fprintf(stderr, "--prelude runs here: it can't be combined with --serve (see --zygote), --connect or --server-stats\n");
+        return 1;
     }
-
-    // After all loadins are processed, interpret the collected statements for the current file
-    if (current_file_code_block->statement_count > 0) {
-        LOG_DEBUG("Interpreting collected code for: %s", source_filepath);
-        interpret(current_file_code_block); // interpret will free its AST content
-    } else {
-        free_ast(current_file_code_block); // Free if empty (no statements moved)
+    // A compiled program has to run the prelude's code itself
+    if (snapshot_path != NULL && (output_path != NULL || c_output_path != NULL)) {
+        fprintf(stderr, "--snapshot can't be combined with -o or --emit-c\n");
+        return 1;
     }
-
-    // Free the original program AST shell (statements were moved or are NODE_LOADINs which are conceptually handled)
-    // Nullify statements array in program_ast before freeing, as its contents were moved or are handled.
-    if (program_ast) {
-        // for(int i=0; i < program_ast->statement_count; ++i) program_ast->statements[i] = NULL; // Ensure children aren't re-freed
-        // The above loop is problematic if some stmts were NODE_LOADIN and not moved.
-        // free_ast should handle freeing children of program_ast correctly if they weren't nulled out.
-        // If a child was moved to current_file_code_block, its pointer in program_ast->statements was set to NULL.
-        // So, free_ast(program_ast) should only free the remaining NODE_LOADINs and the block itself.
-        free_ast(program_ast);
+    if (server_stats_path != NULL) {
+        return print_server_stats(server_stats_path);
     }
-
-    // Free lexer and parser for the current file
-    if (parser) free_parser(parser);
-    if (lexer) free_lexer(lexer);
-     LOG_DEBUG("Finished processing source file: %s", source_filepath);
-}
-
-
-int main(int argc, char* argv[]) {
-    set_debug_level(DEBUG_LEVEL_DEBUG);
-    if (argc != 2) {
-        fprintf(stderr, "Usage: %s <source_file>\n", argv[0]);
-        return 1;
+    if (connect_path != NULL) {
+        return run_on_server(connect_path, initial_filepath_arg);
+    }
+    if (serve_path != NULL) {
+        // The reports at exit and the compilers are for one program, in one thread
+        if (output_path != NULL || c_output_path != NULL || profiling || stats_enabled || time_phases || time_passes) {
+            fprintf(stderr, "--serve can't be combined with -o, --emit-c, --profile, --stats, --time-phases or --time-passes\n");
+            return 1;
+        }
+        return serve(serve_path, serve_threads, zygote_prelude);
     }
 
-    init_loaded_modules_registry(); // Initialize the global registry
-
-    char* initial_filepath_arg = argv[1];
     // char main_script_abs_path[MAX_MODULE_PATH_LEN]; // Unused variable removed
     char main_script_dir[MAX_MODULE_PATH_LEN];
 
@@ -395,7 +261,8 @@ int main(int argc, char* argv[]) {
     LOG_INFO("Main script full path (attempted): %s", initial_file_fullpath);
 
 
-    FILE* file = fopen(initial_filepath_arg, "r"); // Use original argv[1] for fopen
+    double read_began = phase_start(PHASE_READ);
+    FILE* file = fopen(initial_filepath_arg, "r"); // Use the path as given for fopen
     if (!file) {
         error("Error: Could not open file '%s'\n", initial_filepath_arg);
         return 1;
@@ -417,12 +284,29 @@ int main(int argc, char* argv[]) {
     }
     initial_source_code[read_size] = '\0';
     fclose(file);
+    phase_record(PHASE_READ, initial_file_fullpath, read_began);
+
+    if (prelude_path != NULL && !load_prelude(prelude_path, snapshot_path, main_script_dir)) {
+        safe_free(initial_source_code);
+        return 1;
+    }
 
     // Use initial_file_fullpath for the source_filepath context
     process_source_code(initial_source_code, initial_file_fullpath, main_script_dir);
 
     safe_free(initial_source_code);
     free_interpreter_memory(); // Cleans up global symbol table etc.
+    free_type_checker_memory();
+    report_pass_timings(stderr);
+    report_phase_timings(stderr);
+    write_profile();
+    report_stats(stderr);
+
+    if (output_path != NULL || c_output_path != NULL) {
+        int status = elf_backend ? elf_finish(output_path) : aot_finish(output_path, c_output_path);
+        LOG_INFO("Compilation finished.");
+        return status;
+    }
 
     LOG_INFO("Execution finished.");
     return 0;
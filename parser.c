@@ -1,16 +1,49 @@
 #include "compiler.h"
+#include "vm.h"
+#include <stdarg.h>
 #include <stdlib.h>
 #include <string.h>
 
-// Advance to the next token
+// Position of the parser's current token; create_node gives it to new nodes
+static __thread int token_line = 0;
+static __thread int token_column = 0;
+
+// Report a syntax error. Parsing goes on with the next statement; a libzr
+// caller's load fails (loader.c).
+static void parse_error(Parser* parser, const char* format, ...) __attribute__((format(printf, 2, 3)));
+
+static void parse_error(Parser* parser, const char* format, ...) {
+    va_list args;
+    va_start(args, format);
+    fprintf(DIAGNOSTICS, "Parser Error: ");
+    vfprintf(DIAGNOSTICS, format, args);
+    fprintf(DIAGNOSTICS, "\n");
+    va_end(args);
+    parser->error_count++;
+}
+
+// Advance to the next token. With --time-phases, the lexer's share of
+// parsing is added up here; --stats counts its allocations separately.
 static void advance_token(Parser* parser) {
-    parser->current_token = get_next_token(parser->lexer);
+    STAT_PHASE(PHASE_LEX);
+    if (time_phases) {
+        double start = phase_clock();
+        parser->current_token = get_next_token(parser->lexer);
+        note_lex_time(phase_clock() - start);
+    } else {
+        parser->current_token = get_next_token(parser->lexer);
+    }
+    STAT_PHASE(PHASE_PARSE);
+    token_line = parser->current_token.line;
+    token_column = parser->current_token.column;
 }
 
 // Initialize parser with a lexer
 Parser* init_parser(Lexer* lexer) {
     Parser* parser = (Parser*)safe_malloc(sizeof(Parser)); // Use safe_malloc
     parser->lexer = lexer;
+    parser->depth = 0;
+    parser->error_count = 0;
     advance_token(parser);  // Load first token
     return parser;
 }
@@ -38,6 +71,14 @@ ASTNode* create_node(NodeType type) {
     node->statement_count = 0; // Renamed from statements_count for consistency with compiler.h
     node->data_type = TYPE_VOID; // Default data type for the node's own evaluated type
     node->explicit_type = TYPE_VOID; // Default: no explicit type declaration
+    node->op = BINOP_NONE;
+    node->quick = QUICK_NONE;
+    node->cached_value.int64_val = 0;
+    node->hotness = 0;
+    node->chunk = NULL;
+    node->deopts = 0;
+    node->line = token_line;
+    node->column = token_column;
     
     return node;
 }
@@ -47,7 +88,7 @@ static ASTNode* parse_identifier(Parser* parser) {
     ASTNode* node = create_node(NODE_IDENT); 
     if (!node) return NULL;
     if (parser->current_token.text == NULL) { // Should not happen for IDENT if lexer is correct
-        fprintf(stderr, "Parser Error: Identifier token has NULL text.\n");
+        parse_error(parser, "Identifier token has NULL text.");
         safe_free(node);
         return NULL;
     }
@@ -70,7 +111,7 @@ static ASTNode* parse_number(Parser* parser) {
     ASTNode* node = create_node(NODE_NUMBER);
     if (!node) return NULL;
     if (parser->current_token.text == NULL) { // Should not happen for NUMBER if lexer is correct
-        fprintf(stderr, "Parser Error: Number token has NULL text.\n");
+        parse_error(parser, "Number token has NULL text.");
         safe_free(node);
         return NULL;
     }
@@ -88,6 +129,38 @@ static ASTNode* parse_number(Parser* parser) {
     return node;
 }
 
+// Map an operator token to its BinaryOp (BINOP_NONE if it has no binary meaning)
+static BinaryOp token_to_binary_op(TokenType type) {
+    switch (type) {
+        case TOKEN_PLUS:  return BINOP_ADD;
+        case TOKEN_MINUS: return BINOP_SUB;
+        case TOKEN_STAR:  return BINOP_MUL;
+        case TOKEN_SLASH: return BINOP_DIV;
+        case TOKEN_GT:    return BINOP_GT;
+        case TOKEN_LT:    return BINOP_LT;
+        case TOKEN_EQEQ:  return BINOP_EQ;
+        case TOKEN_LTEQ:  return BINOP_LTEQ;
+        case TOKEN_GTEQ:  return BINOP_GTEQ;
+        case TOKEN_NOTEQ: return BINOP_NOTEQ;
+        case TOKEN_AND:   return BINOP_AND;
+        case TOKEN_OR:    return BINOP_OR;
+        default:          return BINOP_NONE;
+    }
+}
+
+// Track nesting so that untrusted input can't exhaust the C stack of the
+// recursive-descent parser (or of the passes that walk the resulting tree).
+static void enter_nesting_level(Parser* parser) {
+    if (++parser->depth > MAX_NESTING_DEPTH) {
+        error("Parser Error: Expression or block nested deeper than %d levels at line %d, column %d.",
+              MAX_NESTING_DEPTH, parser->current_token.line, parser->current_token.column);
+    }
+}
+
+static void leave_nesting_level(Parser* parser) {
+    parser->depth--;
+}
+
 // Forward declarations
 static ASTNode* parse_expression(Parser* parser);
 static ASTNode* parse_statement(Parser* parser); // Will call parse_loadin_statement
@@ -98,7 +171,16 @@ static ASTNode* parse_loadin_statement(Parser* parser); // New forward declarati
 // Logic is handled in parse_expression.
 
 // Parse an expression
+static ASTNode* parse_expression_at_level(Parser* parser);
+
 static ASTNode* parse_expression(Parser* parser) {
+    enter_nesting_level(parser);
+    ASTNode* expression = parse_expression_at_level(parser);
+    leave_nesting_level(parser);
+    return expression;
+}
+
+static ASTNode* parse_expression_at_level(Parser* parser) {
     ASTNode* left = NULL; // Initialize left to NULL
     
     // Parse primary expressions like identifiers, numbers, literals, parenthesized expressions
@@ -112,7 +194,7 @@ static ASTNode* parse_expression(Parser* parser) {
         case TOKEN_STRING: {
             ASTNode* node = create_node(NODE_STRING);
             if (parser->current_token.text == NULL) { // Should not happen for STRING if lexer is correct
-                fprintf(stderr, "Parser Error: String token has NULL text.\n");
+                parse_error(parser, "String token has NULL text.");
                 safe_free(node);
                 left = NULL;
             } else {
@@ -137,7 +219,7 @@ static ASTNode* parse_expression(Parser* parser) {
             advance_token(parser); // Consume TOKEN_LPAREN
             ASTNode* inner_expression = parse_expression(parser);
             if (inner_expression == NULL || parser->current_token.type != TOKEN_RPAREN) {
-                fprintf(stderr, "Parser Error: Mismatched parentheses or invalid expression within parentheses.\n");
+                parse_error(parser, "Mismatched parentheses or invalid expression within parentheses.");
                 if (inner_expression) free_ast(inner_expression);
                 left = NULL; 
             } else {
@@ -150,7 +232,7 @@ static ASTNode* parse_expression(Parser* parser) {
             // If the token cannot start an expression, print an error and return NULL.
             // This prevents falling through to the binary operator loop with a NULL left operand
             // if the token is not a binary operator either.
-            fprintf(stderr, "Parser Error: Token '%s' cannot start an expression.\n", parser->current_token.text);
+            parse_error(parser, "Token '%s' cannot start an expression.", parser->current_token.text);
             return NULL; // Return NULL directly
     }
     
@@ -182,13 +264,14 @@ static ASTNode* parse_expression(Parser* parser) {
         
         // Store operator token text
         if (parser->current_token.text == NULL) { // Should not happen for operator tokens
-             fprintf(stderr, "Parser Error: Operator token has NULL text.\n");
+             parse_error(parser, "Operator token has NULL text.");
              free_ast(left); // Free the left operand
              safe_free(node); // Free the partially created binary node
              return NULL;    // Critical error
         }
         node->value.string_val = parser->current_token.text; // Transfer ownership
         parser->current_token.text = NULL;                  // Nullify original pointer
+        node->op = token_to_binary_op(parser->current_token.type);
         node->left = left;
         
         // Store operator type as node's data_type or a specific field if added
@@ -230,7 +313,7 @@ static ASTNode* parse_let_statement(Parser* parser) {
     // Assuming current_token.text is the correct field from lexer
     node->value.string_val = strdup(parser->current_token.text);
     if (!node->value.string_val) {
-        fprintf(stderr, "Parser Error: Failed to duplicate identifier name for 'let' statement.\n");
+        parse_error(parser, "Failed to duplicate identifier name for 'let' statement.");
         free_ast(node);
         return NULL;
     }
@@ -261,7 +344,7 @@ static ASTNode* parse_let_statement(Parser* parser) {
                 node->explicit_type = TYPE_STRING;
                 break;
             default:
-                fprintf(stderr, "Parser Error: Expected type keyword (int, int32, int64, float, bool, string) after ':' in let statement, got %s.\n", parser->current_token.text);
+                parse_error(parser, "Expected type keyword (int, int32, int64, float, bool, string) after ':' in let statement, got %s.", parser->current_token.text);
                 free_ast(node); // Free the partially created node
                 return NULL;
         }
@@ -270,7 +353,7 @@ static ASTNode* parse_let_statement(Parser* parser) {
     // If no TOKEN_COLON, node->explicit_type remains TYPE_VOID (from create_node)
 
     if (parser->current_token.type != TOKEN_EQ) {
-        fprintf(stderr, "Parser Error: Expected '=' after identifier or type in let statement, got %s.\n", parser->current_token.text);
+        parse_error(parser, "Expected '=' after identifier or type in let statement, got %s.", parser->current_token.text);
         free_ast(node); // Free the partially created node
         return NULL;
     }
@@ -278,7 +361,7 @@ static ASTNode* parse_let_statement(Parser* parser) {
     
     ASTNode* value_expr = parse_expression(parser);
     if (value_expr == NULL) {
-        fprintf(stderr, "Parser Error: Expected expression after '=' in let statement.\n");
+        parse_error(parser, "Expected expression after '=' in let statement.");
         free_ast(node); // Free the partially created node (name is in node->value.string_val)
         return NULL;
     }
@@ -302,7 +385,16 @@ static ASTNode* parse_print_statement(Parser* parser) {
 }
 
 // Parse a block of statements
+static ASTNode* parse_block_at_level(Parser* parser);
+
 static ASTNode* parse_block(Parser* parser) {
+    enter_nesting_level(parser);
+    ASTNode* block = parse_block_at_level(parser);
+    leave_nesting_level(parser);
+    return block;
+}
+
+static ASTNode* parse_block_at_level(Parser* parser) {
     advance_token(parser);  // consume '{'
     
     ASTNode* block_node = create_node(NODE_BLOCK); // Requirement 1
@@ -376,6 +468,30 @@ static ASTNode* parse_if_statement(Parser* parser) {
     return node;
 }
 
+// Parse a while loop: while (condition) { body }
+static ASTNode* parse_while_statement(Parser* parser) {
+    advance_token(parser);  // consume 'while'
+
+    if (parser->current_token.type != TOKEN_LPAREN) {
+        return NULL;
+    }
+    advance_token(parser);  // consume '('
+
+    ASTNode* condition = parse_expression(parser);
+
+    if (parser->current_token.type != TOKEN_RPAREN) {
+        free_ast(condition);
+        return NULL;
+    }
+    advance_token(parser);  // consume ')'
+
+    ASTNode* node = create_node(NODE_WHILE);
+    node->condition = condition;
+    node->body = parse_block(parser);
+
+    return node;
+}
+
 // Parse a loadin statement (e.g., loadin "module_name")
 static ASTNode* parse_loadin_statement(Parser* parser) {
     advance_token(parser); // Consume 'loadin' keyword
@@ -421,6 +537,8 @@ static ASTNode* parse_loadin_statement(Parser* parser) {
 // Parse a statement
 static ASTNode* parse_statement(Parser* parser) {
     ASTNode* statement = NULL;
+    int line = parser->current_token.line; // Statements start at their first token
+    int column = parser->current_token.column;
     
     switch (parser->current_token.type) {
         case TOKEN_LET: // Stays TOKEN_LET, was already correct
@@ -435,7 +553,10 @@ static ASTNode* parse_statement(Parser* parser) {
         case TOKEN_LOADIN: // Added case for TOKEN_LOADIN
             statement = parse_loadin_statement(parser);
             break;
-        // Add other statement types: TOKEN_WHILE, TOKEN_FUNC, TOKEN_RETURN etc.
+        case TOKEN_WHILE:
+            statement = parse_while_statement(parser);
+            break;
+        // Add other statement types: TOKEN_FUNC, TOKEN_RETURN etc.
         default:
             // If it's not a recognized statement keyword, try parsing it as an expression statement
             statement = parse_expression(parser);
@@ -447,6 +568,10 @@ static ASTNode* parse_statement(Parser* parser) {
             }
             break;
     }
+    if (statement != NULL) {
+        statement->line = line;
+        statement->column = column;
+    }
     
     // Consume semicolon if present, and it's expected for the statement type
     if (parser->current_token.type == TOKEN_SEMICOLON) {
@@ -487,52 +612,152 @@ ASTNode* parse_program(Parser* parser) {
     return program_node;
 }
 
-// In parser.c
+// Append a node to the free_ast work list, growing it as needed
+static void push_pending_node(ASTNode*** pending, int* count, int* capacity, ASTNode* node) {
+    if (node == NULL) return;
+    if (*count == *capacity) {
+        int new_capacity = *capacity * 2;
+        ASTNode** grown = safe_malloc(sizeof(ASTNode*) * new_capacity);
+        memcpy(grown, *pending, sizeof(ASTNode*) * (*count));
+        safe_free(*pending);
+        *pending = grown;
+        *capacity = new_capacity;
+    }
+    (*pending)[(*count)++] = node;
+}
+
+// Free an AST. Uses a heap work list instead of recursion, so tearing down a
+// deeply nested tree doesn't depend on the C stack.
+// Whether the node's value.string_val was allocated for it (for NODE_LET,
+// the variable name; for NODE_LOADIN, the module path)
+static bool owns_string(const ASTNode* node) {
+    return (node->type == NODE_IDENT ||
+            node->type == NODE_NUMBER ||
+            node->type == NODE_STRING ||
+            node->type == NODE_BINARY ||
+            node->type == NODE_LET ||
+            node->type == NODE_LOADIN) &&
+           node->value.string_val != NULL;
+}
+
 void free_ast(ASTNode* node) {
     if (node == NULL) {
         return;
     }
 
-    // Corrected conditional free:
-    if ((node->type == NODE_IDENT ||
-         node->type == NODE_NUMBER ||
-         node->type == NODE_STRING ||
-         node->type == NODE_BINARY ||
-         node->type == NODE_LET) && /* NODE_LET's value.string_val is var name */
-        node->value.string_val != NULL) {
-        safe_free(node->value.string_val);
-        node->value.string_val = NULL;
-    }
-    // For other node types like NODE_BOOL, NODE_PRINT, NODE_IF, NODE_BLOCK, etc.,
-    // value.string_val is not used for dynamically allocated strings that free_ast should free.
-
-    // Recursively free children nodes
-    free_ast(node->left);
-    free_ast(node->right);
-    free_ast(node->condition);
-    free_ast(node->body);
-    free_ast(node->else_body);
-
-    // Free parameters if any (for function nodes, not fully implemented yet)
-    if (node->params != NULL) {
-        for (int i = 0; i < node->param_count; i++) {
-            free_ast(node->params[i]);
+    int capacity = 64;
+    int count = 0;
+    ASTNode** pending = safe_malloc(sizeof(ASTNode*) * capacity);
+    push_pending_node(&pending, &count, &capacity, node);
+
+    while (count > 0) {
+        ASTNode* current = pending[--count];
+
+        if (owns_string(current)) {
+            safe_free(current->value.string_val);
+            current->value.string_val = NULL;
+        }
+        // For other node types like NODE_BOOL, NODE_PRINT, NODE_IF, NODE_BLOCK, etc.,
+        // value.string_val is not used for dynamically allocated strings that free_ast should free.
+
+        push_pending_node(&pending, &count, &capacity, current->left);
+        push_pending_node(&pending, &count, &capacity, current->right);
+        push_pending_node(&pending, &count, &capacity, current->condition);
+        push_pending_node(&pending, &count, &capacity, current->body);
+        push_pending_node(&pending, &count, &capacity, current->else_body);
+
+        // Parameters (for function nodes, not fully implemented yet)
+        if (current->params != NULL) {
+            for (int i = 0; i < current->param_count; i++) {
+                push_pending_node(&pending, &count, &capacity, current->params[i]);
+            }
+            safe_free(current->params);
+            current->params = NULL;
         }
-        safe_free(node->params);
-        node->params = NULL;
+
+        // Register bytecode of a loop promoted by tiered execution
+        if (current->chunk != NULL) {
+            free_chunk(current->chunk);
+            current->chunk = NULL;
+        }
+
+        // Statements of block-like nodes
+        if (current->statements != NULL) {
+            for (int i = 0; i < current->statement_count; i++) {
+                push_pending_node(&pending, &count, &capacity, current->statements[i]);
+            }
+            safe_free(current->statements);
+            current->statements = NULL;
+        }
+
+        safe_free(current);
     }
 
-    // Free statements if it's a block-like node
-    if (node->statements != NULL) {
-        for (int i = 0; i < node->statement_count; i++) {
-            free_ast(node->statements[i]);
+    safe_free(pending);
+}
+
+// Deep copy of a tree as parsed, for a module that is run more than once
+// (the loader's module cache): execution state such as a loop's bytecode
+// and hotness starts over in the copy.
+ASTNode* clone_ast(const ASTNode* node) {
+    if (node == NULL) {
+        return NULL;
+    }
+
+    typedef struct {
+        const ASTNode* source;
+        ASTNode** slot; // Where the copy goes
+    } PendingCopy;
+
+    ASTNode* root = NULL;
+    int capacity = 64;
+    int count = 0;
+    PendingCopy* pending = safe_malloc(sizeof(PendingCopy) * capacity);
+    pending[count++] = (PendingCopy){ node, &root };
+
+    while (count > 0) {
+        PendingCopy next = pending[--count];
+        const ASTNode* source = next.source;
+        ASTNode* copy = safe_malloc(sizeof(ASTNode));
+        *copy = *source;
+        *next.slot = copy;
+        if (owns_string(source)) {
+            copy->value.string_val = safe_strdup(source->value.string_val);
+        }
+        copy->hotness = 0;
+        copy->chunk = NULL;
+        copy->deopts = 0;
+        copy->params = source->param_count > 0 ? safe_malloc(sizeof(ASTNode*) * source->param_count) : NULL;
+        copy->statements = source->statement_count > 0 ? safe_malloc(sizeof(ASTNode*) * source->statement_count) : NULL;
+
+        // Children: at most five links plus the node's arrays
+        int needed = count + 5 + source->param_count + source->statement_count;
+        if (needed > capacity) {
+            int new_capacity = capacity;
+            while (new_capacity < needed) new_capacity *= 2;
+            PendingCopy* grown = safe_malloc(sizeof(PendingCopy) * new_capacity);
+            memcpy(grown, pending, sizeof(PendingCopy) * count);
+            safe_free(pending);
+            pending = grown;
+            capacity = new_capacity;
+        }
+        const ASTNode* const links[] = { source->left, source->right, source->condition, source->body, source->else_body };
+        ASTNode** const slots[] = { &copy->left, &copy->right, &copy->condition, &copy->body, &copy->else_body };
+        for (int i = 0; i < 5; i++) {
+            if (links[i] != NULL) pending[count++] = (PendingCopy){ links[i], slots[i] };
+        }
+        for (int i = 0; i < source->param_count; i++) {
+            copy->params[i] = NULL;
+            if (source->params[i] != NULL) pending[count++] = (PendingCopy){ source->params[i], &copy->params[i] };
+        }
+        for (int i = 0; i < source->statement_count; i++) {
+            copy->statements[i] = NULL;
+            if (source->statements[i] != NULL) pending[count++] = (PendingCopy){ source->statements[i], &copy->statements[i] };
         }
-        safe_free(node->statements);
-        node->statements = NULL;
     }
 
-    // Finally, free the node itself
-    safe_free(node);
+    safe_free(pending);
+    return root;
 }
 
 // Free parser resources
@@ -0,0 +1,212 @@
+#include "compiler.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+// Per-module phase timing for --time-phases. main.c brackets each phase of
+// process_source_code with phase_start()/phase_record(); with timing off they
+// only tell --stats which phase allocations belong to. Lexing happens on demand inside the parser, so the parser adds
+// up the time spent fetching tokens (note_lex_time) and that is split off the
+// parse phase.
+//
+// At exit, report_phase_timings prints a table of every module, nested
+// modules indented under the module that loads them, or writes the phases as
+// Chrome trace events ("X" events on one thread, so loadin nesting shows up
+// as nested spans) for chrome://tracing or Perfetto.
+
+bool time_phases = false;
+static const char* trace_path = NULL;
+static double origin;
+
+static const char* const phase_names[PHASE_COUNT] = {
+    "read", "lex", "parse", "resolve", "typecheck", "interpret"
+};
+
+typedef struct {
+    char* path;
+    int depth;                    // loadin nesting, 0 for the main script
+    double seconds[PHASE_COUNT];
+} ModuleTiming;
+
+typedef struct {
+    int module;
+    int phase;       // A Phase, or -1 for the module's whole processing
+    double start;    // Seconds since origin
+    double duration;
+    double lex;      // PHASE_PARSE: time spent in the lexer
+} PhaseEvent;
+
+static ModuleTiming* modules = NULL;
+static int module_count = 0;
+static int module_capacity = 0;
+static PhaseEvent* events = NULL;
+static int event_count = 0;
+static int event_capacity = 0;
+
+// Modules being processed, innermost last
+static int open_modules[MAX_LOADED_MODULES + 1];
+static double open_starts[MAX_LOADED_MODULES + 1];
+static int open_count = 0;
+static double lex_seconds = 0; // Since the last PHASE_PARSE record
+
+void set_time_phases(bool enabled, const char* path) {
+    time_phases = enabled;
+    trace_path = path;
+    origin = phase_clock();
+}
+
+const char* phase_name(Phase phase) {
+    return phase_names[phase];
+}
+
+double phase_clock(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+double phase_start(Phase phase) {
+    STAT_PHASE(phase);
+    return time_phases ? phase_clock() : 0;
+}
+
+void note_lex_time(double seconds) {
+    lex_seconds += seconds;
+}
+
+static int find_module(const char* path) {
+    for (int i = 0; i < module_count; i++) {
+        if (strcmp(modules[i].path, path) == 0) return i;
+    }
+    if (module_count == module_capacity) {
+        int new_capacity = module_capacity == 0 ? 8 : module_capacity * 2;
+        ModuleTiming* grown = safe_malloc(sizeof(ModuleTiming) * new_capacity);
+        if (modules != NULL) {
+            memcpy(grown, modules, sizeof(ModuleTiming) * module_count);
+            safe_free(modules);
+        }
+        modules = grown;
+        module_capacity = new_capacity;
+    }
+    ModuleTiming* module = &modules[module_count];
+    memset(module, 0, sizeof(ModuleTiming));
+    module->path = strdup(path);
+    module->depth = open_count;
+    return module_count++;
+}
+
+static void add_event(int module, int phase, double start, double end, double lex) {
+    if (event_count == event_capacity) {
+        int new_capacity = event_capacity == 0 ? 32 : event_capacity * 2;
+        PhaseEvent* grown = safe_malloc(sizeof(PhaseEvent) * new_capacity);
+        if (events != NULL) {
+            memcpy(grown, events, sizeof(PhaseEvent) * event_count);
+            safe_free(events);
+        }
+        events = grown;
+        event_capacity = new_capacity;
+    }
+    events[event_count++] = (PhaseEvent){ module, phase, start - origin, end - start, lex };
+}
+
+void phase_enter_module(const char* path) {
+    if (!time_phases || open_count > MAX_LOADED_MODULES) return;
+    int module = find_module(path);
+    modules[module].depth = open_count;
+    open_modules[open_count] = module;
+    open_starts[open_count++] = phase_clock();
+}
+
+void phase_leave_module(void) {
+    if (!time_phases || open_count == 0) return;
+    open_count--;
+    add_event(open_modules[open_count], -1, open_starts[open_count], phase_clock(), 0);
+}
+
+// Record a phase of 'path' that began at 'start' (from phase_start) and ends now
+void phase_record(Phase phase, const char* path, double start) {
+    STAT_PHASE(STATS_OTHER_PHASE);
+    if (!time_phases) return;
+    double end = phase_clock();
+    int index = find_module(path);
+    ModuleTiming* module = &modules[index];
+    double lex = 0;
+    if (phase == PHASE_PARSE) {
+        lex = lex_seconds;
+        lex_seconds = 0;
+        module->seconds[PHASE_LEX] += lex;
+        module->seconds[PHASE_PARSE] += end - start - lex;
+    } else {
+        module->seconds[phase] += end - start;
+    }
+    add_event(index, phase, start, end, lex);
+}
+
+static void write_json_string(FILE* out, const char* text) {
+    fputc('"', out);
+    for (const char* c = text; *c != '\0'; c++) {
+        if (*c == '"' || *c == '\\') {
+            fprintf(out, "\\%c", *c);
+        } else if ((unsigned char)*c < 0x20) {
+            fprintf(out, "\\u%04x", *c);
+        } else {
+            fputc(*c, out);
+        }
+    }
+    fputc('"', out);
+}
+
+static void write_trace(FILE* out) {
+    fprintf(out, "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n");
+    for (int i = 0; i < event_count; i++) {
+        const PhaseEvent* event = &events[i];
+        fprintf(out, "  {\"name\": \"%s\", \"cat\": \"zr\", \"ph\": \"X\", \"pid\": 1, \"tid\": 1, "
+                     "\"ts\": %.3f, \"dur\": %.3f, \"args\": {\"module\": ",
+                event->phase < 0 ? "module" : phase_names[event->phase],
+                event->start * 1e6, event->duration * 1e6);
+        write_json_string(out, modules[event->module].path);
+        if (event->phase == PHASE_PARSE) fprintf(out, ", \"lex_ms\": %.3f", event->lex * 1e3);
+        fprintf(out, "}}%s\n", i + 1 < event_count ? "," : "");
+    }
+    fprintf(out, "]}\n");
+}
+
+static void write_table(FILE* out) {
+    double totals[PHASE_COUNT] = {0};
+    fprintf(out, "=== Phase timings (ms) ===\n");
+    for (int p = 0; p < PHASE_COUNT; p++) fprintf(out, "%10s", phase_names[p]);
+    fprintf(out, "%10s  module\n", "total");
+    for (int i = 0; i < module_count; i++) {
+        const ModuleTiming* module = &modules[i];
+        double total = 0;
+        for (int p = 0; p < PHASE_COUNT; p++) {
+            fprintf(out, "%10.3f", module->seconds[p] * 1e3);
+            total += module->seconds[p];
+            totals[p] += module->seconds[p];
+        }
+        fprintf(out, "%10.3f  %*s%s\n", total * 1e3, module->depth * 2, "", module->path);
+    }
+    double total = 0;
+    for (int p = 0; p < PHASE_COUNT; p++) {
+        fprintf(out, "%10.3f", totals[p] * 1e3);
+        total += totals[p];
+    }
+    fprintf(out, "%10.3f  (all modules)\n", total * 1e3);
+}
+
+// The --time-phases report: a table on 'out', or the trace file
+void report_phase_timings(FILE* out) {
+    if (!time_phases) return;
+    if (trace_path == NULL) {
+        write_table(out);
+        return;
+    }
+    FILE* trace = fopen(trace_path, "w");
+    if (trace == NULL) {
+        fprintf(stderr, "Error: Could not write trace file '%s'\n", trace_path);
+        return;
+    }
+    write_trace(trace);
+    fclose(trace);
+}
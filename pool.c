@@ -0,0 +1,272 @@
+#include "zr.h"
+#include "compiler.h"
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+// The thread pool of zr.h. Each worker has a context of its own, reset
+// between jobs, and a queue of jobs: submit deals jobs to the queues in turn,
+// a worker runs its own oldest first and, when its queue is empty, steals the
+// newest job of another. Taking a job only locks the queue it is in; the
+// pool's lock is for workers with nothing to do, which sleep until a submit.
+// A job's output and messages go to its own buffers, never to stdout.
+//
+// Modules are shared through a module cache (loader.c) holding their trees
+// as parsed; each load runs a copy, since running a tree changes it.
+
+struct ZrJob {
+    char* name;
+    char* source;
+    ZrStatus status;
+    char* output; // What 'print' wrote
+    size_t output_size;
+    char* messages;
+    bool done;
+    pthread_mutex_t lock;
+    pthread_cond_t finished;
+};
+
+typedef struct {
+    pthread_mutex_t lock;
+    ZrJob** jobs; // Ring of 'capacity' slots, 'count' from 'head' on
+    int capacity;
+    int head;
+    int count;
+} JobQueue;
+
+typedef struct {
+    ZrPool* pool;
+    int index;
+    pthread_t thread;
+    JobQueue queue;
+} Worker;
+
+struct ZrPool {
+    Worker* workers;
+    int worker_count;    // Grows as workers start, so read atomically
+    ModuleCache* modules;
+    pthread_mutex_t lock; // Only for sleeping on 'work'
+    pthread_cond_t work;
+    int pending;         // Jobs in the queues not yet taken (atomic, briefly negative)
+    int sleepers;        // Workers going to sleep or asleep (atomic)
+    unsigned next_queue; // For dealing jobs (atomic)
+    bool stopping;
+};
+
+static void push_job(JobQueue* queue, ZrJob* job) {
+    pthread_mutex_lock(&queue->lock);
+    if (queue->count == queue->capacity) {
+        int new_capacity = queue->capacity == 0 ? 16 : queue->capacity * 2;
+        ZrJob** grown = safe_malloc(sizeof(ZrJob*) * new_capacity);
+        for (int i = 0; i < queue->count; i++) {
+            grown[i] = queue->jobs[(queue->head + i) % queue->capacity];
+        }
+        safe_free(queue->jobs);
+        queue->jobs = grown;
+        queue->capacity = new_capacity;
+        queue->head = 0;
+    }
+    queue->jobs[(queue->head + queue->count) % queue->capacity] = job;
+    queue->count++;
+    pthread_mutex_unlock(&queue->lock);
+}
+
+// The oldest job, for the queue's worker, or the newest, for a thief
+static ZrJob* pop_job(JobQueue* queue, bool oldest) {
+    ZrJob* job = NULL;
+    pthread_mutex_lock(&queue->lock);
+    if (queue->count > 0) {
+        if (oldest) {
+            job = queue->jobs[queue->head];
+            queue->head = (queue->head + 1) % queue->capacity;
+        } else {
+            job = queue->jobs[(queue->head + queue->count - 1) % queue->capacity];
+        }
+        queue->count--;
+    }
+    pthread_mutex_unlock(&queue->lock);
+    return job;
+}
+
+// The worker's own oldest job, or else another's newest, or NULL
+static ZrJob* find_job(Worker* worker) {
+    ZrPool* pool = worker->pool;
+    int worker_count = __atomic_load_n(&pool->worker_count, __ATOMIC_ACQUIRE);
+    ZrJob* job = pop_job(&worker->queue, true);
+    for (int i = 1; job == NULL && i < worker_count; i++) {
+        job = pop_job(&pool->workers[(worker->index + i) % worker_count].queue, false);
+    }
+    if (job != NULL) __atomic_sub_fetch(&pool->pending, 1, __ATOMIC_SEQ_CST);
+    return job;
+}
+
+// Wait for a job and take it; NULL once the pool stops with none left.
+// A sleeper counts itself before it checks 'pending' and submit counts a
+// job before it checks 'sleepers', so one of them sees the other: either
+// the worker finds the job or submit wakes it, under the lock it waits on.
+static ZrJob* take_job(Worker* worker) {
+    ZrPool* pool = worker->pool;
+    for (;;) {
+        ZrJob* job = find_job(worker);
+        if (job != NULL) return job;
+
+        pthread_mutex_lock(&pool->lock);
+        __atomic_add_fetch(&pool->sleepers, 1, __ATOMIC_SEQ_CST);
+        while (__atomic_load_n(&pool->pending, __ATOMIC_SEQ_CST) <= 0 && !pool->stopping) {
+            pthread_cond_wait(&pool->work, &pool->lock);
+        }
+        __atomic_sub_fetch(&pool->sleepers, 1, __ATOMIC_SEQ_CST);
+        bool finished = pool->stopping && __atomic_load_n(&pool->pending, __ATOMIC_SEQ_CST) <= 0;
+        pthread_mutex_unlock(&pool->lock);
+        if (finished) return NULL;
+        sched_yield(); // Let a worker that just took a job count it
+    }
+}
+
+static void run_job(ZrContext* context, ZrJob* job) {
+    zr_reset(context);
+    FILE* output = open_memstream(&job->output, &job->output_size);
+    zr_set_output(context, output);
+    job->status = zr_load(context, job->name, job->source);
+    if (job->status == ZR_OK) job->status = zr_run(context);
+    zr_set_output(context, NULL);
+    fclose(output);
+    job->messages = safe_strdup(zr_error(context));
+
+    pthread_mutex_lock(&job->lock);
+    job->done = true;
+    pthread_cond_signal(&job->finished);
+    pthread_mutex_unlock(&job->lock);
+}
+
+static void* run_worker(void* argument) {
+    Worker* worker = argument;
+    set_module_cache(worker->pool->modules);
+    ZrContext* context = zr_create();
+    ZrJob* job;
+    while ((job = take_job(worker)) != NULL) {
+        run_job(context, job);
+    }
+    zr_destroy(context);
+    free_eval_stack();
+    return NULL;
+}
+
+ZrPool* zr_pool_create(int threads) {
+    if (threads <= 0) {
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        threads = cpus > 0 ? (int)cpus : 1;
+    }
+    ZrPool* pool = safe_malloc(sizeof(ZrPool));
+    pool->workers = safe_malloc(sizeof(Worker) * threads);
+    pool->worker_count = 0;
+    pool->modules = create_module_cache();
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->work, NULL);
+    pool->pending = 0;
+    pool->sleepers = 0;
+    pool->next_queue = 0;
+    pool->stopping = false;
+
+    // Queues first: a worker may steal from any of them as soon as it starts
+    for (int i = 0; i < threads; i++) {
+        Worker* worker = &pool->workers[i];
+        worker->pool = pool;
+        worker->index = i;
+        pthread_mutex_init(&worker->queue.lock, NULL);
+        worker->queue.jobs = NULL;
+        worker->queue.capacity = 0;
+        worker->queue.head = 0;
+        worker->queue.count = 0;
+    }
+    // Only the workers started take part
+    for (int i = 0; i < threads; i++) {
+        if (pthread_create(&pool->workers[i].thread, NULL, run_worker, &pool->workers[i]) != 0) break;
+        __atomic_store_n(&pool->worker_count, i + 1, __ATOMIC_RELEASE);
+    }
+    for (int i = pool->worker_count; i < threads; i++) {
+        pthread_mutex_destroy(&pool->workers[i].queue.lock);
+    }
+    if (pool->worker_count == 0) {
+        zr_pool_destroy(pool);
+        return NULL;
+    }
+    return pool;
+}
+
+void zr_pool_destroy(ZrPool* pool) {
+    if (pool == NULL) return;
+    pthread_mutex_lock(&pool->lock);
+    pool->stopping = true;
+    pthread_cond_broadcast(&pool->work);
+    pthread_mutex_unlock(&pool->lock);
+    // Any worker may look in any queue until it stops
+    for (int i = 0; i < pool->worker_count; i++) {
+        pthread_join(pool->workers[i].thread, NULL);
+    }
+    for (int i = 0; i < pool->worker_count; i++) {
+        safe_free(pool->workers[i].queue.jobs);
+        pthread_mutex_destroy(&pool->workers[i].queue.lock);
+    }
+    free_module_cache(pool->modules);
+    pthread_cond_destroy(&pool->work);
+    pthread_mutex_destroy(&pool->lock);
+    safe_free(pool->workers);
+    safe_free(pool);
+}
+
+ZrJob* zr_pool_submit(ZrPool* pool, const char* name, const char* source) {
+    ZrJob* job = safe_malloc(sizeof(ZrJob));
+    job->name = safe_strdup(name);
+    job->source = safe_strdup(source);
+    job->status = ZR_OK;
+    job->output = NULL;
+    job->output_size = 0;
+    job->messages = NULL;
+    job->done = false;
+    pthread_mutex_init(&job->lock, NULL);
+    pthread_cond_init(&job->finished, NULL);
+
+    unsigned queue = __atomic_fetch_add(&pool->next_queue, 1, __ATOMIC_RELAXED) % pool->worker_count;
+    push_job(&pool->workers[queue].queue, job);
+
+    // Counted once queued: a worker may take it first, leaving 'pending' below zero for a moment
+    __atomic_add_fetch(&pool->pending, 1, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&pool->sleepers, __ATOMIC_SEQ_CST) > 0) {
+        pthread_mutex_lock(&pool->lock);
+        pthread_cond_signal(&pool->work);
+        pthread_mutex_unlock(&pool->lock);
+    }
+    return job;
+}
+
+ZrStatus zr_job_wait(ZrJob* job) {
+    pthread_mutex_lock(&job->lock);
+    while (!job->done) {
+        pthread_cond_wait(&job->finished, &job->lock);
+    }
+    pthread_mutex_unlock(&job->lock);
+    return job->status;
+}
+
+const char* zr_job_output(const ZrJob* job) {
+    return job->output != NULL ? job->output : "";
+}
+
+const char* zr_job_error(const ZrJob* job) {
+    return job->messages != NULL ? job->messages : "";
+}
+
+void zr_job_free(ZrJob* job) {
+    if (job == NULL) return;
+    safe_free(job->name);
+    safe_free(job->source);
+    free(job->output); // From open_memstream
+    safe_free(job->messages);
+    pthread_cond_destroy(&job->finished);
+    pthread_mutex_destroy(&job->lock);
+    safe_free(job);
+}
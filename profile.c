@@ -0,0 +1,321 @@
+#include "compiler.h"
+#include "vm.h"
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+
+// Sampling profiler for --profile.
+//
+// An ITIMER_PROF timer raises SIGPROF once per millisecond of CPU time. The
+// handler reads what the engines publish about the statement they are
+// running: the AST walker stores the statement it starts in
+// profile_statement; the bytecode engines store their chunk and, on every
+// dispatch, the pc, and each chunk records the statement every instruction
+// was compiled from. The handler only bumps a counter in a fixed hash table
+// keyed by (statement, module, engine), so it never allocates.
+//
+// When a module has run, its counters are attributed to source lines by
+// walking the module's AST, and turned into folded stacks:
+//
+//   module;while (line 3);while (line 5);line 7 42
+//
+// one frame per enclosing while loop (ZR# has no functions; loops are where
+// the time goes), then the statement's line, then the engine if it wasn't the
+// AST walker ([stack vm], [register vm], [jit]). Time a module spends outside
+// its statements (reading, parsing, type checking) is "module;[load]".
+// write_profile prints the stacks in the format flamegraph.pl and speedscope
+// read.
+
+#define PROFILE_INTERVAL_USEC 1000
+#define SAMPLE_TABLE_SIZE 4096 // Distinct (statement, module, engine) keys; a power of two
+#define MAX_FRAMES_LEN 4096
+
+bool profiling = false;
+// Per thread, as each engine updates them whether or not profiling is on;
+// SIGPROF samples the thread it interrupts (the CLI runs one)
+__thread const ASTNode* volatile profile_statement = NULL;
+__thread const Chunk* volatile profile_chunk = NULL;
+__thread volatile sig_atomic_t profile_pc = 0;
+__thread volatile sig_atomic_t profile_engine = PROFILE_TREE;
+
+static const char* output_path = NULL;
+
+static const char* const engine_frames[PROFILE_ENGINE_COUNT] = {
+    [PROFILE_TREE] = NULL,
+    [PROFILE_STACK_VM] = "[stack vm]",
+    [PROFILE_REGISTER_VM] = "[register vm]",
+    [PROFILE_JIT] = "[jit]",
+};
+
+typedef struct {
+    bool used;
+    const ASTNode* site; // NULL: not inside a statement
+    int module;
+    int engine;
+    unsigned long count;
+} SampleSlot;
+
+static SampleSlot sample_table[SAMPLE_TABLE_SIZE];
+static volatile unsigned long dropped_samples = 0;
+
+// Modules by index; the innermost one being processed takes the samples
+static char* module_names[MAX_LOADED_MODULES + 1];
+static int module_count = 0;
+static int open_modules[MAX_LOADED_MODULES + 1];
+static int open_count = 0;
+static volatile sig_atomic_t current_module = -1;
+
+typedef struct {
+    char* stack;
+    unsigned long count;
+} FoldedStack;
+
+static FoldedStack* stacks = NULL;
+static int stack_count = 0;
+static int stack_capacity = 0;
+
+// Slot for a key, claimed if 'insert' and the key is new. NULL if the key
+// isn't there (or the table is full).
+static SampleSlot* find_slot(const ASTNode* site, int module, int engine, bool insert) {
+    unsigned long hash = ((unsigned long)(uintptr_t)site >> 4) * 31 + (unsigned long)module * 7 + (unsigned long)engine;
+    for (int probe = 0; probe < SAMPLE_TABLE_SIZE; probe++) {
+        SampleSlot* slot = &sample_table[(hash + probe) & (SAMPLE_TABLE_SIZE - 1)];
+        if (!slot->used) {
+            if (!insert) return NULL;
+            slot->used = true;
+            slot->site = site;
+            slot->module = module;
+            slot->engine = engine;
+            slot->count = 0;
+            return slot;
+        }
+        if (slot->site == site && slot->module == module && slot->engine == engine) return slot;
+    }
+    return NULL;
+}
+
+static void take_sample(int signal_number) {
+    (void)signal_number;
+    int module = current_module;
+    if (module < 0) return;
+
+    const ASTNode* site = profile_statement;
+    int engine = PROFILE_TREE;
+    const Chunk* chunk = profile_chunk;
+    if (chunk != NULL) {
+        int pc = profile_pc;
+        engine = profile_engine;
+        site = pc >= 0 && pc < chunk->count ? chunk->sites[pc] : NULL;
+    }
+    SampleSlot* slot = find_slot(site, module, engine, true);
+    if (slot == NULL) {
+        dropped_samples++;
+        return;
+    }
+    slot->count++;
+}
+
+void set_profile(bool enabled, const char* path) {
+    profiling = enabled;
+    output_path = path;
+    if (!enabled) return;
+
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = take_sample;
+    action.sa_flags = SA_RESTART;
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGPROF, &action, NULL);
+
+    struct itimerval timer;
+    timer.it_interval.tv_sec = 0;
+    timer.it_interval.tv_usec = PROFILE_INTERVAL_USEC;
+    timer.it_value = timer.it_interval;
+    setitimer(ITIMER_PROF, &timer, NULL);
+}
+
+// Keep SIGPROF out while the sample table is being read
+static void block_samples(bool block) {
+    sigset_t set;
+    sigemptyset(&set);
+    sigaddset(&set, SIGPROF);
+    sigprocmask(block ? SIG_BLOCK : SIG_UNBLOCK, &set, NULL);
+}
+
+void profile_enter_module(const char* module) {
+    if (!profiling || module_count > MAX_LOADED_MODULES) return;
+    char* name = strdup(module);
+    for (char* c = name; *c != '\0'; c++) {
+        if (*c == ';') *c = '_'; // Frame separator in folded stacks
+    }
+    module_names[module_count] = name;
+    open_modules[open_count++] = module_count;
+    current_module = module_count++;
+}
+
+static void add_stack(const char* stack, unsigned long count) {
+    for (int i = 0; i < stack_count; i++) {
+        if (strcmp(stacks[i].stack, stack) == 0) {
+            stacks[i].count += count;
+            return;
+        }
+    }
+    if (stack_count == stack_capacity) {
+        int new_capacity = stack_capacity == 0 ? 64 : stack_capacity * 2;
+        FoldedStack* grown = safe_malloc(sizeof(FoldedStack) * new_capacity);
+        if (stacks != NULL) {
+            memcpy(grown, stacks, sizeof(FoldedStack) * stack_count);
+            safe_free(stacks);
+        }
+        stacks = grown;
+        stack_capacity = new_capacity;
+    }
+    stacks[stack_count].stack = strdup(stack);
+    stacks[stack_count++].count = count;
+}
+
+// Enclosing while loops of a statement, as a chain towards the outermost
+typedef struct {
+    const ASTNode* loop;
+    int parent; // Index of the next enclosing loop, or -1
+} LoopFrame;
+
+typedef struct {
+    const ASTNode* node;
+    int loop; // Innermost enclosing loop, or -1
+} PendingNode;
+
+// Move the module's samples of 'site' (under the loops from 'loop' outwards)
+// into the folded stacks
+static void attribute_site(int module, const ASTNode* site, const LoopFrame* loops, int loop) {
+    for (int engine = 0; engine < PROFILE_ENGINE_COUNT; engine++) {
+        SampleSlot* slot = find_slot(site, module, engine, false);
+        if (slot == NULL || slot->count == 0) continue;
+
+        // Loops are listed innermost first; the frames want them outermost first
+        int chain[MAX_FRAMES_LEN / 16];
+        int depth = 0;
+        for (int i = loop; i >= 0 && depth < (int)(sizeof(chain) / sizeof(chain[0])); i = loops[i].parent) {
+            chain[depth++] = i;
+        }
+        char frames[MAX_FRAMES_LEN];
+        int length = snprintf(frames, sizeof(frames), "%s", module_names[module]);
+        for (int i = depth - 1; i >= 0 && length < (int)sizeof(frames); i--) {
+            length += snprintf(frames + length, sizeof(frames) - length, ";while (line %d)", loops[chain[i]].loop->line);
+        }
+        if (length < (int)sizeof(frames)) {
+            length += snprintf(frames + length, sizeof(frames) - length, ";line %d", site->line);
+        }
+        if (engine_frames[engine] != NULL && length < (int)sizeof(frames)) {
+            snprintf(frames + length, sizeof(frames) - length, ";%s", engine_frames[engine]);
+        }
+        add_stack(frames, slot->count);
+        slot->count = 0;
+    }
+}
+
+// Attribute the samples of the innermost open module, whose executed code is
+// 'code', and close it
+void profile_leave_module(const ASTNode* code) {
+    if (!profiling || open_count == 0) return;
+    block_samples(true);
+    int module = open_modules[--open_count];
+    current_module = open_count > 0 ? open_modules[open_count - 1] : -1;
+    profile_statement = NULL;
+
+    // Walk the statements iteratively (nesting can be deep), keeping track of
+    // the loops around each one
+    int loop_count = 0, loop_capacity = 16;
+    LoopFrame* loops = safe_malloc(sizeof(LoopFrame) * loop_capacity);
+    int pending_count = 0, pending_capacity = 64;
+    PendingNode* pending = safe_malloc(sizeof(PendingNode) * pending_capacity);
+    if (code != NULL) pending[pending_count++] = (PendingNode){ code, -1 };
+    while (pending_count > 0) {
+        PendingNode item = pending[--pending_count];
+        const ASTNode* node = item.node;
+        attribute_site(module, node, loops, item.loop);
+
+        const ASTNode* children[2] = { NULL, NULL };
+        int child_loop = item.loop;
+        if (node->type == NODE_IF) {
+            children[0] = node->body;
+            children[1] = node->else_body;
+        } else if (node->type == NODE_WHILE) {
+            if (loop_count == loop_capacity) {
+                LoopFrame* grown = safe_malloc(sizeof(LoopFrame) * loop_capacity * 2);
+                memcpy(grown, loops, sizeof(LoopFrame) * loop_count);
+                safe_free(loops);
+                loops = grown;
+                loop_capacity *= 2;
+            }
+            loops[loop_count] = (LoopFrame){ node, item.loop };
+            child_loop = loop_count++;
+            children[0] = node->body;
+        }
+        int child_count = node->type == NODE_BLOCK ? node->statement_count : 2;
+        for (int i = 0; i < child_count; i++) {
+            const ASTNode* child = node->type == NODE_BLOCK ? node->statements[i] : children[i];
+            if (child == NULL) continue;
+            if (pending_count == pending_capacity) {
+                PendingNode* grown = safe_malloc(sizeof(PendingNode) * pending_capacity * 2);
+                memcpy(grown, pending, sizeof(PendingNode) * pending_count);
+                safe_free(pending);
+                pending = grown;
+                pending_capacity *= 2;
+            }
+            pending[pending_count++] = (PendingNode){ child, child_loop };
+        }
+    }
+    safe_free(loops);
+    safe_free(pending);
+
+    // Whatever is left ran outside the module's statements
+    for (int i = 0; i < SAMPLE_TABLE_SIZE; i++) {
+        SampleSlot* slot = &sample_table[i];
+        if (!slot->used || slot->module != module || slot->count == 0) continue;
+        char frames[MAX_FRAMES_LEN];
+        const char* engine = engine_frames[slot->engine] != NULL ? engine_frames[slot->engine] : "[load]";
+        snprintf(frames, sizeof(frames), "%s;%s", module_names[module], engine);
+        add_stack(frames, slot->count);
+        slot->count = 0;
+    }
+    block_samples(false);
+}
+
+static int compare_stacks(const void* a, const void* b) {
+    return strcmp(((const FoldedStack*)a)->stack, ((const FoldedStack*)b)->stack);
+}
+
+// Stop sampling and write the folded stacks to the --profile file (or stderr)
+void write_profile(void) {
+    if (!profiling) return;
+    struct itimerval timer;
+    memset(&timer, 0, sizeof(timer));
+    setitimer(ITIMER_PROF, &timer, NULL);
+    signal(SIGPROF, SIG_IGN);
+
+    FILE* out = stderr;
+    if (output_path != NULL) {
+        out = fopen(output_path, "w");
+        if (out == NULL) {
+            fprintf(stderr, "Error: Could not write profile '%s'\n", output_path);
+            return;
+        }
+    }
+    if (stack_count > 1) qsort(stacks, stack_count, sizeof(FoldedStack), compare_stacks);
+    for (int i = 0; i < stack_count; i++) {
+        fprintf(out, "%s %lu\n", stacks[i].stack, stacks[i].count);
+        safe_free(stacks[i].stack);
+    }
+    if (out != stderr) fclose(out);
+    if (dropped_samples > 0) {
+        fprintf(stderr, "Warning: %lu profile samples dropped (too many distinct statements)\n", dropped_samples);
+    }
+    safe_free(stacks);
+    stacks = NULL;
+    stack_count = stack_capacity = 0;
+    for (int i = 0; i < module_count; i++) safe_free(module_names[i]);
+    module_count = 0;
+}
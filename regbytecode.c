@@ -0,0 +1,604 @@
+#include "compiler.h"
+#include "vm.h"
+#include "debug.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// AST -> register bytecode translator.
+//
+// Every expression is compiled straight into its destination register:
+// `let result = (x + y) * (x - y)` becomes two BINARYs into temporaries and a
+// third into the slot of 'result', where the stack form needs eight
+// instructions. Identifiers and literals are used as operands in place, so
+// they cost no instruction at all.
+//
+// Operands are evaluated left to right like the AST interpreter, so the first
+// error reported is the same: an identifier on the left of an operator whose
+// right operand emits code is copied to a temporary first, which checks that
+// it is defined before the right operand runs.
+//
+// Loops promoted by tiered execution may be compiled speculatively: a binary
+// node the AST interpreter has only ever seen with int64 (or float) operands
+// becomes a BINARY_INT64 (BINARY_FLOAT) whose guard deoptimizes back to the
+// interpreter instead of handling other types. Every statement is free of side
+// effects until its last instruction, so the interpreter simply runs the
+// statement holding the failed guard again from its start.
+
+//
+// Like the stack bytecode compiler, this one doesn't recurse on the C stack:
+// each node being compiled has a frame on a heap stack recording how far it
+// got, so any nesting the parser accepts compiles. An operand's register is
+// chosen before its code is compiled, so a finished child has nothing to
+// hand back to its parent.
+
+typedef enum {
+    TASK_STATEMENT,
+    TASK_INTO // compile_into: an expression into a register
+} CompileTask;
+
+typedef struct {
+    CompileTask task;
+    ASTNode* node;
+    int state;         // 0 on entry; afterwards node-specific progress
+    int index;         // Next statement to compile, for blocks
+    int dest;          // TASK_INTO: the destination register, and the type
+    DataType type;     // to convert the value to (TYPE_VOID: none)
+    int mark;          // Temporaries live on entry, released on exit
+    int operands;      // Operands of a binary node (or condition) started so far
+    int left, right;   // Their RK operands
+    int branch;        // if/while: the conditional branch to patch
+    int jump;          // if: the jump over the else arm; while: the loop head
+    ASTNode* enclosing_site;
+} CompileFrame;
+
+typedef struct {
+    Chunk* chunk;
+    int temp_count;      // Temporaries currently live
+    bool speculate;      // Use the AST interpreter's type feedback (compile_loop_chunk)
+    ASTNode** enclosing; // Statements being compiled, outermost (the loop) first
+    int depth;
+    int capacity;
+    CompileFrame* frames; // Work stack
+    int frame_count;
+    int frame_capacity;
+} RegisterCompiler;
+
+static int emit(RegisterCompiler* rc, RegOpCode op, int binop, int type, int a, int b, int c) {
+    return chunk_write(rc->chunk, op, binop, type, a, b, c);
+}
+
+static int alloc_temp(RegisterCompiler* rc) {
+    int reg = rc->chunk->slot_count + rc->temp_count++;
+    if (reg + 1 > rc->chunk->register_count) {
+        rc->chunk->register_count = reg + 1;
+    }
+    return reg;
+}
+
+// Emit a runtime failure with the message the AST interpreter would report
+static void emit_fail(RegisterCompiler* rc, const char* message) {
+    emit(rc, ROP_FAIL, 0, 0, chunk_add_constant(rc->chunk, create_string_runtime_value(message)), 0, 0);
+}
+
+// Operand for code that follows a FAIL and can never run
+static int unreachable_operand(RegisterCompiler* rc) {
+    return RK_CONSTANT(chunk_add_constant(rc->chunk, create_void_runtime_value()));
+}
+
+// Give every variable of the block its slot up front, so that temporaries can
+// be numbered after the slots while compiling. Nodes are visited in preorder
+// (node, left, right, condition, body, else, statements), from a stack of
+// nodes still to visit.
+static void declare_slots(Chunk* chunk, ASTNode* root) {
+    ASTNode** pending = NULL;
+    int count = 0;
+    int capacity = 0;
+    ASTNode* node = root;
+    for (;;) {
+        if (node != NULL) {
+            if ((node->type == NODE_IDENT || node->type == NODE_LET) && node->value.string_val != NULL) {
+                chunk_resolve_slot(chunk, node->value.string_val);
+            }
+            int statements = node->type == NODE_BLOCK && node->statements != NULL ? node->statement_count : 0;
+            if (count + statements + 5 > capacity) {
+                int new_capacity = capacity == 0 ? 64 : capacity * 2;
+                while (new_capacity < count + statements + 5) new_capacity *= 2;
+                ASTNode** grown = safe_malloc(sizeof(ASTNode*) * new_capacity);
+                if (pending != NULL) {
+                    memcpy(grown, pending, sizeof(ASTNode*) * count);
+                    safe_free(pending);
+                }
+                pending = grown;
+                capacity = new_capacity;
+            }
+            // Pushed in reverse, so that they are visited in order
+            for (int i = statements - 1; i >= 0; i--) {
+                pending[count++] = node->statements[i];
+            }
+            pending[count++] = node->else_body;
+            pending[count++] = node->body;
+            pending[count++] = node->condition;
+            pending[count++] = node->right;
+            pending[count++] = node->left;
+        }
+        if (count == 0) break;
+        node = pending[--count];
+    }
+    safe_free(pending);
+}
+
+// Can 'node' be used as an operand without emitting any code?
+static bool is_simple_operand(const ASTNode* node) {
+    if (node == NULL) return false;
+    if (node->type == NODE_IDENT) return true;
+
+    RuntimeValue constant;
+    char message[MAX_STRING_LEN];
+    if (!literal_constant(node, &constant, message, sizeof(message))) return false;
+    release_runtime_value(&constant);
+    return true;
+}
+
+static void push_compile_frame(RegisterCompiler* rc, CompileTask task, ASTNode* node, int dest, DataType type) {
+    if (rc->frame_count == rc->frame_capacity) {
+        int new_capacity = rc->frame_capacity == 0 ? 64 : rc->frame_capacity * 2;
+        CompileFrame* grown = safe_malloc(sizeof(CompileFrame) * new_capacity);
+        if (rc->frames != NULL) {
+            memcpy(grown, rc->frames, sizeof(CompileFrame) * rc->frame_count);
+            safe_free(rc->frames);
+        }
+        rc->frames = grown;
+        rc->frame_capacity = new_capacity;
+    }
+    CompileFrame* frame = &rc->frames[rc->frame_count++];
+    frame->task = task;
+    frame->node = node;
+    frame->state = 0;
+    frame->index = 0;
+    frame->dest = dest;
+    frame->type = type;
+    frame->mark = 0;
+    frame->operands = 0;
+    frame->left = 0;
+    frame->right = 0;
+    frame->branch = -1;
+    frame->jump = -1;
+    frame->enclosing_site = NULL;
+}
+
+// RK operand of a node that needs no code of its own: an identifier, a
+// literal, or (after a failure) nothing
+static int leaf_operand(RegisterCompiler* rc, ASTNode* node) {
+    char message[MAX_STRING_LEN];
+    RuntimeValue constant;
+
+    if (node == NULL) {
+        emit_fail(rc, ""); // A missing operand is an error without a message
+        return unreachable_operand(rc);
+    }
+    if (node->type == NODE_IDENT) {
+        return chunk_resolve_slot(rc->chunk, node->value.string_val);
+    }
+    if (literal_constant(node, &constant, message, sizeof(message))) {
+        return RK_CONSTANT(chunk_add_constant(rc->chunk, constant));
+    }
+    emit_fail(rc, message);
+    return unreachable_operand(rc);
+}
+
+static bool is_leaf(const ASTNode* node) {
+    return node == NULL || node->type == NODE_NUMBER || node->type == NODE_STRING ||
+           node->type == NODE_BOOL || node->type == NODE_IDENT;
+}
+
+// Set *operand to an RK operand holding the value of 'node'. Anything that
+// isn't an identifier or literal gets a temporary, whose code is pushed to
+// be compiled next; returns whether it was.
+static bool start_operand(RegisterCompiler* rc, ASTNode* node, int* operand) {
+    if (is_leaf(node)) {
+        *operand = leaf_operand(rc, node);
+        return false;
+    }
+    *operand = alloc_temp(rc);
+    push_compile_frame(rc, TASK_INTO, node, *operand, TYPE_VOID);
+    return true;
+}
+
+// Operand type a binary node of a speculative chunk may assume, from the
+// quickening state the AST interpreter left behind; TYPE_VOID if none. The
+// result must not need converting to the 'type' it is stored as.
+static DataType speculated_type(RegisterCompiler* rc, const ASTNode* node, int left, int right, DataType type) {
+    DataType operand_type;
+    if (!rc->speculate) return TYPE_VOID;
+    if (node->quick >= QUICK_INT64_ADD && node->quick <= QUICK_INT64_NOTEQ) {
+        operand_type = TYPE_INT64;
+    } else if (node->quick >= QUICK_FLOAT_ADD && node->quick <= QUICK_FLOAT_NOTEQ) {
+        operand_type = TYPE_FLOAT;
+    } else {
+        return TYPE_VOID;
+    }
+
+    DataType result_type = (node->op >= BINOP_GT && node->op <= BINOP_NOTEQ) ? TYPE_BOOL : operand_type;
+    if (type != TYPE_VOID && type != result_type) return TYPE_VOID;
+    if (RK_IS_CONSTANT(left) && rc->chunk->constants[RK_CONSTANT_INDEX(left)].type != operand_type) return TYPE_VOID;
+    if (RK_IS_CONSTANT(right) && rc->chunk->constants[RK_CONSTANT_INDEX(right)].type != operand_type) return TYPE_VOID;
+    return operand_type;
+}
+
+// Record where the AST interpreter resumes if the guard at 'pc' fails: the
+// innermost statement being compiled, then the nodes around it
+static void add_deopt_point(RegisterCompiler* rc, int pc) {
+    Chunk* chunk = rc->chunk;
+    DeoptPoint* grown = safe_malloc(sizeof(DeoptPoint) * (chunk->deopt_count + 1));
+    if (chunk->deopt_count > 0) {
+        memcpy(grown, chunk->deopt_points, sizeof(DeoptPoint) * chunk->deopt_count);
+    }
+    safe_free(chunk->deopt_points);
+    chunk->deopt_points = grown;
+
+    DeoptPoint* point = &chunk->deopt_points[chunk->deopt_count++];
+    point->pc = pc;
+    point->depth = rc->depth - 1; // Not the loop itself
+    point->path = NULL;
+    if (point->depth > 0) {
+        point->path = safe_malloc(sizeof(ASTNode*) * point->depth);
+        for (int i = 0; i < point->depth; i++) {
+            point->path[i] = rc->enclosing[rc->depth - 1 - i];
+        }
+    }
+}
+
+// Start the operands of a binary node, in evaluation order, into
+// frame->left and frame->right. Returns false after pushing the code of one:
+// call again once it is compiled.
+static bool compile_binary_operands(RegisterCompiler* rc, int frame_index, ASTNode* node) {
+    CompileFrame* frame = &rc->frames[frame_index];
+    if (frame->operands == 0) {
+        frame->operands = 1;
+        if (node->left != NULL && node->left->type == NODE_IDENT && !is_simple_operand(node->right)) {
+            frame->left = alloc_temp(rc);
+            emit(rc, ROP_MOVE, 0, TYPE_VOID, frame->left, chunk_resolve_slot(rc->chunk, node->left->value.string_val), 0);
+        } else if (start_operand(rc, node->left, &frame->left)) {
+            return false;
+        }
+    }
+    if (frame->operands == 1) {
+        frame->operands = 2;
+        if (start_operand(rc, node->right, &frame->right)) return false;
+    }
+    return true;
+}
+
+// Compile an expression so that its value (converted to 'type' unless that is
+// TYPE_VOID) ends up in register 'dest'. Returns true once it is compiled.
+static bool step_into(RegisterCompiler* rc, int frame_index) {
+    char message[MAX_STRING_LEN];
+    CompileFrame* frame = &rc->frames[frame_index];
+    ASTNode* node = frame->node;
+
+    if (frame->state == 0) {
+        frame->mark = rc->temp_count;
+        frame->state = 1;
+    }
+
+    if (node != NULL && node->type == NODE_BINARY) {
+        if (!compile_binary_operands(rc, frame_index, node)) return false;
+        frame = &rc->frames[frame_index];
+        if (node->value.string_val == NULL) {
+            emit_fail(rc, "Error: Binary operator token has NULL text.\n");
+        } else {
+            DataType speculated = speculated_type(rc, node, frame->left, frame->right, frame->type);
+            RegOpCode op = speculated == TYPE_INT64 ? ROP_BINARY_INT64
+                         : speculated == TYPE_FLOAT ? ROP_BINARY_FLOAT : ROP_BINARY;
+            int pc = emit(rc, op, node->op, frame->type, frame->dest, frame->left, frame->right);
+            if (op != ROP_BINARY) add_deopt_point(rc, pc);
+        }
+    } else if (is_leaf(node)) {
+        emit(rc, ROP_MOVE, 0, frame->type, frame->dest, leaf_operand(rc, node), 0);
+    } else {
+        snprintf(message, sizeof(message), "Error: Unknown AST node type %d in evaluate_node.\n", node->type);
+        emit_fail(rc, message);
+    }
+
+    rc->temp_count = frame->mark;
+    return true;
+}
+
+// Emit a branch to a not-yet-known target, taken when 'condition' is false,
+// into frame->branch (for patch_branch). Returns false after pushing the code
+// of an operand: call again once it is compiled.
+static bool compile_branch_unless(RegisterCompiler* rc, int frame_index, ASTNode* condition, bool loop) {
+    CompileFrame* frame = &rc->frames[frame_index];
+    if (frame->operands == 0) frame->mark = rc->temp_count;
+
+    if (condition != NULL && condition->type == NODE_BINARY && condition->value.string_val != NULL &&
+        condition->op >= BINOP_GT && condition->op <= BINOP_NOTEQ) {
+        // Comparisons always produce a bool, so compare and branch in one go
+        if (!compile_binary_operands(rc, frame_index, condition)) return false;
+        frame = &rc->frames[frame_index];
+        DataType speculated = speculated_type(rc, condition, frame->left, frame->right, TYPE_VOID);
+        RegOpCode op = speculated == TYPE_INT64 ? ROP_JUMP_UNLESS_CMP_INT64
+                     : speculated == TYPE_FLOAT ? ROP_JUMP_UNLESS_CMP_FLOAT : ROP_JUMP_UNLESS_CMP;
+        frame->branch = emit(rc, op, condition->op, 0, frame->left, frame->right, -1);
+        if (op != ROP_JUMP_UNLESS_CMP) add_deopt_point(rc, frame->branch);
+    } else {
+        if (frame->operands == 0) {
+            frame->operands = 1;
+            if (start_operand(rc, condition, &frame->left)) return false;
+            frame = &rc->frames[frame_index];
+        }
+        frame->branch = emit(rc, ROP_JUMP_IF_FALSE, 0, 0, frame->left, -1, loop ? 1 : 0);
+    }
+    rc->temp_count = frame->mark;
+    return true;
+}
+
+static void patch_branch(RegisterCompiler* rc, int index, int target) {
+    Instruction* branch_instr = &rc->chunk->code[index];
+    if (generic_register_opcode(branch_instr->op) == ROP_JUMP_UNLESS_CMP) {
+        branch_instr->c = target;
+    } else {
+        branch_instr->b = target;
+    }
+}
+
+static void start_statement(RegisterCompiler* rc, ASTNode* node) {
+    if (node != NULL) push_compile_frame(rc, TASK_STATEMENT, node, 0, TYPE_VOID);
+}
+
+// Advance a statement by one step. A step ends whenever it starts a child,
+// since pushing a frame moves the stack; the statement is stepped again once
+// the child is compiled. Returns true once the statement is compiled.
+static bool step_statement(RegisterCompiler* rc, int frame_index) {
+    char message[MAX_STRING_LEN];
+    CompileFrame* frame = &rc->frames[frame_index];
+    ASTNode* node = frame->node;
+
+    if (frame->state == 0) {
+        // Each instruction is attributed to the innermost statement it belongs to
+        frame->enclosing_site = rc->chunk->site;
+        if (node->type != NODE_BLOCK) rc->chunk->site = node;
+
+        if (rc->speculate) {
+            if (rc->depth == rc->capacity) {
+                rc->capacity = rc->capacity == 0 ? 8 : rc->capacity * 2;
+                ASTNode** grown = safe_malloc(sizeof(ASTNode*) * rc->capacity);
+                if (rc->depth > 0) memcpy(grown, rc->enclosing, sizeof(ASTNode*) * rc->depth);
+                safe_free(rc->enclosing);
+                rc->enclosing = grown;
+            }
+            rc->enclosing[rc->depth++] = node;
+        }
+        frame->state = 1;
+    }
+
+    switch (node->type) {
+        case NODE_LET:
+            if (frame->state == 1) {
+                if (node->value.string_val == NULL || node->left == NULL) {
+                    emit_fail(rc, "Error: Invalid let statement structure.\n");
+                    break;
+                }
+                frame->state = 2;
+                push_compile_frame(rc, TASK_INTO, node->left,
+                                   chunk_resolve_slot(rc->chunk, node->value.string_val), node->explicit_type);
+                return false;
+            }
+            break;
+        case NODE_PRINT:
+            if (node->left == NULL) {
+                emit_fail(rc, "Error: Nothing to print\n");
+                break;
+            }
+            if (frame->state == 1) {
+                frame->mark = rc->temp_count;
+                frame->state = 2;
+                if (start_operand(rc, node->left, &frame->left)) return false;
+                frame = &rc->frames[frame_index];
+            }
+            emit(rc, ROP_PRINT, 0, 0, frame->left, 0, 0);
+            rc->temp_count = frame->mark;
+            break;
+        case NODE_IF:
+            if (frame->state == 1) {
+                if (!compile_branch_unless(rc, frame_index, node->condition, false)) return false;
+                frame->state = 2;
+                start_statement(rc, node->body);
+                return false;
+            }
+            if (frame->state == 2 && node->else_body != NULL) {
+                frame->jump = emit(rc, ROP_JUMP, 0, 0, -1, 0, 0);
+                patch_branch(rc, frame->branch, rc->chunk->count);
+                frame->state = 3;
+                start_statement(rc, node->else_body);
+                return false;
+            }
+            if (frame->state == 2) {
+                patch_branch(rc, frame->branch, rc->chunk->count);
+            } else {
+                rc->chunk->code[frame->jump].a = rc->chunk->count;
+            }
+            break;
+        case NODE_WHILE:
+            if (frame->state == 1) {
+                if (frame->operands == 0) frame->jump = rc->chunk->count; // Loop head
+                if (!compile_branch_unless(rc, frame_index, node->condition, true)) return false;
+                frame->state = 2;
+                start_statement(rc, node->body);
+                return false;
+            }
+            emit(rc, ROP_JUMP, 0, 0, frame->jump, 0, 0);
+            patch_branch(rc, frame->branch, rc->chunk->count);
+            break;
+        case NODE_BLOCK:
+            if (node->statements == NULL && node->statement_count > 0) {
+                emit_fail(rc, "Internal Error: NODE_BLOCK has statements but statements array is NULL.\n");
+                break;
+            }
+            if (frame->index < node->statement_count) {
+                start_statement(rc, node->statements[frame->index++]);
+                return false;
+            }
+            break;
+        case NODE_LOADIN:
+            emit_fail(rc, "Internal Error: NODE_LOADIN encountered in evaluate_node. This should have been processed earlier.\n");
+            break;
+        case NODE_NUMBER:
+        case NODE_STRING:
+        case NODE_BOOL:
+        case NODE_IDENT:
+        case NODE_BINARY:
+            // Expression statement: evaluated for its errors, value discarded
+            if (frame->state == 1) {
+                frame->mark = rc->temp_count;
+                frame->state = 2;
+                push_compile_frame(rc, TASK_INTO, node, alloc_temp(rc), TYPE_VOID);
+                return false;
+            }
+            rc->temp_count = frame->mark;
+            break;
+        default:
+            snprintf(message, sizeof(message), "Error: Unknown AST node type %d in evaluate_node.\n", node->type);
+            emit_fail(rc, message);
+            break;
+    }
+
+    rc->chunk->site = frame->enclosing_site;
+    if (rc->speculate) rc->depth--;
+    return true;
+}
+
+static void compile_statement(RegisterCompiler* rc, ASTNode* root) {
+    start_statement(rc, root);
+    while (rc->frame_count > 0) {
+        int top = rc->frame_count - 1;
+        bool finished = rc->frames[top].task == TASK_STATEMENT ? step_statement(rc, top) : step_into(rc, top);
+        if (finished) rc->frame_count--;
+    }
+}
+
+// Compile a module's code block into a register chunk
+Chunk* compile_register_chunk(ASTNode* block) {
+    Chunk* chunk = safe_malloc(sizeof(Chunk));
+    memset(chunk, 0, sizeof(Chunk));
+
+    declare_slots(chunk, block);
+    chunk->register_count = chunk->slot_count;
+
+    RegisterCompiler rc = { chunk, 0, false, NULL, 0, 0, NULL, 0, 0 };
+    compile_statement(&rc, block);
+    emit(&rc, ROP_HALT, 0, 0, 0, 0, 0);
+    safe_free(rc.frames);
+
+    LOG_DEBUG("Compiled register chunk: %d instructions, %d constants, %d slots, %d registers",
+              chunk->count, chunk->constant_count, chunk->slot_count, chunk->register_count);
+    return chunk;
+}
+
+// Compile one while statement into a register chunk of its own, for tiered
+// execution. With 'speculate', binary nodes specialize on the operand types
+// the AST interpreter has seen so far (see speculated_type).
+Chunk* compile_loop_chunk(ASTNode* loop, bool speculate) {
+    Chunk* chunk = safe_malloc(sizeof(Chunk));
+    memset(chunk, 0, sizeof(Chunk));
+
+    declare_slots(chunk, loop);
+    chunk->register_count = chunk->slot_count;
+
+    RegisterCompiler rc = { chunk, 0, speculate, NULL, 0, 0, NULL, 0, 0 };
+    compile_statement(&rc, loop);
+    emit(&rc, ROP_HALT, 0, 0, 0, 0, 0);
+    safe_free(rc.enclosing);
+    safe_free(rc.frames);
+
+    LOG_DEBUG("Compiled loop chunk: %d instructions (%d speculative), %d slots, %d registers",
+              chunk->count, chunk->deopt_count, chunk->slot_count, chunk->register_count);
+    return chunk;
+}
+
+static const char* register_opcode_names[ROP_COUNT] = {
+    [ROP_MOVE] = "MOVE",
+    [ROP_BINARY] = "BINARY",
+    [ROP_PRINT] = "PRINT",
+    [ROP_JUMP] = "JUMP",
+    [ROP_JUMP_IF_FALSE] = "JUMP_IF_FALSE",
+    [ROP_JUMP_UNLESS_CMP] = "JUMP_UNLESS_CMP",
+    [ROP_FAIL] = "FAIL",
+    [ROP_HALT] = "HALT",
+    [ROP_BINARY_INT64] = "BINARY_INT64",
+    [ROP_BINARY_FLOAT] = "BINARY_FLOAT",
+    [ROP_JUMP_UNLESS_CMP_INT64] = "JUMP_UNLESS_I64",
+    [ROP_JUMP_UNLESS_CMP_FLOAT] = "JUMP_UNLESS_F64",
+    [ROP_PRECOMPUTE] = "PRECOMPUTE",
+    [ROP_INVARIANT] = "INVARIANT",
+    [ROP_MUL_POW2] = "MUL_POW2",
+    [ROP_DIV_POW2] = "DIV_POW2",
+    [ROP_DIV_MAGIC] = "DIV_MAGIC",
+};
+
+// Print an RK operand: a variable name, tN for temporaries, or a constant
+static void print_operand(const Chunk* chunk, int operand, FILE* out) {
+    if (RK_IS_CONSTANT(operand)) {
+        print_constant(chunk, RK_CONSTANT_INDEX(operand), out);
+    } else if (operand < chunk->slot_count) {
+        fprintf(out, "%s", chunk->slot_names[operand]);
+    } else {
+        fprintf(out, "t%d", operand - chunk->slot_count);
+    }
+}
+
+static void print_destination(const Chunk* chunk, const Instruction* instr, FILE* out) {
+    print_operand(chunk, instr->a, out);
+    if (instr->type != TYPE_VOID) fprintf(out, " : %s", get_type_name((DataType)instr->type));
+    fprintf(out, " = ");
+}
+
+// Print a human-readable listing of a register chunk
+void disassemble_register_chunk(const Chunk* chunk, FILE* out) {
+    for (int i = 0; i < chunk->count; i++) {
+        const Instruction* instr = &chunk->code[i];
+        fprintf(out, "%04d  %-16s", i, instr->op < ROP_COUNT ? register_opcode_names[instr->op] : "UNKNOWN");
+        switch (generic_register_opcode(instr->op)) {
+            case ROP_MOVE:
+                print_destination(chunk, instr, out);
+                print_operand(chunk, instr->b, out);
+                break;
+            case ROP_BINARY:
+            case ROP_PRECOMPUTE:
+                print_destination(chunk, instr, out);
+                print_operand(chunk, instr->b, out);
+                fprintf(out, " %s ", binary_op_text((BinaryOp)instr->binop));
+                print_operand(chunk, instr->c, out);
+                break;
+            case ROP_INVARIANT:
+                print_destination(chunk, instr, out);
+                print_operand(chunk, instr->b, out);
+                fprintf(out, " (from %04d)", instr->c);
+                break;
+            case ROP_PRINT:
+                print_operand(chunk, instr->a, out);
+                break;
+            case ROP_JUMP:
+                fprintf(out, "-> %04d", instr->a);
+                break;
+            case ROP_JUMP_IF_FALSE:
+                print_operand(chunk, instr->a, out);
+                fprintf(out, " else -> %04d", instr->b);
+                break;
+            case ROP_JUMP_UNLESS_CMP:
+                print_operand(chunk, instr->a, out);
+                fprintf(out, " %s ", binary_op_text((BinaryOp)instr->binop));
+                print_operand(chunk, instr->b, out);
+                fprintf(out, " else -> %04d", instr->c);
+                break;
+            case ROP_FAIL:
+                fprintf(out, "\"%.*s\"", (int)strcspn(chunk->constants[instr->a].val.string_val, "\n"),
+                        chunk->constants[instr->a].val.string_val);
+                break;
+            default:
+                break;
+        }
+        fprintf(out, "\n");
+    }
+}
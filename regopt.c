@@ -0,0 +1,397 @@
+#include "compiler.h"
+#include "vm.h"
+#include "debug.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+// Register bytecode optimizer. optimize_chunk runs a fixed pipeline of passes
+// over every register chunk, whichever back end takes it from there:
+//
+//   -O1  constant propagation, copy propagation and dead code elimination,
+//        on the SSA form of the chunk (ssa.c)
+//   -O2  (the default) adds global value numbering, then loop-invariant code
+//        motion and strength reduction on the bytecode itself
+//
+// The last two emit instructions only the register VM and the JIT implement,
+// so the C and ELF back ends stop after the SSA passes. -O0 leaves chunks as
+// the compiler produced them. With --time-passes, the time, runs and changes
+// of every pass are summed up and reported at exit.
+//
+// Loop-invariant code motion: a BINARY inside a while loop whose operands are
+// constants or variables the loop never assigns yields the same value on
+// every iteration. A PRECOMPUTE in front of the loop computes it once into a
+// register of its own, and in the loop an INVARIANT copies that register to
+// the original destination. The PRECOMPUTE runs even if the loop body, or the
+// branch holding the instruction, never does, so it must not fail: it handles
+// int64 and float operands only and leaves TYPE_VOID for anything else. The
+// INVARIANT then performs the original operation, errors and all, when the
+// loop gets there.
+//
+// Strength reduction: an int64 multiply or divide by a constant becomes a
+// shift (powers of two) or a multiply by a magic number (other divisors),
+// guarded on the other operand being an int64. Results are those of C's
+// truncating division, as in evaluate_binary_op; any other operand type takes
+// the generic path.
+
+typedef struct {
+    int head;      // First instruction of the loop (its condition)
+    int end;       // The backward JUMP closing it
+    bool* written; // Registers some instruction of the loop assigns
+    int hoisted;   // Instructions moved in front of it
+    int preheader; // New pc of its first PRECOMPUTE
+} Loop;
+
+// Register an instruction assigns, or -1
+static int written_register(const Instruction* instr) {
+    switch (instr->op) {
+        case ROP_MOVE:
+        case ROP_BINARY:
+        case ROP_BINARY_INT64:
+        case ROP_BINARY_FLOAT:
+        case ROP_PRECOMPUTE:
+        case ROP_INVARIANT:
+        case ROP_MUL_POW2:
+        case ROP_DIV_POW2:
+        case ROP_DIV_MAGIC:
+            return instr->a;
+        default:
+            return -1;
+    }
+}
+
+// While loops of the chunk: every backward JUMP closes one
+static Loop* find_loops(const Chunk* chunk, int* loop_count) {
+    int count = 0;
+    for (int pc = 0; pc < chunk->count; pc++) {
+        if (chunk->code[pc].op == ROP_JUMP && chunk->code[pc].a <= pc) count++;
+    }
+    *loop_count = count;
+    if (count == 0) return NULL;
+
+    Loop* loops = safe_malloc(sizeof(Loop) * count);
+    int index = 0;
+    for (int pc = 0; pc < chunk->count; pc++) {
+        if (chunk->code[pc].op != ROP_JUMP || chunk->code[pc].a > pc) continue;
+        Loop* loop = &loops[index++];
+        loop->head = chunk->code[pc].a;
+        loop->end = pc;
+        loop->hoisted = 0;
+        loop->preheader = -1;
+        loop->written = safe_malloc(sizeof(bool) * (chunk->register_count + 1));
+        memset(loop->written, 0, sizeof(bool) * (chunk->register_count + 1));
+        for (int i = loop->head; i <= loop->end; i++) {
+            int reg = written_register(&chunk->code[i]);
+            if (reg >= 0) loop->written[reg] = true;
+        }
+    }
+    return loops;
+}
+
+static bool is_invariant_operand(const Loop* loop, int operand) {
+    return RK_IS_CONSTANT(operand) || !loop->written[operand];
+}
+
+// Arithmetic or a comparison into a temporary. Variables are left alone:
+// their assignments are visible to the rest of the program.
+static bool is_hoistable(const Chunk* chunk, const Instruction* instr) {
+    if (instr->op != ROP_BINARY && instr->op != ROP_BINARY_INT64 && instr->op != ROP_BINARY_FLOAT) return false;
+    if (instr->binop < BINOP_ADD || instr->binop > BINOP_NOTEQ) return false;
+    return instr->a >= chunk->slot_count && instr->type == TYPE_VOID;
+}
+
+// The outermost loop around 'pc' that leaves the instruction's operands
+// alone, or -1. Loops nest, so it is invariant in every loop inside that one.
+static int hoisting_target(const Chunk* chunk, const Loop* loops, int loop_count, int pc) {
+    const Instruction* instr = &chunk->code[pc];
+    int target = -1;
+    for (int i = 0; i < loop_count; i++) {
+        const Loop* loop = &loops[i];
+        if (pc < loop->head || pc > loop->end) continue;
+        if (!is_invariant_operand(loop, instr->b) || !is_invariant_operand(loop, instr->c)) continue;
+        if (target < 0 || loop->head < loops[target].head) target = i;
+    }
+    return target;
+}
+
+// New pc for a jump from old pc 'from' to old pc 'to': entering a loop from
+// outside goes through the PRECOMPUTEs in front of it, its own back-edge
+// doesn't
+static int remap_target(const Loop* loops, int loop_count, const int* new_pc, int from, int to) {
+    int target = new_pc[to];
+    for (int i = 0; i < loop_count; i++) {
+        const Loop* loop = &loops[i];
+        if (loop->head != to || loop->preheader < 0) continue;
+        if (from >= loop->head && from <= loop->end) continue;
+        if (loop->preheader < target) target = loop->preheader;
+    }
+    return target;
+}
+
+static int hoist_loop_invariants(Chunk* chunk) {
+    int loop_count;
+    Loop* loops = find_loops(chunk, &loop_count);
+    if (loops == NULL) return 0;
+
+    int count = chunk->count;
+    int* target_loop = safe_malloc(sizeof(int) * count);
+    int* hoist_register = safe_malloc(sizeof(int) * count);
+    int* precompute_pc = safe_malloc(sizeof(int) * count);
+    int hoisted = 0;
+    for (int pc = 0; pc < count; pc++) {
+        target_loop[pc] = is_hoistable(chunk, &chunk->code[pc]) ? hoisting_target(chunk, loops, loop_count, pc) : -1;
+        if (target_loop[pc] >= 0) {
+            loops[target_loop[pc]].hoisted++;
+            hoist_register[pc] = chunk->register_count++;
+            hoisted++;
+        }
+    }
+
+    if (hoisted > 0) {
+        // Rebuild the code with each loop's PRECOMPUTEs in front of its head.
+        // Loops sharing a head get theirs outermost first.
+        Instruction* code = safe_malloc(sizeof(Instruction) * (count + hoisted));
+        ASTNode** sites = safe_malloc(sizeof(ASTNode*) * (count + hoisted));
+        int* new_pc = safe_malloc(sizeof(int) * (count + 1));
+        int out = 0;
+        for (int pc = 0; pc < count; pc++) {
+            for (;;) {
+                int next = -1;
+                for (int i = 0; i < loop_count; i++) {
+                    if (loops[i].head == pc && loops[i].hoisted > 0 && loops[i].preheader < 0 &&
+                        (next < 0 || loops[i].end > loops[next].end)) {
+                        next = i;
+                    }
+                }
+                if (next < 0) break;
+                loops[next].preheader = out;
+                for (int q = loops[next].head; q <= loops[next].end; q++) {
+                    if (target_loop[q] != next) continue;
+                    code[out] = chunk->code[q];
+                    code[out].op = ROP_PRECOMPUTE;
+                    code[out].a = hoist_register[q];
+                    sites[out] = chunk->sites[q];
+                    precompute_pc[q] = out++;
+                }
+            }
+            new_pc[pc] = out;
+            sites[out] = chunk->sites[pc];
+            code[out++] = chunk->code[pc];
+        }
+        new_pc[count] = out;
+
+        for (int pc = 0; pc < count; pc++) {
+            Instruction* instr = &code[new_pc[pc]];
+            if (target_loop[pc] >= 0) {
+                instr->op = ROP_INVARIANT;
+                instr->b = hoist_register[pc];
+                instr->c = precompute_pc[pc];
+                continue;
+            }
+            switch (generic_register_opcode(instr->op)) {
+                case ROP_JUMP:
+                    instr->a = remap_target(loops, loop_count, new_pc, pc, instr->a);
+                    break;
+                case ROP_JUMP_IF_FALSE:
+                    instr->b = remap_target(loops, loop_count, new_pc, pc, instr->b);
+                    break;
+                case ROP_JUMP_UNLESS_CMP:
+                    instr->c = remap_target(loops, loop_count, new_pc, pc, instr->c);
+                    break;
+                default:
+                    break;
+            }
+        }
+        for (int i = 0; i < chunk->deopt_count; i++) {
+            chunk->deopt_points[i].pc = new_pc[chunk->deopt_points[i].pc];
+        }
+
+        safe_free(chunk->code);
+        safe_free(chunk->sites);
+        chunk->code = code;
+        chunk->sites = sites;
+        chunk->count = out;
+        chunk->capacity = count + hoisted;
+        safe_free(new_pc);
+    }
+
+    for (int i = 0; i < loop_count; i++) {
+        safe_free(loops[i].written);
+    }
+    safe_free(loops);
+    safe_free(target_loop);
+    safe_free(hoist_register);
+    safe_free(precompute_pc);
+    return hoisted;
+}
+
+// Magic multiplier and shift for signed division by d >= 3 (Hacker's Delight,
+// section 10-4): n / d == mulhi(n, magic) (+ n if magic < 0) >> shift, plus
+// one if that is negative. Shared with the JIT.
+void division_magic(int64_t d, int64_t* magic, int* shift) {
+    const uint64_t two63 = 1ULL << 63;
+    uint64_t ad = (uint64_t)d;
+    uint64_t anc = two63 - 1 - two63 % ad;
+    int p = 63;
+    uint64_t q1 = two63 / anc, r1 = two63 - q1 * anc;
+    uint64_t q2 = two63 / ad, r2 = two63 - q2 * ad;
+    uint64_t delta;
+    do {
+        p++;
+        q1 *= 2;
+        r1 *= 2;
+        if (r1 >= anc) { q1++; r1 -= anc; }
+        q2 *= 2;
+        r2 *= 2;
+        if (r2 >= ad) { q2++; r2 -= ad; }
+        delta = ad - r2;
+    } while (q1 < delta || (q1 == delta && r1 == 0));
+    *magic = (int64_t)(q2 + 1);
+    *shift = p - 64;
+}
+
+static int reduce_strength(Chunk* chunk) {
+    int reduced = 0;
+    for (int pc = 0; pc < chunk->count; pc++) {
+        Instruction* instr = &chunk->code[pc];
+        if (instr->op != ROP_BINARY && instr->op != ROP_BINARY_INT64) continue;
+        if (instr->binop != BINOP_MUL && instr->binop != BINOP_DIV) continue;
+        if (instr->type != TYPE_VOID && instr->type != TYPE_INT64) continue; // Would need a conversion
+        if (RK_IS_CONSTANT(instr->b) || !RK_IS_CONSTANT(instr->c)) continue;
+        RuntimeValue constant = chunk->constants[RK_CONSTANT_INDEX(instr->c)];
+        if (constant.type != TYPE_INT64 || constant.val.int64_val < 2) continue;
+
+        int64_t d = constant.val.int64_val;
+        if ((d & (d - 1)) == 0) {
+            if (instr->binop == BINOP_MUL && d > (1LL << 62)) continue;
+            instr->op = instr->binop == BINOP_MUL ? ROP_MUL_POW2 : ROP_DIV_POW2;
+            reduced++;
+            continue;
+        }
+#ifdef __SIZEOF_INT128__
+        if (instr->binop == BINOP_DIV) {
+            // The divisor, then its magic multiplier and shift, side by side
+            int64_t magic;
+            int shift;
+            division_magic(d, &magic, &shift);
+            int index = chunk_add_constant(chunk, create_int64_runtime_value(d));
+            chunk_add_constant(chunk, create_int64_runtime_value(magic));
+            chunk_add_constant(chunk, create_int64_runtime_value(shift));
+            instr = &chunk->code[pc];
+            instr->op = ROP_DIV_MAGIC;
+            instr->c = RK_CONSTANT(index);
+            reduced++;
+        }
+#endif
+    }
+    return reduced;
+}
+
+typedef struct {
+    const char* name;
+    int level;                        // Lowest -O level that runs it
+    bool vm_only;                     // Emits instructions only the register VM and the JIT know
+    int (*run_ssa)(SsaFunction* fn);  // Either works on the SSA form...
+    int (*run_chunk)(Chunk* chunk);   // ...or on the bytecode; returns the changes made
+} OptimizationPass;
+
+static const OptimizationPass pipeline[] = {
+    { "constant-propagation",  1, false, ssa_propagate_constants, NULL },
+    { "value-numbering",       2, false, ssa_number_values,       NULL },
+    { "copy-propagation",      1, false, ssa_propagate_copies,    NULL },
+    { "dead-code-elimination", 1, false, ssa_eliminate_dead_code, NULL },
+    { "loop-invariant-motion", 2, true,  NULL, hoist_loop_invariants },
+    { "strength-reduction",    2, true,  NULL, reduce_strength },
+};
+
+#define PASS_COUNT ((int)(sizeof(pipeline) / sizeof(pipeline[0])))
+
+typedef struct {
+    double seconds;
+    int runs;
+    long changes;
+} PassTiming;
+
+// Pipeline passes, then SSA construction and lowering
+static PassTiming timings[PASS_COUNT + 2];
+static int optimization_level = 2;
+bool time_passes = false;
+
+void set_optimization_level(int level) {
+    optimization_level = level;
+}
+
+void set_time_passes(bool enabled) {
+    time_passes = enabled;
+}
+
+static double now_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void record(int index, double start, long changes) {
+    if (!time_passes) return;
+    timings[index].seconds += now_seconds() - start;
+    timings[index].runs++;
+    timings[index].changes += changes;
+}
+
+static bool runs_pass(const OptimizationPass* pass, bool for_vm) {
+    return optimization_level >= pass->level && (for_vm || !pass->vm_only);
+}
+
+// Optimize a freshly compiled register chunk in place. 'for_vm': the register
+// VM (and the JIT) will run it, rather than the C or ELF back end.
+void optimize_chunk(Chunk* chunk, bool for_vm) {
+    bool any_ssa = false;
+    for (int i = 0; i < PASS_COUNT; i++) {
+        if (pipeline[i].run_ssa != NULL && runs_pass(&pipeline[i], for_vm)) any_ssa = true;
+    }
+
+    if (any_ssa) {
+        double start = time_passes ? now_seconds() : 0;
+        SsaFunction* fn = ssa_build(chunk);
+        record(PASS_COUNT, start, 0);
+        if (fn != NULL) {
+            for (int i = 0; i < PASS_COUNT; i++) {
+                if (pipeline[i].run_ssa == NULL || !runs_pass(&pipeline[i], for_vm)) continue;
+                start = time_passes ? now_seconds() : 0;
+                int changes = pipeline[i].run_ssa(fn);
+                record(i, start, changes);
+                LOG_DEBUG("Pass %s: %d changes", pipeline[i].name, changes);
+            }
+            start = time_passes ? now_seconds() : 0;
+            int removed = ssa_lower(fn);
+            record(PASS_COUNT + 1, start, removed);
+        }
+    }
+
+    for (int i = 0; i < PASS_COUNT; i++) {
+        if (pipeline[i].run_chunk == NULL || !runs_pass(&pipeline[i], for_vm)) continue;
+        double start = time_passes ? now_seconds() : 0;
+        int changes = pipeline[i].run_chunk(chunk);
+        record(i, start, changes);
+        LOG_DEBUG("Pass %s: %d changes", pipeline[i].name, changes);
+    }
+}
+
+// The --time-passes report, in pipeline order
+void report_pass_timings(FILE* out) {
+    if (!time_passes) return;
+    double total = 0;
+    fprintf(out, "=== Optimization passes (-O%d) ===\n", optimization_level);
+    fprintf(out, "%-24s %6s %9s %12s\n", "Pass", "Runs", "Changes", "Time (ms)");
+    for (int i = -1; i <= PASS_COUNT; i++) {
+        // SSA construction first, lowering last
+        int index = i < 0 ? PASS_COUNT : i == PASS_COUNT ? PASS_COUNT + 1 : i;
+        const char* name = i < 0 ? "ssa-construction" : i == PASS_COUNT ? "ssa-lowering" : pipeline[i].name;
+        const PassTiming* timing = &timings[index];
+        if (timing->runs == 0) continue;
+        fprintf(out, "%-24s %6d %9ld %12.3f\n", name, timing->runs, timing->changes, timing->seconds * 1000);
+        total += timing->seconds;
+    }
+    fprintf(out, "%-24s %6s %9s %12.3f\n", "Total", "", "", total * 1000);
+}
@@ -0,0 +1,473 @@
+#include "compiler.h"
+#include "vm.h"
+#include "debug.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Register VM for chunks produced by regbytecode.c. Dispatch works like the
+// stack VM in vm.c: computed goto, with a switch fallback for
+// -DZR_NO_COMPUTED_GOTO.
+//
+// With the JIT enabled (set_jit_threshold), each loop's back-edge is counted;
+// once a loop is hot the chunk is compiled to native code (jit.c), which takes
+// over the same register file at the loop head.
+//
+// Speculative instructions (compile_loop_chunk) check their operand types and
+// otherwise stop the chunk early, recording the failed guard in chunk->deopt
+// so the AST interpreter can take the loop over from there.
+
+#if defined(__GNUC__) && !defined(ZR_NO_COMPUTED_GOTO)
+#define ZR_COMPUTED_GOTO 1
+#endif
+
+// Resolve an RK operand. Registers are read in place; a variable slot that
+// still holds TYPE_VOID is undefined, which is reported and yields NULL.
+static inline const RuntimeValue* read_operand(const Chunk* chunk, const RuntimeValue* registers, int operand) {
+    if (RK_IS_CONSTANT(operand)) {
+        return &chunk->constants[RK_CONSTANT_INDEX(operand)];
+    }
+    if (registers[operand].type == TYPE_VOID) {
+        fprintf(DIAGNOSTICS, "Error: Undefined variable '%s'\n",
+                operand < chunk->slot_count ? chunk->slot_names[operand] : "<temporary>");
+        return NULL;
+    }
+    return &registers[operand];
+}
+
+// Convert a value for a let destination (type TYPE_VOID: plain move)
+static inline RuntimeValue convert_destination(const Chunk* chunk, const Instruction* instr, RuntimeValue value) {
+    if (instr->type == TYPE_VOID || value.type == TYPE_ERROR) return value;
+    return convert_let_value(chunk->slot_names[instr->a], (DataType)instr->type, value);
+}
+
+static inline bool store_destination(const Chunk* chunk, RuntimeValue* registers, bool* dirty,
+                                     const Instruction* instr, RuntimeValue value) {
+    value = convert_destination(chunk, instr, value);
+    if (value.type == TYPE_ERROR) return false;
+    release_runtime_value(&registers[instr->a]);
+    registers[instr->a] = value;
+    dirty[instr->a] = true;
+    return true;
+}
+
+static inline bool execute_move(const Chunk* chunk, RuntimeValue* registers, bool* dirty, const Instruction* instr) {
+    const RuntimeValue* source = read_operand(chunk, registers, instr->b);
+    if (source == NULL) return false;
+    return store_destination(chunk, registers, dirty, instr, copy_runtime_value(*source));
+}
+
+static inline bool execute_binary(const Chunk* chunk, RuntimeValue* registers, bool* dirty, const Instruction* instr) {
+    const RuntimeValue* left = read_operand(chunk, registers, instr->b);
+    if (left == NULL) return false;
+    const RuntimeValue* right = read_operand(chunk, registers, instr->c);
+    if (right == NULL) return false;
+    return store_destination(chunk, registers, dirty, instr, vm_binary((BinaryOp)instr->binop, *left, *right));
+}
+
+static inline bool execute_print(const Chunk* chunk, RuntimeValue* registers, const Instruction* instr) {
+    const RuntimeValue* value = read_operand(chunk, registers, instr->a);
+    if (value == NULL) return false;
+    evaluate_print(copy_runtime_value(*value));
+    return true;
+}
+
+// Operand of a speculative instruction. Constants were checked at compile
+// time; an undefined variable (TYPE_VOID) simply fails the guard.
+static inline const RuntimeValue* speculated_operand(const Chunk* chunk, const RuntimeValue* registers, int operand) {
+    return RK_IS_CONSTANT(operand) ? &chunk->constants[RK_CONSTANT_INDEX(operand)] : &registers[operand];
+}
+
+// int64 and float arithmetic and comparisons, computed exactly like the AST
+// interpreter's quickened nodes. Returns false (the guard failed) for a
+// division by zero, which the interpreter reports itself.
+static inline bool speculated_int64_binary(int binop, int64_t l_val, int64_t r_val, RuntimeValue* result) {
+    switch (binop) {
+        case BINOP_ADD:   *result = create_int64_runtime_value(l_val + r_val); return true;
+        case BINOP_SUB:   *result = create_int64_runtime_value(l_val - r_val); return true;
+        case BINOP_MUL:   *result = create_int64_runtime_value(l_val * r_val); return true;
+        case BINOP_DIV:
+            if (r_val == 0) return false;
+            *result = create_int64_runtime_value(l_val / r_val);
+            return true;
+        case BINOP_GT:    *result = create_bool_runtime_value(l_val > r_val); return true;
+        case BINOP_LT:    *result = create_bool_runtime_value(l_val < r_val); return true;
+        case BINOP_EQ:    *result = create_bool_runtime_value(l_val == r_val); return true;
+        case BINOP_LTEQ:  *result = create_bool_runtime_value(l_val <= r_val); return true;
+        case BINOP_GTEQ:  *result = create_bool_runtime_value(l_val >= r_val); return true;
+        case BINOP_NOTEQ: *result = create_bool_runtime_value(l_val != r_val); return true;
+        default: return false;
+    }
+}
+
+static inline bool speculated_float_binary(int binop, double l_val, double r_val, RuntimeValue* result) {
+    switch (binop) {
+        case BINOP_ADD:   *result = create_number_runtime_value(l_val + r_val); return true;
+        case BINOP_SUB:   *result = create_number_runtime_value(l_val - r_val); return true;
+        case BINOP_MUL:   *result = create_number_runtime_value(l_val * r_val); return true;
+        case BINOP_DIV:
+            if (r_val == 0.0) return false;
+            *result = create_number_runtime_value(l_val / r_val);
+            return true;
+        case BINOP_GT:    *result = create_bool_runtime_value(l_val > r_val); return true;
+        case BINOP_LT:    *result = create_bool_runtime_value(l_val < r_val); return true;
+        case BINOP_EQ:    *result = create_bool_runtime_value(l_val == r_val); return true;
+        case BINOP_LTEQ:  *result = create_bool_runtime_value(l_val <= r_val); return true;
+        case BINOP_GTEQ:  *result = create_bool_runtime_value(l_val >= r_val); return true;
+        case BINOP_NOTEQ: *result = create_bool_runtime_value(l_val != r_val); return true;
+        default: return false;
+    }
+}
+
+// Evaluate a speculative BINARY or JUMP_UNLESS_CMP. Returns false if its guard fails.
+static inline bool execute_speculated(const Chunk* chunk, const RuntimeValue* registers,
+                                      const Instruction* instr, int left_operand, int right_operand,
+                                      bool is_float, RuntimeValue* result) {
+    const RuntimeValue* left = speculated_operand(chunk, registers, left_operand);
+    const RuntimeValue* right = speculated_operand(chunk, registers, right_operand);
+    STAT_BINARY(instr->binop, left->type, right->type);
+    if (is_float) {
+        if (left->type != TYPE_FLOAT || right->type != TYPE_FLOAT) return false;
+        return speculated_float_binary(instr->binop, left->val.float_val, right->val.float_val, result);
+    }
+    if (left->type != TYPE_INT64 || right->type != TYPE_INT64) return false;
+    return speculated_int64_binary(instr->binop, left->val.int64_val, right->val.int64_val, result);
+}
+
+// A binary operation on two int64s or two floats that cannot fail: no
+// division by zero, nor INT64_MIN / -1. Returns false for anything else.
+// Shared by PRECOMPUTE and constant propagation (ssa.c).
+bool evaluate_binary_quietly(int binop, RuntimeValue left, RuntimeValue right, RuntimeValue* result) {
+    if (left.type == TYPE_INT64 && right.type == TYPE_INT64) {
+        if (binop == BINOP_DIV && right.val.int64_val == -1) return false;
+        return speculated_int64_binary(binop, left.val.int64_val, right.val.int64_val, result);
+    }
+    if (left.type == TYPE_FLOAT && right.type == TYPE_FLOAT) {
+        return speculated_float_binary(binop, left.val.float_val, right.val.float_val, result);
+    }
+    return false;
+}
+
+// PRECOMPUTE: a loop-invariant operation hoisted in front of its loop
+// (regopt.c). It may run where the loop's own instruction never would, so it
+// reports nothing: operands other than two int64s or two floats, or a
+// division that could fail, leave TYPE_VOID for the INVARIANT to redo.
+static inline void execute_precompute(const Chunk* chunk, RuntimeValue* registers, const Instruction* instr) {
+    const RuntimeValue* left = speculated_operand(chunk, registers, instr->b);
+    const RuntimeValue* right = speculated_operand(chunk, registers, instr->c);
+    RuntimeValue value;
+    STAT_BINARY(instr->binop, left->type, right->type);
+    if (!evaluate_binary_quietly(instr->binop, *left, *right, &value)) {
+        value = create_void_runtime_value();
+    }
+    registers[instr->a] = value; // A register of its own, never holding a string
+}
+
+// INVARIANT: the precomputed value, or the original operation if there is none
+static inline bool execute_invariant(const Chunk* chunk, RuntimeValue* registers, bool* dirty, const Instruction* instr) {
+    if (registers[instr->b].type == TYPE_VOID) {
+        Instruction original = chunk->code[instr->c];
+        original.a = instr->a;
+        return execute_binary(chunk, registers, dirty, &original);
+    }
+    release_runtime_value(&registers[instr->a]);
+    registers[instr->a] = registers[instr->b];
+    dirty[instr->a] = true;
+    return true;
+}
+
+// MUL_POW2, DIV_POW2 and DIV_MAGIC on an int64 operand, equal to C's
+// multiplication and truncating division by the constant
+static inline int64_t reduced_int64_operation(const Chunk* chunk, const Instruction* instr, int64_t value) {
+    int index = RK_CONSTANT_INDEX(instr->c);
+    int64_t constant = chunk->constants[index].val.int64_val;
+    switch (instr->op) {
+        case ROP_MUL_POW2:
+            return (int64_t)((uint64_t)value << __builtin_ctzll((uint64_t)constant));
+        case ROP_DIV_POW2: {
+            // Bias negative dividends by 2^k - 1 so the shift rounds toward zero
+            int shift = __builtin_ctzll((uint64_t)constant);
+            int64_t bias = (int64_t)((uint64_t)(value >> 63) >> (64 - shift));
+            return (value + bias) >> shift;
+        }
+        default: {
+#ifdef __SIZEOF_INT128__
+            int64_t magic = chunk->constants[index + 1].val.int64_val;
+            int shift = (int)chunk->constants[index + 2].val.int64_val;
+            int64_t quotient = (int64_t)(((__int128)magic * value) >> 64);
+            if (magic < 0) quotient += value;
+            quotient >>= shift;
+            return quotient + (int64_t)((uint64_t)quotient >> 63);
+#else
+            return value / constant;
+#endif
+        }
+    }
+}
+
+// Deoptimization metadata for the speculative instruction at 'pc'
+static const DeoptPoint* find_deopt_point(const Chunk* chunk, int pc) {
+    for (int i = 0; i < chunk->deopt_count; i++) {
+        if (chunk->deopt_points[i].pc == pc) return &chunk->deopt_points[i];
+    }
+    return NULL;
+}
+
+// Should a conditional branch be taken? Returns -1 after reporting an error.
+static inline int branch_taken(const Chunk* chunk, RuntimeValue* registers, const Instruction* instr) {
+    if (instr->op == ROP_JUMP_IF_FALSE) {
+        const RuntimeValue* condition = read_operand(chunk, registers, instr->a);
+        if (condition == NULL) return -1;
+        if (condition->type != TYPE_BOOL) {
+            fputs(CONDITION_ERROR_MESSAGE(instr->c), DIAGNOSTICS);
+            return -1;
+        }
+        return !condition->val.bool_val;
+    }
+    const RuntimeValue* left = read_operand(chunk, registers, instr->a);
+    if (left == NULL) return -1;
+    const RuntimeValue* right = read_operand(chunk, registers, instr->b);
+    if (right == NULL) return -1;
+    RuntimeValue result = vm_binary((BinaryOp)instr->binop, *left, *right);
+    if (result.type == TYPE_ERROR) return -1;
+    return !result.val.bool_val;
+}
+
+// Execute the single instruction at 'pc' with the generic semantics and
+// return the pc to continue at, or -1 after reporting a runtime error. This is
+// the slow path native code falls back on (see jit.c).
+int execute_register_instruction(Chunk* chunk, RuntimeValue* registers, bool* dirty, int pc) {
+    const Instruction* instr = &chunk->code[pc];
+    int taken;
+    switch (generic_register_opcode(instr->op)) {
+        case ROP_MOVE:
+            return execute_move(chunk, registers, dirty, instr) ? pc + 1 : -1;
+        case ROP_BINARY:
+            return execute_binary(chunk, registers, dirty, instr) ? pc + 1 : -1;
+        case ROP_PRINT:
+            return execute_print(chunk, registers, instr) ? pc + 1 : -1;
+        case ROP_JUMP:
+            return instr->a;
+        case ROP_JUMP_IF_FALSE:
+            taken = branch_taken(chunk, registers, instr);
+            return taken < 0 ? -1 : (taken ? instr->b : pc + 1);
+        case ROP_JUMP_UNLESS_CMP:
+            taken = branch_taken(chunk, registers, instr);
+            return taken < 0 ? -1 : (taken ? instr->c : pc + 1);
+        case ROP_FAIL:
+            fputs(chunk->constants[instr->a].val.string_val, DIAGNOSTICS);
+            return -1;
+        case ROP_HALT:
+            return pc;
+        case ROP_PRECOMPUTE:
+            execute_precompute(chunk, registers, instr);
+            return pc + 1;
+        case ROP_INVARIANT:
+            return execute_invariant(chunk, registers, dirty, instr) ? pc + 1 : -1;
+        default:
+            fprintf(DIAGNOSTICS, "Internal Error: Unknown opcode %d.\n", instr->op);
+            return -1;
+    }
+}
+
+static int jit_threshold = 0; // Loop iterations before native compilation; 0: JIT off
+
+void set_jit_threshold(int threshold) {
+    jit_threshold = threshold;
+}
+
+// A loop's back-edge has been taken often enough: compile the chunk (once) and
+// continue at the loop head in native code. Returns the pc to resume the
+// interpreter at (the HALT, normally), -1 after a runtime error, or -2 if
+// native code isn't available.
+static int enter_native_code(Chunk* chunk, RuntimeValue* registers, bool* dirty, int loop_head) {
+    if (chunk->native == NULL) {
+        if (chunk->native_unavailable) return -2;
+        chunk->native = jit_compile(chunk);
+        if (chunk->native == NULL) {
+            LOG_DEBUG("Native code unavailable for this chunk; staying in the interpreter.");
+            chunk->native_unavailable = true;
+            return -2;
+        }
+    }
+    return jit_execute(chunk->native, chunk, registers, dirty, loop_head);
+}
+
+// Run a register chunk to completion. Returns a void value, or an error value
+// if a runtime error stopped it (the error has already been reported).
+RuntimeValue run_register_chunk(Chunk* chunk) {
+#ifdef ZR_COMPUTED_GOTO
+    static void* dispatch_table[ROP_COUNT] = {
+        [ROP_MOVE] = &&op_MOVE,
+        [ROP_BINARY] = &&op_BINARY,
+        [ROP_PRINT] = &&op_PRINT,
+        [ROP_JUMP] = &&op_JUMP,
+        [ROP_JUMP_IF_FALSE] = &&op_JUMP_IF_FALSE,
+        [ROP_JUMP_UNLESS_CMP] = &&op_JUMP_UNLESS_CMP,
+        [ROP_FAIL] = &&op_FAIL,
+        [ROP_HALT] = &&op_HALT,
+        [ROP_BINARY_INT64] = &&op_BINARY_INT64,
+        [ROP_BINARY_FLOAT] = &&op_BINARY_FLOAT,
+        [ROP_JUMP_UNLESS_CMP_INT64] = &&op_JUMP_UNLESS_CMP_INT64,
+        [ROP_JUMP_UNLESS_CMP_FLOAT] = &&op_JUMP_UNLESS_CMP_FLOAT,
+        [ROP_PRECOMPUTE] = &&op_PRECOMPUTE,
+        [ROP_INVARIANT] = &&op_INVARIANT,
+        [ROP_MUL_POW2] = &&op_MUL_POW2,
+        [ROP_DIV_POW2] = &&op_DIV_POW2,
+        [ROP_DIV_MAGIC] = &&op_DIV_MAGIC,
+    };
+#define VM_CASE(name) op_##name
+#define VM_DISPATCH()                                   \
+    do {                                                \
+        profile_pc = pc;                                \
+        instr = &chunk->code[pc++];                     \
+        goto *dispatch_table[instr->op];                \
+    } while (0)
+#else
+#define VM_CASE(name) case ROP_##name
+#define VM_DISPATCH() goto dispatch
+#endif
+
+    int register_count = chunk->register_count;
+    RuntimeValue* registers = safe_malloc(sizeof(RuntimeValue) * (register_count + 1));
+    bool* dirty = safe_malloc(sizeof(bool) * (register_count + 1));
+    memset(dirty, 0, sizeof(bool) * (register_count + 1));
+    load_frame(chunk, registers);
+    for (int i = chunk->slot_count; i < register_count; i++) {
+        registers[i] = create_void_runtime_value();
+    }
+
+    RuntimeValue result = create_void_runtime_value();
+    RuntimeValue speculated;
+    const Instruction* instr;
+    int taken;
+    int pc = 0;
+    chunk->deopt = NULL;
+
+    // Samples taken from here on are attributed to this chunk's instructions
+    profile_pc = 0;
+    profile_engine = PROFILE_REGISTER_VM;
+    profile_chunk = chunk;
+
+#ifdef ZR_COMPUTED_GOTO
+    VM_DISPATCH();
+#else
+dispatch:
+    profile_pc = pc;
+    instr = &chunk->code[pc++];
+    switch (instr->op) {
+#endif
+
+    VM_CASE(MOVE):
+        if (!execute_move(chunk, registers, dirty, instr)) goto failed;
+        VM_DISPATCH();
+
+    VM_CASE(BINARY):
+        if (!execute_binary(chunk, registers, dirty, instr)) goto failed;
+        VM_DISPATCH();
+
+    VM_CASE(PRINT):
+        if (!execute_print(chunk, registers, instr)) goto failed;
+        VM_DISPATCH();
+
+    VM_CASE(JUMP):
+        // Backward jumps close loops; c counts how often this one was taken
+        if (instr->a < pc && jit_threshold > 0 && ++chunk->code[pc - 1].c >= jit_threshold) {
+            profile_pc = instr->a; // Compiling counts as the loop head
+            profile_engine = PROFILE_JIT;
+            int resume = enter_native_code(chunk, registers, dirty, instr->a);
+            profile_engine = PROFILE_REGISTER_VM;
+            if (resume == -1) goto failed;
+            if (resume >= 0) {
+                pc = resume;
+                VM_DISPATCH();
+            }
+        }
+        pc = instr->a;
+        VM_DISPATCH();
+
+    VM_CASE(JUMP_IF_FALSE):
+        if ((taken = branch_taken(chunk, registers, instr)) < 0) goto failed;
+        if (taken) pc = instr->b;
+        VM_DISPATCH();
+
+    VM_CASE(JUMP_UNLESS_CMP):
+        if ((taken = branch_taken(chunk, registers, instr)) < 0) goto failed;
+        if (taken) pc = instr->c;
+        VM_DISPATCH();
+
+    VM_CASE(FAIL):
+        fputs(chunk->constants[instr->a].val.string_val, DIAGNOSTICS);
+        goto failed;
+
+    VM_CASE(HALT):
+        goto finished;
+
+    VM_CASE(BINARY_INT64):
+    VM_CASE(BINARY_FLOAT):
+        if (!execute_speculated(chunk, registers, instr, instr->b, instr->c,
+                                instr->op == ROP_BINARY_FLOAT, &speculated)) goto deoptimize;
+        release_runtime_value(&registers[instr->a]);
+        registers[instr->a] = speculated;
+        dirty[instr->a] = true;
+        VM_DISPATCH();
+
+    VM_CASE(JUMP_UNLESS_CMP_INT64):
+    VM_CASE(JUMP_UNLESS_CMP_FLOAT):
+        if (!execute_speculated(chunk, registers, instr, instr->a, instr->b,
+                                instr->op == ROP_JUMP_UNLESS_CMP_FLOAT, &speculated)) goto deoptimize;
+        if (!speculated.val.bool_val) pc = instr->c;
+        VM_DISPATCH();
+
+    VM_CASE(PRECOMPUTE):
+        execute_precompute(chunk, registers, instr);
+        VM_DISPATCH();
+
+    VM_CASE(INVARIANT):
+        if (!execute_invariant(chunk, registers, dirty, instr)) goto failed;
+        VM_DISPATCH();
+
+    VM_CASE(MUL_POW2):
+    VM_CASE(DIV_POW2):
+    VM_CASE(DIV_MAGIC):
+        if (registers[instr->b].type != TYPE_INT64) {
+            if (!execute_binary(chunk, registers, dirty, instr)) goto failed;
+            VM_DISPATCH();
+        }
+        STAT_BINARY(instr->binop, TYPE_INT64, TYPE_INT64);
+        speculated = create_int64_runtime_value(reduced_int64_operation(chunk, instr, registers[instr->b].val.int64_val));
+        release_runtime_value(&registers[instr->a]);
+        registers[instr->a] = speculated;
+        dirty[instr->a] = true;
+        VM_DISPATCH();
+
+#ifndef ZR_COMPUTED_GOTO
+    default:
+        fprintf(DIAGNOSTICS, "Internal Error: Unknown opcode %d.\n", instr->op);
+        goto failed;
+    }
+#endif
+
+deoptimize:
+    // Nothing of the failed instruction's statement has been stored yet: hand
+    // the state back and let the AST interpreter run it again
+    chunk->deopt = find_deopt_point(chunk, pc - 1);
+    LOG_DEBUG("Deoptimizing: guard failed at pc %d.", pc - 1);
+    goto finished;
+
+failed:
+    result = create_error_runtime_value();
+
+finished:
+    profile_chunk = NULL;
+    store_frame(chunk, registers, dirty);
+    for (int i = chunk->slot_count; i < register_count; i++) {
+        release_runtime_value(&registers[i]);
+    }
+    safe_free(registers);
+    safe_free(dirty);
+    return result;
+
+#undef VM_CASE
+#undef VM_DISPATCH
+}
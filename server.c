@@ -0,0 +1,486 @@
+#define _GNU_SOURCE // fopencookie
+#include "compiler.h"
+#include "zr.h"
+#include "debug.h"
+#include <errno.h>
+#include <limits.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+
+// Script server: --serve=SOCKET listens on a Unix domain socket and runs the
+// scripts clients send, so that a run costs neither process startup nor
+// re-parsing the modules it loads. A fixed set of threads takes connections,
+// each with its own libzr context, reset between requests; parsed modules
+// are shared between them through a module cache (loader.c).
+//
+// A connection carries one request, a line:
+//
+//   RUN <length> <path>   followed by <length> bytes of source, at most
+//                         MAX_SOURCE_SIZE; 'path' is the script's absolute
+//                         path, to resolve its loadins from
+//   STATS                 counters of the requests served so far
+//
+// and is answered with frames, the last one EXIT:
+//
+//   OUT <length>          followed by output, sent as the script prints
+//   ERR <length>          followed by the error messages (zr_error)
+//   EXIT <status> <usec>  the ZrStatus and the request's wall time
+//
+// With --zygote=PRELUDE, the server instead runs PRELUDE once, then forks
+// a child per connection, which runs the request on top of the state the
+// prelude left (variables, modules and their code, shared copy-on-write)
+// and exits. The parent stays single-threaded, so that forking it is safe.
+//
+// --connect=SOCKET runs a script on a server; --server-stats=SOCKET prints
+// its counters.
+
+#define MAX_REQUEST_LINE (PATH_MAX + 64)
+#define MAX_SOURCE_SIZE (64 * 1024 * 1024) // Longest source a RUN request may send
+
+// Shared with the zygote's children, which count their own requests
+typedef struct {
+    pthread_mutex_t lock; // Process-shared and robust: a child can die holding it
+    unsigned long requests;
+    unsigned long by_status[ZR_ERROR_TYPE + 1];
+    unsigned long output_bytes;
+    double total_usec;
+    double max_usec;
+    double last_usec;
+} ServerStats;
+
+static ServerStats* served = NULL;
+static int listener = -1;
+static ModuleCache* modules = NULL; // Threaded server only
+
+static ServerStats* create_server_stats(void) {
+    ServerStats* stats = mmap(NULL, sizeof(ServerStats), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (stats == MAP_FAILED) return NULL;
+    memset(stats, 0, sizeof(ServerStats));
+    pthread_mutexattr_t attributes;
+    pthread_mutexattr_init(&attributes);
+    pthread_mutexattr_setpshared(&attributes, PTHREAD_PROCESS_SHARED);
+    pthread_mutexattr_setrobust(&attributes, PTHREAD_MUTEX_ROBUST);
+    pthread_mutex_init(&stats->lock, &attributes);
+    pthread_mutexattr_destroy(&attributes);
+    return stats;
+}
+
+static void lock_stats(void) {
+    if (pthread_mutex_lock(&served->lock) == EOWNERDEAD) {
+        pthread_mutex_consistent(&served->lock); // At worst, one request's counts are partial
+    }
+}
+
+static double now_usec(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1e6 + now.tv_nsec / 1e3;
+}
+
+static bool send_all(int fd, const char* data, size_t size) {
+    while (size > 0) {
+        ssize_t sent = send(fd, data, size, MSG_NOSIGNAL); // A client that left isn't fatal
+        if (sent < 0 && errno == EINTR) continue;
+        if (sent <= 0) return false;
+        data += sent;
+        size -= sent;
+    }
+    return true;
+}
+
+static bool send_frame(int fd, const char* kind, const char* data, size_t size) {
+    char header[64];
+    int length = snprintf(header, sizeof(header), "%s %zu\n", kind, size);
+    return send_all(fd, header, length) && send_all(fd, data, size);
+}
+
+typedef struct {
+    int fd;
+    unsigned long output_bytes;
+} Connection;
+
+// The stream 'print' writes to: each flush (every print) becomes an OUT frame
+static ssize_t write_output(void* cookie, const char* data, size_t size) {
+    Connection* connection = cookie;
+    if (!send_frame(connection->fd, "OUT", data, size)) return -1;
+    connection->output_bytes += size;
+    return size;
+}
+
+static void finish_request(Connection* connection, ZrStatus status, double began) {
+    double usec = now_usec() - began;
+    char exit_line[64];
+    int length = snprintf(exit_line, sizeof(exit_line), "EXIT %d %.0f\n", status, usec);
+    send_all(connection->fd, exit_line, length);
+
+    lock_stats();
+    served->requests++;
+    served->by_status[status]++;
+    served->output_bytes += connection->output_bytes;
+    served->total_usec += usec;
+    if (usec > served->max_usec) served->max_usec = usec;
+    served->last_usec = usec;
+    pthread_mutex_unlock(&served->lock);
+}
+
+static void send_stats(int fd) {
+    ModuleCacheStats cache = { 0, 0, 0 };
+    if (modules != NULL) cache = get_module_cache_stats(modules);
+    char text[1024];
+    lock_stats();
+    int length = snprintf(text, sizeof(text),
+        "requests %lu\n"
+        "ok %lu\n"
+        "compile_errors %lu\n"
+        "runtime_errors %lu\n"
+        "output_bytes %lu\n"
+        "wall_usec_total %.0f\n"
+        "wall_usec_mean %.1f\n"
+        "wall_usec_max %.0f\n"
+        "wall_usec_last %.0f\n"
+        "cached_modules %d\n"
+        "module_cache_hits %lu\n"
+        "module_parses %lu\n",
+        served->requests, served->by_status[ZR_OK], served->by_status[ZR_ERROR_COMPILE],
+        served->by_status[ZR_ERROR_RUNTIME], served->output_bytes, served->total_usec,
+        served->requests > 0 ? served->total_usec / served->requests : 0.0,
+        served->max_usec, served->last_usec, cache.modules, cache.hits, cache.parses);
+    pthread_mutex_unlock(&served->lock);
+    send_frame(fd, "OUT", text, length);
+    send_all(fd, "EXIT 0 0\n", 9);
+}
+
+static void send_error(int fd, const char* message) {
+    send_frame(fd, "ERR", message, strlen(message));
+    char exit_line[32];
+    int length = snprintf(exit_line, sizeof(exit_line), "EXIT %d 0\n", ZR_ERROR_COMPILE);
+    send_all(fd, exit_line, length);
+}
+
+// Answer the request on 'fd', accepted at 'began', with the context as it is
+static void serve_connection(ZrContext* context, int fd, double began) {
+    FILE* in = fdopen(fd, "r");
+    if (in == NULL) {
+        close(fd);
+        return;
+    }
+    char line[MAX_REQUEST_LINE];
+    if (fgets(line, sizeof(line), in) == NULL) {
+        fclose(in);
+        return;
+    }
+    line[strcspn(line, "\n")] = '\0';
+
+    size_t size;
+    int path_start = 0;
+    if (strcmp(line, "STATS") == 0) {
+        send_stats(fd);
+    } else if (sscanf(line, "RUN %zu %n", &size, &path_start) != 1 || path_start == 0 || line[path_start] == '\0') {
+        send_error(fd, "Error: Bad request.\n");
+    } else if (size > MAX_SOURCE_SIZE) {
+        send_error(fd, "Error: Source too long.\n");
+    } else {
+        // Not safe_malloc: running out of memory fails the request, not the server
+        char* source = malloc(size + 1);
+        if (source == NULL) {
+            send_error(fd, "Error: Out of memory for the source.\n");
+        } else if (fread(source, 1, size, in) != size) {
+            send_error(fd, "Error: Request ended before its source.\n");
+        } else {
+            source[size] = '\0';
+            Connection connection = { fd, 0 };
+            cookie_io_functions_t functions = { NULL, write_output, NULL, NULL };
+            FILE* output = fopencookie(&connection, "w", functions);
+
+            zr_set_output(context, output);
+            ZrStatus status = zr_load(context, line + path_start, source);
+            if (status == ZR_OK) status = zr_run(context);
+            zr_set_output(context, NULL);
+            fclose(output);
+            const char* messages = zr_error(context);
+            if (*messages != '\0') send_frame(fd, "ERR", messages, strlen(messages));
+            finish_request(&connection, status, began);
+        }
+        free(source);
+    }
+    fclose(in);
+}
+
+static void* serve_connections(void* unused) {
+    (void)unused;
+    set_module_cache(modules);
+    ZrContext* context = zr_create();
+    for (;;) {
+        int fd = accept(listener, NULL, NULL);
+        if (fd < 0) {
+            if (errno == EINTR || errno == ECONNABORTED) continue;
+            break; // The listener was shut down
+        }
+        double began = now_usec();
+        zr_reset(context);
+        serve_connection(context, fd, began);
+    }
+    zr_destroy(context);
+    free_eval_stack();
+    return NULL;
+}
+
+static bool fill_address(struct sockaddr_un* address, const char* socket_path) {
+    if (strlen(socket_path) >= sizeof(address->sun_path)) {
+        fprintf(stderr, "Error: Socket path '%s' is too long.\n", socket_path);
+        return false;
+    }
+    memset(address, 0, sizeof(*address));
+    address->sun_family = AF_UNIX;
+    strcpy(address->sun_path, socket_path);
+    return true;
+}
+
+static bool open_listener(const char* socket_path) {
+    struct sockaddr_un address;
+    if (!fill_address(&address, socket_path)) return false;
+    listener = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (listener < 0) {
+        perror("socket");
+        return false;
+    }
+    // A socket file left by a server that is gone is replaced
+    struct stat existing;
+    if (stat(socket_path, &existing) == 0 && S_ISSOCK(existing.st_mode)) {
+        int probe = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (connect(probe, (struct sockaddr*)&address, sizeof(address)) != 0 && errno == ECONNREFUSED) {
+            unlink(socket_path);
+        }
+        close(probe);
+    }
+    if (bind(listener, (struct sockaddr*)&address, sizeof(address)) != 0 || listen(listener, SOMAXCONN) != 0) {
+        fprintf(stderr, "Error: Could not listen on '%s': %s\n", socket_path, strerror(errno));
+        close(listener);
+        return false;
+    }
+    return true;
+}
+
+static int serve_threads(const char* socket_path, int threads, const sigset_t* stop_signals) {
+    if (threads <= 0) {
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        threads = cpus > 0 ? (int)cpus : 1;
+    }
+    modules = create_module_cache();
+    pthread_t* workers = safe_malloc(sizeof(pthread_t) * threads);
+    int started = 0;
+    while (started < threads && pthread_create(&workers[started], NULL, serve_connections, NULL) == 0) {
+        started++;
+    }
+    int status = 0;
+    if (started == 0) {
+        fprintf(stderr, "Error: Could not start a server thread.\n");
+        status = 1;
+    } else {
+        LOG_INFO("Serving on %s with %d thread(s)", socket_path, started);
+        int signal_number;
+        sigwait(stop_signals, &signal_number);
+        LOG_INFO("Stopping on signal %d", signal_number);
+    }
+
+    shutdown(listener, SHUT_RDWR); // Wakes the threads in accept()
+    for (int i = 0; i < started; i++) {
+        pthread_join(workers[i], NULL);
+    }
+    safe_free(workers);
+    free_module_cache(modules);
+    return status;
+}
+
+static volatile sig_atomic_t stop_signal = 0;
+
+static void note_stop_signal(int signal_number) {
+    stop_signal = signal_number;
+}
+
+static char* read_prelude(const char* path) {
+    FILE* file = fopen(path, "r");
+    if (file == NULL) return NULL;
+    fseek(file, 0, SEEK_END);
+    long size = ftell(file);
+    fseek(file, 0, SEEK_SET);
+    char* source = safe_malloc(size + 1);
+    size_t read_size = fread(source, 1, size, file);
+    source[read_size] = '\0';
+    fclose(file);
+    return source;
+}
+
+static int serve_forked(const char* socket_path, const char* prelude_path, const sigset_t* stop_signals) {
+    char* full_path = realpath(prelude_path, NULL);
+    char* source = full_path != NULL ? read_prelude(full_path) : NULL;
+    if (source == NULL) {
+        fprintf(stderr, "Error: Could not open file '%s'\n", prelude_path);
+        free(full_path);
+        return 1;
+    }
+    ZrContext* context = zr_create();
+    ZrStatus prelude_status = zr_preload(context, full_path, source);
+    safe_free(source);
+    free(full_path);
+    if (prelude_status != ZR_OK) {
+        fprintf(stderr, "%sError: The prelude '%s' failed.\n", zr_error(context), prelude_path);
+        zr_destroy(context);
+        return 1;
+    }
+    fputs(zr_error(context), stderr); // Warnings
+    // The log writer thread wouldn't be in the children
+    set_debug_async(false);
+
+    // Stop signals only arrive while waiting for a connection; children
+    // are reaped by the kernel
+    sigset_t waiting;
+    pthread_sigmask(SIG_BLOCK, NULL, &waiting);
+    sigdelset(&waiting, SIGINT);
+    sigdelset(&waiting, SIGTERM);
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = note_stop_signal;
+    sigaction(SIGINT, &action, NULL);
+    sigaction(SIGTERM, &action, NULL);
+    action.sa_handler = SIG_IGN;
+    action.sa_flags = SA_NOCLDWAIT;
+    sigaction(SIGCHLD, &action, NULL);
+
+    LOG_INFO("Serving on %s, forking from the state of %s", socket_path, prelude_path);
+    while (stop_signal == 0) {
+        struct pollfd ready = { listener, POLLIN, 0 };
+        if (ppoll(&ready, 1, NULL, &waiting) < 0) continue; // EINTR: maybe a stop signal
+        int fd = accept(listener, NULL, NULL);
+        if (fd < 0) continue;
+        double began = now_usec();
+        pid_t child = fork();
+        if (child == 0) {
+            close(listener);
+            signal(SIGINT, SIG_DFL);
+            signal(SIGTERM, SIG_DFL);
+            signal(SIGCHLD, SIG_DFL);
+            pthread_sigmask(SIG_UNBLOCK, stop_signals, NULL);
+            serve_connection(context, fd, began);
+            _exit(0); // Without the parent's exit handlers
+        }
+        if (child < 0) {
+            perror("fork");
+            send_error(fd, "Error: The server could not fork.\n");
+        }
+        close(fd);
+    }
+    LOG_INFO("Stopping on signal %d", (int)stop_signal);
+    zr_destroy(context);
+    return 0;
+}
+
+int serve(const char* socket_path, int threads, const char* prelude_path) {
+    served = create_server_stats();
+    if (served == NULL || !open_listener(socket_path)) return 1;
+
+    // Blocked everywhere but where the server waits for them
+    sigset_t stop_signals;
+    sigemptyset(&stop_signals);
+    sigaddset(&stop_signals, SIGINT);
+    sigaddset(&stop_signals, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &stop_signals, NULL);
+
+    int status = prelude_path != NULL ? serve_forked(socket_path, prelude_path, &stop_signals)
+                                      : serve_threads(socket_path, threads, &stop_signals);
+    close(listener);
+    unlink(socket_path);
+    munmap(served, sizeof(ServerStats));
+    return status;
+}
+
+static int connect_to_server(const char* socket_path) {
+    struct sockaddr_un address;
+    if (!fill_address(&address, socket_path)) return -1;
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0 || connect(fd, (struct sockaddr*)&address, sizeof(address)) != 0) {
+        fprintf(stderr, "Error: Could not connect to '%s': %s\n", socket_path, strerror(errno));
+        if (fd >= 0) close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+// Copy OUT frames to stdout and ERR frames to stderr; the status from EXIT
+static int relay_response(int fd) {
+    FILE* in = fdopen(fd, "r");
+    char line[128];
+    char buffer[4096];
+    while (fgets(line, sizeof(line), in) != NULL) {
+        size_t size;
+        int status;
+        if (sscanf(line, "EXIT %d", &status) == 1) {
+            fclose(in);
+            return status;
+        }
+        bool output = strncmp(line, "OUT ", 4) == 0;
+        if (!(output || strncmp(line, "ERR ", 4) == 0) || sscanf(line + 4, "%zu", &size) != 1) break;
+        FILE* out = output ? stdout : stderr;
+        while (size > 0) {
+            size_t chunk = size < sizeof(buffer) ? size : sizeof(buffer);
+            if (fread(buffer, 1, chunk, in) != chunk) break;
+            fwrite(buffer, 1, chunk, out);
+            size -= chunk;
+        }
+        fflush(out);
+    }
+    fclose(in);
+    fprintf(stderr, "Error: The server closed the connection.\n");
+    return 1;
+}
+
+int run_on_server(const char* socket_path, const char* script_path) {
+    char* full_path = realpath(script_path, NULL);
+    FILE* file = full_path != NULL ? fopen(full_path, "r") : NULL;
+    if (file == NULL) {
+        fprintf(stderr, "Error: Could not open file '%s'\n", script_path);
+        free(full_path);
+        return 1;
+    }
+    fseek(file, 0, SEEK_END);
+    long size = ftell(file);
+    fseek(file, 0, SEEK_SET);
+    char* source = safe_malloc(size + 1);
+    size_t read_size = fread(source, 1, size, file);
+    fclose(file);
+
+    int status = 1;
+    int fd = connect_to_server(socket_path);
+    if (fd >= 0) {
+        char header[MAX_REQUEST_LINE];
+        int length = snprintf(header, sizeof(header), "RUN %zu %s\n", read_size, full_path);
+        if (send_all(fd, header, length) && send_all(fd, source, read_size)) {
+            status = relay_response(fd);
+        } else {
+            close(fd);
+        }
+    }
+    safe_free(source);
+    free(full_path);
+    return status;
+}
+
+int print_server_stats(const char* socket_path) {
+    int fd = connect_to_server(socket_path);
+    if (fd < 0) return 1;
+    if (!send_all(fd, "STATS\n", 6)) {
+        close(fd);
+        return 1;
+    }
+    return relay_response(fd);
+}
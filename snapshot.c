@@ -0,0 +1,453 @@
+#include "compiler.h"
+#include "vm.h"
+#include "debug.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Preludes and their snapshots (--prelude, --snapshot). A prelude runs
+// before the program, like a module that every program loads. The state it
+// leaves is the same on every run until a source changes: the variables
+// (interpreter.c), their static types (typecheck.c) and the modules loaded
+// (loader.c). A snapshot saves that state to a file once the prelude has
+// run, so that later runs map the file and bind it all again instead of
+// reading, parsing, checking and running the prelude and its modules.
+//
+// The file has no pointers: strings are offsets into its string area, so it
+// is used in place wherever it is mapped. It also records the prelude and
+// every module it loaded, by path, device, inode, size and modification
+// time (as the module cache does), and the main script's directory, which
+// module paths are resolved against. When any of these differ, the snapshot
+// is stale: the prelude runs and the snapshot is written again. The code of
+// the prelude isn't kept; it has run, and so have its modules, which the
+// program's 'loadin's skip from then on.
+//
+// Layout, each part 8-byte aligned:
+//   SnapshotHeader
+//   SnapshotSource[source_count] (the prelude, then its modules in load order)
+//   SnapshotSymbol[symbol_count]
+//   SnapshotType[type_count]
+//   strings_size bytes of NUL-terminated strings, the last byte a NUL
+
+#define SNAPSHOT_MAGIC "ZRSNAP\n"
+#define SNAPSHOT_VERSION 1 // Bump when the layout, DataType or Value changes
+#define NO_STRING UINT32_MAX
+
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t source_count;
+    uint32_t symbol_count;
+    uint32_t type_count;
+    uint32_t main_script_dir; // String offset
+    uint32_t reserved;
+    uint64_t strings_size;
+    uint64_t checksum; // FNV-1a of everything after the header
+} SnapshotHeader;
+
+typedef struct {
+    uint32_t path;
+    uint32_t reserved;
+    uint64_t device;
+    uint64_t inode;
+    int64_t size;
+    int64_t modified_sec;
+    int64_t modified_nsec;
+} SnapshotSource;
+
+typedef struct {
+    uint32_t name;
+    int32_t type;
+    uint64_t bits; // The value: integer, bool, IEEE double, or a string offset (NO_STRING for NULL)
+} SnapshotSymbol;
+
+typedef struct {
+    uint32_t name;
+    int32_t type;
+} SnapshotType;
+
+// Writing
+
+typedef struct {
+    char* data;
+    size_t size;
+    size_t capacity;
+} StringArea;
+
+static uint32_t add_string(StringArea* strings, const char* text) {
+    size_t length = strlen(text) + 1;
+    if (strings->size + length > strings->capacity) {
+        size_t new_capacity = strings->capacity == 0 ? 4096 : strings->capacity * 2;
+        while (new_capacity < strings->size + length) new_capacity *= 2;
+        char* grown = safe_malloc(new_capacity);
+        if (strings->data != NULL) {
+            memcpy(grown, strings->data, strings->size);
+            safe_free(strings->data);
+        }
+        strings->data = grown;
+        strings->capacity = new_capacity;
+    }
+    uint32_t offset = (uint32_t)strings->size;
+    memcpy(strings->data + strings->size, text, length);
+    strings->size += length;
+    return offset;
+}
+
+static uint64_t encode_value(RuntimeValue value, StringArea* strings) {
+    uint64_t bits = 0;
+    switch (value.type) {
+        case TYPE_INT:    bits = (uint64_t)(int64_t)value.val.int_val; break;
+        case TYPE_INT32:  bits = (uint64_t)(int64_t)value.val.int32_val; break;
+        case TYPE_INT64:  bits = (uint64_t)value.val.int64_val; break;
+        case TYPE_BOOL:   bits = value.val.bool_val ? 1 : 0; break;
+        case TYPE_FLOAT:  memcpy(&bits, &value.val.float_val, sizeof(bits)); break;
+        case TYPE_STRING:
+            bits = value.val.string_val != NULL ? add_string(strings, value.val.string_val) : NO_STRING;
+            break;
+        default: break;
+    }
+    return bits;
+}
+
+static void record_source(SnapshotSource* source, const char* path, const struct stat* file, StringArea* strings) {
+    source->path = add_string(strings, path);
+    source->reserved = 0;
+    source->device = (uint64_t)file->st_dev;
+    source->inode = (uint64_t)file->st_ino;
+    source->size = (int64_t)file->st_size;
+    source->modified_sec = (int64_t)file->st_mtim.tv_sec;
+    source->modified_nsec = (int64_t)file->st_mtim.tv_nsec;
+}
+
+static uint64_t checksum_part(uint64_t hash, const void* data, size_t size) {
+    const unsigned char* bytes = data;
+    for (size_t i = 0; i < size; i++) {
+        hash = (hash ^ bytes[i]) * 0x100000001b3ULL;
+    }
+    return hash;
+}
+
+#define CHECKSUM_START 0xcbf29ce484222325ULL
+
+static bool write_part(FILE* file, const void* data, size_t size) {
+    return size == 0 || fwrite(data, 1, size, file) == size;
+}
+
+// Save the current state as left by the prelude at 'prelude_path' (whose
+// file was 'prelude_file' when it was read). Sources are recorded as they
+// were read, so an edit made while the prelude ran invalidates the
+// snapshot instead of being hidden by it. The file is written under a
+// temporary name and renamed, so a concurrent run sees the old snapshot or
+// the new one.
+static bool write_snapshot(const char* snapshot_path, const char* prelude_path, const struct stat* prelude_file,
+                           const char* main_script_dir) {
+    LoadedModulesRegistry* registry = get_module_registry();
+    StringArea strings = { NULL, 0, 0 };
+    SnapshotHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic));
+    header.version = SNAPSHOT_VERSION;
+    header.main_script_dir = add_string(&strings, main_script_dir);
+
+    SnapshotSource* sources = safe_malloc(sizeof(SnapshotSource) * (registry->count + 1));
+    record_source(&sources[0], prelude_path, prelude_file, &strings);
+    header.source_count = 1;
+    for (int i = 0; i < registry->count; i++) {
+        record_source(&sources[header.source_count++], registry->paths[i], &registry->files[i], &strings);
+    }
+
+    int symbols = symbol_count();
+    SnapshotSymbol* symbol_records = safe_malloc(sizeof(SnapshotSymbol) * (symbols > 0 ? symbols : 1));
+    for (int i = 0; i < symbols; i++) {
+        RuntimeValue value;
+        const char* name = symbol_at(i, &value);
+        symbol_records[i].name = add_string(&strings, name);
+        symbol_records[i].type = value.type;
+        symbol_records[i].bits = encode_value(value, &strings);
+    }
+    header.symbol_count = (uint32_t)symbols;
+
+    int types = static_type_count();
+    SnapshotType* type_records = safe_malloc(sizeof(SnapshotType) * (types > 0 ? types : 1));
+    for (int i = 0; i < types; i++) {
+        DataType type;
+        const char* name = static_type_at(i, &type);
+        type_records[i].name = add_string(&strings, name);
+        type_records[i].type = type;
+    }
+    header.type_count = (uint32_t)types;
+
+    // Pad the strings to keep the file size a multiple of 8
+    while (strings.size % 8 != 0) add_string(&strings, "");
+    header.strings_size = strings.size;
+    header.checksum = checksum_part(CHECKSUM_START, sources, sizeof(SnapshotSource) * header.source_count);
+    header.checksum = checksum_part(header.checksum, symbol_records, sizeof(SnapshotSymbol) * header.symbol_count);
+    header.checksum = checksum_part(header.checksum, type_records, sizeof(SnapshotType) * header.type_count);
+    header.checksum = checksum_part(header.checksum, strings.data, strings.size);
+
+    char temporary_path[PATH_MAX];
+    snprintf(temporary_path, sizeof(temporary_path), "%s.%ld.tmp", snapshot_path, (long)getpid());
+    FILE* file = fopen(temporary_path, "wb");
+    bool written = file != NULL
+        && write_part(file, &header, sizeof(header))
+        && write_part(file, sources, sizeof(SnapshotSource) * header.source_count)
+        && write_part(file, symbol_records, sizeof(SnapshotSymbol) * header.symbol_count)
+        && write_part(file, type_records, sizeof(SnapshotType) * header.type_count)
+        && write_part(file, strings.data, strings.size);
+    if (file != NULL && fclose(file) != 0) written = false;
+    if (written && rename(temporary_path, snapshot_path) != 0) written = false;
+    if (!written) {
+        fprintf(stderr, "Warning: Could not write the snapshot '%s': %s\n", snapshot_path, strerror(errno));
+        if (file != NULL) unlink(temporary_path);
+    }
+    safe_free(sources);
+    safe_free(symbol_records);
+    safe_free(type_records);
+    safe_free(strings.data);
+    return written;
+}
+
+// Reading
+
+typedef struct {
+    const SnapshotHeader* header;
+    const SnapshotSource* sources;
+    const SnapshotSymbol* symbols;
+    const SnapshotType* types;
+    const char* strings;
+} MappedSnapshot;
+
+// A string of the snapshot, or NULL if the offset is out of its string area
+// (which ends with a NUL, so every string in it is terminated)
+static const char* string_at(const MappedSnapshot* snapshot, uint32_t offset) {
+    if (offset >= snapshot->header->strings_size) return NULL;
+    return snapshot->strings + offset;
+}
+
+static bool valid_type(int32_t type) {
+    return type >= TYPE_INT && type < TYPE_ERROR;
+}
+
+// Find the parts of a mapped file; false if it isn't a snapshot this build
+// can read, or it was damaged
+static bool locate_parts(MappedSnapshot* snapshot, const char* data, uint64_t size) {
+    if (size < sizeof(SnapshotHeader)) return false;
+    const SnapshotHeader* header = (const SnapshotHeader*)data;
+    if (memcmp(header->magic, SNAPSHOT_MAGIC, sizeof(header->magic)) != 0) return false;
+    if (header->version != SNAPSHOT_VERSION) return false;
+    if (header->source_count < 1 || header->source_count > MAX_LOADED_MODULES + 1) return false;
+
+    // The counts are 32-bit, so none of these overflow
+    uint64_t sources_at = sizeof(SnapshotHeader);
+    uint64_t symbols_at = sources_at + (uint64_t)header->source_count * sizeof(SnapshotSource);
+    uint64_t types_at = symbols_at + (uint64_t)header->symbol_count * sizeof(SnapshotSymbol);
+    uint64_t strings_at = types_at + (uint64_t)header->type_count * sizeof(SnapshotType);
+    if (header->strings_size == 0 || header->strings_size > size || strings_at != size - header->strings_size) return false;
+    if (checksum_part(CHECKSUM_START, data + sources_at, size - sources_at) != header->checksum) return false;
+
+    snapshot->header = header;
+    snapshot->sources = (const SnapshotSource*)(data + sources_at);
+    snapshot->symbols = (const SnapshotSymbol*)(data + symbols_at);
+    snapshot->types = (const SnapshotType*)(data + types_at);
+    snapshot->strings = data + strings_at;
+    return snapshot->strings[header->strings_size - 1] == '\0';
+}
+
+static bool decode_value(const MappedSnapshot* snapshot, const SnapshotSymbol* symbol, RuntimeValue* value) {
+    if (!valid_type(symbol->type)) return false;
+    value->type = (DataType)symbol->type;
+    memset(&value->val, 0, sizeof(value->val));
+    switch (value->type) {
+        case TYPE_INT:    value->val.int_val = (int)(int64_t)symbol->bits; break;
+        case TYPE_INT32:  value->val.int32_val = (int32_t)(int64_t)symbol->bits; break;
+        case TYPE_INT64:  value->val.int64_val = (int64_t)symbol->bits; break;
+        case TYPE_BOOL:   value->val.bool_val = symbol->bits != 0; break;
+        case TYPE_FLOAT:  memcpy(&value->val.float_val, &symbol->bits, sizeof(symbol->bits)); break;
+        case TYPE_STRING:
+            if (symbol->bits != NO_STRING) {
+                if (symbol->bits > UINT32_MAX) return false;
+                // Points into the mapping; set_symbol copies it
+                value->val.string_val = (char*)string_at(snapshot, (uint32_t)symbol->bits);
+                if (value->val.string_val == NULL) return false;
+            }
+            break;
+        default: break;
+    }
+    return true;
+}
+
+// Everything in the snapshot must be readable before any of it is bound
+static bool valid_contents(const MappedSnapshot* snapshot) {
+    const SnapshotHeader* header = snapshot->header;
+    if (string_at(snapshot, header->main_script_dir) == NULL) return false;
+    for (uint32_t i = 0; i < header->source_count; i++) {
+        const char* path = string_at(snapshot, snapshot->sources[i].path);
+        if (path == NULL || strlen(path) >= MAX_MODULE_PATH_LEN) return false;
+    }
+    for (uint32_t i = 0; i < header->symbol_count; i++) {
+        RuntimeValue value;
+        if (string_at(snapshot, snapshot->symbols[i].name) == NULL) return false;
+        if (!decode_value(snapshot, &snapshot->symbols[i], &value)) return false;
+    }
+    for (uint32_t i = 0; i < header->type_count; i++) {
+        if (string_at(snapshot, snapshot->types[i].name) == NULL) return false;
+        if (!valid_type(snapshot->types[i].type)) return false;
+    }
+    return true;
+}
+
+// The name of the first source that changed since the snapshot was taken,
+// or NULL if it is current for this prelude and main script directory
+static const char* changed_source(const MappedSnapshot* snapshot, const char* prelude_path, const char* main_script_dir) {
+    if (strcmp(string_at(snapshot, snapshot->header->main_script_dir), main_script_dir) != 0) {
+        return main_script_dir;
+    }
+    const char* recorded_prelude = string_at(snapshot, snapshot->sources[0].path);
+    if (strcmp(recorded_prelude, prelude_path) != 0) return prelude_path;
+    for (uint32_t i = 0; i < snapshot->header->source_count; i++) {
+        const SnapshotSource* source = &snapshot->sources[i];
+        const char* path = string_at(snapshot, source->path);
+        struct stat file;
+        if (stat(path, &file) != 0
+            || (uint64_t)file.st_dev != source->device
+            || (uint64_t)file.st_ino != source->inode
+            || (int64_t)file.st_size != source->size
+            || (int64_t)file.st_mtim.tv_sec != source->modified_sec
+            || (int64_t)file.st_mtim.tv_nsec != source->modified_nsec) {
+            return path;
+        }
+    }
+    return NULL;
+}
+
+static void bind_snapshot(const MappedSnapshot* snapshot) {
+    for (uint32_t i = 0; i < snapshot->header->symbol_count; i++) {
+        RuntimeValue value;
+        decode_value(snapshot, &snapshot->symbols[i], &value);
+        set_symbol(string_at(snapshot, snapshot->symbols[i].name), value);
+    }
+    for (uint32_t i = 0; i < snapshot->header->type_count; i++) {
+        declare_static_type(string_at(snapshot, snapshot->types[i].name), (DataType)snapshot->types[i].type);
+    }
+    // The prelude itself isn't a module: the modules follow it
+    LoadedModulesRegistry* registry = get_module_registry();
+    for (uint32_t i = 1; i < snapshot->header->source_count; i++) {
+        const SnapshotSource* source = &snapshot->sources[i];
+        struct stat* file = &registry->files[registry->count];
+        memset(file, 0, sizeof(*file));
+        file->st_dev = source->device;
+        file->st_ino = source->inode;
+        file->st_size = source->size;
+        file->st_mtim.tv_sec = source->modified_sec;
+        file->st_mtim.tv_nsec = source->modified_nsec;
+        strcpy(registry->paths[registry->count++], string_at(snapshot, source->path));
+    }
+    registry->preloaded = registry->count;
+}
+
+// Bind the state saved in the snapshot, if it is current; false (with
+// nothing bound) if it is missing, stale or unreadable
+static bool restore_snapshot(const char* snapshot_path, const char* prelude_path, const char* main_script_dir) {
+    int fd = open(snapshot_path, O_RDONLY);
+    if (fd < 0) {
+        if (errno != ENOENT) LOG_WARN("Could not open the snapshot '%s': %s", snapshot_path, strerror(errno));
+        return false;
+    }
+    struct stat file;
+    if (fstat(fd, &file) != 0 || file.st_size < (off_t)sizeof(SnapshotHeader)) {
+        LOG_WARN("Ignoring the snapshot '%s': not a snapshot", snapshot_path);
+        close(fd);
+        return false;
+    }
+    void* data = mmap(NULL, (size_t)file.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+        LOG_WARN("Could not map the snapshot '%s': %s", snapshot_path, strerror(errno));
+        return false;
+    }
+
+    bool restored = false;
+    MappedSnapshot snapshot;
+    LoadedModulesRegistry* registry = get_module_registry();
+    if (!locate_parts(&snapshot, data, (uint64_t)file.st_size) || !valid_contents(&snapshot)) {
+        LOG_WARN("Ignoring the snapshot '%s': damaged, or from another version", snapshot_path);
+    } else if (registry->count + (int)snapshot.header->source_count - 1 > MAX_LOADED_MODULES) {
+        LOG_WARN("Ignoring the snapshot '%s': too many modules", snapshot_path);
+    } else {
+        const char* changed = changed_source(&snapshot, prelude_path, main_script_dir);
+        if (changed != NULL) {
+            LOG_INFO("Snapshot '%s' is stale: '%s' changed", snapshot_path, changed);
+        } else {
+            bind_snapshot(&snapshot);
+            restored = true;
+        }
+    }
+    munmap(data, (size_t)file.st_size);
+    return restored;
+}
+
+// The prelude's source, and in 'version' its file as read
+static char* read_source(const char* path, struct stat* version) {
+    FILE* file = fopen(path, "r");
+    if (file == NULL) return NULL;
+    if (fstat(fileno(file), version) != 0) {
+        fclose(file);
+        return NULL;
+    }
+    fseek(file, 0, SEEK_END);
+    long size = ftell(file);
+    fseek(file, 0, SEEK_SET);
+    if (size < 0) {
+        fclose(file);
+        return NULL;
+    }
+    char* source = safe_malloc(size + 1);
+    size_t read_size = fread(source, 1, size, file);
+    source[read_size] = '\0';
+    fclose(file);
+    return source;
+}
+
+bool load_prelude(const char* prelude_path, const char* snapshot_path, const char* main_script_dir) {
+    char* full_path = realpath(prelude_path, NULL);
+    if (full_path == NULL || strlen(full_path) >= MAX_MODULE_PATH_LEN) {
+        fprintf(stderr, "Error: Could not open file '%s'\n", prelude_path);
+        free(full_path);
+        return false;
+    }
+    if (snapshot_path != NULL && restore_snapshot(snapshot_path, full_path, main_script_dir)) {
+        LOG_INFO("Prelude '%s' restored from the snapshot '%s'", full_path, snapshot_path);
+        free(full_path);
+        return true;
+    }
+
+    double read_began = phase_start(PHASE_READ);
+    struct stat prelude_file;
+    char* source = read_source(full_path, &prelude_file);
+    if (source == NULL) {
+        fprintf(stderr, "Error: Could not open file '%s'\n", prelude_path);
+        free(full_path);
+        return false;
+    }
+    phase_record(PHASE_READ, full_path, read_began);
+    bool completed = process_source_code(source, full_path, main_script_dir);
+    safe_free(source);
+    LoadedModulesRegistry* registry = get_module_registry();
+    registry->preloaded = registry->count;
+
+    // A snapshot would hide the error on later runs
+    if (snapshot_path != NULL && !completed) {
+        fprintf(stderr, "Warning: Not writing the snapshot '%s': the prelude failed\n", snapshot_path);
+    } else if (snapshot_path != NULL && write_snapshot(snapshot_path, full_path, &prelude_file, main_script_dir)) {
+        LOG_INFO("Prelude '%s' saved to the snapshot '%s'", full_path, snapshot_path);
+    }
+    free(full_path);
+    return true;
+}
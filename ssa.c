@@ -0,0 +1,877 @@
+#include "compiler.h"
+#include "vm.h"
+#include "debug.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// SSA form of register bytecode, for the optimization passes regopt.c runs.
+//
+// The IR keeps the chunk's instructions and registers as they are and adds
+// the data flow on top: every MOVE or BINARY defines a value, every register
+// operand names the value it reads, and where control flow merges different
+// assignments of a register a phi joins them. Phis are built on demand from
+// the uses (Braun et al., "Simple and Efficient Construction of SSA Form"),
+// so only registers read across blocks get any.
+//
+// A value lives in the register its instruction assigns, and passes only use
+// it where that register still holds it (available()). Lowering back to
+// bytecode therefore just drops the instructions the passes removed and fixes
+// up jump targets; there is no register allocation to redo.
+//
+// Passes must keep every observable effect in place and in order: prints,
+// writes to variable slots (visible after the chunk, and after an error),
+// and every error, including reading an undefined variable. They only fold,
+// share or forward computations into temporaries, and delete temporaries
+// nothing reads.
+
+typedef enum {
+    SSA_ENTRY,       // A register's contents when the chunk starts
+    SSA_INSTRUCTION, // Assigned by the MOVE or BINARY at 'pc'
+    SSA_PHI          // Merge of a register's values at the start of 'block'
+} SsaValueKind;
+
+typedef enum {
+    LATTICE_TOP,      // No evidence yet (optimistic)
+    LATTICE_CONSTANT, // Always 'constant'
+    LATTICE_VARYING   // Anything
+} Lattice;
+
+typedef struct {
+    SsaValueKind kind;
+    int reg;              // Register holding the value
+    int pc;               // SSA_INSTRUCTION
+    int block;            // SSA_PHI
+    int* operands;        // SSA_PHI: value flowing in from each predecessor
+    int operand_count;    // (then, for the entry block, from the chunk's start)
+    int forward;          // Value this one turned out to be, or -1
+    Lattice lattice;      // Constant propagation
+    RuntimeValue constant;
+    int constant_index;   // Chunk constant equal to 'constant', or -1
+    bool defined;         // Dead code elimination: never TYPE_VOID
+    bool live;
+} SsaValue;
+
+typedef struct {
+    int start;        // First instruction
+    int end;          // One past the last
+    int* preds;
+    int pred_count;
+    int succs[2];
+    int succ_count;
+    int* entry;       // Value of each register on entry, -1 until asked for
+    int idom;         // Immediate dominator (the entry block: itself)
+    int order;        // Reverse postorder index, -1 if unreachable
+} SsaBlock;
+
+struct SsaFunction {
+    Chunk* chunk;
+    SsaBlock* blocks;
+    int block_count;
+    int* block_of;       // Block of each instruction
+    int* defs;           // Value each instruction defines, or -1
+    int (*uses)[3];      // Value each operand (a, b, c) reads, or -1
+    bool* removed;
+    SsaValue* values;
+    int value_count;
+    int value_capacity;
+    int* entry_values;   // SSA_ENTRY value of each register, -1 until asked for
+    int* rpo;            // Reachable blocks in reverse postorder
+    int rpo_count;
+};
+
+// --- Instruction shapes ---
+
+static int* instruction_field(Instruction* instr, int field) {
+    return field == 0 ? &instr->a : field == 1 ? &instr->b : &instr->c;
+}
+
+// Whether field 'field' (0: a, 1: b, 2: c) is an RK operand the instruction reads
+static bool reads_field(const Instruction* instr, int field) {
+    switch (generic_register_opcode(instr->op)) {
+        case ROP_MOVE:            return field == 1;
+        case ROP_BINARY:          return field >= 1;
+        case ROP_PRINT:
+        case ROP_JUMP_IF_FALSE:   return field == 0;
+        case ROP_JUMP_UNLESS_CMP: return field <= 1;
+        default:                  return false;
+    }
+}
+
+static bool defines_register(const Instruction* instr) {
+    RegOpCode op = generic_register_opcode(instr->op);
+    return op == ROP_MOVE || op == ROP_BINARY;
+}
+
+// Field holding the jump target, or -1
+static int target_field(const Instruction* instr) {
+    switch (generic_register_opcode(instr->op)) {
+        case ROP_JUMP:            return 0;
+        case ROP_JUMP_IF_FALSE:   return 1;
+        case ROP_JUMP_UNLESS_CMP: return 2;
+        default:                  return -1;
+    }
+}
+
+static bool ends_block(const Instruction* instr) {
+    RegOpCode op = generic_register_opcode(instr->op);
+    return target_field(instr) >= 0 || op == ROP_FAIL || op == ROP_HALT;
+}
+
+static bool falls_through(const Instruction* instr) {
+    RegOpCode op = generic_register_opcode(instr->op);
+    return op != ROP_JUMP && op != ROP_FAIL && op != ROP_HALT;
+}
+
+static bool same_constant(RuntimeValue x, RuntimeValue y) {
+    if (x.type != y.type) return false;
+    switch (x.type) {
+        case TYPE_INT64:  return x.val.int64_val == y.val.int64_val;
+        case TYPE_INT32:  return x.val.int32_val == y.val.int32_val;
+        case TYPE_INT:    return x.val.int_val == y.val.int_val;
+        case TYPE_BOOL:   return x.val.bool_val == y.val.bool_val;
+        case TYPE_FLOAT:  return memcmp(&x.val.float_val, &y.val.float_val, sizeof(double)) == 0;
+        case TYPE_STRING: return strcmp(x.val.string_val, y.val.string_val) == 0;
+        default:          return false;
+    }
+}
+
+// --- Values ---
+
+static int new_value(SsaFunction* fn, SsaValueKind kind, int reg) {
+    if (fn->value_count == fn->value_capacity) {
+        int new_capacity = fn->value_capacity == 0 ? 64 : fn->value_capacity * 2;
+        SsaValue* grown = safe_malloc(sizeof(SsaValue) * new_capacity);
+        if (fn->values != NULL) {
+            memcpy(grown, fn->values, sizeof(SsaValue) * fn->value_count);
+            safe_free(fn->values);
+        }
+        fn->values = grown;
+        fn->value_capacity = new_capacity;
+    }
+    SsaValue* value = &fn->values[fn->value_count];
+    memset(value, 0, sizeof(SsaValue));
+    value->kind = kind;
+    value->reg = reg;
+    value->pc = -1;
+    value->block = -1;
+    value->forward = -1;
+    value->lattice = LATTICE_VARYING;
+    value->constant_index = -1;
+    return fn->value_count++;
+}
+
+static int resolve(const SsaFunction* fn, int value) {
+    while (fn->values[value].forward >= 0) value = fn->values[value].forward;
+    return value;
+}
+
+static int entry_value(SsaFunction* fn, int reg) {
+    if (fn->entry_values[reg] < 0) fn->entry_values[reg] = new_value(fn, SSA_ENTRY, reg);
+    return fn->entry_values[reg];
+}
+
+static int block_entry_value(SsaFunction* fn, int b, int reg);
+
+// Value of 'reg' just before instruction 'pc' of block 'b' (pc == end: after the block)
+static int value_before(SsaFunction* fn, int b, int pc, int reg) {
+    for (int q = pc - 1; q >= fn->blocks[b].start; q--) {
+        if (!fn->removed[q] && fn->defs[q] >= 0 && fn->chunk->code[q].a == reg) return resolve(fn, fn->defs[q]);
+    }
+    return block_entry_value(fn, b, reg);
+}
+
+// A phi whose operands are all one value (or itself) is that value
+static int simplify_phi(SsaFunction* fn, int phi) {
+    int same = -1;
+    for (int i = 0; i < fn->values[phi].operand_count; i++) {
+        int operand = resolve(fn, fn->values[phi].operands[i]);
+        if (operand == phi || operand == same) continue;
+        if (same >= 0) return phi;
+        same = operand;
+    }
+    if (same < 0) same = entry_value(fn, fn->values[phi].reg); // Only reachable from itself
+    fn->values[phi].forward = same;
+    return same;
+}
+
+static int block_entry_value(SsaFunction* fn, int b, int reg) {
+    SsaBlock* block = &fn->blocks[b];
+    if (block->entry == NULL) {
+        block->entry = safe_malloc(sizeof(int) * (fn->chunk->register_count + 1));
+        memset(block->entry, -1, sizeof(int) * fn->chunk->register_count);
+    }
+    if (block->entry[reg] >= 0) return resolve(fn, block->entry[reg]);
+
+    // The entry block may be a loop head too (tiered loop chunks), and then
+    // merges the chunk's start with its predecessors
+    int value;
+    int operand_count = block->pred_count + (b == 0 ? 1 : 0);
+    if (operand_count == 1 && b == 0) {
+        value = entry_value(fn, reg);
+    } else if (block->order < 0) {
+        value = entry_value(fn, reg); // Never runs
+    } else if (operand_count == 1) {
+        int pred = block->preds[0];
+        value = value_before(fn, pred, fn->blocks[pred].end, reg);
+    } else {
+        // Recorded before its operands are looked up, which may lead back here
+        int phi = new_value(fn, SSA_PHI, reg);
+        fn->values[phi].block = b;
+        fn->values[phi].operands = safe_malloc(sizeof(int) * operand_count);
+        fn->values[phi].operand_count = operand_count;
+        block->entry[reg] = phi;
+        for (int i = 0; i < operand_count; i++) fn->values[phi].operands[i] = phi;
+        if (b == 0) {
+            int start = entry_value(fn, reg);
+            fn->values[phi].operands[block->pred_count] = start;
+        }
+        for (int i = 0; i < block->pred_count; i++) {
+            int pred = block->preds[i];
+            if (fn->blocks[pred].order < 0) continue; // Never taken
+            int operand = value_before(fn, pred, fn->blocks[pred].end, reg);
+            fn->values[phi].operands[i] = operand;
+        }
+        value = simplify_phi(fn, phi);
+    }
+    block->entry[reg] = value;
+    return value;
+}
+
+// Whether register reg(value) still holds 'value' just before 'pc'
+static bool available(SsaFunction* fn, int value, int pc) {
+    return value_before(fn, fn->block_of[pc], pc, fn->values[value].reg) == value;
+}
+
+// --- Construction ---
+
+static void add_edge(SsaFunction* fn, int from, int to) {
+    SsaBlock* block = &fn->blocks[from];
+    for (int i = 0; i < block->succ_count; i++) {
+        if (block->succs[i] == to) return;
+    }
+    block->succs[block->succ_count++] = to;
+    fn->blocks[to].pred_count++;
+}
+
+static void find_blocks(SsaFunction* fn) {
+    const Chunk* chunk = fn->chunk;
+    int count = chunk->count;
+    bool* leader = safe_malloc(sizeof(bool) * count);
+    memset(leader, 0, sizeof(bool) * count);
+    leader[0] = true;
+    for (int pc = 0; pc < count; pc++) {
+        const Instruction* instr = &chunk->code[pc];
+        int field = target_field(instr);
+        if (field >= 0) {
+            int target = *instruction_field((Instruction*)instr, field);
+            if (target < count) leader[target] = true;
+        }
+        if (ends_block(instr) && pc + 1 < count) leader[pc + 1] = true;
+    }
+
+    for (int pc = 0; pc < count; pc++) {
+        if (leader[pc]) fn->block_count++;
+    }
+    fn->blocks = safe_malloc(sizeof(SsaBlock) * fn->block_count);
+    memset(fn->blocks, 0, sizeof(SsaBlock) * fn->block_count);
+    fn->block_of = safe_malloc(sizeof(int) * count);
+    int b = -1;
+    for (int pc = 0; pc < count; pc++) {
+        if (leader[pc]) {
+            b++;
+            fn->blocks[b].start = pc;
+            fn->blocks[b].order = -1;
+        }
+        fn->blocks[b].end = pc + 1;
+        fn->block_of[pc] = b;
+    }
+    safe_free(leader);
+
+    // Edges (jumps past the last instruction leave the chunk)
+    for (b = 0; b < fn->block_count; b++) {
+        const Instruction* last = &chunk->code[fn->blocks[b].end - 1];
+        if (falls_through(last) && fn->blocks[b].end < count) add_edge(fn, b, b + 1);
+        int field = target_field(last);
+        if (field >= 0) {
+            int target = *instruction_field((Instruction*)last, field);
+            if (target < count) add_edge(fn, b, fn->block_of[target]);
+        }
+    }
+    for (b = 0; b < fn->block_count; b++) {
+        fn->blocks[b].preds = safe_malloc(sizeof(int) * (fn->blocks[b].pred_count + 1));
+        fn->blocks[b].pred_count = 0;
+    }
+    for (b = 0; b < fn->block_count; b++) {
+        for (int i = 0; i < fn->blocks[b].succ_count; i++) {
+            SsaBlock* succ = &fn->blocks[fn->blocks[b].succs[i]];
+            succ->preds[succ->pred_count++] = b;
+        }
+    }
+}
+
+static int intersect(const SsaFunction* fn, int x, int y) {
+    while (x != y) {
+        while (fn->blocks[x].order > fn->blocks[y].order) x = fn->blocks[x].idom;
+        while (fn->blocks[y].order > fn->blocks[x].order) y = fn->blocks[y].idom;
+    }
+    return x;
+}
+
+// Reverse postorder, then dominators (Cooper, Harvey and Kennedy)
+static void find_dominators(SsaFunction* fn) {
+    int n = fn->block_count;
+    int* postorder = safe_malloc(sizeof(int) * n);
+    int* stack = safe_malloc(sizeof(int) * n);
+    int* next_succ = safe_malloc(sizeof(int) * n);
+    bool* visited = safe_malloc(sizeof(bool) * n);
+    memset(visited, 0, sizeof(bool) * n);
+    memset(next_succ, 0, sizeof(int) * n);
+    int depth = 0, visited_count = 0;
+    stack[depth++] = 0;
+    visited[0] = true;
+    while (depth > 0) {
+        int b = stack[depth - 1];
+        if (next_succ[b] < fn->blocks[b].succ_count) {
+            int succ = fn->blocks[b].succs[next_succ[b]++];
+            if (!visited[succ]) {
+                visited[succ] = true;
+                stack[depth++] = succ;
+            }
+        } else {
+            postorder[visited_count++] = b;
+            depth--;
+        }
+    }
+    fn->rpo = safe_malloc(sizeof(int) * (visited_count + 1));
+    fn->rpo_count = visited_count;
+    for (int i = 0; i < visited_count; i++) {
+        fn->rpo[i] = postorder[visited_count - 1 - i];
+        fn->blocks[fn->rpo[i]].order = i;
+    }
+    safe_free(postorder);
+    safe_free(stack);
+    safe_free(next_succ);
+    safe_free(visited);
+
+    for (int b = 0; b < n; b++) fn->blocks[b].idom = -1;
+    fn->blocks[0].idom = 0;
+    bool changed = true;
+    while (changed) {
+        changed = false;
+        for (int i = 1; i < fn->rpo_count; i++) {
+            SsaBlock* block = &fn->blocks[fn->rpo[i]];
+            int idom = -1;
+            for (int p = 0; p < block->pred_count; p++) {
+                int pred = block->preds[p];
+                if (fn->blocks[pred].idom < 0) continue; // Unreachable or not processed yet
+                idom = idom < 0 ? pred : intersect(fn, pred, idom);
+            }
+            if (idom != block->idom) {
+                block->idom = idom;
+                changed = true;
+            }
+        }
+    }
+}
+
+static bool dominates(const SsaFunction* fn, int x, int y) {
+    for (;;) {
+        if (x == y) return true;
+        if (y == 0 || fn->blocks[y].idom < 0) return false;
+        y = fn->blocks[y].idom;
+    }
+}
+
+// Whether instruction 'p' runs before 'q' on every path to 'q'
+static bool instruction_dominates(const SsaFunction* fn, int p, int q) {
+    int bp = fn->block_of[p], bq = fn->block_of[q];
+    return bp == bq ? p < q : dominates(fn, bp, bq);
+}
+
+SsaFunction* ssa_build(Chunk* chunk) {
+    int count = chunk->count;
+    if (count == 0) return NULL;
+    for (int pc = 0; pc < count; pc++) {
+        if (generic_register_opcode(chunk->code[pc].op) > ROP_HALT) return NULL; // Already optimized
+    }
+
+    SsaFunction* fn = safe_malloc(sizeof(SsaFunction));
+    memset(fn, 0, sizeof(SsaFunction));
+    fn->chunk = chunk;
+    fn->defs = safe_malloc(sizeof(int) * count);
+    fn->uses = safe_malloc(sizeof(int[3]) * count);
+    fn->removed = safe_malloc(sizeof(bool) * count);
+    fn->entry_values = safe_malloc(sizeof(int) * (chunk->register_count + 1));
+    memset(fn->defs, -1, sizeof(int) * count);
+    memset(fn->uses, -1, sizeof(int[3]) * count);
+    memset(fn->removed, 0, sizeof(bool) * count);
+    memset(fn->entry_values, -1, sizeof(int) * chunk->register_count);
+    find_blocks(fn);
+    find_dominators(fn);
+
+    // Definitions, and uses of values defined earlier in the same block.
+    // Uses of values from other blocks (-2) need every block's definitions.
+    int* local = safe_malloc(sizeof(int) * (chunk->register_count + 1));
+    memset(local, -1, sizeof(int) * chunk->register_count);
+    for (int b = 0; b < fn->block_count; b++) {
+        for (int pc = fn->blocks[b].start; pc < fn->blocks[b].end; pc++) {
+            Instruction* instr = &chunk->code[pc];
+            for (int field = 0; field < 3; field++) {
+                int operand = *instruction_field(instr, field);
+                if (!reads_field(instr, field) || RK_IS_CONSTANT(operand)) continue;
+                fn->uses[pc][field] = local[operand] >= 0 ? local[operand] : -2;
+            }
+            if (defines_register(instr)) {
+                int value = new_value(fn, SSA_INSTRUCTION, instr->a);
+                fn->values[value].pc = pc;
+                fn->defs[pc] = value;
+                local[instr->a] = value;
+            }
+        }
+        for (int pc = fn->blocks[b].start; pc < fn->blocks[b].end; pc++) {
+            if (fn->defs[pc] >= 0) local[chunk->code[pc].a] = -1;
+        }
+    }
+    safe_free(local);
+
+    for (int pc = 0; pc < count; pc++) {
+        for (int field = 0; field < 3; field++) {
+            if (fn->uses[pc][field] != -2) continue;
+            int reg = *instruction_field(&chunk->code[pc], field);
+            fn->uses[pc][field] = block_entry_value(fn, fn->block_of[pc], reg);
+        }
+    }
+
+    // Phis found trivial only after their users were built
+    bool changed = true;
+    while (changed) {
+        changed = false;
+        for (int v = 0; v < fn->value_count; v++) {
+            if (fn->values[v].kind == SSA_PHI && fn->values[v].forward < 0 && simplify_phi(fn, v) != v) {
+                changed = true;
+            }
+        }
+    }
+    return fn;
+}
+
+// --- Constant propagation ---
+
+// Lattice value of an instruction's operand
+static Lattice operand_lattice(const SsaFunction* fn, int pc, int field, RuntimeValue* constant, int* index) {
+    int operand = *instruction_field(&fn->chunk->code[pc], field);
+    if (RK_IS_CONSTANT(operand)) {
+        *constant = fn->chunk->constants[RK_CONSTANT_INDEX(operand)];
+        *index = RK_CONSTANT_INDEX(operand);
+        return LATTICE_CONSTANT;
+    }
+    const SsaValue* value = &fn->values[resolve(fn, fn->uses[pc][field])];
+    *constant = value->constant;
+    *index = value->constant_index;
+    return value->lattice;
+}
+
+static Lattice evaluate_instruction(const SsaFunction* fn, int pc, RuntimeValue* result, int* index) {
+    const Instruction* instr = &fn->chunk->code[pc];
+    RuntimeValue left, right;
+    int left_index, right_index;
+    if (generic_register_opcode(instr->op) == ROP_MOVE) {
+        Lattice lattice = operand_lattice(fn, pc, 1, result, index);
+        if (lattice == LATTICE_CONSTANT && instr->type != TYPE_VOID && instr->type != result->type) {
+            return LATTICE_VARYING; // A conversion
+        }
+        return lattice;
+    }
+
+    Lattice l = operand_lattice(fn, pc, 1, &left, &left_index);
+    Lattice r = operand_lattice(fn, pc, 2, &right, &right_index);
+    if (l == LATTICE_VARYING || r == LATTICE_VARYING) return LATTICE_VARYING;
+    if (l == LATTICE_TOP || r == LATTICE_TOP) return LATTICE_TOP;
+    *index = -1;
+    if (!evaluate_binary_quietly(instr->binop, left, right, result)) return LATTICE_VARYING;
+    if (instr->type != TYPE_VOID && instr->type != result->type) return LATTICE_VARYING;
+    return LATTICE_CONSTANT;
+}
+
+static Lattice meet_phi(const SsaFunction* fn, int phi, RuntimeValue* result, int* index) {
+    Lattice lattice = LATTICE_TOP;
+    for (int i = 0; i < fn->values[phi].operand_count; i++) {
+        const SsaValue* operand = &fn->values[resolve(fn, fn->values[phi].operands[i])];
+        if (operand->lattice == LATTICE_TOP) continue;
+        if (operand->lattice == LATTICE_VARYING) return LATTICE_VARYING;
+        if (lattice == LATTICE_CONSTANT) {
+            if (!same_constant(*result, operand->constant)) return LATTICE_VARYING;
+            continue;
+        }
+        lattice = LATTICE_CONSTANT;
+        *result = operand->constant;
+        *index = operand->constant_index;
+    }
+    return lattice;
+}
+
+// Chunk constant holding a value's constant, added on first use
+static int constant_index(SsaFunction* fn, int v) {
+    if (fn->values[v].constant_index < 0) {
+        fn->values[v].constant_index = chunk_add_constant(fn->chunk, fn->values[v].constant);
+    }
+    return fn->values[v].constant_index;
+}
+
+// Values whose lattice is computed from 'value' (its phi operands, or the
+// operands its instruction reads), as resolved when the pass starts
+static int value_inputs(const SsaFunction* fn, int value, int* inputs) {
+    const SsaValue* v = &fn->values[value];
+    int count = 0;
+    if (v->kind == SSA_PHI) {
+        for (int i = 0; i < v->operand_count; i++) inputs[count++] = resolve(fn, v->operands[i]);
+    } else if (v->kind == SSA_INSTRUCTION) {
+        for (int field = 1; field < 3; field++) {
+            if (fn->uses[v->pc][field] >= 0) inputs[count++] = resolve(fn, fn->uses[v->pc][field]);
+        }
+    }
+    return count;
+}
+
+// Sparse-conditional style: every value starts at TOP and only moves down,
+// so loops whose variables keep their initial value fold as well. A value is
+// re-evaluated only when one of its inputs moves, so each is visited a few
+// times however deeply the chunk's loops nest.
+int ssa_propagate_constants(SsaFunction* fn) {
+    int value_count = fn->value_count;
+    if (value_count == 0) return 0; // Nothing read from registers
+    for (int v = 0; v < value_count; v++) {
+        fn->values[v].lattice = fn->values[v].kind == SSA_ENTRY ? LATTICE_VARYING : LATTICE_TOP;
+    }
+
+    // Users of each value, grouped by value: first[v] .. first[v + 1]
+    int* first = safe_malloc(sizeof(int) * (value_count + 1));
+    memset(first, 0, sizeof(int) * (value_count + 1));
+    int input_capacity = 2;
+    for (int v = 0; v < value_count; v++) {
+        if (fn->values[v].kind == SSA_PHI && fn->values[v].operand_count > input_capacity) {
+            input_capacity = fn->values[v].operand_count;
+        }
+    }
+    int* inputs = safe_malloc(sizeof(int) * input_capacity);
+    for (int v = 0; v < value_count; v++) {
+        if (fn->values[v].forward >= 0) continue;
+        int count = value_inputs(fn, v, inputs);
+        for (int i = 0; i < count; i++) first[inputs[i] + 1]++;
+    }
+    for (int v = 0; v < value_count; v++) first[v + 1] += first[v];
+    int* users = safe_malloc(sizeof(int) * (first[value_count] > 0 ? first[value_count] : 1));
+    int* filled = safe_malloc(sizeof(int) * value_count);
+    memcpy(filled, first, sizeof(int) * value_count);
+    for (int v = 0; v < value_count; v++) {
+        if (fn->values[v].forward >= 0) continue;
+        int count = value_inputs(fn, v, inputs);
+        for (int i = 0; i < count; i++) users[filled[inputs[i]]++] = v;
+    }
+
+    int* worklist = safe_malloc(sizeof(int) * value_count);
+    bool* queued = safe_malloc(sizeof(bool) * value_count);
+    int size = 0;
+    for (int v = value_count - 1; v >= 0; v--) {
+        const SsaValue* value = &fn->values[v];
+        queued[v] = value->forward < 0 && value->kind != SSA_ENTRY;
+        if (queued[v]) worklist[size++] = v;
+    }
+    while (size > 0) {
+        int v = worklist[--size];
+        queued[v] = false;
+        SsaValue* value = &fn->values[v];
+        if (value->lattice == LATTICE_VARYING) continue;
+        RuntimeValue constant = value->constant;
+        int index = -1;
+        Lattice lattice = value->kind == SSA_PHI ? meet_phi(fn, v, &constant, &index)
+                                                 : evaluate_instruction(fn, value->pc, &constant, &index);
+        if (lattice == value->lattice) continue;
+        value->lattice = lattice;
+        value->constant = constant;
+        value->constant_index = index;
+        for (int i = first[v]; i < first[v + 1]; i++) {
+            if (!queued[users[i]]) {
+                queued[users[i]] = true;
+                worklist[size++] = users[i];
+            }
+        }
+    }
+    safe_free(first);
+    safe_free(inputs);
+    safe_free(users);
+    safe_free(filled);
+    safe_free(worklist);
+    safe_free(queued);
+
+    int changes = 0;
+    Chunk* chunk = fn->chunk;
+    for (int pc = 0; pc < chunk->count; pc++) {
+        if (fn->removed[pc]) continue;
+        for (int field = 0; field < 3; field++) {
+            if (fn->uses[pc][field] < 0) continue;
+            int v = resolve(fn, fn->uses[pc][field]);
+            if (fn->values[v].lattice != LATTICE_CONSTANT) continue;
+            *instruction_field(&chunk->code[pc], field) = RK_CONSTANT(constant_index(fn, v));
+            fn->uses[pc][field] = -1;
+            changes++;
+        }
+        int def = fn->defs[pc];
+        if (def >= 0 && generic_register_opcode(chunk->code[pc].op) == ROP_BINARY &&
+            fn->values[def].lattice == LATTICE_CONSTANT) {
+            Instruction* instr = &chunk->code[pc];
+            instr->op = ROP_MOVE;
+            instr->binop = BINOP_NONE;
+            instr->b = RK_CONSTANT(constant_index(fn, def));
+            instr->c = 0;
+            fn->uses[pc][1] = fn->uses[pc][2] = -1;
+            changes++;
+        }
+    }
+    return changes;
+}
+
+// --- Global value numbering ---
+
+static bool same_operand(const SsaFunction* fn, int p, int q, int field) {
+    int x = *instruction_field(&fn->chunk->code[p], field);
+    int y = *instruction_field(&fn->chunk->code[q], field);
+    if (RK_IS_CONSTANT(x) || RK_IS_CONSTANT(y)) {
+        return RK_IS_CONSTANT(x) && RK_IS_CONSTANT(y) &&
+               same_constant(fn->chunk->constants[RK_CONSTANT_INDEX(x)], fn->chunk->constants[RK_CONSTANT_INDEX(y)]);
+    }
+    return resolve(fn, fn->uses[p][field]) == resolve(fn, fn->uses[q][field]);
+}
+
+static unsigned operand_hash(const SsaFunction* fn, int pc, int field) {
+    int operand = *instruction_field(&fn->chunk->code[pc], field);
+    if (!RK_IS_CONSTANT(operand)) return (unsigned)resolve(fn, fn->uses[pc][field]) * 2654435761u;
+    RuntimeValue constant = fn->chunk->constants[RK_CONSTANT_INDEX(operand)];
+    if (constant.type == TYPE_INT64) return (unsigned)constant.val.int64_val ^ 0x9e3779b9u;
+    return (unsigned)constant.type;
+}
+
+// A BINARY computing what a dominating BINARY already left in a register
+// becomes a MOVE from that register
+int ssa_number_values(SsaFunction* fn) {
+    Chunk* chunk = fn->chunk;
+    int bucket_count = 64;
+    while (bucket_count < chunk->count) bucket_count *= 2;
+    int* buckets = safe_malloc(sizeof(int) * bucket_count);
+    int* next = safe_malloc(sizeof(int) * chunk->count);
+    memset(buckets, -1, sizeof(int) * bucket_count);
+
+    int changes = 0;
+    for (int i = 0; i < fn->rpo_count; i++) {
+        const SsaBlock* block = &fn->blocks[fn->rpo[i]];
+        for (int pc = block->start; pc < block->end; pc++) {
+            Instruction* instr = &chunk->code[pc];
+            if (fn->removed[pc] || generic_register_opcode(instr->op) != ROP_BINARY) continue;
+            unsigned hash = (unsigned)instr->binop * 31u + (unsigned)instr->type;
+            hash = hash * 17u + operand_hash(fn, pc, 1);
+            hash = hash * 17u + operand_hash(fn, pc, 2);
+            int bucket = (int)(hash & (unsigned)(bucket_count - 1));
+
+            int match = -1;
+            for (int q = buckets[bucket]; q >= 0; q = next[q]) {
+                const Instruction* other = &chunk->code[q];
+                if (other->binop != instr->binop || other->type != instr->type) continue;
+                if (!same_operand(fn, pc, q, 1) || !same_operand(fn, pc, q, 2)) continue;
+                if (!instruction_dominates(fn, q, pc) || !available(fn, fn->defs[q], pc)) continue;
+                match = q;
+                break;
+            }
+            if (match < 0) {
+                next[pc] = buckets[bucket];
+                buckets[bucket] = pc;
+                continue;
+            }
+            int value = fn->defs[match];
+            instr->op = ROP_MOVE;
+            instr->binop = BINOP_NONE;
+            instr->type = TYPE_VOID; // Already converted
+            instr->b = fn->values[value].reg;
+            instr->c = 0;
+            fn->uses[pc][1] = value;
+            fn->uses[pc][2] = -1;
+            changes++;
+        }
+    }
+    safe_free(buckets);
+    safe_free(next);
+    return changes;
+}
+
+// --- Copy propagation ---
+
+// An operand reading a plain MOVE's result reads the MOVE's source instead,
+// when the source is a constant or its register still holds it
+int ssa_propagate_copies(SsaFunction* fn) {
+    Chunk* chunk = fn->chunk;
+    int changes = 0;
+    for (int pc = 0; pc < chunk->count; pc++) {
+        if (fn->removed[pc]) continue;
+        for (int field = 0; field < 3; field++) {
+            if (fn->uses[pc][field] < 0) continue;
+            int value = resolve(fn, fn->uses[pc][field]);
+            while (fn->values[value].kind == SSA_INSTRUCTION) {
+                int source_pc = fn->values[value].pc;
+                const Instruction* copy = &chunk->code[source_pc];
+                if (generic_register_opcode(copy->op) != ROP_MOVE || copy->type != TYPE_VOID) break;
+                if (RK_IS_CONSTANT(copy->b)) {
+                    *instruction_field(&chunk->code[pc], field) = copy->b;
+                    fn->uses[pc][field] = -1;
+                    changes++;
+                    break;
+                }
+                int source = resolve(fn, fn->uses[source_pc][1]);
+                if (!available(fn, source, pc)) break;
+                *instruction_field(&chunk->code[pc], field) = fn->values[source].reg;
+                fn->uses[pc][field] = source;
+                changes++;
+                value = source;
+            }
+        }
+    }
+    return changes;
+}
+
+// --- Dead code elimination ---
+
+static void mark_live(SsaFunction* fn, int v, int* worklist, int* size) {
+    v = resolve(fn, v);
+    if (fn->values[v].live) return;
+    fn->values[v].live = true;
+    worklist[(*size)++] = v;
+}
+
+// Plain MOVEs into temporaries nothing reads, and MOVEs of a register onto
+// itself. Only sources known to be defined qualify: reading an undefined
+// variable is an error the program must still report.
+int ssa_eliminate_dead_code(SsaFunction* fn) {
+    Chunk* chunk = fn->chunk;
+    for (int v = 0; v < fn->value_count; v++) {
+        fn->values[v].defined = fn->values[v].kind != SSA_ENTRY;
+    }
+    bool changed = true;
+    while (changed) {
+        changed = false;
+        for (int v = 0; v < fn->value_count; v++) {
+            SsaValue* value = &fn->values[v];
+            if (value->kind != SSA_PHI || value->forward >= 0 || !value->defined) continue;
+            for (int i = 0; i < value->operand_count; i++) {
+                if (!fn->values[resolve(fn, value->operands[i])].defined) {
+                    value->defined = false;
+                    changed = true;
+                    break;
+                }
+            }
+        }
+    }
+
+    int removed = 0;
+    int* worklist = NULL;
+    int worklist_capacity = 0;
+    for (;;) {
+        if (worklist_capacity < fn->value_count) {
+            safe_free(worklist);
+            worklist_capacity = fn->value_count;
+            worklist = safe_malloc(sizeof(int) * worklist_capacity);
+        }
+        int size = 0;
+        for (int v = 0; v < fn->value_count; v++) fn->values[v].live = false;
+        for (int pc = 0; pc < chunk->count; pc++) {
+            if (fn->removed[pc]) continue;
+            for (int field = 0; field < 3; field++) {
+                if (fn->uses[pc][field] >= 0) mark_live(fn, fn->uses[pc][field], worklist, &size);
+            }
+        }
+        while (size > 0) {
+            const SsaValue* value = &fn->values[worklist[--size]];
+            if (value->kind != SSA_PHI) continue;
+            int* operands = value->operands;
+            int operand_count = value->operand_count;
+            for (int i = 0; i < operand_count; i++) mark_live(fn, operands[i], worklist, &size);
+        }
+
+        int removed_now = 0;
+        for (int pc = 0; pc < chunk->count; pc++) {
+            const Instruction* instr = &chunk->code[pc];
+            if (fn->removed[pc] || generic_register_opcode(instr->op) != ROP_MOVE || instr->type != TYPE_VOID) continue;
+            int source = RK_IS_CONSTANT(instr->b) ? -1 : resolve(fn, fn->uses[pc][1]);
+            if (source >= 0 && !fn->values[source].defined) continue;
+            if (instr->a >= chunk->slot_count && !fn->values[fn->defs[pc]].live) {
+                fn->removed[pc] = true;
+                removed_now++;
+            } else if (source >= 0 && instr->b == instr->a) {
+                fn->removed[pc] = true;
+                fn->values[fn->defs[pc]].forward = source;
+                removed_now++;
+            }
+        }
+        removed += removed_now;
+        if (removed_now == 0) break;
+    }
+    safe_free(worklist);
+    return removed;
+}
+
+// --- Lowering ---
+
+// Write the IR back: drop removed instructions, retarget jumps and deopt
+// points, and free the IR. Returns the number of instructions dropped.
+int ssa_lower(SsaFunction* fn) {
+    Chunk* chunk = fn->chunk;
+    int count = chunk->count;
+    int* new_pc = safe_malloc(sizeof(int) * (count + 1));
+    int out = 0;
+    for (int pc = 0; pc < count; pc++) {
+        new_pc[pc] = out;
+        if (fn->removed[pc]) continue;
+        chunk->sites[out] = chunk->sites[pc];
+        chunk->code[out++] = chunk->code[pc];
+    }
+    new_pc[count] = out;
+    for (int pc = 0; pc < count; pc++) {
+        if (fn->removed[pc]) continue;
+        Instruction* instr = &chunk->code[new_pc[pc]];
+        int field = target_field(instr);
+        if (field >= 0) {
+            int* target = instruction_field(instr, field);
+            *target = new_pc[*target < count ? *target : count];
+        }
+    }
+
+    int kept = 0;
+    for (int i = 0; i < chunk->deopt_count; i++) {
+        DeoptPoint point = chunk->deopt_points[i];
+        if (fn->removed[point.pc]) {
+            safe_free(point.path);
+            continue;
+        }
+        point.pc = new_pc[point.pc];
+        chunk->deopt_points[kept++] = point;
+    }
+    chunk->deopt_count = kept;
+    chunk->count = out;
+    safe_free(new_pc);
+
+    for (int b = 0; b < fn->block_count; b++) {
+        safe_free(fn->blocks[b].preds);
+        safe_free(fn->blocks[b].entry);
+    }
+    for (int v = 0; v < fn->value_count; v++) {
+        safe_free(fn->values[v].operands);
+    }
+    safe_free(fn->blocks);
+    safe_free(fn->block_of);
+    safe_free(fn->defs);
+    safe_free(fn->uses);
+    safe_free(fn->removed);
+    safe_free(fn->values);
+    safe_free(fn->entry_values);
+    safe_free(fn->rpo);
+    safe_free(fn);
+    return count - out;
+}
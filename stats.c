@@ -0,0 +1,124 @@
+#include "compiler.h"
+#include "vm.h"
+#include <stdio.h>
+#include <string.h>
+#ifdef __GLIBC__
+#include <malloc.h>
+#endif
+
+// Execution statistics for --stats: how often each kind of node is
+// evaluated, which operator and operand type combinations binary operations
+// see, how long symbol table searches are, and how much safe_malloc and
+// safe_free are called in each phase.
+//
+// The counting sites are the STAT_* macros in compiler.h: a flag test and an
+// increment when compiled in, nothing at all with -DZR_NO_STATS. Operations
+// that JIT-compiled code does inline aren't counted; its slow paths are.
+
+#ifndef ZR_NO_STATS
+bool stats_enabled = false;
+ExecutionStats stats;
+int stats_phase = STATS_OTHER_PHASE;
+
+// Bytes are only known for frees where the C library can tell the size
+void stats_count_free(void* ptr) {
+    stats.frees[stats_phase]++;
+#ifdef __GLIBC__
+    stats.freed_bytes[stats_phase] += malloc_usable_size(ptr);
+#else
+    (void)ptr;
+#endif
+}
+#endif
+
+static const char* const node_type_names[NODE_LOADIN + 1] = {
+    [NODE_NUMBER] = "number",
+    [NODE_STRING] = "string",
+    [NODE_BOOL] = "bool",
+    [NODE_IDENT] = "identifier",
+    [NODE_BINARY] = "binary",
+    [NODE_UNARY] = "unary",
+    [NODE_LET] = "let",
+    [NODE_IF] = "if",
+    [NODE_WHILE] = "while",
+    [NODE_BLOCK] = "block",
+    [NODE_PRINT] = "print",
+    [NODE_FUNC] = "func",
+    [NODE_CALL] = "call",
+    [NODE_RETURN] = "return",
+    [NODE_LOADIN] = "loadin",
+};
+
+void set_stats(bool enabled) {
+#ifndef ZR_NO_STATS
+    stats_enabled = enabled;
+#else
+    if (enabled) {
+        fprintf(stderr, "Warning: --stats ignored; this build has no statistics (ZR_NO_STATS)\n");
+    }
+#endif
+}
+
+// The --stats report (a no-op unless set_stats was called)
+void report_stats(FILE* out) {
+#ifndef ZR_NO_STATS
+    if (!stats_enabled) return;
+    stats_enabled = false; // Don't count the report itself
+
+    fprintf(out, "=== Execution statistics ===\n");
+    fprintf(out, "Node evaluations (AST walker):\n");
+    unsigned long total = 0;
+    for (int type = 0; type <= NODE_LOADIN; type++) {
+        if (stats.evaluations[type] == 0) continue;
+        fprintf(out, "  %-12s %14lu\n", node_type_names[type], stats.evaluations[type]);
+        total += stats.evaluations[type];
+    }
+    fprintf(out, "  %-12s %14lu\n", "total", total);
+
+    fprintf(out, "Binary operations:\n");
+    for (int op = 0; op <= BINOP_OR; op++) {
+        for (int left = 0; left <= TYPE_ERROR; left++) {
+            for (int right = 0; right <= TYPE_ERROR; right++) {
+                unsigned long count = stats.binary_ops[op][left][right];
+                if (count == 0) continue;
+                fprintf(out, "  %-7s %-2s %-7s %14lu\n", get_type_name((DataType)left),
+                        binary_op_text((BinaryOp)op), get_type_name((DataType)right), count);
+            }
+        }
+    }
+
+    fprintf(out, "Symbol lookups: %lu, %.2f entries compared on average, %lu not found\n",
+            stats.lookups, stats.lookups > 0 ? (double)stats.lookup_probes / stats.lookups : 0.0,
+            stats.lookup_misses);
+
+    fprintf(out, "Allocations:\n");
+    fprintf(out, "  %-10s %12s %14s %12s", "phase", "mallocs", "bytes", "frees");
+#ifdef __GLIBC__
+    fprintf(out, " %14s", "bytes freed");
+#endif
+    fprintf(out, "\n");
+    ExecutionStats sums;
+    memset(&sums, 0, sizeof(sums));
+    for (int phase = 0; phase <= STATS_OTHER_PHASE + 1; phase++) {
+        bool is_total = phase == STATS_OTHER_PHASE + 1;
+        const ExecutionStats* row = is_total ? &sums : &stats;
+        int index = is_total ? 0 : phase;
+        if (!is_total) {
+            sums.allocations[0] += stats.allocations[phase];
+            sums.allocated_bytes[0] += stats.allocated_bytes[phase];
+            sums.frees[0] += stats.frees[phase];
+            sums.freed_bytes[0] += stats.freed_bytes[phase];
+        }
+        const char* name = is_total ? "total" : phase == STATS_OTHER_PHASE ? "other" : phase_name((Phase)phase);
+        fprintf(out, "  %-10s %12lu %14lu %12lu", name, row->allocations[index], row->allocated_bytes[index],
+                row->frees[index]);
+#ifdef __GLIBC__
+        fprintf(out, " %14lu", row->freed_bytes[index]);
+#endif
+        fprintf(out, "\n");
+    }
+#else
+    (void)out;
+    (void)node_type_names;
+#endif
+}
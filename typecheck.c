@@ -0,0 +1,537 @@
+#include "compiler.h"
+#include "debug.h"
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>    // For ERANGE with strtoll
+
+// Static type checking and inference.
+//
+// check_types() walks a module's statements in execution order and tracks the
+// static type of every variable. Each expression node gets its type stored in
+// node->data_type; TYPE_VOID there means "not known statically" (for example a
+// variable that is bound to different types in the two arms of an if), in which
+// case the interpreter keeps checking it at runtime.
+//
+// Variables live in one flat namespace at runtime (blocks don't introduce
+// scopes), so the environment here is flat as well and persists across modules:
+// a module loaded with 'loadin' is checked before the file that loads it.
+
+typedef struct {
+    char* name;
+    DataType type; // TYPE_VOID: bound, but type depends on the path taken
+} TypeBinding;
+
+struct TypeEnv {
+    TypeBinding* bindings;
+    int count;
+    int capacity;
+};
+
+// The CLI's environment, or that of the libzr context this thread is running
+static TypeEnv default_type_env = { NULL, 0, 0 };
+static __thread TypeEnv* global_type_env = &default_type_env;
+static __thread int type_error_count = 0;
+static __thread bool type_errors_quiet = false; // Set while a loop is checked to find its fixpoint
+
+static void report_type_error(const char* format, ...) __attribute__((format(printf, 1, 2)));
+
+static void report_type_error(const char* format, ...) {
+    if (type_errors_quiet) return;
+    va_list args;
+    va_start(args, format);
+    fprintf(DIAGNOSTICS, "Type Error: ");
+    vfprintf(DIAGNOSTICS, format, args);
+    fprintf(DIAGNOSTICS, "\n");
+    va_end(args);
+    type_error_count++;
+}
+
+static TypeBinding* env_lookup(TypeEnv* env, const char* name) {
+    for (int i = 0; i < env->count; i++) {
+        if (strcmp(env->bindings[i].name, name) == 0) {
+            return &env->bindings[i];
+        }
+    }
+    return NULL;
+}
+
+static void env_bind(TypeEnv* env, const char* name, DataType type) {
+    TypeBinding* existing = env_lookup(env, name);
+    if (existing != NULL) {
+        existing->type = type;
+        return;
+    }
+    if (env->count == env->capacity) {
+        int new_capacity = env->capacity == 0 ? 16 : env->capacity * 2;
+        TypeBinding* grown = safe_malloc(sizeof(TypeBinding) * new_capacity);
+        if (env->bindings != NULL) {
+            memcpy(grown, env->bindings, sizeof(TypeBinding) * env->count);
+            safe_free(env->bindings);
+        }
+        env->bindings = grown;
+        env->capacity = new_capacity;
+    }
+    env->bindings[env->count].name = safe_strdup(name);
+    env->bindings[env->count].type = type;
+    env->count++;
+}
+
+static void env_clone(TypeEnv* dst, const TypeEnv* src) {
+    dst->bindings = NULL;
+    dst->count = 0;
+    dst->capacity = 0;
+    for (int i = 0; i < src->count; i++) {
+        env_bind(dst, src->bindings[i].name, src->bindings[i].type);
+    }
+}
+
+static void env_free(TypeEnv* env) {
+    for (int i = 0; i < env->count; i++) {
+        safe_free(env->bindings[i].name);
+    }
+    safe_free(env->bindings);
+    env->bindings = NULL;
+    env->count = 0;
+    env->capacity = 0;
+}
+
+// Replace 'dst' with the join of two branch environments: a variable keeps its
+// type only if both branches agree on it; otherwise it becomes dynamic.
+static void env_merge(TypeEnv* dst, TypeEnv* then_env, TypeEnv* else_env) {
+    TypeEnv merged = { NULL, 0, 0 };
+    for (int i = 0; i < then_env->count; i++) {
+        TypeBinding* other = env_lookup(else_env, then_env->bindings[i].name);
+        DataType type = (other != NULL && other->type == then_env->bindings[i].type)
+            ? then_env->bindings[i].type : TYPE_VOID;
+        env_bind(&merged, then_env->bindings[i].name, type);
+    }
+    for (int i = 0; i < else_env->count; i++) {
+        if (env_lookup(then_env, else_env->bindings[i].name) == NULL) {
+            env_bind(&merged, else_env->bindings[i].name, TYPE_VOID);
+        }
+    }
+    env_free(dst);
+    *dst = merged;
+}
+
+static bool env_equal(TypeEnv* a, TypeEnv* b) {
+    if (a->count != b->count) return false;
+    for (int i = 0; i < a->count; i++) {
+        TypeBinding* other = env_lookup(b, a->bindings[i].name);
+        if (other == NULL || other->type != a->bindings[i].type) return false;
+    }
+    return true;
+}
+
+static bool is_integer_type(DataType type) {
+    return type == TYPE_INT || type == TYPE_INT32 || type == TYPE_INT64;
+}
+
+static bool is_numeric_type(DataType type) {
+    return is_integer_type(type) || type == TYPE_FLOAT;
+}
+
+// Can a value of type 'right' be stored in a variable declared as 'left'?
+// Mirrors the conversions evaluate_let performs; int64 -> int32 narrowing is
+// allowed here and range-checked on the actual value.
+bool is_compatible_type(DataType left, DataType right) {
+    if (left == right) return true;
+    switch (left) {
+        case TYPE_FLOAT:
+            return is_numeric_type(right);
+        case TYPE_INT64:
+        case TYPE_INT32:
+            return is_integer_type(right);
+        default:
+            return false;
+    }
+}
+
+// Result type of an arithmetic operator on two statically known operand types,
+// or TYPE_ERROR if the combination is rejected at runtime.
+static DataType arithmetic_result_type(DataType left, DataType right) {
+    if (left == TYPE_INT32 && right == TYPE_INT32) return TYPE_INT32;
+    if (is_integer_type(left) && is_integer_type(right)) return TYPE_INT64;
+    if (is_numeric_type(left) && is_numeric_type(right)) return TYPE_FLOAT;
+    return TYPE_ERROR;
+}
+
+static DataType check_node(ASTNode* node, TypeEnv* env);
+
+static DataType check_binary(ASTNode* node, TypeEnv* env) {
+    DataType left = check_node(node->left, env);
+    DataType right = check_node(node->right, env);
+    const char* op = node->value.string_val ? node->value.string_val : "?";
+
+    if (left == TYPE_ERROR || right == TYPE_ERROR) return TYPE_ERROR;
+
+    bool known = (left != TYPE_VOID && right != TYPE_VOID);
+    DataType result = TYPE_VOID;
+
+    switch (node->op) {
+        case BINOP_ADD:
+        case BINOP_SUB:
+        case BINOP_MUL:
+        case BINOP_DIV:
+            if (!known) {
+                // Numeric either way; the exact type depends on the dynamic operand.
+                if ((left != TYPE_VOID && !is_numeric_type(left)) || (right != TYPE_VOID && !is_numeric_type(right))) {
+                    report_type_error("Operands for arithmetic operator '%s' must be numbers (got %s and %s).",
+                                      op, get_type_name(left), get_type_name(right));
+                    return TYPE_ERROR;
+                }
+                return TYPE_VOID;
+            }
+            result = arithmetic_result_type(left, right);
+            if (result == TYPE_ERROR) {
+                report_type_error("Operands for arithmetic operator '%s' must be numbers (got %s and %s).",
+                                  op, get_type_name(left), get_type_name(right));
+            }
+            break;
+        case BINOP_GT:
+        case BINOP_LT:
+        case BINOP_EQ:
+        case BINOP_LTEQ:
+        case BINOP_GTEQ:
+        case BINOP_NOTEQ:
+            result = TYPE_BOOL;
+            if (known && !(is_numeric_type(left) && is_numeric_type(right)) &&
+                !(left == TYPE_STRING && right == TYPE_STRING && (node->op == BINOP_EQ || node->op == BINOP_NOTEQ))) {
+                report_type_error("Operands for comparison operator '%s' are incompatible (%s, %s).",
+                                  op, get_type_name(left), get_type_name(right));
+                result = TYPE_ERROR;
+            }
+            break;
+        case BINOP_AND:
+        case BINOP_OR:
+            result = TYPE_BOOL;
+            if ((left != TYPE_VOID && left != TYPE_BOOL) || (right != TYPE_VOID && right != TYPE_BOOL)) {
+                report_type_error("Operands for logical operator '%s' must be booleans (got %s and %s).",
+                                  op, get_type_name(left), get_type_name(right));
+                result = TYPE_ERROR;
+            }
+            break;
+        default:
+            report_type_error("Operator '%s' is not a binary operator.", op);
+            result = TYPE_ERROR;
+            break;
+    }
+
+    // Both operand types are fixed, so the node can start out specialized.
+    if (result != TYPE_ERROR && known && node->quick == QUICK_NONE && !type_errors_quiet) {
+        node->quick = select_binary_quick_kind(node->op, left, right);
+    }
+    return result;
+}
+
+// Check an explicit annotation against the inferred type of its initializer.
+// Integer literals are retyped to the declared type so the interpreter produces
+// the declared representation directly instead of converting at runtime.
+static DataType check_let_annotation(ASTNode* node, DataType declared, DataType actual) {
+    ASTNode* init = node->left;
+
+    if (actual == TYPE_VOID) return declared; // Converted and checked at runtime
+
+    if (!is_compatible_type(declared, actual)) {
+        report_type_error("Cannot assign expression of type %s to variable '%s' of declared type %s.",
+                          get_type_name(actual), node->value.string_val, get_type_name(declared));
+        return TYPE_ERROR;
+    }
+
+    if (init->type == NODE_NUMBER && is_integer_type(actual)) {
+        if (declared == TYPE_INT32) {
+            char* endptr;
+            errno = 0;
+            long long literal = strtoll(init->value.string_val, &endptr, 10);
+            if (errno == ERANGE || literal < INT32_MIN || literal > INT32_MAX) {
+                report_type_error("Value %s for variable '%s' overflows declared type int32.",
+                                  init->value.string_val, node->value.string_val);
+                return TYPE_ERROR;
+            }
+            init->data_type = TYPE_INT32;
+        } else if (declared == TYPE_FLOAT) {
+            init->data_type = TYPE_FLOAT;
+        }
+    }
+    return declared;
+}
+
+static DataType check_let(ASTNode* node, TypeEnv* env) {
+    if (node->value.string_val == NULL || node->left == NULL) {
+        return TYPE_VOID; // Malformed; evaluate_let reports it
+    }
+
+    DataType actual = check_node(node->left, env);
+    DataType bound = actual;
+    if (actual != TYPE_ERROR && node->explicit_type != TYPE_VOID) {
+        bound = check_let_annotation(node, node->explicit_type, actual);
+    }
+
+    if (actual == TYPE_ERROR || bound == TYPE_ERROR) {
+        // Keep the declared type (if any) so later uses don't cascade errors.
+        env_bind(env, node->value.string_val, node->explicit_type);
+        node->data_type = node->explicit_type;
+        return TYPE_ERROR;
+    }
+    env_bind(env, node->value.string_val, bound);
+    node->data_type = bound;
+    return TYPE_VOID;
+}
+
+static DataType check_block(ASTNode* node, TypeEnv* env) {
+    DataType result = TYPE_VOID;
+    for (int i = 0; i < node->statement_count; i++) {
+        if (node->statements[i] != NULL && check_node(node->statements[i], env) == TYPE_ERROR) {
+            result = TYPE_ERROR;
+        }
+    }
+    return result;
+}
+
+static DataType check_if(ASTNode* node, TypeEnv* env) {
+    DataType result = TYPE_VOID;
+    DataType condition = check_node(node->condition, env);
+    if (condition == TYPE_ERROR) {
+        result = TYPE_ERROR;
+    } else if (condition != TYPE_VOID && condition != TYPE_BOOL) {
+        report_type_error("If statement condition must be a boolean (got %s).", get_type_name(condition));
+        result = TYPE_ERROR;
+    }
+
+    TypeEnv then_env;
+    TypeEnv else_env;
+    env_clone(&then_env, env);
+    env_clone(&else_env, env);
+    if (node->body != NULL && check_node(node->body, &then_env) == TYPE_ERROR) result = TYPE_ERROR;
+    if (node->else_body != NULL && check_node(node->else_body, &else_env) == TYPE_ERROR) result = TYPE_ERROR;
+    env_merge(env, &then_env, &else_env);
+    env_free(&then_env);
+    env_free(&else_env);
+    return result;
+}
+
+// The body of a loop can run any number of times, so the environment at the
+// loop head is the join of the one on entry and the one after each iteration.
+// The outermost loop of a nest finds those joins for every loop in it at
+// once: it re-checks its body quietly, each nested loop's body once per pass,
+// until no loop head changes, then a final pass reports errors (once) against
+// the stable environments. Nested loops keep their head between passes in
+// loop_heads, by the order the passes reach them (always the same), so a
+// nest costs a few passes in all rather than a few per level of nesting.
+typedef struct {
+    const ASTNode* loop;
+    TypeEnv head;
+} LoopHead;
+
+static __thread struct {
+    LoopHead* heads;
+    int count;
+    int capacity;
+    int next;     // Slot of the next loop the current pass reaches
+    bool changed; // A head widened during the current pass
+    bool active;  // Inside the outermost loop of a nest
+} loop_heads = { NULL, 0, 0, 0, false, false };
+
+// The head of the next loop this pass reaches, joined with 'entry'
+static LoopHead* enter_loop_head(const ASTNode* node, TypeEnv* entry) {
+    int slot = loop_heads.next++;
+    if (slot == loop_heads.count) {
+        if (loop_heads.count == loop_heads.capacity) {
+            int new_capacity = loop_heads.capacity == 0 ? 16 : loop_heads.capacity * 2;
+            LoopHead* grown = safe_malloc(sizeof(LoopHead) * new_capacity);
+            if (loop_heads.heads != NULL) {
+                memcpy(grown, loop_heads.heads, sizeof(LoopHead) * loop_heads.count);
+                safe_free(loop_heads.heads);
+            }
+            loop_heads.heads = grown;
+            loop_heads.capacity = new_capacity;
+        }
+        loop_heads.heads[slot].loop = node;
+        env_clone(&loop_heads.heads[slot].head, entry);
+        loop_heads.count++;
+        loop_heads.changed = true;
+        return &loop_heads.heads[slot];
+    }
+    LoopHead* head = &loop_heads.heads[slot];
+    if (head->loop != node) { // Not reached in the same order; start over from here
+        head->loop = node;
+        env_free(&head->head);
+        env_clone(&head->head, entry);
+        loop_heads.changed = true;
+        return head;
+    }
+    TypeEnv joined = { NULL, 0, 0 };
+    env_merge(&joined, &head->head, entry);
+    if (!env_equal(&joined, &head->head)) loop_heads.changed = true;
+    env_free(&head->head);
+    head->head = joined;
+    return head;
+}
+
+// One pass over a loop: its body from the head, whose join with the body's
+// result is where the loop exits to
+static DataType check_loop_pass(ASTNode* node, TypeEnv* env) {
+    int slot = enter_loop_head(node, env) - loop_heads.heads;
+    DataType result = TYPE_VOID;
+    DataType condition = check_node(node->condition, &loop_heads.heads[slot].head);
+    if (condition == TYPE_ERROR) {
+        result = TYPE_ERROR;
+    } else if (condition != TYPE_VOID && condition != TYPE_BOOL) {
+        report_type_error("While loop condition must be a boolean (got %s).", get_type_name(condition));
+        result = TYPE_ERROR;
+    }
+
+    TypeEnv body_env;
+    env_clone(&body_env, &loop_heads.heads[slot].head);
+    if (node->body != NULL && check_node(node->body, &body_env) == TYPE_ERROR) result = TYPE_ERROR;
+    // The body may have added loops, moving the heads
+    LoopHead* head = &loop_heads.heads[slot];
+    TypeEnv joined = { NULL, 0, 0 };
+    env_merge(&joined, &head->head, &body_env);
+    if (!env_equal(&joined, &head->head)) loop_heads.changed = true;
+    env_free(&head->head);
+    head->head = joined;
+    env_free(&body_env);
+
+    env_free(env);
+    env_clone(env, &head->head);
+    return result;
+}
+
+static DataType check_while(ASTNode* node, TypeEnv* env) {
+    if (loop_heads.active) return check_loop_pass(node, env);
+
+    loop_heads.active = true;
+    bool was_quiet = type_errors_quiet;
+    type_errors_quiet = true;
+    do {
+        TypeEnv pass_env;
+        env_clone(&pass_env, env);
+        loop_heads.next = 0;
+        loop_heads.changed = false;
+        check_loop_pass(node, &pass_env);
+        env_free(&pass_env);
+    } while (loop_heads.changed);
+    type_errors_quiet = was_quiet;
+
+    loop_heads.next = 0;
+    DataType result = check_loop_pass(node, env);
+    for (int i = 0; i < loop_heads.count; i++) {
+        env_free(&loop_heads.heads[i].head);
+    }
+    safe_free(loop_heads.heads);
+    loop_heads.heads = NULL;
+    loop_heads.count = 0;
+    loop_heads.capacity = 0;
+    loop_heads.active = false;
+    return result;
+}
+
+static DataType check_node(ASTNode* node, TypeEnv* env) {
+    if (node == NULL) return TYPE_VOID;
+
+    switch (node->type) {
+        case NODE_NUMBER:
+            return node->data_type;
+        case NODE_STRING:
+            node->data_type = TYPE_STRING;
+            return TYPE_STRING;
+        case NODE_BOOL:
+            node->data_type = TYPE_BOOL;
+            return TYPE_BOOL;
+        case NODE_IDENT: {
+            TypeBinding* binding = env_lookup(env, node->value.string_val);
+            if (binding == NULL) {
+                report_type_error("Undefined variable '%s'.", node->value.string_val);
+                node->data_type = TYPE_VOID;
+                return TYPE_ERROR;
+            }
+            node->data_type = binding->type;
+            return binding->type;
+        }
+        case NODE_BINARY: {
+            DataType type = check_binary(node, env);
+            node->data_type = (type == TYPE_ERROR) ? TYPE_VOID : type;
+            return type;
+        }
+        case NODE_LET:
+            return check_let(node, env);
+        case NODE_IF:
+            return check_if(node, env);
+        case NODE_WHILE:
+            return check_while(node, env);
+        case NODE_BLOCK:
+            return check_block(node, env);
+        case NODE_PRINT:
+            return check_node(node->left, env) == TYPE_ERROR ? TYPE_ERROR : TYPE_VOID;
+        default:
+            // Other statement kinds are checked dynamically.
+            return TYPE_VOID;
+    }
+}
+
+// Type check one module's code block against the variables bound so far.
+// Returns TYPE_ERROR (after reporting every problem found) if the block is ill-typed.
+DataType check_types(ASTNode* node) {
+    type_error_count = 0;
+    check_node(node, global_type_env);
+    LOG_DEBUG("Type checking finished with %d error(s).", type_error_count);
+    return type_error_count > 0 ? TYPE_ERROR : TYPE_VOID;
+}
+
+// Release the static type environment
+void free_type_checker_memory(void) {
+    env_free(global_type_env);
+}
+
+// The static type of a variable bound so far (TYPE_VOID: it depends on the path taken)
+bool lookup_static_type(const char* name, DataType* type) {
+    TypeBinding* binding = env_lookup(global_type_env, name);
+    if (binding == NULL) return false;
+    *type = binding->type;
+    return true;
+}
+
+// Bind a variable the embedding program has set
+void declare_static_type(const char* name, DataType type) {
+    env_bind(global_type_env, name, type);
+}
+
+// The bindings in the order they were made, for snapshot.c
+int static_type_count(void) {
+    return global_type_env->count;
+}
+
+const char* static_type_at(int index, DataType* type) {
+    *type = global_type_env->bindings[index].type;
+    return global_type_env->bindings[index].name;
+}
+
+TypeEnv* create_type_env(void) {
+    TypeEnv* env = safe_malloc(sizeof(TypeEnv));
+    env->bindings = NULL;
+    env->count = 0;
+    env->capacity = 0;
+    return env;
+}
+
+void free_type_env(TypeEnv* env) {
+    if (env == NULL) return;
+    env_free(env);
+    if (global_type_env == env) global_type_env = &default_type_env;
+    safe_free(env);
+}
+
+// Unbind every variable, keeping the bindings array
+void clear_type_env(TypeEnv* env) {
+    for (int i = 0; i < env->count; i++) {
+        safe_free(env->bindings[i].name);
+    }
+    env->count = 0;
+}
+
+void set_type_env(TypeEnv* env) {
+    global_type_env = env != NULL ? env : &default_type_env;
+}
@@ -0,0 +1,257 @@
+#include "compiler.h"
+#include "vm.h"
+#include "debug.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Stack VM for chunks produced by bytecode.c.
+//
+// Dispatch is direct-threaded with computed goto where available (see the
+// evaluator in interpreter.c), with a switch fallback for -DZR_NO_COMPUTED_GOTO.
+// Building with -DZR_VM_PROFILE counts executed opcode pairs and prints them at
+// exit; that profile is what the superinstructions were picked from.
+
+#if defined(__GNUC__) && !defined(ZR_NO_COMPUTED_GOTO)
+#define ZR_COMPUTED_GOTO 1
+#endif
+
+#ifdef ZR_VM_PROFILE
+static unsigned long opcode_pair_counts[OP_COUNT][OP_COUNT];
+static bool profile_registered = false;
+
+static void dump_opcode_pair_profile(void) {
+    fprintf(stderr, "VM opcode pair profile (previous -> next: count):\n");
+    for (int i = 0; i < OP_COUNT; i++) {
+        for (int j = 0; j < OP_COUNT; j++) {
+            if (opcode_pair_counts[i][j] > 0) {
+                fprintf(stderr, "  %-26s -> %-26s %lu\n", opcode_name(i), opcode_name(j), opcode_pair_counts[i][j]);
+            }
+        }
+    }
+}
+#define PROFILE_PAIR(prev, next) (opcode_pair_counts[(prev)][(next)]++)
+#else
+#define PROFILE_PAIR(prev, next) ((void)0)
+#endif
+
+// Load the chunk's variables from the symbol table. Undefined variables get
+// TYPE_VOID, which no variable can otherwise hold.
+void load_frame(const Chunk* chunk, RuntimeValue* slots) {
+    for (int i = 0; i < chunk->slot_count; i++) {
+        RuntimeValue current;
+        if (lookup_symbol_value(chunk->slot_names[i], &current)) {
+            slots[i] = copy_runtime_value(current);
+        } else {
+            slots[i] = create_void_runtime_value();
+        }
+    }
+}
+
+// Write the slots assigned by the chunk back to the symbol table and release the frame
+void store_frame(const Chunk* chunk, RuntimeValue* slots, const bool* dirty) {
+    for (int i = 0; i < chunk->slot_count; i++) {
+        if (dirty[i]) {
+            set_symbol(chunk->slot_names[i], slots[i]);
+        }
+        release_runtime_value(&slots[i]);
+    }
+}
+
+static bool report_undefined(const Chunk* chunk, int slot) {
+    fprintf(DIAGNOSTICS, "Error: Undefined variable '%s'\n", chunk->slot_names[slot]);
+    return false;
+}
+
+// Run a chunk to completion. Returns a void value, or an error value if a
+// runtime error stopped it (the error has already been reported).
+RuntimeValue run_chunk(Chunk* chunk) {
+#ifdef ZR_COMPUTED_GOTO
+    static void* dispatch_table[OP_COUNT] = {
+        [OP_CONST] = &&op_CONST,
+        [OP_LOAD] = &&op_LOAD,
+        [OP_LET] = &&op_LET,
+        [OP_BINARY] = &&op_BINARY,
+        [OP_POP] = &&op_POP,
+        [OP_PRINT] = &&op_PRINT,
+        [OP_JUMP] = &&op_JUMP,
+        [OP_JUMP_IF_FALSE] = &&op_JUMP_IF_FALSE,
+        [OP_FAIL] = &&op_FAIL,
+        [OP_HALT] = &&op_HALT,
+        [OP_LET_VAR_OP_CONST] = &&op_LET_VAR_OP_CONST,
+        [OP_JUMP_UNLESS_VAR_CMP_CONST] = &&op_JUMP_UNLESS_VAR_CMP_CONST,
+        [OP_PRINT_VAR] = &&op_PRINT_VAR,
+    };
+#define VM_CASE(name) op_##name
+#define VM_DISPATCH()                                   \
+    do {                                                \
+        profile_pc = pc;                                \
+        instr = &chunk->code[pc++];                     \
+        PROFILE_PAIR(prev_op, instr->op);               \
+        prev_op = instr->op;                            \
+        goto *dispatch_table[instr->op];                \
+    } while (0)
+#else
+#define VM_CASE(name) case OP_##name
+#define VM_DISPATCH() goto dispatch
+#endif
+
+#ifdef ZR_VM_PROFILE
+    if (!profile_registered) {
+        atexit(dump_opcode_pair_profile);
+        profile_registered = true;
+    }
+#endif
+
+    RuntimeValue* slots = safe_malloc(sizeof(RuntimeValue) * (chunk->slot_count + 1));
+    bool* dirty = safe_malloc(sizeof(bool) * (chunk->slot_count + 1));
+    RuntimeValue* stack = safe_malloc(sizeof(RuntimeValue) * (chunk->max_stack + 1));
+    memset(dirty, 0, sizeof(bool) * (chunk->slot_count + 1));
+    load_frame(chunk, slots);
+
+    RuntimeValue* sp = stack; // Next free stack entry
+    RuntimeValue result = create_void_runtime_value();
+    const Instruction* instr;
+    int pc = 0;
+    uint8_t prev_op = OP_HALT;
+    (void)prev_op;
+
+    // Samples taken from here on are attributed to this chunk's instructions
+    profile_pc = 0;
+    profile_engine = PROFILE_STACK_VM;
+    profile_chunk = chunk;
+
+#ifdef ZR_COMPUTED_GOTO
+    VM_DISPATCH();
+#else
+dispatch:
+    profile_pc = pc;
+    instr = &chunk->code[pc++];
+    PROFILE_PAIR(prev_op, instr->op);
+    prev_op = instr->op;
+    switch (instr->op) {
+#endif
+
+    VM_CASE(CONST):
+        *sp++ = copy_runtime_value(chunk->constants[instr->a]);
+        VM_DISPATCH();
+
+    VM_CASE(LOAD):
+        if (slots[instr->a].type == TYPE_VOID) {
+            report_undefined(chunk, instr->a);
+            goto failed;
+        }
+        *sp++ = copy_runtime_value(slots[instr->a]);
+        VM_DISPATCH();
+
+    VM_CASE(LET): {
+        RuntimeValue value = convert_let_value(chunk->slot_names[instr->a], (DataType)instr->type, *--sp);
+        if (value.type == TYPE_ERROR) goto failed;
+        release_runtime_value(&slots[instr->a]);
+        slots[instr->a] = value;
+        dirty[instr->a] = true;
+        VM_DISPATCH();
+    }
+
+    VM_CASE(BINARY): {
+        RuntimeValue right = *--sp;
+        RuntimeValue left = *--sp;
+        RuntimeValue value = vm_binary((BinaryOp)instr->binop, left, right);
+        release_runtime_value(&left);
+        release_runtime_value(&right);
+        if (value.type == TYPE_ERROR) goto failed;
+        *sp++ = value;
+        VM_DISPATCH();
+    }
+
+    VM_CASE(POP):
+        --sp;
+        release_runtime_value(sp);
+        VM_DISPATCH();
+
+    VM_CASE(PRINT):
+        evaluate_print(*--sp);
+        VM_DISPATCH();
+
+    VM_CASE(JUMP):
+        pc = instr->a;
+        VM_DISPATCH();
+
+    VM_CASE(JUMP_IF_FALSE): {
+        RuntimeValue condition = *--sp;
+        if (condition.type != TYPE_BOOL) {
+            fputs(CONDITION_ERROR_MESSAGE(instr->b), DIAGNOSTICS);
+            release_runtime_value(&condition);
+            goto failed;
+        }
+        if (!condition.val.bool_val) pc = instr->a;
+        VM_DISPATCH();
+    }
+
+    VM_CASE(FAIL):
+        fputs(chunk->constants[instr->a].val.string_val, DIAGNOSTICS);
+        goto failed;
+
+    VM_CASE(HALT):
+        goto finished;
+
+    VM_CASE(LET_VAR_OP_CONST): {
+        if (slots[instr->b].type == TYPE_VOID) {
+            report_undefined(chunk, instr->b);
+            goto failed;
+        }
+        // Operands are only read, so they are used in place without copying
+        RuntimeValue value = vm_binary((BinaryOp)instr->binop, slots[instr->b], chunk->constants[instr->c]);
+        if (value.type == TYPE_ERROR) goto failed;
+        value = convert_let_value(chunk->slot_names[instr->a], (DataType)instr->type, value);
+        if (value.type == TYPE_ERROR) goto failed;
+        release_runtime_value(&slots[instr->a]);
+        slots[instr->a] = value;
+        dirty[instr->a] = true;
+        VM_DISPATCH();
+    }
+
+    VM_CASE(JUMP_UNLESS_VAR_CMP_CONST): {
+        if (slots[instr->a].type == TYPE_VOID) {
+            report_undefined(chunk, instr->a);
+            goto failed;
+        }
+        RuntimeValue condition = vm_binary((BinaryOp)instr->binop, slots[instr->a], chunk->constants[instr->b]);
+        if (condition.type == TYPE_ERROR) goto failed;
+        if (!condition.val.bool_val) pc = instr->c;
+        VM_DISPATCH();
+    }
+
+    VM_CASE(PRINT_VAR):
+        if (slots[instr->a].type == TYPE_VOID) {
+            report_undefined(chunk, instr->a);
+            goto failed;
+        }
+        evaluate_print(copy_runtime_value(slots[instr->a]));
+        VM_DISPATCH();
+
+#ifndef ZR_COMPUTED_GOTO
+    default:
+        fprintf(DIAGNOSTICS, "Internal Error: Unknown opcode %d.\n", instr->op);
+        goto failed;
+    }
+#endif
+
+failed:
+    result = create_error_runtime_value();
+    while (sp > stack) {
+        --sp;
+        release_runtime_value(sp);
+    }
+
+finished:
+    profile_chunk = NULL;
+    store_frame(chunk, slots, dirty);
+    safe_free(slots);
+    safe_free(dirty);
+    safe_free(stack);
+    return result;
+
+#undef VM_CASE
+#undef VM_DISPATCH
+}
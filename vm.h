@@ -0,0 +1,245 @@
+#ifndef VM_H
+#define VM_H
+
+#include "compiler.h"
+#include <signal.h>
+
+// Runtime value: a DataType tag plus the Value union. A RuntimeValue owns its
+// string (if any); copy_runtime_value/release_runtime_value manage that.
+typedef struct {
+    DataType type;
+    Value val; // Value here is the union from compiler.h
+} RuntimeValue;
+
+// Runtime helpers shared by the AST interpreter and the bytecode engines (interpreter.c)
+RuntimeValue create_error_runtime_value(void);
+RuntimeValue create_void_runtime_value(void);
+RuntimeValue create_int64_runtime_value(int64_t num);
+RuntimeValue create_int32_runtime_value(int32_t num);
+RuntimeValue create_number_runtime_value(double num);
+RuntimeValue create_string_runtime_value(const char* str);
+RuntimeValue create_bool_runtime_value(bool b);
+RuntimeValue copy_runtime_value(RuntimeValue rt_value);
+void release_runtime_value(RuntimeValue* rt_value);
+
+bool parse_number_literal(const ASTNode* node, RuntimeValue* out, char* message, size_t message_size);
+RuntimeValue evaluate_binary_values(BinaryOp binop, const char* op, RuntimeValue left_rt, RuntimeValue right_rt);
+RuntimeValue convert_let_value(const char* name, DataType explicit_type, RuntimeValue expr_val);
+RuntimeValue evaluate_print(RuntimeValue rt_val_to_print);
+
+bool lookup_symbol_value(const char* name, RuntimeValue* out);
+void set_symbol(const char* name, RuntimeValue rt_new_value);
+int symbol_count(void);
+bool symbol_table_full(void); // set_symbol can't bind another name
+const char* symbol_at(int index, RuntimeValue* out); // The name; 0 <= index < symbol_count()
+
+// Stack bytecode (bytecode.c compiles it, vm.c runs it).
+//
+// A chunk is the compiled form of one module's code block. Variables are
+// resolved to frame slots at compile time; the VM loads the slots from the
+// symbol table on entry and writes assigned slots back when the chunk finishes
+// (or fails), so other modules see the same symbol table as with the AST
+// interpreter.
+typedef enum {
+    OP_CONST,          // push constants[a]
+    OP_LOAD,           // push slot a (error if the variable is undefined)
+    OP_LET,            // pop, convert to declared type 'type', store into slot a
+    OP_BINARY,         // pop right, pop left, push left 'binop' right
+    OP_POP,            // discard the top of the stack
+    OP_PRINT,          // pop and print
+    OP_JUMP,           // continue at a
+    OP_JUMP_IF_FALSE,  // pop a bool; continue at a if it is false (b: 1 for a while condition)
+    OP_FAIL,           // report constants[a] (a message string) and fail
+    OP_HALT,           // end of chunk
+
+    // Superinstructions for the statement shapes that dominate our scripts
+    OP_LET_VAR_OP_CONST,         // slot a = convert(slot b 'binop' constants[c])
+    OP_JUMP_UNLESS_VAR_CMP_CONST, // if !(slot a 'binop' constants[b]) continue at c
+    OP_PRINT_VAR,                // print slot a
+
+    OP_COUNT
+} OpCode;
+
+typedef struct {
+    uint8_t op;      // OpCode
+    uint8_t binop;   // BinaryOp for OP_BINARY and the fused forms
+    uint8_t type;    // Declared DataType for let forms (TYPE_VOID: none)
+    int32_t a;       // Operands: slot, constant or jump target indexes
+    int32_t b;
+    int32_t c;
+} Instruction;
+
+// Where the AST interpreter takes over when the guard of the speculative
+// instruction at 'pc' fails: path[0] is the statement that instruction
+// belongs to, to be run again from its start, and each further entry is the
+// node enclosing the previous one, up to (not including) the compiled loop.
+// An empty path resumes at the loop's own condition.
+typedef struct DeoptPoint {
+    int pc;
+    ASTNode** path;
+    int depth;
+} DeoptPoint;
+
+typedef struct Chunk {
+    Instruction* code;
+    int count;
+    int capacity;
+    RuntimeValue* constants;
+    int constant_count;
+    int constant_capacity;
+    char** slot_names;   // Variable name of each frame slot
+    int slot_count;
+    int slot_capacity;
+    int max_stack;       // Operand stack depth the code needs (stack chunks)
+    int register_count;  // Slots plus temporaries (register chunks)
+    struct NativeCode* native; // JIT-compiled form of a register chunk, if any
+    bool native_unavailable;   // The JIT declined this chunk; don't retry
+    DeoptPoint* deopt_points;  // One per speculative instruction
+    int deopt_count;
+    const DeoptPoint* deopt;   // Set by run_register_chunk when a guard failed
+    ASTNode** sites;           // Statement each instruction was compiled from (--profile)
+    ASTNode* site;             // Statement being compiled; chunk_write records it
+} Chunk;
+
+Chunk* compile_chunk(ASTNode* block);
+void free_chunk(Chunk* chunk);
+void disassemble_chunk(const Chunk* chunk, FILE* out);
+const char* binary_op_text(BinaryOp op);
+const char* opcode_name(uint8_t op);
+
+// Chunk building helpers shared by both code generators (bytecode.c)
+int chunk_write(Chunk* chunk, int op, int binop, int type, int a, int b, int c);
+int chunk_add_constant(Chunk* chunk, RuntimeValue value);
+int chunk_resolve_slot(Chunk* chunk, const char* name);
+bool literal_constant(const ASTNode* node, RuntimeValue* out, char* message, size_t message_size);
+void print_constant(const Chunk* chunk, int index, FILE* out);
+
+RuntimeValue run_chunk(Chunk* chunk);
+
+// What the bytecode engines are running, for the profiler's SIGPROF handler
+// (profile.c): the chunk, the engine, and the pc of the current instruction,
+// which both VMs store on every dispatch. profile_chunk is NULL while the
+// AST walker runs.
+extern __thread const Chunk* volatile profile_chunk;
+extern __thread volatile sig_atomic_t profile_pc;
+extern __thread volatile sig_atomic_t profile_engine;
+
+// Reported when a condition isn't a bool; 'loop' selects the while wording
+#define CONDITION_ERROR_MESSAGE(loop) \
+    ((loop) ? "Error: While loop condition must be a boolean.\n" : "Error: If statement condition must be a boolean.\n")
+
+// Frame handling shared by both VMs (vm.c)
+void load_frame(const Chunk* chunk, RuntimeValue* slots);
+void store_frame(const Chunk* chunk, RuntimeValue* slots, const bool* dirty);
+
+// Binary operation with inline int64 fast paths; everything else (including
+// errors such as division by zero) goes through the shared generic code.
+static inline RuntimeValue vm_binary(BinaryOp binop, RuntimeValue left, RuntimeValue right) {
+    STAT_BINARY(binop, left.type, right.type);
+    if (left.type == TYPE_INT64 && right.type == TYPE_INT64) {
+        int64_t l_val = left.val.int64_val;
+        int64_t r_val = right.val.int64_val;
+        switch (binop) {
+            case BINOP_ADD:   return create_int64_runtime_value(l_val + r_val);
+            case BINOP_SUB:   return create_int64_runtime_value(l_val - r_val);
+            case BINOP_MUL:   return create_int64_runtime_value(l_val * r_val);
+            case BINOP_GT:    return create_bool_runtime_value(l_val > r_val);
+            case BINOP_LT:    return create_bool_runtime_value(l_val < r_val);
+            case BINOP_EQ:    return create_bool_runtime_value(l_val == r_val);
+            case BINOP_LTEQ:  return create_bool_runtime_value(l_val <= r_val);
+            case BINOP_GTEQ:  return create_bool_runtime_value(l_val >= r_val);
+            case BINOP_NOTEQ: return create_bool_runtime_value(l_val != r_val);
+            default: break;
+        }
+    }
+    return evaluate_binary_values(binop, binary_op_text(binop), left, right);
+}
+
+// Register bytecode (regbytecode.c compiles it, regvm.c runs it).
+//
+// Three-address instructions over a register file that holds the variable
+// slots (0 .. slot_count-1) followed by expression temporaries. Operands
+// marked RK are either a register or a constant: non-negative values are
+// registers, negative values encode constant index -1 - value. Slots are
+// loaded and written back exactly as for stack chunks.
+#define RK_CONSTANT(index) (-1 - (index))
+#define RK_IS_CONSTANT(operand) ((operand) < 0)
+#define RK_CONSTANT_INDEX(operand) (-1 - (operand))
+
+typedef enum {
+    ROP_MOVE,            // register a = convert(RK b) to declared type 'type'
+    ROP_BINARY,          // register a = convert(RK b 'binop' RK c) to 'type'
+    ROP_PRINT,           // print RK a
+    ROP_JUMP,            // continue at a (c: times taken, counted for backward jumps)
+    ROP_JUMP_IF_FALSE,   // RK a must be a bool; continue at b if it is false (c: 1 for a while condition)
+    ROP_JUMP_UNLESS_CMP, // continue at c unless RK a 'binop' RK b
+    ROP_FAIL,            // report constants[a] (a message string) and fail
+    ROP_HALT,            // end of chunk
+
+    // Speculative forms of BINARY and JUMP_UNLESS_CMP (compile_loop_chunk with
+    // speculation): they assume int64, or float, operands as the AST
+    // interpreter has observed them. Any other operand, or a division by zero,
+    // fails the guard before the instruction has any effect, and the loop
+    // deoptimizes back to the AST interpreter (see DeoptPoint).
+    ROP_BINARY_INT64,
+    ROP_BINARY_FLOAT,
+    ROP_JUMP_UNLESS_CMP_INT64,
+    ROP_JUMP_UNLESS_CMP_FLOAT,
+
+    // Produced by optimize_chunk (regopt.c)
+    ROP_PRECOMPUTE,      // a = b binop c ahead of a loop; TYPE_VOID instead of reporting any error
+    ROP_INVARIANT,       // a = b (a PRECOMPUTE result), or else the operation of the PRECOMPUTE at pc c
+    ROP_MUL_POW2,        // a = b * c, c an int64 constant 2^k
+    ROP_DIV_POW2,        // a = b / c, c an int64 constant 2^k
+    ROP_DIV_MAGIC,       // a = b / c, c an int64 constant followed by its magic multiplier and shift
+
+    ROP_COUNT
+} RegOpCode;
+
+// The generic instruction a speculative or strength-reduced one stands for
+static inline RegOpCode generic_register_opcode(int op) {
+    switch (op) {
+        case ROP_BINARY_INT64:
+        case ROP_BINARY_FLOAT:
+        case ROP_MUL_POW2:
+        case ROP_DIV_POW2:
+        case ROP_DIV_MAGIC:             return ROP_BINARY;
+        case ROP_JUMP_UNLESS_CMP_INT64:
+        case ROP_JUMP_UNLESS_CMP_FLOAT: return ROP_JUMP_UNLESS_CMP;
+        default:                        return (RegOpCode)op;
+    }
+}
+
+Chunk* compile_register_chunk(ASTNode* block);
+Chunk* compile_loop_chunk(ASTNode* loop, bool speculate); // A while statement on its own (tiered execution)
+void disassemble_register_chunk(const Chunk* chunk, FILE* out);
+void optimize_chunk(Chunk* chunk, bool for_vm); // The -O level's pass pipeline (regopt.c)
+void division_magic(int64_t d, int64_t* magic, int* shift);
+
+bool evaluate_binary_quietly(int binop, RuntimeValue left, RuntimeValue right, RuntimeValue* result);
+
+// SSA form of a register chunk (ssa.c), for the passes of optimize_chunk.
+// Each pass returns the number of changes it made; ssa_lower writes the
+// result back to the chunk and frees the IR.
+typedef struct SsaFunction SsaFunction;
+
+SsaFunction* ssa_build(Chunk* chunk); // NULL for code the IR doesn't model
+int ssa_propagate_constants(SsaFunction* fn);
+int ssa_number_values(SsaFunction* fn);
+int ssa_propagate_copies(SsaFunction* fn);
+int ssa_eliminate_dead_code(SsaFunction* fn);
+int ssa_lower(SsaFunction* fn);
+
+RuntimeValue run_register_chunk(Chunk* chunk);
+int execute_register_instruction(Chunk* chunk, RuntimeValue* registers, bool* dirty, int pc);
+
+// Baseline JIT for register chunks (jit.c). Native code works directly on the
+// register VM's register file; jit_execute runs from 'pc' and returns the pc at
+// which the interpreter resumes, or -1 after a runtime error.
+typedef struct NativeCode NativeCode;
+
+NativeCode* jit_compile(const Chunk* chunk); // NULL if native code isn't supported here
+int jit_execute(NativeCode* native, Chunk* chunk, RuntimeValue* registers, bool* dirty, int pc);
+void jit_free(NativeCode* native);
+
+#endif // VM_H
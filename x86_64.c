@@ -0,0 +1,404 @@
+#include "compiler.h"
+#include "x86_64.h"
+#include <string.h>
+
+// Encoding notes: every instruction is built from an optional mandatory
+// prefix (66/F2), an optional REX byte, the opcode and a ModRM byte (plus SIB
+// when the base register is RSP/R12, which ModRM can't name directly).
+
+void code_init(CodeBuffer* code) {
+    code->bytes = NULL;
+    code->count = 0;
+    code->capacity = 0;
+}
+
+void code_free(CodeBuffer* code) {
+    safe_free(code->bytes);
+    code_init(code);
+}
+
+void code_byte(CodeBuffer* code, uint8_t byte) {
+    if (code->count == code->capacity) {
+        size_t new_capacity = code->capacity == 0 ? 4096 : code->capacity * 2;
+        uint8_t* grown = safe_malloc(new_capacity);
+        if (code->bytes != NULL) {
+            memcpy(grown, code->bytes, code->count);
+            safe_free(code->bytes);
+        }
+        code->bytes = grown;
+        code->capacity = new_capacity;
+    }
+    code->bytes[code->count++] = byte;
+}
+
+void code_u32(CodeBuffer* code, uint32_t value) {
+    for (int i = 0; i < 4; i++) {
+        code_byte(code, (uint8_t)(value >> (8 * i)));
+    }
+}
+
+void code_u64(CodeBuffer* code, uint64_t value) {
+    for (int i = 0; i < 8; i++) {
+        code_byte(code, (uint8_t)(value >> (8 * i)));
+    }
+}
+
+void code_patch_u32(CodeBuffer* code, size_t at, uint32_t value) {
+    for (int i = 0; i < 4; i++) {
+        code->bytes[at + i] = (uint8_t)(value >> (8 * i));
+    }
+}
+
+// REX prefix for a 'reg' field and an r/m base register; omitted when empty
+// unless 'force' (needed to address SPL/BPL/SIL/DIL as byte registers)
+static void emit_rex(CodeBuffer* code, bool wide, int reg, int base, bool force) {
+    uint8_t rex = 0x40 | (wide ? 0x08 : 0) | ((reg & 8) ? 0x04 : 0) | ((base & 8) ? 0x01 : 0);
+    if (rex != 0x40 || force) {
+        code_byte(code, rex);
+    }
+}
+
+// ModRM (and SIB/displacement) for the memory operand [base + disp]
+static void emit_mem(CodeBuffer* code, int reg, X86Register base, int32_t disp) {
+    bool short_disp = disp >= -128 && disp <= 127;
+    uint8_t mod = short_disp ? 0x40 : 0x80;
+    code_byte(code, mod | ((reg & 7) << 3) | (base & 7));
+    if ((base & 7) == X86_RSP) {
+        code_byte(code, 0x24); // SIB: no index, base in ModRM
+    }
+    if (short_disp) {
+        code_byte(code, (uint8_t)(int8_t)disp);
+    } else {
+        code_u32(code, (uint32_t)disp);
+    }
+}
+
+// ModRM for a register-to-register operand
+static void emit_direct(CodeBuffer* code, int reg, int rm) {
+    code_byte(code, 0xC0 | ((reg & 7) << 3) | (rm & 7));
+}
+
+static bool needs_byte_rex(int reg) {
+    return reg >= X86_RSP && reg <= X86_RDI;
+}
+
+size_t x86_jmp(CodeBuffer* code) {
+    code_byte(code, 0xE9);
+    size_t at = code->count;
+    code_u32(code, 0);
+    return at;
+}
+
+size_t x86_jcc(CodeBuffer* code, X86Condition cc) {
+    code_byte(code, 0x0F);
+    code_byte(code, 0x80 | cc);
+    size_t at = code->count;
+    code_u32(code, 0);
+    return at;
+}
+
+void x86_patch_jump(CodeBuffer* code, size_t rel32_at, size_t target) {
+    code_patch_u32(code, rel32_at, (uint32_t)(int32_t)((int64_t)target - (int64_t)(rel32_at + 4)));
+}
+
+size_t x86_call(CodeBuffer* code) {
+    code_byte(code, 0xE8);
+    size_t at = code->count;
+    code_u32(code, 0);
+    return at;
+}
+
+void x86_jmp_reg(CodeBuffer* code, X86Register reg) {
+    emit_rex(code, false, 0, reg, false);
+    code_byte(code, 0xFF);
+    emit_direct(code, 4, reg);
+}
+
+void x86_call_reg(CodeBuffer* code, X86Register reg) {
+    emit_rex(code, false, 0, reg, false);
+    code_byte(code, 0xFF);
+    emit_direct(code, 2, reg);
+}
+
+void x86_ret(CodeBuffer* code) {
+    code_byte(code, 0xC3);
+}
+
+void x86_push(CodeBuffer* code, X86Register reg) {
+    emit_rex(code, false, 0, reg, false);
+    code_byte(code, 0x50 | (reg & 7));
+}
+
+void x86_pop(CodeBuffer* code, X86Register reg) {
+    emit_rex(code, false, 0, reg, false);
+    code_byte(code, 0x58 | (reg & 7));
+}
+
+void x86_syscall(CodeBuffer* code) {
+    code_byte(code, 0x0F);
+    code_byte(code, 0x05);
+}
+
+void x86_mov_imm64(CodeBuffer* code, X86Register dst, uint64_t value) {
+    if (value <= UINT32_MAX) {
+        x86_mov_imm32(code, dst, (uint32_t)value);
+        return;
+    }
+    emit_rex(code, true, 0, dst, false);
+    code_byte(code, 0xB8 | (dst & 7));
+    code_u64(code, value);
+}
+
+void x86_mov_imm32(CodeBuffer* code, X86Register dst, uint32_t value) {
+    emit_rex(code, false, 0, dst, false);
+    code_byte(code, 0xB8 | (dst & 7));
+    code_u32(code, value);
+}
+
+void x86_mov_reg(CodeBuffer* code, X86Register dst, X86Register src) {
+    emit_rex(code, true, src, dst, false);
+    code_byte(code, 0x89);
+    emit_direct(code, src, dst);
+}
+
+void x86_load64(CodeBuffer* code, X86Register dst, X86Register base, int32_t disp) {
+    emit_rex(code, true, dst, base, false);
+    code_byte(code, 0x8B);
+    emit_mem(code, dst, base, disp);
+}
+
+void x86_load32(CodeBuffer* code, X86Register dst, X86Register base, int32_t disp) {
+    emit_rex(code, false, dst, base, false);
+    code_byte(code, 0x8B);
+    emit_mem(code, dst, base, disp);
+}
+
+void x86_load8_zx(CodeBuffer* code, X86Register dst, X86Register base, int32_t disp) {
+    emit_rex(code, false, dst, base, false);
+    code_byte(code, 0x0F);
+    code_byte(code, 0xB6);
+    emit_mem(code, dst, base, disp);
+}
+
+void x86_store64(CodeBuffer* code, X86Register base, int32_t disp, X86Register src) {
+    emit_rex(code, true, src, base, false);
+    code_byte(code, 0x89);
+    emit_mem(code, src, base, disp);
+}
+
+void x86_store32(CodeBuffer* code, X86Register base, int32_t disp, X86Register src) {
+    emit_rex(code, false, src, base, false);
+    code_byte(code, 0x89);
+    emit_mem(code, src, base, disp);
+}
+
+void x86_store8(CodeBuffer* code, X86Register base, int32_t disp, X86Register src) {
+    emit_rex(code, false, src, base, needs_byte_rex(src));
+    code_byte(code, 0x88);
+    emit_mem(code, src, base, disp);
+}
+
+void x86_store32_imm(CodeBuffer* code, X86Register base, int32_t disp, uint32_t value) {
+    emit_rex(code, false, 0, base, false);
+    code_byte(code, 0xC7);
+    emit_mem(code, 0, base, disp);
+    code_u32(code, value);
+}
+
+void x86_store8_imm(CodeBuffer* code, X86Register base, int32_t disp, uint8_t value) {
+    emit_rex(code, false, 0, base, false);
+    code_byte(code, 0xC6);
+    emit_mem(code, 0, base, disp);
+    code_byte(code, value);
+}
+
+void x86_load32_sx(CodeBuffer* code, X86Register dst, X86Register base, int32_t disp) {
+    emit_rex(code, true, dst, base, false);
+    code_byte(code, 0x63);
+    emit_mem(code, dst, base, disp);
+}
+
+void x86_lea(CodeBuffer* code, X86Register dst, X86Register base, int32_t disp) {
+    emit_rex(code, true, dst, base, false);
+    code_byte(code, 0x8D);
+    emit_mem(code, dst, base, disp);
+}
+
+void x86_rep_movsb(CodeBuffer* code) {
+    code_byte(code, 0xF3);
+    code_byte(code, 0xA4);
+}
+
+void x86_alu(CodeBuffer* code, X86AluOp op, X86Register dst, X86Register src) {
+    emit_rex(code, true, src, dst, false);
+    code_byte(code, (uint8_t)op);
+    emit_direct(code, src, dst);
+}
+
+void x86_alu_imm32(CodeBuffer* code, X86AluOp op, X86Register dst, int32_t value) {
+    // The /digit of the 81 group is the ALU opcode's row (ADD=0, OR=1, ... CMP=7)
+    emit_rex(code, true, 0, dst, false);
+    code_byte(code, 0x81);
+    emit_direct(code, op >> 3, dst);
+    code_u32(code, (uint32_t)value);
+}
+
+void x86_imul(CodeBuffer* code, X86Register dst, X86Register src) {
+    emit_rex(code, true, dst, src, false);
+    code_byte(code, 0x0F);
+    code_byte(code, 0xAF);
+    emit_direct(code, dst, src);
+}
+
+void x86_imul_wide(CodeBuffer* code, X86Register src) {
+    emit_rex(code, true, 0, src, false);
+    code_byte(code, 0xF7);
+    emit_direct(code, 5, src);
+}
+
+void x86_cqo(CodeBuffer* code) {
+    code_byte(code, 0x48);
+    code_byte(code, 0x99);
+}
+
+void x86_idiv(CodeBuffer* code, X86Register divisor) {
+    emit_rex(code, true, 0, divisor, false);
+    code_byte(code, 0xF7);
+    emit_direct(code, 7, divisor);
+}
+
+void x86_div(CodeBuffer* code, X86Register divisor) {
+    emit_rex(code, true, 0, divisor, false);
+    code_byte(code, 0xF7);
+    emit_direct(code, 6, divisor);
+}
+
+void x86_neg(CodeBuffer* code, X86Register reg) {
+    emit_rex(code, true, 0, reg, false);
+    code_byte(code, 0xF7);
+    emit_direct(code, 3, reg);
+}
+
+void x86_movsxd(CodeBuffer* code, X86Register dst, X86Register src) {
+    emit_rex(code, true, dst, src, false);
+    code_byte(code, 0x63);
+    emit_direct(code, dst, src);
+}
+
+void x86_shift_imm(CodeBuffer* code, X86ShiftOp op, X86Register reg, uint8_t count) {
+    emit_rex(code, true, 0, reg, false);
+    code_byte(code, 0xC1);
+    emit_direct(code, op, reg);
+    code_byte(code, count);
+}
+
+void x86_shift_cl(CodeBuffer* code, X86ShiftOp op, X86Register reg) {
+    emit_rex(code, true, 0, reg, false);
+    code_byte(code, 0xD3);
+    emit_direct(code, op, reg);
+}
+
+void x86_cmp32_imm(CodeBuffer* code, X86Register reg, uint32_t value) {
+    emit_rex(code, false, 0, reg, false);
+    code_byte(code, 0x81);
+    emit_direct(code, 7, reg);
+    code_u32(code, value);
+}
+
+void x86_cmp32_mem_imm(CodeBuffer* code, X86Register base, int32_t disp, uint32_t value) {
+    emit_rex(code, false, 0, base, false);
+    code_byte(code, 0x81);
+    emit_mem(code, 7, base, disp);
+    code_u32(code, value);
+}
+
+void x86_cmp8_mem_imm(CodeBuffer* code, X86Register base, int32_t disp, uint8_t value) {
+    emit_rex(code, false, 0, base, false);
+    code_byte(code, 0x80);
+    emit_mem(code, 7, base, disp);
+    code_byte(code, value);
+}
+
+void x86_test8(CodeBuffer* code, X86Register a, X86Register b) {
+    emit_rex(code, false, b, a, needs_byte_rex(a) || needs_byte_rex(b));
+    code_byte(code, 0x84);
+    emit_direct(code, b, a);
+}
+
+void x86_setcc(CodeBuffer* code, X86Condition cc, X86Register dst) {
+    emit_rex(code, false, 0, dst, needs_byte_rex(dst));
+    code_byte(code, 0x0F);
+    code_byte(code, 0x90 | cc);
+    emit_direct(code, 0, dst);
+}
+
+void x86_movzx8(CodeBuffer* code, X86Register dst, X86Register src) {
+    emit_rex(code, false, dst, src, needs_byte_rex(src));
+    code_byte(code, 0x0F);
+    code_byte(code, 0xB6);
+    emit_direct(code, dst, src);
+}
+
+void x86_movsd_load(CodeBuffer* code, X86XmmRegister dst, X86Register base, int32_t disp) {
+    code_byte(code, 0xF2);
+    emit_rex(code, false, dst, base, false);
+    code_byte(code, 0x0F);
+    code_byte(code, 0x10);
+    emit_mem(code, dst, base, disp);
+}
+
+void x86_movsd_store(CodeBuffer* code, X86Register base, int32_t disp, X86XmmRegister src) {
+    code_byte(code, 0xF2);
+    emit_rex(code, false, src, base, false);
+    code_byte(code, 0x0F);
+    code_byte(code, 0x11);
+    emit_mem(code, src, base, disp);
+}
+
+void x86_movq_to_xmm(CodeBuffer* code, X86XmmRegister dst, X86Register src) {
+    code_byte(code, 0x66);
+    emit_rex(code, true, dst, src, false);
+    code_byte(code, 0x0F);
+    code_byte(code, 0x6E);
+    emit_direct(code, dst, src);
+}
+
+void x86_movq_from_xmm(CodeBuffer* code, X86Register dst, X86XmmRegister src) {
+    code_byte(code, 0x66);
+    emit_rex(code, true, src, dst, false);
+    code_byte(code, 0x0F);
+    code_byte(code, 0x7E);
+    emit_direct(code, src, dst);
+}
+
+void x86_cvtsi2sd(CodeBuffer* code, X86XmmRegister dst, X86Register src) {
+    code_byte(code, 0xF2);
+    emit_rex(code, true, dst, src, false);
+    code_byte(code, 0x0F);
+    code_byte(code, 0x2A);
+    emit_direct(code, dst, src);
+}
+
+void x86_sse_arith(CodeBuffer* code, X86SseOp op, X86XmmRegister dst, X86XmmRegister src) {
+    code_byte(code, 0xF2);
+    emit_rex(code, false, dst, src, false);
+    code_byte(code, 0x0F);
+    code_byte(code, (uint8_t)op);
+    emit_direct(code, dst, src);
+}
+
+void x86_ucomisd(CodeBuffer* code, X86XmmRegister a, X86XmmRegister b) {
+    code_byte(code, 0x66);
+    emit_rex(code, false, a, b, false);
+    code_byte(code, 0x0F);
+    code_byte(code, 0x2E);
+    emit_direct(code, a, b);
+}
+
+void x86_xorpd(CodeBuffer* code, X86XmmRegister dst, X86XmmRegister src) {
+    code_byte(code, 0x66);
+    emit_rex(code, false, dst, src, false);
+    code_byte(code, 0x0F);
+    code_byte(code, 0x57);
+    emit_direct(code, dst, src);
+}
@@ -0,0 +1,116 @@
+#ifndef X86_64_H
+#define X86_64_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+// Minimal x86-64 machine code emitter, shared by the JIT (jit.c) and the ELF
+// backend. Only the encodings those back ends use are provided. Memory
+// operands are always [base + disp].
+
+typedef enum {
+    X86_RAX, X86_RCX, X86_RDX, X86_RBX, X86_RSP, X86_RBP, X86_RSI, X86_RDI,
+    X86_R8, X86_R9, X86_R10, X86_R11, X86_R12, X86_R13, X86_R14, X86_R15
+} X86Register;
+
+// SSE registers use the same 0-15 numbering
+typedef enum {
+    X86_XMM0, X86_XMM1, X86_XMM2, X86_XMM3
+} X86XmmRegister;
+
+// Condition codes, as encoded in Jcc/SETcc
+typedef enum {
+    X86_CC_O = 0x0, X86_CC_NO = 0x1, X86_CC_B = 0x2, X86_CC_AE = 0x3,
+    X86_CC_E = 0x4, X86_CC_NE = 0x5, X86_CC_BE = 0x6, X86_CC_A = 0x7,
+    X86_CC_S = 0x8, X86_CC_NS = 0x9, X86_CC_P = 0xA, X86_CC_NP = 0xB,
+    X86_CC_L = 0xC, X86_CC_GE = 0xD, X86_CC_LE = 0xE, X86_CC_G = 0xF
+} X86Condition;
+
+// Two-operand integer ALU instructions (opcode of the "r/m, reg" form)
+typedef enum {
+    X86_ADD = 0x01, X86_OR = 0x09, X86_AND = 0x21, X86_SUB = 0x29,
+    X86_XOR = 0x31, X86_CMP = 0x39
+} X86AluOp;
+
+// Shifts (the /digit of the D3/C1 group)
+typedef enum {
+    X86_SHL = 4, X86_SHR = 5, X86_SAR = 7
+} X86ShiftOp;
+
+// Scalar double SSE2 arithmetic (F2 0F xx)
+typedef enum {
+    X86_ADDSD = 0x58, X86_MULSD = 0x59, X86_SUBSD = 0x5C, X86_DIVSD = 0x5E
+} X86SseOp;
+
+typedef struct {
+    uint8_t* bytes;
+    size_t count;
+    size_t capacity;
+} CodeBuffer;
+
+void code_init(CodeBuffer* code);
+void code_free(CodeBuffer* code);
+void code_byte(CodeBuffer* code, uint8_t byte);
+void code_u32(CodeBuffer* code, uint32_t value);
+void code_u64(CodeBuffer* code, uint64_t value);
+void code_patch_u32(CodeBuffer* code, size_t at, uint32_t value);
+
+// Control flow. Jumps return the offset of their rel32 field for x86_patch_jump.
+size_t x86_jmp(CodeBuffer* code);
+size_t x86_jcc(CodeBuffer* code, X86Condition cc);
+void x86_patch_jump(CodeBuffer* code, size_t rel32_at, size_t target);
+size_t x86_call(CodeBuffer* code);
+void x86_jmp_reg(CodeBuffer* code, X86Register reg);
+void x86_call_reg(CodeBuffer* code, X86Register reg);
+void x86_ret(CodeBuffer* code);
+void x86_push(CodeBuffer* code, X86Register reg);
+void x86_pop(CodeBuffer* code, X86Register reg);
+void x86_syscall(CodeBuffer* code);
+
+// Moves
+void x86_mov_imm64(CodeBuffer* code, X86Register dst, uint64_t value);
+void x86_mov_imm32(CodeBuffer* code, X86Register dst, uint32_t value); // Zero-extends
+void x86_mov_reg(CodeBuffer* code, X86Register dst, X86Register src);
+void x86_load64(CodeBuffer* code, X86Register dst, X86Register base, int32_t disp);
+void x86_load32(CodeBuffer* code, X86Register dst, X86Register base, int32_t disp);
+void x86_load8_zx(CodeBuffer* code, X86Register dst, X86Register base, int32_t disp);
+void x86_store64(CodeBuffer* code, X86Register base, int32_t disp, X86Register src);
+void x86_store32(CodeBuffer* code, X86Register base, int32_t disp, X86Register src);
+void x86_store8(CodeBuffer* code, X86Register base, int32_t disp, X86Register src);
+void x86_store32_imm(CodeBuffer* code, X86Register base, int32_t disp, uint32_t value);
+void x86_store8_imm(CodeBuffer* code, X86Register base, int32_t disp, uint8_t value);
+void x86_load32_sx(CodeBuffer* code, X86Register dst, X86Register base, int32_t disp); // movsxd
+void x86_lea(CodeBuffer* code, X86Register dst, X86Register base, int32_t disp);
+void x86_rep_movsb(CodeBuffer* code);
+
+// Integer arithmetic and comparisons
+void x86_alu(CodeBuffer* code, X86AluOp op, X86Register dst, X86Register src);
+void x86_alu_imm32(CodeBuffer* code, X86AluOp op, X86Register dst, int32_t value);
+void x86_imul(CodeBuffer* code, X86Register dst, X86Register src);
+void x86_imul_wide(CodeBuffer* code, X86Register src); // Signed rdx:rax = rax * src
+void x86_cqo(CodeBuffer* code);
+void x86_idiv(CodeBuffer* code, X86Register divisor);
+void x86_div(CodeBuffer* code, X86Register divisor); // Unsigned rdx:rax / divisor
+void x86_neg(CodeBuffer* code, X86Register reg);
+void x86_movsxd(CodeBuffer* code, X86Register dst, X86Register src); // Sign-extend the low 32 bits
+void x86_shift_imm(CodeBuffer* code, X86ShiftOp op, X86Register reg, uint8_t count);
+void x86_shift_cl(CodeBuffer* code, X86ShiftOp op, X86Register reg);
+void x86_cmp32_imm(CodeBuffer* code, X86Register reg, uint32_t value);
+void x86_cmp32_mem_imm(CodeBuffer* code, X86Register base, int32_t disp, uint32_t value);
+void x86_cmp8_mem_imm(CodeBuffer* code, X86Register base, int32_t disp, uint8_t value);
+void x86_test8(CodeBuffer* code, X86Register a, X86Register b);
+void x86_setcc(CodeBuffer* code, X86Condition cc, X86Register dst);
+void x86_movzx8(CodeBuffer* code, X86Register dst, X86Register src);
+
+// SSE2 scalar doubles
+void x86_movsd_load(CodeBuffer* code, X86XmmRegister dst, X86Register base, int32_t disp);
+void x86_movsd_store(CodeBuffer* code, X86Register base, int32_t disp, X86XmmRegister src);
+void x86_movq_to_xmm(CodeBuffer* code, X86XmmRegister dst, X86Register src);
+void x86_movq_from_xmm(CodeBuffer* code, X86Register dst, X86XmmRegister src);
+void x86_cvtsi2sd(CodeBuffer* code, X86XmmRegister dst, X86Register src);
+void x86_sse_arith(CodeBuffer* code, X86SseOp op, X86XmmRegister dst, X86XmmRegister src);
+void x86_ucomisd(CodeBuffer* code, X86XmmRegister a, X86XmmRegister b);
+void x86_xorpd(CodeBuffer* code, X86XmmRegister dst, X86XmmRegister src);
+
+#endif // X86_64_H
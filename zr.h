@@ -0,0 +1,121 @@
+#ifndef ZR_H
+#define ZR_H
+
+// libzr: the ZR# interpreter as a library (make lib builds libzr.a and
+// libzr.so). A context is an independent interpreter instance with its own
+// variables and loaded modules. Errors are returned as a status, never fatal;
+// the messages explaining them are kept for zr_error.
+//
+//   ZrContext* zr = zr_create();
+//   zr_set_int(zr, "order_total", 250);
+//   if (zr_load(zr, "rules/discount.zr", source) != ZR_OK || zr_run(zr) != ZR_OK) {
+//       fprintf(stderr, "%s", zr_error(zr));
+//   }
+//   double rate;
+//   if (zr_get_float(zr, "rate", &rate) == ZR_OK) ...
+//   zr_destroy(zr);
+//
+// Different contexts can be used on different threads at once; a context must
+// not be used by two threads at a time. 'print' writes to stdout unless the
+// context is given another stream. For running many scripts in parallel, a
+// pool (zr_pool_create) keeps a context per worker thread.
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#if defined(__GNUC__)
+#define ZR_API __attribute__((visibility("default")))
+#else
+#define ZR_API
+#endif
+
+typedef struct ZrContext ZrContext;
+
+typedef enum {
+    ZR_OK = 0,
+    ZR_ERROR_COMPILE,    // The source, or a module it loads, couldn't be read, parsed or type checked
+    ZR_ERROR_RUNTIME,    // A runtime error stopped the program
+    ZR_ERROR_NO_PROGRAM, // zr_run without a successful zr_load
+    ZR_ERROR_UNDEFINED,  // No variable of that name
+    ZR_ERROR_TYPE,       // The variable has (or was declared with) another type
+    ZR_ERROR_FULL        // No room for another variable (a context holds 100)
+} ZrStatus;
+
+ZR_API ZrContext* zr_create(void);
+ZR_API void zr_destroy(ZrContext* context);
+
+// Forget the program, the modules it loaded and all variables, as if the
+// context had just been created, but keeping its memory for reuse
+ZR_API void zr_reset(ZrContext* context);
+
+// Where 'print' writes from now on (NULL: stdout). The context doesn't close it.
+ZR_API void zr_set_output(ZrContext* context, FILE* output);
+
+// Parse and type check 'source', loading (and running) the modules it names
+// with 'loadin'. 'name' is its path: loadin paths are resolved from its
+// directory. The program replaces any loaded before; zr_run runs it.
+// ZR_ERROR_RUNTIME if a runtime error stopped one of the modules.
+ZR_API ZrStatus zr_load(ZrContext* context, const char* name, const char* source);
+
+// Run the loaded program. It can be run again, with other inputs.
+ZR_API ZrStatus zr_run(ZrContext* context);
+
+// Load and run a prelude that the programs loaded next build on. Like any
+// program's, its variables stay bound; in addition, the modules it loaded
+// count as loaded for good, so a 'loadin' of one of them is skipped instead
+// of failing as a second load. zr_reset forgets it. A prelude that fails,
+// or whose modules fail, marks nothing preloaded.
+ZR_API ZrStatus zr_preload(ZrContext* context, const char* name, const char* source);
+
+// Messages written by the last zr_load or zr_run ("" if none), valid until the next one
+ZR_API const char* zr_error(const ZrContext* context);
+
+// Variables. Inputs should be set before zr_load, so that the type checker
+// knows them; an integer is int64 unless the program declared it int32.
+ZR_API ZrStatus zr_set_int(ZrContext* context, const char* name, int64_t value);
+ZR_API ZrStatus zr_set_float(ZrContext* context, const char* name, double value);
+ZR_API ZrStatus zr_set_bool(ZrContext* context, const char* name, bool value);
+ZR_API ZrStatus zr_set_string(ZrContext* context, const char* name, const char* value); // Copied
+
+ZR_API ZrStatus zr_get_int(ZrContext* context, const char* name, int64_t* value); // int32 or int64
+ZR_API ZrStatus zr_get_float(ZrContext* context, const char* name, double* value);
+ZR_API ZrStatus zr_get_bool(ZrContext* context, const char* name, bool* value);
+// The string stays owned by the context, until the variable changes
+ZR_API ZrStatus zr_get_string(ZrContext* context, const char* name, const char** value);
+
+// Thread pool running scripts as jobs, each on a fresh context: a job sees
+// no variables or modules of the jobs before it. Jobs are queued per worker
+// and an idle worker takes jobs from the others' queues. Modules named with
+// 'loadin' are parsed once per pool (again if their file changes) and
+// shared by the workers.
+//
+//   ZrPool* pool = zr_pool_create(0);
+//   ZrJob* job = zr_pool_submit(pool, "jobs/report.zr", source);
+//   if (zr_job_wait(job) == ZR_OK) fputs(zr_job_output(job), stdout);
+//   zr_job_free(job);
+//   zr_pool_destroy(pool);
+typedef struct ZrPool ZrPool;
+typedef struct ZrJob ZrJob;
+
+ZR_API ZrPool* zr_pool_create(int threads); // 0: one per online CPU; NULL if no thread could start
+// Waits for the jobs submitted so far, then stops the workers. Jobs stay the caller's.
+ZR_API void zr_pool_destroy(ZrPool* pool);
+
+// Queue a script (zr_load, then zr_run); 'name' and 'source' are copied
+ZR_API ZrJob* zr_pool_submit(ZrPool* pool, const char* name, const char* source);
+ZR_API ZrStatus zr_job_wait(ZrJob* job); // Blocks until the job has run
+// What the job printed, and its messages as zr_error gives them; valid after zr_job_wait
+ZR_API const char* zr_job_output(const ZrJob* job);
+ZR_API const char* zr_job_error(const ZrJob* job);
+ZR_API void zr_job_free(ZrJob* job); // After zr_job_wait
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // ZR_H